@@ -118,6 +118,29 @@ bool shouldMarkSocket(int socketFd, const sockaddr* dst) {
     return dst && FwmarkClient::shouldSetFwmark(dst->sa_family) && (checkSocket(socketFd) == 0);
 }
 
+// Returns true if the kernel has already given the socket the mark that ON_CONNECT would set. This
+// is the case if the BPF connect programs are marking sockets from the connect mark map (see
+// mainline/ConnectMarkMap.h) and the socket has neither selected a network explicitly nor been
+// protected from VPNs. Connecting to a scoped link-local address still needs fwmarkd, because the
+// network comes from the interface.
+bool isMarkedByKernel(int socketFd, const sockaddr* dst) {
+    Fwmark fwmark;
+    socklen_t fwmarkLen = sizeof(fwmark.intValue);
+    if (getsockopt(socketFd, SOL_SOCKET, SO_MARK, &fwmark.intValue, &fwmarkLen) == -1) {
+        return false;
+    }
+    if (!fwmark.kernelMarked || fwmark.explicitlySelected || fwmark.protectedFromVpn) {
+        return false;
+    }
+    if (dst->sa_family == AF_INET6) {
+        const sockaddr_in6* sin6 = reinterpret_cast<const sockaddr_in6*>(dst);
+        if (sin6->sin6_scope_id && IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 int closeFdAndSetErrno(int fd, int error) {
     close(fd);
     errno = -error;
@@ -149,7 +172,7 @@ int netdClientAccept4(int sockfd, sockaddr* addr, socklen_t* addrlen, int flags)
 
 int netdClientConnect(int sockfd, const sockaddr* addr, socklen_t addrlen) {
     const bool shouldSetFwmark = shouldMarkSocket(sockfd, addr);
-    if (shouldSetFwmark) {
+    if (shouldSetFwmark && !isMarkedByKernel(sockfd, addr)) {
         FwmarkCommand command = {FwmarkCommand::ON_CONNECT, 0, 0, 0};
         FwmarkConnectInfo connectInfo(0, 0, addr);
         int error = FwmarkClient().send(&command, sockfd, &connectInfo);
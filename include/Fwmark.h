@@ -29,7 +29,8 @@ union Fwmark {
         bool protectedFromVpn   :  1;
         Permission permission   :  2;
         bool uidBillingDone     :  1;
-        unsigned reserved       :  8;
+        bool kernelMarked       :  1;  // set by the BPF connect programs, see ConnectMarkMap.h
+        unsigned reserved       :  7;
         unsigned vendor         :  2;  // reserved for vendor
         bool ingress_cpu_wakeup :  1;  // reserved for config_networkWakeupPacketMark/Mask
     };
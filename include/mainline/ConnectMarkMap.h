@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * If the BPF loader provides a BPF_MAP_TYPE_LPM_TRIE map at this location, netd keeps it in sync
+ * with the fwmark that FwmarkServer sets on ON_CONNECT for a socket that has neither selected a
+ * network explicitly nor been protected from VPNs. The loader is then expected to attach cgroup
+ * sock_create, connect4 and connect6 programs that look up the socket's UID in the map and, if
+ * there is a match and neither of those bits is set, do:
+ *
+ *     mark = (mark & ~CONNECT_MARK_MASK) | value;
+ *
+ * libnetd_client skips the ON_CONNECT round trip to fwmarkd for sockets that carry the
+ * kernelMarked bit (see Fwmark.h), which the value always includes. Without the map, or while it
+ * is empty, nothing is marked in the kernel and every connect() goes through fwmarkd as before.
+ */
+#define CONNECT_MARK_MAP_PATH "/sys/fs/bpf/netd_shared/map_netd_connect_mark_map"
+
+// The netId, permission and kernelMarked bits of the fwmark.
+#define CONNECT_MARK_MASK 0x002CFFFF
+
+struct ConnectMarkKey {
+    uint32_t prefixLen;  // 0..32
+    uint32_t uid;        // Network byte order, as the LPM trie compares keys bytewise.
+};
@@ -115,6 +115,7 @@ public:
 
     // For testing.
     friend class BandwidthControllerTest;
+    friend class ControllerBenchmark;
     static int (*execFunction)(int, char **, int *, bool, bool);
     static FILE *(*popenFunction)(const char *, const char *);
     static int (*iptablesRestoreFunction)(IptablesTarget, const std::string&, std::string *);
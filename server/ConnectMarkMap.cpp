@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ConnectMarkMap"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/bpf.h>
+
+#include <bpf/BpfSyscallWrappers.h>
+#include <log/log.h>
+
+#include "ConnectMarkMap.h"
+#include "mainline/ConnectMarkMap.h"
+
+using android::base::unique_fd;
+using android::netdutils::DumpWriter;
+
+namespace android {
+namespace net {
+
+namespace {
+
+ConnectMarkKey makeKey(uint32_t prefixLen, uint32_t uid) {
+    return {.prefixLen = prefixLen, .uid = htonl(uid)};
+}
+
+int writeEntry(const unique_fd& mapFd, uint32_t prefixLen, uint32_t uid, uint32_t value) {
+    const ConnectMarkKey key = makeKey(prefixLen, uid);
+    if (bpf::writeToMapEntry(mapFd, &key, &value, BPF_ANY)) return -errno;
+    return 0;
+}
+
+int deleteEntry(const unique_fd& mapFd, uint32_t prefixLen, uint32_t uid) {
+    const ConnectMarkKey key = makeKey(prefixLen, uid);
+    if (bpf::deleteMapEntry(mapFd, &key)) return -errno;
+    return 0;
+}
+
+}  // namespace
+
+int (*ConnectMarkMap::writeEntryFunction)(const unique_fd&, uint32_t, uint32_t,
+                                          uint32_t) = writeEntry;
+int (*ConnectMarkMap::deleteEntryFunction)(const unique_fd&, uint32_t, uint32_t) = deleteEntry;
+
+int ConnectMarkMap::init() {
+    unique_fd mapFd(bpf::mapRetrieveRW(CONNECT_MARK_MAP_PATH));
+    if (mapFd == -1) return -errno;
+    return init(std::move(mapFd));
+}
+
+int ConnectMarkMap::init(unique_fd mapFd) {
+    // Entries left by a previous instance of netd may be stale. Remove them all before the map is
+    // used, so that until the first update() every socket is marked by fwmarkd.
+    ConnectMarkKey key;
+    while (bpf::getFirstMapKey(mapFd, &key) == 0) {
+        if (bpf::deleteMapEntry(mapFd, &key)) {
+            const int err = errno;
+            ALOGE("Cannot clear connect mark map: %s", strerror(err));
+            return -err;
+        }
+    }
+    mMapFd = std::move(mapFd);
+    mEntries.clear();
+    return 0;
+}
+
+void ConnectMarkMap::addRange(Entries* entries, uid_t first, uid_t last, uint32_t value) {
+    // Cover [first, last] with the fewest aligned power-of-two blocks, each of which is a prefix.
+    uint64_t start = first;
+    const uint64_t end = static_cast<uint64_t>(last) + 1;
+    while (start < end) {
+        uint32_t hostBits = 0;
+        while (hostBits < 32 && (start & ((2ULL << hostBits) - 1)) == 0 &&
+               start + (2ULL << hostBits) <= end) {
+            hostBits++;
+        }
+        (*entries)[{32 - hostBits, static_cast<uint32_t>(start)}] = value;
+        start += 1ULL << hostBits;
+    }
+}
+
+int ConnectMarkMap::update(const Entries& entries) {
+    if (!isEnabled()) return -ENOTCONN;
+    mUpdates++;
+
+    // Write new and changed entries before deleting stale ones, so that a lookup that races with
+    // the update never falls through to a less specific prefix than it should.
+    for (const auto& [prefix, value] : entries) {
+        auto it = mEntries.find(prefix);
+        if (it != mEntries.end() && it->second == value) continue;
+        if (int ret = writeEntryFunction(mMapFd, prefix.first, prefix.second, value)) {
+            ALOGE("Cannot write connect mark for %u/%u: %s", prefix.second, prefix.first,
+                  strerror(-ret));
+            disable();
+            return ret;
+        }
+        mWrites++;
+        mEntries[prefix] = value;
+    }
+    for (auto it = mEntries.begin(); it != mEntries.end();) {
+        if (entries.count(it->first)) {
+            ++it;
+            continue;
+        }
+        if (int ret = deleteEntryFunction(mMapFd, it->first.first, it->first.second)) {
+            ALOGE("Cannot delete connect mark for %u/%u: %s", it->first.second, it->first.first,
+                  strerror(-ret));
+            disable();
+            return ret;
+        }
+        mDeletes++;
+        it = mEntries.erase(it);
+    }
+    return 0;
+}
+
+void ConnectMarkMap::disable() {
+    // The map no longer matches NetworkController. Empty it so that the BPF programs stop marking
+    // sockets, and stop using it.
+    for (const auto& [prefix, value] : mEntries) {
+        deleteEntryFunction(mMapFd, prefix.first, prefix.second);
+    }
+    mEntries.clear();
+    mMapFd.reset();
+}
+
+void ConnectMarkMap::dump(DumpWriter& dw) const {
+    if (!isEnabled()) {
+        dw.println("Connect mark map: disabled");
+        return;
+    }
+    dw.println("Connect mark map: %zu entries, %" PRIu64 " updates, %" PRIu64 " writes, %" PRIu64
+               " deletes",
+               mEntries.size(), mUpdates, mWrites, mDeletes);
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <map>
+#include <utility>
+
+#include <android-base/unique_fd.h>
+
+#include "netdutils/DumpWriter.h"
+
+namespace android {
+namespace net {
+
+// netd's copy of the UID-keyed BPF map described in mainline/ConnectMarkMap.h. The map is written
+// only through this class, which keeps the entries it has written so that an update only touches
+// the entries that changed.
+class ConnectMarkMap {
+  public:
+    // (prefix length, UID in host byte order) -> value.
+    typedef std::map<std::pair<uint32_t, uint32_t>, uint32_t> Entries;
+
+    ConnectMarkMap() = default;
+    ConnectMarkMap(const ConnectMarkMap&) = delete;
+    ConnectMarkMap& operator=(const ConnectMarkMap&) = delete;
+
+    // Opens the map pinned at CONNECT_MARK_MAP_PATH and deletes anything a previous instance of
+    // netd left in it. Returns 0, -ENOENT if the BPF loader does not provide the map, or negative
+    // errno.
+    [[nodiscard]] int init();
+    // Same as init(), but uses |mapFd| instead of the pinned map.
+    [[nodiscard]] int init(android::base::unique_fd mapFd);
+    bool isEnabled() const { return mMapFd.get() != -1; }
+
+    // Adds the prefixes that cover the UIDs [first, last] with |value| to |entries|. Prefixes that
+    // are already in |entries| are overwritten. Use single UIDs, which are the most specific
+    // prefixes, to override part of a range.
+    static void addRange(Entries* entries, uid_t first, uid_t last, uint32_t value);
+
+    // Makes |entries| the complete contents of the map. Returns 0 or negative errno. If the map
+    // cannot be updated, it is emptied and disabled, so that sockets are marked by fwmarkd again.
+    [[nodiscard]] int update(const Entries& entries);
+
+    void dump(netdutils::DumpWriter& dw) const;
+
+  private:
+    void disable();
+
+    android::base::unique_fd mMapFd;
+    // The entries that are currently in the map.
+    Entries mEntries;
+    uint64_t mUpdates = 0;
+    uint64_t mWrites = 0;
+    uint64_t mDeletes = 0;
+
+    // For testing.
+    friend class ConnectMarkMapTest;
+    static int (*writeEntryFunction)(const android::base::unique_fd& mapFd, uint32_t prefixLen,
+                                     uint32_t uid, uint32_t value);
+    static int (*deleteEntryFunction)(const android::base::unique_fd& mapFd, uint32_t prefixLen,
+                                      uint32_t uid);
+};
+
+}  // namespace net
+}  // namespace android
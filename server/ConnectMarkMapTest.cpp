@@ -0,0 +1,222 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ConnectMarkMapTest.cpp - unit tests for ConnectMarkMap.cpp
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/bpf.h>
+#include <unistd.h>
+
+#include <map>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+#include <android-base/unique_fd.h>
+#include <bpf/BpfSyscallWrappers.h>
+#include <netdutils/NetNativeTestBase.h>
+
+#include "ConnectMarkMap.h"
+#include "Fwmark.h"
+#include "mainline/ConnectMarkMap.h"
+
+using android::base::unique_fd;
+
+namespace android {
+namespace net {
+
+class ConnectMarkMapTest : public NetNativeTestBase {
+  public:
+    ConnectMarkMapTest() {
+        ConnectMarkMap::writeEntryFunction = fakeWriteEntry;
+        ConnectMarkMap::deleteEntryFunction = fakeDeleteEntry;
+        sFakeMap.clear();
+        sFailWrites = false;
+    }
+
+    ~ConnectMarkMapTest() { useKernelMap(); }
+
+  protected:
+    static void useKernelMap() {
+        ConnectMarkMap::writeEntryFunction = sRealWriteEntry;
+        ConnectMarkMap::deleteEntryFunction = sRealDeleteEntry;
+    }
+
+    static int fakeWriteEntry(const unique_fd&, uint32_t prefixLen, uint32_t uid, uint32_t value) {
+        if (sFailWrites) return -E2BIG;
+        sFakeMap[{prefixLen, uid}] = value;
+        sWrites++;
+        return 0;
+    }
+
+    static int fakeDeleteEntry(const unique_fd&, uint32_t prefixLen, uint32_t uid) {
+        sFakeMap.erase({prefixLen, uid});
+        sDeletes++;
+        return 0;
+    }
+
+    // Enables |map| without a real BPF map behind it.
+    static void enable(ConnectMarkMap& map) {
+        map.mMapFd.reset(open("/dev/null", O_RDONLY | O_CLOEXEC));
+    }
+
+    static unique_fd createLpmTrie() {
+        return unique_fd(bpf::createMap(BPF_MAP_TYPE_LPM_TRIE, sizeof(ConnectMarkKey),
+                                        sizeof(uint32_t), 1024, BPF_F_NO_PREALLOC));
+    }
+
+    static inline ConnectMarkMap::Entries sFakeMap;
+    static inline bool sFailWrites = false;
+    static inline int sWrites = 0;
+    static inline int sDeletes = 0;
+    static inline const auto sRealWriteEntry = ConnectMarkMap::writeEntryFunction;
+    static inline const auto sRealDeleteEntry = ConnectMarkMap::deleteEntryFunction;
+};
+
+TEST_F(ConnectMarkMapTest, MaskMatchesFwmark) {
+    Fwmark fwmark;
+    fwmark.netId = FWMARK_NET_ID_MASK;
+    fwmark.permission = PERMISSION_SYSTEM;
+    fwmark.kernelMarked = true;
+    EXPECT_EQ(static_cast<uint32_t>(CONNECT_MARK_MASK), fwmark.intValue);
+}
+
+TEST_F(ConnectMarkMapTest, AddRange) {
+    ConnectMarkMap::Entries entries;
+    ConnectMarkMap::addRange(&entries, 0, UINT32_MAX, 1);
+    EXPECT_EQ((ConnectMarkMap::Entries{{{0, 0}, 1}}), entries);
+
+    entries.clear();
+    ConnectMarkMap::addRange(&entries, 10000, 19999, 2);
+    EXPECT_EQ((ConnectMarkMap::Entries{
+                      {{28, 10000}, 2},
+                      {{27, 10016}, 2},
+                      {{26, 10048}, 2},
+                      {{25, 10112}, 2},
+                      {{21, 10240}, 2},
+                      {{20, 12288}, 2},
+                      {{21, 16384}, 2},
+                      {{22, 18432}, 2},
+                      {{23, 19456}, 2},
+                      {{27, 19968}, 2},
+              }),
+              entries);
+
+    // Every UID in the range is covered exactly once, and nothing else is.
+    uint64_t covered = 0;
+    for (const auto& [prefix, value] : entries) {
+        const uint64_t size = 1ULL << (32 - prefix.first);
+        EXPECT_EQ(0U, prefix.second % size);
+        EXPECT_GE(prefix.second, 10000U);
+        EXPECT_LE(prefix.second + size - 1, 19999U);
+        covered += size;
+    }
+    EXPECT_EQ(10000U, covered);
+
+    entries.clear();
+    ConnectMarkMap::addRange(&entries, 1000, 1000, 3);
+    ConnectMarkMap::addRange(&entries, UINT32_MAX, UINT32_MAX, 4);
+    EXPECT_EQ((ConnectMarkMap::Entries{{{32, 1000}, 3}, {{32, UINT32_MAX}, 4}}), entries);
+}
+
+TEST_F(ConnectMarkMapTest, UpdateOnlyWritesChanges) {
+    ConnectMarkMap map;
+    ConnectMarkMap::Entries entries;
+    EXPECT_EQ(-ENOTCONN, map.update(entries));
+
+    enable(map);
+    ConnectMarkMap::addRange(&entries, 0, UINT32_MAX, 1);
+    ConnectMarkMap::addRange(&entries, 10001, 10001, 2);
+    ConnectMarkMap::addRange(&entries, 10002, 10002, 3);
+    sWrites = sDeletes = 0;
+    EXPECT_EQ(0, map.update(entries));
+    EXPECT_EQ(entries, sFakeMap);
+    EXPECT_EQ(3, sWrites);
+    EXPECT_EQ(0, sDeletes);
+
+    entries.erase({32, 10001});
+    entries[{32, 10002}] = 4;
+    sWrites = sDeletes = 0;
+    EXPECT_EQ(0, map.update(entries));
+    EXPECT_EQ(entries, sFakeMap);
+    EXPECT_EQ(1, sWrites);
+    EXPECT_EQ(1, sDeletes);
+
+    sWrites = sDeletes = 0;
+    EXPECT_EQ(0, map.update(entries));
+    EXPECT_EQ(0, sWrites);
+    EXPECT_EQ(0, sDeletes);
+}
+
+TEST_F(ConnectMarkMapTest, FailedUpdateEmptiesAndDisablesMap) {
+    ConnectMarkMap map;
+    enable(map);
+    ConnectMarkMap::Entries entries;
+    ConnectMarkMap::addRange(&entries, 0, UINT32_MAX, 1);
+    ASSERT_EQ(0, map.update(entries));
+    ASSERT_FALSE(sFakeMap.empty());
+
+    sFailWrites = true;
+    ConnectMarkMap::addRange(&entries, 10001, 10001, 2);
+    EXPECT_EQ(-E2BIG, map.update(entries));
+    EXPECT_TRUE(sFakeMap.empty());
+    EXPECT_FALSE(map.isEnabled());
+}
+
+TEST_F(ConnectMarkMapTest, KernelLookup) {
+    useKernelMap();
+
+    unique_fd mapFd = createLpmTrie();
+    if (mapFd == -1) GTEST_SKIP() << "LPM trie maps not supported: " << strerror(errno);
+
+    // Anything already in the map is removed by init().
+    const ConnectMarkKey staleKey = {.prefixLen = 32, .uid = htonl(12345)};
+    const uint32_t staleValue = 99;
+    ASSERT_EQ(0, bpf::writeToMapEntry(mapFd, &staleKey, &staleValue, BPF_ANY));
+
+    const int rawFd = mapFd.get();
+    ConnectMarkMap map;
+    ASSERT_EQ(0, map.init(unique_fd(dup(rawFd))));
+
+    ConnectMarkMap::Entries entries;
+    ConnectMarkMap::addRange(&entries, 0, 9999, 1);
+    ConnectMarkMap::addRange(&entries, 10000, 19999, 2);
+    ConnectMarkMap::addRange(&entries, 20000, UINT32_MAX, 1);
+    ConnectMarkMap::addRange(&entries, 10500, 10500, 3);
+    ASSERT_EQ(0, map.update(entries));
+
+    const auto lookup = [&](uint32_t uid) {
+        const ConnectMarkKey key = {.prefixLen = 32, .uid = htonl(uid)};
+        uint32_t value = 0;
+        if (bpf::findMapEntry(mapFd, &key, &value)) return 0U;
+        return value;
+    };
+    const std::map<uint32_t, uint32_t> expected = {
+            {0, 1},     {1000, 1},  {9999, 1},  {10000, 2}, {10499, 2},       {10500, 3},
+            {10501, 2}, {19999, 2}, {20000, 1}, {12345, 2}, {UINT32_MAX, 1},
+    };
+    for (const auto& [uid, value] : expected) {
+        EXPECT_EQ(value, lookup(uid)) << "uid " << uid;
+    }
+
+    entries.erase({32, 10500});
+    ASSERT_EQ(0, map.update(entries));
+    EXPECT_EQ(2U, lookup(10500));
+}
+
+}  // namespace net
+}  // namespace android
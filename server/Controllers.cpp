@@ -311,6 +311,7 @@ void Controllers::initIptablesRules() {
 }
 
 void Controllers::init() {
+    netCtrl.removeClsactQdiscs();
     initIptablesRules();
     Stopwatch s;
 
@@ -325,11 +326,28 @@ void Controllers::init() {
     }
     gLog.info("Enabling bandwidth control: %" PRId64 "us", s.getTimeAndResetUs());
 
+    // If RouteController keeps the rules and routes of the previous instance of netd, restore its
+    // networks too, so that fwmarkd and DNS can use them until the framework creates them again.
+    RouteController::setReconcileFinishedCallback([this] { netCtrl.finishRestore(); });
     if (int ret = RouteController::Init(NetworkController::LOCAL_NET_ID)) {
         gLog.error("Failed to initialize RouteController (%s)", strerror(-ret));
     }
     gLog.info("Initializing RouteController: %" PRId64 "us", s.getTimeAndResetUs());
 
+    if (int ret = netCtrl.openSnapshot(NetworkController::SNAPSHOT_PATH,
+                                       RouteController::isReconciling())) {
+        gLog.error("Failed to open network snapshot (%s)", strerror(-ret));
+    }
+    // In case reconciling finished before the networks were restored.
+    if (!RouteController::isReconciling()) netCtrl.finishRestore();
+    gLog.info("Opening network snapshot: %" PRId64 "us", s.getTimeAndResetUs());
+
+    // The connect mark map is optional: it only exists if the BPF loader provides it.
+    if (int ret = netCtrl.enableConnectMarkMap(); ret && ret != -ENOENT) {
+        gLog.error("Failed to enable the connect mark map (%s)", strerror(-ret));
+    }
+    gLog.info("Enabling connect mark map: %" PRId64 "us", s.getTimeAndResetUs());
+
     netdutils::Status xStatus = XfrmController::Init();
     if (!isOk(xStatus)) {
         gLog.error("Failed to initialize XfrmController (%s)", netdutils::toString(xStatus).c_str());
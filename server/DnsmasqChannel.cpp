@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DnsmasqChannel"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string_view>
+
+#include <log/log.h>
+
+#include "Controllers.h"
+#include "DnsmasqChannel.h"
+
+using android::base::unique_fd;
+using android::netdutils::DumpWriter;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+namespace android {
+namespace net {
+
+namespace {
+
+// The part of a command before the first separator, e.g., "update_dns".
+std::string_view commandKind(std::string_view cmd) {
+    return cmd.substr(0, cmd.find('|'));
+}
+
+}  // namespace
+
+DnsmasqChannel::~DnsmasqChannel() {
+    stop();
+}
+
+int DnsmasqChannel::start(unique_fd fd) {
+    // The pipe is non-blocking so that a stalled dnsmasq only delays the writer thread up to the
+    // write timeout, and never forever.
+    const int flags = fcntl(fd.get(), F_GETFL);
+    if (flags == -1 || fcntl(fd.get(), F_SETFL, flags | O_NONBLOCK) == -1) {
+        const int err = errno;
+        ALOGE("Failed to make dnsmasq control pipe non-blocking (%s)", strerror(err));
+        return -err;
+    }
+
+    std::lock_guard guard(mLock);
+    if (mIsRunning) {
+        return -EBUSY;
+    }
+    mFd = std::move(fd);
+    mIsRunning = true;
+    mWriterThread = std::thread([this] { run(); });
+    return 0;
+}
+
+void DnsmasqChannel::stop() {
+    {
+        std::lock_guard guard(mLock);
+        if (!mIsRunning) return;
+        mIsRunning = false;
+        mDropped += mQueue.size();
+        mQueue.clear();
+    }
+    mCv.notify_all();
+    // If the writer thread is waiting for room in the pipe, this waits for it too. Stop dnsmasq
+    // first so that the wait ends right away.
+    mWriterThread.join();
+
+    std::lock_guard guard(mLock);
+    mFd.reset();
+}
+
+bool DnsmasqChannel::isRunning() const {
+    std::lock_guard guard(mLock);
+    return mIsRunning;
+}
+
+void DnsmasqChannel::enqueue(const std::string& cmd) {
+    if (cmd.empty()) return;
+
+    {
+        std::lock_guard guard(mLock);
+        if (!mIsRunning) return;
+
+        const std::string_view kind = commandKind(cmd);
+        auto it = std::find_if(mQueue.begin(), mQueue.end(), [kind](const Update& update) {
+            return commandKind(update.cmd) == kind;
+        });
+        if (it != mQueue.end()) {
+            it->cmd = cmd;
+            mCoalesced++;
+        } else {
+            mQueue.push_back({.cmd = cmd, .queued = steady_clock::now()});
+            mMaxQueueDepth = std::max(mMaxQueueDepth, mQueue.size());
+        }
+    }
+    mCv.notify_all();
+}
+
+void DnsmasqChannel::flush() {
+    std::unique_lock lock(mLock);
+    mCv.wait(lock, [this]() REQUIRES(mLock) {
+        return !mIsRunning || (mQueue.empty() && !mIsWriting);
+    });
+}
+
+void DnsmasqChannel::run() {
+    std::unique_lock lock(mLock);
+    while (true) {
+        mCv.wait(lock, [this]() REQUIRES(mLock) { return !mIsRunning || !mQueue.empty(); });
+        if (!mIsRunning) break;
+
+        Update update = std::move(mQueue.front());
+        mQueue.pop_front();
+        mIsWriting = true;
+        const int fd = mFd.get();
+        const milliseconds timeout = mWriteTimeout;
+
+        lock.unlock();
+        const int ret = sendCmd(fd, update.cmd, timeout);
+        const auto latencyUs = duration_cast<microseconds>(steady_clock::now() - update.queued);
+        lock.lock();
+
+        mIsWriting = false;
+        if (ret == 0) {
+            mSent++;
+            mTotalLatencyUs += latencyUs.count();
+            mMaxLatencyUs = std::max<int64_t>(mMaxLatencyUs, latencyUs.count());
+        } else {
+            mDropped++;
+        }
+        mCv.notify_all();
+    }
+}
+
+/* static */
+int DnsmasqChannel::sendCmd(int fd, const std::string& cmd, milliseconds timeout) {
+    // Commands are only logged when they fail. Logging every command made the log the largest
+    // cost of a burst of updates.
+    //
+    // dnsmasq can't parse commands larger than 1023 bytes, which is less than PIPE_BUF. This makes
+    // every write atomic: either the whole command is written, or nothing and EAGAIN.
+    static_assert(PIPE_BUF > 1024);
+    const auto deadline = steady_clock::now() + timeout;
+    while (true) {
+        // Send the trailing \0 as well.
+        if (write(fd, cmd.c_str(), cmd.size() + 1) >= 0) {
+            return 0;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) {
+            const int err = errno;
+            gLog.error("Failed to send update msg to dnsmasq [%s] (%s)", cmd.c_str(),
+                       strerror(err));
+            return -err;
+        }
+
+        // The pipe is full. Wait for dnsmasq to read from it.
+        const auto remaining = duration_cast<milliseconds>(deadline - steady_clock::now());
+        if (remaining.count() <= 0) {
+            gLog.error("Timed out sending update msg to dnsmasq [%s]", cmd.c_str());
+            return -ETIMEDOUT;
+        }
+        pollfd pfd = {.fd = fd, .events = POLLOUT};
+        if (poll(&pfd, 1, remaining.count()) == -1 && errno != EINTR) {
+            const int err = errno;
+            gLog.error("Failed to wait for dnsmasq control pipe [%s] (%s)", cmd.c_str(),
+                       strerror(err));
+            return -err;
+        }
+    }
+}
+
+void DnsmasqChannel::dump(DumpWriter& dw) const {
+    std::lock_guard guard(mLock);
+    const int64_t avgLatencyUs = mSent ? mTotalLatencyUs / mSent : 0;
+    dw.println("dnsmasq updates: sent %" PRIu64 " coalesced %" PRIu64 " dropped %" PRIu64, mSent,
+               mCoalesced, mDropped);
+    dw.println("dnsmasq update queue: depth %zu max %zu", mQueue.size() + (mIsWriting ? 1 : 0),
+               mMaxQueueDepth);
+    dw.println("dnsmasq update latency: avg %" PRId64 "us max %" PRId64 "us", avgLatencyUs,
+               mMaxLatencyUs);
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <android-base/thread_annotations.h>
+#include <android-base/unique_fd.h>
+
+#include "netdutils/DumpWriter.h"
+
+namespace android {
+namespace net {
+
+// Writes update commands to the control pipe of a running dnsmasq on a dedicated thread, so that
+// callers never block on dnsmasq reading the pipe.
+//
+// Every command that dnsmasq understands ("update_ifaces|..." and "update_dns|...") carries the
+// complete state of one kind, so a queued command is replaced by a newer command of the same kind
+// instead of being sent twice. The queue therefore never holds more than one command per kind.
+class DnsmasqChannel {
+  public:
+    using milliseconds = std::chrono::milliseconds;
+    using time_point = std::chrono::steady_clock::time_point;
+
+    static constexpr milliseconds kDefaultWriteTimeout = milliseconds(5000);
+
+    DnsmasqChannel() = default;
+    ~DnsmasqChannel();
+
+    DnsmasqChannel(const DnsmasqChannel&) = delete;
+    DnsmasqChannel& operator=(const DnsmasqChannel&) = delete;
+
+    // Takes ownership of the write end of the dnsmasq control pipe and starts the writer thread.
+    // Returns 0 or negative errno.
+    [[nodiscard]] int start(android::base::unique_fd fd);
+    // Stops the writer thread and closes the pipe. Commands not yet written are dropped.
+    void stop();
+    bool isRunning() const;
+
+    // Queues |cmd| to be written. Does nothing if the channel is not running.
+    void enqueue(const std::string& cmd);
+    // Waits until every queued command has been written or dropped.
+    void flush();
+
+    void dump(netdutils::DumpWriter& dw) const;
+
+  private:
+    struct Update {
+        std::string cmd;
+        // When the oldest state that this command replaced was queued.
+        time_point queued;
+    };
+
+    void run();
+    // Writes |cmd| and its trailing \0 to |fd|, waiting up to |timeout| for dnsmasq to make room
+    // in the pipe. Returns 0 or negative errno.
+    static int sendCmd(int fd, const std::string& cmd, milliseconds timeout);
+
+    mutable std::mutex mLock;
+    // Signalled when a command is queued, when the writer thread is idle, and on stop().
+    std::condition_variable mCv;
+    std::thread mWriterThread;
+    android::base::unique_fd mFd GUARDED_BY(mLock);
+    std::deque<Update> mQueue GUARDED_BY(mLock);
+    bool mIsRunning GUARDED_BY(mLock) = false;
+    // True while the writer thread is writing a command that has already left mQueue.
+    bool mIsWriting GUARDED_BY(mLock) = false;
+    // How long to wait for dnsmasq to read the pipe before dropping a command.
+    milliseconds mWriteTimeout GUARDED_BY(mLock) = kDefaultWriteTimeout;
+
+    // Counters, kept across restarts of dnsmasq.
+    uint64_t mSent GUARDED_BY(mLock) = 0;
+    uint64_t mCoalesced GUARDED_BY(mLock) = 0;
+    uint64_t mDropped GUARDED_BY(mLock) = 0;
+    size_t mMaxQueueDepth GUARDED_BY(mLock) = 0;
+    // Time from queueing a command to writing it to the pipe.
+    int64_t mTotalLatencyUs GUARDED_BY(mLock) = 0;
+    int64_t mMaxLatencyUs GUARDED_BY(mLock) = 0;
+
+    friend class DnsmasqChannelTest;
+};
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * DnsmasqChannelTest.cpp - unit tests for DnsmasqChannel.cpp
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <netdutils/NetNativeTestBase.h>
+
+#include "DnsmasqChannel.h"
+
+using android::base::Pipe;
+using android::base::unique_fd;
+using namespace std::chrono_literals;
+
+namespace android {
+namespace net {
+
+class DnsmasqChannelTest : public NetNativeTestBase {
+  protected:
+    void SetUp() override {
+        unique_fd writeFd;
+        ASSERT_TRUE(Pipe(&mReadFd, &writeFd, O_CLOEXEC));
+        ASSERT_EQ(0, mChannel.start(std::move(writeFd)));
+    }
+
+    // Fills the pipe so that the writer thread has to wait for the test to read from it. Returns
+    // the number of bytes written.
+    size_t fillPipe() {
+        std::lock_guard guard(mChannel.mLock);
+        const int fd = mChannel.mFd.get();
+        fcntl(fd, F_SETPIPE_SZ, 4096);
+        const std::string filler(512, 'x');
+        size_t filled = 0;
+        ssize_t ret;
+        while ((ret = write(fd, filler.data(), filler.size())) > 0) filled += ret;
+        EXPECT_EQ(EAGAIN, errno);
+        return filled;
+    }
+
+    void waitUntilWriting() {
+        for (int i = 0; i < 100; i++) {
+            {
+                std::lock_guard guard(mChannel.mLock);
+                if (mChannel.mIsWriting) return;
+            }
+            std::this_thread::sleep_for(10ms);
+        }
+        FAIL() << "Writer thread did not pick up the command";
+    }
+
+    // Reads everything currently in the pipe.
+    std::string readPipe() {
+        const int flags = fcntl(mReadFd.get(), F_GETFL);
+        fcntl(mReadFd.get(), F_SETFL, flags | O_NONBLOCK);
+        std::string contents;
+        char buf[1024];
+        ssize_t ret;
+        while ((ret = read(mReadFd.get(), buf, sizeof(buf))) > 0) contents.append(buf, ret);
+        fcntl(mReadFd.get(), F_SETFL, flags);
+        return contents;
+    }
+
+    void setWriteTimeout(DnsmasqChannel::milliseconds timeout) {
+        std::lock_guard guard(mChannel.mLock);
+        mChannel.mWriteTimeout = timeout;
+    }
+
+    void expectCounters(uint64_t sent, uint64_t coalesced, uint64_t dropped) {
+        std::lock_guard guard(mChannel.mLock);
+        EXPECT_EQ(sent, mChannel.mSent);
+        EXPECT_EQ(coalesced, mChannel.mCoalesced);
+        EXPECT_EQ(dropped, mChannel.mDropped);
+    }
+
+    unique_fd mReadFd;
+    DnsmasqChannel mChannel;
+};
+
+TEST_F(DnsmasqChannelTest, SendsCommandsWithTrailingNul) {
+    mChannel.enqueue("update_ifaces|wlan0");
+    mChannel.flush();
+    mChannel.enqueue("update_dns|0x1234|192.0.2.1");
+    mChannel.flush();
+
+    using namespace std::string_literals;
+    EXPECT_EQ("update_ifaces|wlan0\0update_dns|0x1234|192.0.2.1\0"s, readPipe());
+    expectCounters(2, 0, 0);
+}
+
+TEST_F(DnsmasqChannelTest, CoalescesQueuedCommandsOfTheSameKind) {
+    const size_t filled = fillPipe();
+
+    // The first command is picked up by the writer thread, which then waits for the test to make
+    // room in the pipe. Only the latest command of each kind queued behind it is sent.
+    mChannel.enqueue("update_ifaces|wlan0");
+    waitUntilWriting();
+    mChannel.enqueue("update_ifaces|wlan0|usb0");
+    mChannel.enqueue("update_dns|0x1234|192.0.2.1");
+    mChannel.enqueue("update_ifaces|wlan0|usb0|rndis0");
+
+    std::string contents;
+    while (contents.size() < filled) contents += readPipe();
+    mChannel.flush();
+    contents += readPipe();
+
+    using namespace std::string_literals;
+    EXPECT_EQ(std::string(filled, 'x') +
+                      "update_ifaces|wlan0\0"
+                      "update_ifaces|wlan0|usb0|rndis0\0"
+                      "update_dns|0x1234|192.0.2.1\0"s,
+              contents);
+    expectCounters(3, 1, 0);
+}
+
+TEST_F(DnsmasqChannelTest, DropsCommandWhenDnsmasqDoesNotRead) {
+    setWriteTimeout(50ms);
+    const size_t filled = fillPipe();
+
+    mChannel.enqueue("update_ifaces|wlan0");
+    mChannel.flush();
+    expectCounters(0, 0, 1);
+
+    // The channel keeps working once dnsmasq catches up.
+    EXPECT_EQ(std::string(filled, 'x'), readPipe());
+    mChannel.enqueue("update_ifaces|wlan0|usb0");
+    mChannel.flush();
+    using namespace std::string_literals;
+    EXPECT_EQ("update_ifaces|wlan0|usb0\0"s, readPipe());
+    expectCounters(1, 0, 1);
+}
+
+TEST_F(DnsmasqChannelTest, StopDropsQueuedCommands) {
+    setWriteTimeout(50ms);
+    fillPipe();
+
+    mChannel.enqueue("update_ifaces|wlan0");
+    waitUntilWriting();
+    mChannel.enqueue("update_dns|0x1234|192.0.2.1");
+    mChannel.stop();
+    EXPECT_FALSE(mChannel.isRunning());
+    expectCounters(0, 0, 2);
+
+    // Nothing is queued while stopped.
+    mChannel.enqueue("update_ifaces|wlan0");
+    mChannel.flush();
+    expectCounters(0, 0, 2);
+}
+
+}  // namespace net
+}  // namespace android
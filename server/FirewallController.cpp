@@ -119,37 +119,49 @@ int FirewallController::isFirewallEnabled(void) {
 }
 
 int FirewallController::setInterfaceRule(const char* iface, FirewallRule rule) {
+    return setInterfaceRules({iface}, rule);
+}
+
+int FirewallController::setInterfaceRules(const std::vector<std::string>& ifaces,
+                                          FirewallRule rule) {
     if (mFirewallType == DENYLIST) {
         // Unsupported in DENYLIST mode
         return -EINVAL;
     }
 
-    if (!isIfaceName(iface)) {
-        errno = ENOENT;
-        return -ENOENT;
+    for (const auto& iface : ifaces) {
+        if (!isIfaceName(iface)) {
+            errno = ENOENT;
+            return -ENOENT;
+        }
     }
 
     // Only delete rules if we actually added them, because otherwise our iptables-restore
     // processes will terminate with "no such rule" errors and cause latency penalties while we
     // spin up new ones.
-    const char* op;
-    if (rule == ALLOW && mIfaceRules.find(iface) == mIfaceRules.end()) {
-        op = "-I";
-        mIfaceRules.insert(iface);
-    } else if (rule == DENY && mIfaceRules.find(iface) != mIfaceRules.end()) {
-        op = "-D";
-        mIfaceRules.erase(iface);
-    } else {
-        return 0;
+    const char* op = (rule == ALLOW) ? "-I" : "-D";
+    std::set<std::string> changed;
+    std::vector<std::string> commands = {"*filter"};
+    for (const auto& iface : ifaces) {
+        const bool present = mIfaceRules.find(iface) != mIfaceRules.end();
+        if (present == (rule == ALLOW) || !changed.insert(iface).second) continue;
+        commands.push_back(StringPrintf("%s fw_INPUT -i %s -j RETURN", op, iface.c_str()));
+        commands.push_back(StringPrintf("%s fw_OUTPUT -o %s -j RETURN", op, iface.c_str()));
     }
+    if (changed.empty()) return 0;
+    commands.push_back("COMMIT\n");
 
-    std::string command = Join(std::vector<std::string> {
-        "*filter",
-        StringPrintf("%s fw_INPUT -i %s -j RETURN", op, iface),
-        StringPrintf("%s fw_OUTPUT -o %s -j RETURN", op, iface),
-        "COMMIT\n"
-    }, "\n");
-    return (execIptablesRestore(V4V6, command) == 0) ? 0 : -EREMOTEIO;
+    if (execIptablesRestore(V4V6, Join(commands, "\n")) != 0) {
+        return -EREMOTEIO;
+    }
+    for (const auto& iface : changed) {
+        if (rule == ALLOW) {
+            mIfaceRules.insert(iface);
+        } else {
+            mIfaceRules.erase(iface);
+        }
+    }
+    return 0;
 }
 
 /* static */
@@ -25,6 +25,8 @@
 
 #include "NetdConstants.h"
 
+class IptablesRestoreControllerTest;
+
 namespace android {
 namespace net {
 
@@ -48,6 +50,8 @@ public:
 
   /* Match traffic going in/out over the given iface. */
   int setInterfaceRule(const char*, FirewallRule);
+  /* Same as setInterfaceRule, but for many ifaces in a single iptables-restore transaction. */
+  int setInterfaceRules(const std::vector<std::string>&, FirewallRule);
   /* Match traffic owned by given UID. This is specific to a particular chain. */
   int setUidRule(ChildChain, int, FirewallRule);
 
@@ -65,6 +69,7 @@ public:
 
 protected:
   friend class FirewallControllerTest;
+  friend class ::IptablesRestoreControllerTest;
   static int (*execIptablesRestore)(IptablesTarget target, const std::string& commands);
 
 private:
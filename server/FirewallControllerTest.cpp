@@ -109,5 +109,54 @@ TEST_F(FirewallControllerTest, TestFirewall) {
     expectIptablesRestoreCommands(noCommands);
 }
 
+TEST_F(FirewallControllerTest, TestSetInterfaceRules) {
+    std::vector<std::string> noCommands = {};
+
+    EXPECT_EQ(-EINVAL, mFw.setInterfaceRules({"wlan0"}, ALLOW));
+    expectIptablesRestoreCommands(noCommands);
+
+    EXPECT_EQ(0, mFw.setFirewallType(ALLOWLIST));
+    sRestoreCmds.clear();
+
+    // All the interfaces are validated before anything is programmed.
+    EXPECT_EQ(-ENOENT, mFw.setInterfaceRules({"wlan0", "../bad"}, ALLOW));
+    expectIptablesRestoreCommands(noCommands);
+
+    std::vector<std::string> ifaceCommands = {
+        "*filter\n"
+        "-I fw_INPUT -i wlan0 -j RETURN\n"
+        "-I fw_OUTPUT -o wlan0 -j RETURN\n"
+        "-I fw_INPUT -i rmnet_data0 -j RETURN\n"
+        "-I fw_OUTPUT -o rmnet_data0 -j RETURN\n"
+        "COMMIT\n"
+    };
+    EXPECT_EQ(0, mFw.setInterfaceRules({"wlan0", "rmnet_data0", "wlan0"}, ALLOW));
+    expectIptablesRestoreCommands(ifaceCommands);
+
+    // Only interfaces whose state changes are touched.
+    ifaceCommands = {
+        "*filter\n"
+        "-I fw_INPUT -i eth0 -j RETURN\n"
+        "-I fw_OUTPUT -o eth0 -j RETURN\n"
+        "COMMIT\n"
+    };
+    EXPECT_EQ(0, mFw.setInterfaceRules({"wlan0", "eth0"}, ALLOW));
+    expectIptablesRestoreCommands(ifaceCommands);
+
+    ifaceCommands = {
+        "*filter\n"
+        "-D fw_INPUT -i rmnet_data0 -j RETURN\n"
+        "-D fw_OUTPUT -o rmnet_data0 -j RETURN\n"
+        "-D fw_INPUT -i eth0 -j RETURN\n"
+        "-D fw_OUTPUT -o eth0 -j RETURN\n"
+        "COMMIT\n"
+    };
+    EXPECT_EQ(0, mFw.setInterfaceRules({"rmnet_data0", "eth0", "ipsec0"}, DENY));
+    expectIptablesRestoreCommands(ifaceCommands);
+
+    EXPECT_EQ(0, mFw.setInterfaceRule("wlan0", ALLOW));
+    expectIptablesRestoreCommands(noCommands);
+}
+
 }  // namespace net
 }  // namespace android
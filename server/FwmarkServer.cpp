@@ -16,16 +16,28 @@
 
 #include "FwmarkServer.h"
 
+#include <fcntl.h>
+#include <inttypes.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <selinux/selinux.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <utils/String16.h>
 
+#include <algorithm>
+#include <iterator>
+#include <string>
+
 #include <android-base/cmsg.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+#include <cutils/sockets.h>
 #include <binder/IServiceManager.h>
 #include <netd_resolv/resolv.h>  // NETID_UNSET
 
@@ -37,32 +49,368 @@
 #include "NetdUpdatablePublic.h"
 
 using android::base::ReceiveFileDescriptorVector;
+using android::base::StringAppendF;
+using android::base::StringPrintf;
 using android::base::unique_fd;
 using android::net::metrics::INetdEventListener;
+using android::netdutils::DumpWriter;
+using android::netdutils::ScopedIndent;
 
 namespace android {
 namespace net {
 
-FwmarkServer::FwmarkServer(NetworkController* networkController, EventReporter* eventReporter)
-    : SocketListener(SOCKET_NAME, true),
-      mNetworkController(networkController),
-      mEventReporter(eventReporter) {}
+namespace {
+
+constexpr int kListenBacklog = 128;
+constexpr int kMaxEvents = 64;
+
+const char* commandName(size_t cmdId) {
+    switch (cmdId) {
+        case FwmarkCommand::ON_ACCEPT: return "ON_ACCEPT";
+        case FwmarkCommand::ON_CONNECT: return "ON_CONNECT";
+        case FwmarkCommand::SELECT_NETWORK: return "SELECT_NETWORK";
+        case FwmarkCommand::PROTECT_FROM_VPN: return "PROTECT_FROM_VPN";
+        case FwmarkCommand::SELECT_FOR_USER: return "SELECT_FOR_USER";
+        case FwmarkCommand::QUERY_USER_ACCESS: return "QUERY_USER_ACCESS";
+        case FwmarkCommand::ON_CONNECT_COMPLETE: return "ON_CONNECT_COMPLETE";
+        case FwmarkCommand::TAG_SOCKET: return "TAG_SOCKET";
+        case FwmarkCommand::UNTAG_SOCKET: return "UNTAG_SOCKET";
+        case FwmarkCommand::ON_SENDMMSG: return "ON_SENDMMSG";
+        case FwmarkCommand::ON_SENDMSG: return "ON_SENDMSG";
+        case FwmarkCommand::ON_SENDTO: return "ON_SENDTO";
+        default: return "INVALID";
+    }
+}
+
+unsigned defaultNumWorkers() {
+    return std::clamp(std::thread::hardware_concurrency(), 1U, FwmarkServer::kMaxDefaultWorkers);
+}
+
+uint64_t elapsedUs(FwmarkServer::clock::time_point from, FwmarkServer::clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+void updateMax(std::atomic<uint64_t>* max, uint64_t value) {
+    uint64_t current = max->load(std::memory_order_relaxed);
+    while (value > current &&
+           !max->compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+}  // namespace
+
+std::atomic<FwmarkServer*> FwmarkServer::sRunningServer = nullptr;
+
+FwmarkServer::FwmarkServer(NetworkController* networkController, EventReporter* eventReporter,
+                           unsigned numWorkers)
+    : mNetworkController(networkController),
+      mEventReporter(eventReporter),
+      mNumWorkers(numWorkers ? numWorkers : defaultNumWorkers()) {}
+
+FwmarkServer::~FwmarkServer() {
+    stop();
+}
+
+int FwmarkServer::start() {
+    const int sock = android_get_control_socket(SOCKET_NAME);
+    if (sock < 0) {
+        LOG(ERROR) << "Failed to get socket " << SOCKET_NAME;
+        return -ENOENT;
+    }
+    return start(unique_fd(sock));
+}
+
+int FwmarkServer::start(unique_fd sock) {
+    if (mAcceptThread.joinable()) return -EBUSY;
+
+    if (listen(sock.get(), kListenBacklog) == -1) {
+        const int err = errno;
+        PLOG(ERROR) << "Unable to listen on " << SOCKET_NAME;
+        return -err;
+    }
+    // The accept thread drains the backlog until accept() would block.
+    const int flags = fcntl(sock.get(), F_GETFL);
+    if (flags == -1 || fcntl(sock.get(), F_SETFL, flags | O_NONBLOCK) == -1) {
+        return -errno;
+    }
+
+    unique_fd stopEvent(eventfd(0, EFD_CLOEXEC));
+    if (stopEvent == -1) return -errno;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (unsigned i = 0; i < mNumWorkers; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->epollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+        if (worker->epollFd == -1) return -errno;
+        epoll_event event = {.events = EPOLLIN, .data = {.ptr = nullptr}};
+        if (epoll_ctl(worker->epollFd.get(), EPOLL_CTL_ADD, stopEvent.get(), &event) == -1) {
+            return -errno;
+        }
+        workers.push_back(std::move(worker));
+    }
+
+    mListenSock = std::move(sock);
+    mStopEvent = std::move(stopEvent);
+    mWorkers = std::move(workers);
+    for (auto& worker : mWorkers) {
+        worker->thread = std::thread(&FwmarkServer::runWorker, this, worker.get());
+    }
+    mAcceptThread = std::thread(&FwmarkServer::acceptClients, this);
+    sRunningServer = this;
+    return 0;
+}
+
+void FwmarkServer::stop() {
+    if (!mAcceptThread.joinable()) return;
+
+    FwmarkServer* self = this;
+    sRunningServer.compare_exchange_strong(self, nullptr);
 
-bool FwmarkServer::onDataAvailable(SocketClient* client) {
+    const uint64_t one = 1;
+    if (write(mStopEvent.get(), &one, sizeof(one)) != sizeof(one)) {
+        PLOG(ERROR) << "Failed to stop FwmarkServer";
+        return;
+    }
+    mAcceptThread.join();
+    for (auto& worker : mWorkers) {
+        worker->thread.join();
+        std::lock_guard guard(worker->lock);
+        mQueueDepth -= worker->clients.size();
+        worker->clients.clear();
+        worker->queued = 0;
+    }
+    mListenSock.reset();
+}
+
+void FwmarkServer::acceptClients() {
+    pollfd fds[] = {
+            {.fd = mListenSock.get(), .events = POLLIN, .revents = 0},
+            {.fd = mStopEvent.get(), .events = POLLIN, .revents = 0},
+    };
+    while (true) {
+        if (poll(fds, std::size(fds), -1) == -1) {
+            if (errno == EINTR) continue;
+            PLOG(ERROR) << "FwmarkServer poll failed";
+            return;
+        }
+        if (fds[1].revents) return;
+
+        while (true) {
+            unique_fd fd(accept4(mListenSock.get(), nullptr, nullptr,
+                                 SOCK_CLOEXEC | SOCK_NONBLOCK));
+            if (fd == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                // Out of fds or memory. Give the workers a chance to close some clients instead
+                // of spinning on the pending connection.
+                PLOG(ERROR) << "FwmarkServer accept failed";
+                mAcceptErrors++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                break;
+            }
+
+            ucred cred;
+            socklen_t credLen = sizeof(cred);
+            if (getsockopt(fd.get(), SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == -1) {
+                PLOG(ERROR) << "FwmarkServer failed to get peer credentials";
+                mAcceptErrors++;
+                continue;
+            }
+            addClient(std::move(fd), cred.uid);
+        }
+    }
+}
+
+void FwmarkServer::addClient(unique_fd fd, uid_t uid) {
+    Worker* worker = mWorkers[0].get();
+    for (const auto& candidate : mWorkers) {
+        if (candidate->queued < worker->queued) worker = candidate.get();
+    }
+
+    Client* client;
+    {
+        std::lock_guard guard(worker->lock);
+        worker->clients.push_back({std::move(fd), uid, clock::now(), {}});
+        client = &worker->clients.back();
+        client->self = std::prev(worker->clients.end());
+    }
+    worker->queued++;
+    mAccepted++;
+    const size_t depth = ++mQueueDepth;
+    size_t max = mMaxQueueDepth.load(std::memory_order_relaxed);
+    while (depth > max && !mMaxQueueDepth.compare_exchange_weak(max, depth)) {
+    }
+
+    // Once the client is in the epoll set the worker may serve and free it at any time.
+    const int clientFd = client->fd.get();
+    epoll_event event = {.events = EPOLLIN | EPOLLRDHUP, .data = {.ptr = client}};
+    if (epoll_ctl(worker->epollFd.get(), EPOLL_CTL_ADD, clientFd, &event) == -1) {
+        PLOG(ERROR) << "FwmarkServer failed to add client";
+        mAcceptErrors++;
+        std::lock_guard guard(worker->lock);
+        worker->clients.erase(client->self);
+        worker->queued--;
+        mQueueDepth--;
+    }
+}
+
+void FwmarkServer::interleaveByUid(std::vector<Client*>* clients) {
+    if (clients->size() < 2) return;
+
+    // The clients of each UID, with the UIDs in the order in which their first client appears.
+    std::vector<std::vector<Client*>> byUid;
+    for (Client* client : *clients) {
+        auto it = std::find_if(byUid.begin(), byUid.end(), [client](const auto& uidClients) {
+            return uidClients.front()->uid == client->uid;
+        });
+        if (it == byUid.end()) {
+            byUid.push_back({client});
+        } else {
+            it->push_back(client);
+        }
+    }
+    if (byUid.size() == 1) return;
+
+    clients->clear();
+    for (size_t round = 0; !byUid.empty(); round++) {
+        for (const auto& uidClients : byUid) {
+            clients->push_back(uidClients[round]);
+        }
+        byUid.erase(std::remove_if(byUid.begin(), byUid.end(),
+                                   [round](const auto& uidClients) {
+                                       return uidClients.size() == round + 1;
+                                   }),
+                    byUid.end());
+    }
+}
+
+void FwmarkServer::runWorker(Worker* worker) {
+    epoll_event events[kMaxEvents];
+    std::vector<Client*> ready;
+    ready.reserve(kMaxEvents);
+    while (true) {
+        const int n = epoll_wait(worker->epollFd.get(), events, kMaxEvents, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            PLOG(ERROR) << "FwmarkServer epoll_wait failed";
+            return;
+        }
+
+        ready.clear();
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == nullptr) return;  // Stopped.
+            ready.push_back(static_cast<Client*>(events[i].data.ptr));
+        }
+        interleaveByUid(&ready);
+        for (Client* client : ready) {
+            serveClient(worker, client);
+        }
+    }
+}
+
+void FwmarkServer::serveClient(Worker* worker, Client* client) {
+    const clock::time_point start = clock::now();
+    worker->queueTime.add(elapsedUs(client->accepted, start));
+    worker->queued--;
+    mQueueDepth--;
+
+    int cmdId = -1;
     int socketFd = -1;
-    int error = processClient(client, &socketFd);
+    int error = processClient(client->fd.get(), client->uid, &cmdId, &socketFd);
     if (socketFd >= 0) {
         close(socketFd);
     }
 
     // Always send a response even if there were connection errors or read errors, so that we don't
     // inadvertently cause the client to hang (which always waits for a response).
-    client->sendData(&error, sizeof(error));
+    //
+    // Always close the client connection afterwards. This prevents a DoS attack where the client
+    // issues multiple commands on the same connection, never reading the responses, causing its
+    // receive buffer to fill up. For the same reason, never wait for room in that buffer.
+    send(client->fd.get(), &error, sizeof(error), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    const size_t index = (cmdId >= 0 && cmdId < static_cast<int>(kNumCommands) - 1)
+                                 ? cmdId
+                                 : kNumCommands - 1;
+    worker->serviceTime[index].add(elapsedUs(start, clock::now()));
+    worker->served++;
+
+    // Closing the fd doesn't remove the client from the epoll set if another process, e.g., a
+    // child forked since, still has the socket open. epoll_wait() would then return the freed
+    // client.
+    if (epoll_ctl(worker->epollFd.get(), EPOLL_CTL_DEL, client->fd.get(), nullptr) == -1) {
+        PLOG(ERROR) << "FwmarkServer failed to remove client";
+    }
+    {
+        std::lock_guard guard(worker->lock);
+        worker->clients.erase(client->self);
+    }
+}
+
+void FwmarkServer::Histogram::add(uint64_t us) {
+    size_t bucket = 0;
+    while (bucket < kNumBuckets - 1 && us >= (1ULL << bucket)) bucket++;
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    totalUs.fetch_add(us, std::memory_order_relaxed);
+    updateMax(&maxUs, us);
+}
+
+void FwmarkServer::dump(DumpWriter& dw) const {
+    dw.println("FwmarkServer: %zu workers, %" PRIu64 " accepted, %" PRIu64 " accept errors",
+               mWorkers.size(), mAccepted.load(), mAcceptErrors.load());
+    ScopedIndent indent(dw);
+    dw.println("Queue depth: %zu (max %zu)", mQueueDepth.load(), mMaxQueueDepth.load());
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        dw.println("Worker %zu: %" PRIu64 " served, %zu queued", i, mWorkers[i]->served.load(),
+                   mWorkers[i]->queued.load());
+    }
+
+    const auto printHistogram = [&](const char* name, const Histogram* const* histograms) {
+        uint64_t buckets[kNumBuckets] = {};
+        uint64_t count = 0, totalUs = 0, maxUs = 0;
+        for (size_t w = 0; w < mWorkers.size(); w++) {
+            for (size_t b = 0; b < kNumBuckets; b++) {
+                const uint64_t n = histograms[w]->buckets[b].load(std::memory_order_relaxed);
+                buckets[b] += n;
+                count += n;
+            }
+            totalUs += histograms[w]->totalUs.load(std::memory_order_relaxed);
+            maxUs = std::max(maxUs, histograms[w]->maxUs.load(std::memory_order_relaxed));
+        }
+        if (count == 0) return;
+
+        std::string line = StringPrintf("%s: count=%" PRIu64 " avg=%" PRIu64 "us max=%" PRIu64
+                                        "us",
+                                        name, count, totalUs / count, maxUs);
+        for (size_t b = 0; b < kNumBuckets; b++) {
+            if (buckets[b] == 0) continue;
+            if (b == kNumBuckets - 1) {
+                StringAppendF(&line, " >=%lluus:%" PRIu64, 1ULL << (b - 1), buckets[b]);
+            } else {
+                StringAppendF(&line, " <%lluus:%" PRIu64, 1ULL << b, buckets[b]);
+            }
+        }
+        dw.println(line);
+    };
+
+    std::vector<const Histogram*> histograms(mWorkers.size());
+    for (size_t w = 0; w < mWorkers.size(); w++) histograms[w] = &mWorkers[w]->queueTime;
+    printHistogram("Queue time", histograms.data());
+
+    dw.println("Service time:");
+    ScopedIndent indentCommands(dw);
+    for (size_t cmd = 0; cmd < kNumCommands; cmd++) {
+        for (size_t w = 0; w < mWorkers.size(); w++) {
+            histograms[w] = &mWorkers[w]->serviceTime[cmd];
+        }
+        printHistogram(commandName(cmd), histograms.data());
+    }
+}
 
-    // Always close the client connection (by returning false). This prevents a DoS attack where
-    // the client issues multiple commands on the same connection, never reading the responses,
-    // causing its receive buffer to fill up, and thus causing our client->sendData() to block.
-    return false;
+void FwmarkServer::dumpRunningServer(DumpWriter& dw) {
+    if (FwmarkServer* server = sRunningServer.load()) {
+        server->dump(dw);
+    }
 }
 
 static bool hasDestinationAddress(FwmarkCommand::CmdId cmdId) {
@@ -78,7 +426,7 @@ static bool hasDestinationAddress(FwmarkCommand::CmdId cmdId) {
     }
 }
 
-int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
+int FwmarkServer::processClient(int clientFd, uid_t uid, int* cmdId, int* socketFd) {
     struct {
         FwmarkCommand command;
         FwmarkConnectInfo connectInfo;
@@ -89,7 +437,7 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
 
     std::vector<unique_fd> received_fds;
     ssize_t messageLength =
-            ReceiveFileDescriptorVector(client->getSocket(), &buf, sizeof(buf), 1, &received_fds);
+            ReceiveFileDescriptorVector(clientFd, &buf, sizeof(buf), 1, &received_fds);
 
     if (messageLength < 0) {
         return -errno;
@@ -108,8 +456,9 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
     if (messageLength != static_cast<ssize_t>(expectedLen)) {
         return -EBADMSG;
     }
+    *cmdId = command.cmdId;
 
-    Permission permission = mNetworkController->getPermissionForUser(client->getUid());
+    Permission permission = mNetworkController->getPermissionForUser(uid);
 
     if (command.cmdId == FwmarkCommand::QUERY_USER_ACCESS) {
         if ((permission & PERMISSION_SYSTEM) != PERMISSION_SYSTEM) {
@@ -137,6 +486,15 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
         return -EAFNOSUPPORT;
     }
 
+    // Requests for the same socket, e.g., from two threads of an app, may be served by different
+    // workers at the same time. Serialize them from reading the mark to setting it, so that
+    // neither overwrites the changes of the other.
+    struct stat socketStat;
+    if (fstat(*socketFd, &socketStat) == -1) {
+        return -errno;
+    }
+    std::lock_guard markGuard(mMarkLocks[socketStat.st_ino % kNumMarkLocks]);
+
     Fwmark fwmark;
     socklen_t fwmarkLen = sizeof(fwmark.intValue);
     if (getsockopt(*socketFd, SOL_SOCKET, SO_MARK, &fwmark.intValue, &fwmarkLen) == -1) {
@@ -191,7 +549,7 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
                     fwmark.netId = mNetworkController->getNetworkForInterface(
                             connectInfo.addr.sin6.sin6_scope_id);
                 } else if (!fwmark.protectedFromVpn) {
-                    fwmark.netId = mNetworkController->getNetworkForConnect(client->getUid());
+                    fwmark.netId = mNetworkController->getNetworkForConnect(uid);
                 } else if (!mNetworkController->isVirtualNetwork(fwmark.netId)) {
                     fwmark.netId = mNetworkController->getDefaultNetwork();
                 }
@@ -227,7 +585,7 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
                 netdEventListener->onConnectEvent(fwmark.netId, connectInfo.error,
                         connectInfo.latencyMs,
                         (ret == 0) ? String16(addrstr) : String16(""),
-                        (ret == 0) ? strtoul(portstr, nullptr, 10) : 0, client->getUid());
+                        (ret == 0) ? strtoul(portstr, nullptr, 10) : 0, uid);
             }
             break;
         }
@@ -245,19 +603,19 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
                 fwmark.protectedFromVpn = false;
                 permission = PERMISSION_NONE;
             } else {
-                if (int ret = mNetworkController->checkUserNetworkAccess(client->getUid(),
+                if (int ret = mNetworkController->checkUserNetworkAccess(uid,
                                                                          command.netId)) {
                     return ret;
                 }
                 fwmark.explicitlySelected = true;
-                fwmark.protectedFromVpn = mNetworkController->canProtect(client->getUid());
+                fwmark.protectedFromVpn = mNetworkController->canProtect(uid);
             }
             break;
         }
 
         case FwmarkCommand::PROTECT_FROM_VPN: {
-            if (!mNetworkController->canProtect(client->getUid())) {
-                LOG(ERROR) << "uid " << client->getUid() << " protect from VPN failed.";
+            if (!mNetworkController->canProtect(uid)) {
+                LOG(ERROR) << "uid " << uid << " protect from VPN failed.";
                 return -EPERM;
             }
             // If a bypassable VPN's provider app calls connect() and then protect(), it will end up
@@ -290,9 +648,9 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
             //  - xt_qtaguid will see -1 on the command line, fail to parse it as a uint32_t,
             //    and fall back to current_fsuid().
             uid_t tagUid = command.uid;
-            if (static_cast<int>(tagUid) == -1) tagUid = client->getUid();
+            if (static_cast<int>(tagUid) == -1) tagUid = uid;
             return libnetd_updatable_tagSocket(*socketFd, command.trafficCtrlInfo, tagUid,
-                                               client->getUid());
+                                               uid);
         }
 
         case FwmarkCommand::UNTAG_SOCKET: {
@@ -17,29 +17,131 @@
 #ifndef NETD_SERVER_FWMARK_SERVER_H
 #define NETD_SERVER_FWMARK_SERVER_H
 
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <android-base/thread_annotations.h>
+#include <android-base/unique_fd.h>
+#include <netdutils/DumpWriter.h>
+
 #include "EventReporter.h"
-#include "sysutils/SocketListener.h"
+#include "FwmarkCommand.h"
 
 namespace android {
 namespace net {
 
 class NetworkController;
 
-class FwmarkServer : public SocketListener {
-public:
-  explicit FwmarkServer(NetworkController* networkController, EventReporter* eventReporter);
+// Serves the fwmarkd socket that libnetd_client uses to mark the sockets of app processes.
+//
+// One thread accepts connections and hands each client to the least busy of several worker
+// threads, each of which waits for its clients with epoll. A connection carries exactly one
+// request, so a client is closed as soon as its response is sent. Workers serve the clients that
+// are ready at the same time in round-robin order of their UIDs, so that an app that opens many
+// sockets at once cannot delay the requests of other apps by more than one round.
+class FwmarkServer {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    // If |numWorkers| is 0, one worker is started per CPU, up to kMaxDefaultWorkers.
+    FwmarkServer(NetworkController* networkController, EventReporter* eventReporter,
+                 unsigned numWorkers = 0);
+    ~FwmarkServer();
+
+    FwmarkServer(const FwmarkServer&) = delete;
+    FwmarkServer& operator=(const FwmarkServer&) = delete;
+
+    static constexpr const char* SOCKET_NAME = "fwmarkd";
+    static constexpr unsigned kMaxDefaultWorkers = 4;
+
+    // Starts serving the fwmarkd socket created by init. Returns 0 or negative errno.
+    [[nodiscard]] int start();
+    // Starts serving the listening socket |sock|. Returns 0 or negative errno.
+    [[nodiscard]] int start(android::base::unique_fd sock);
+    // Stops all threads. Clients that have not been served yet are disconnected.
+    void stop();
+
+    void dump(netdutils::DumpWriter& dw) const;
+    // Dumps the server that is currently running, if any.
+    static void dumpRunningServer(netdutils::DumpWriter& dw);
+
+  private:
+    struct Client {
+        android::base::unique_fd fd;
+        uid_t uid;
+        clock::time_point accepted;
+        std::list<Client>::iterator self;
+    };
 
-  static constexpr const char* SOCKET_NAME = "fwmarkd";
+    // Service time buckets, in powers of two microseconds. The last bucket is unbounded.
+    static constexpr size_t kNumBuckets = 16;
+    // One histogram per command, plus one for requests that could not be parsed.
+    static constexpr size_t kNumCommands = FwmarkCommand::ON_SENDTO + 2;
+    // Locks that serialize the changes to the mark of a socket, chosen by its inode number.
+    static constexpr size_t kNumMarkLocks = 64;
 
-private:
-    // Overridden from SocketListener:
-    bool onDataAvailable(SocketClient* client);
+    struct Histogram {
+        std::atomic<uint64_t> buckets[kNumBuckets] = {};
+        std::atomic<uint64_t> totalUs = 0;
+        std::atomic<uint64_t> maxUs = 0;
 
-    // Returns 0 on success or a negative errno value on failure.
-    int processClient(SocketClient* client, int* socketFd);
+        void add(uint64_t us);
+    };
+
+    struct Worker {
+        android::base::unique_fd epollFd;
+        std::thread thread;
+        std::mutex lock;
+        // Accepted clients that have not been closed yet.
+        std::list<Client> clients GUARDED_BY(lock);
+        // Clients that are waiting for service.
+        std::atomic<size_t> queued = 0;
+        std::atomic<uint64_t> served = 0;
+        // Time from accept() to the start of service.
+        Histogram queueTime;
+        Histogram serviceTime[kNumCommands];
+    };
+
+    void acceptClients();
+    void addClient(android::base::unique_fd fd, uid_t uid);
+    void runWorker(Worker* worker);
+    void serveClient(Worker* worker, Client* client);
+
+    // Reorders |clients|, which are in the order they became ready, so that consecutive clients
+    // belong to different UIDs where possible. The clients of each UID keep their order.
+    static void interleaveByUid(std::vector<Client*>* clients);
+
+    // Returns 0 on success or a negative errno value on failure. Sets |cmdId| to the command of
+    // the request if it could be parsed, or -1 if not.
+    int processClient(int clientFd, uid_t uid, int* cmdId, int* socketFd);
 
     NetworkController* const mNetworkController;
     EventReporter* mEventReporter;
+    const unsigned mNumWorkers;
+
+    android::base::unique_fd mListenSock;
+    // Becomes readable, and stays readable, when the server is stopped.
+    android::base::unique_fd mStopEvent;
+    std::thread mAcceptThread;
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::mutex mMarkLocks[kNumMarkLocks];
+
+    std::atomic<uint64_t> mAccepted = 0;
+    std::atomic<uint64_t> mAcceptErrors = 0;
+    // Clients that are waiting for service, over all workers.
+    std::atomic<size_t> mQueueDepth = 0;
+    std::atomic<size_t> mMaxQueueDepth = 0;
+
+    static std::atomic<FwmarkServer*> sRunningServer;
+
+    friend class FwmarkServerTest;
 };
 
 }  // namespace net
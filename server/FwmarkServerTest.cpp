@@ -0,0 +1,183 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * FwmarkServerTest.cpp - unit tests for FwmarkServer.cpp
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+
+#include "FwmarkServer.h"
+
+using android::base::unique_fd;
+
+namespace android {
+namespace net {
+
+class FwmarkServerTest : public ::testing::Test {
+  protected:
+    // Starts a server with one worker on a socket in a temporary directory. The requests that the
+    // tests send are all malformed, so the server never uses its NetworkController.
+    void SetUp() override {
+        mAddr.sun_family = AF_UNIX;
+        const std::string path = std::string(mDir.path) + "/fwmarkd";
+        ASSERT_LT(path.size(), sizeof(mAddr.sun_path));
+        strlcpy(mAddr.sun_path, path.c_str(), sizeof(mAddr.sun_path));
+
+        unique_fd sock(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        ASSERT_NE(-1, sock.get()) << strerror(errno);
+        ASSERT_EQ(0, bind(sock.get(), reinterpret_cast<sockaddr*>(&mAddr), sizeof(mAddr)))
+                << strerror(errno);
+        ASSERT_EQ(0, mServer.start(std::move(sock)));
+    }
+
+    void TearDown() override { mServer.stop(); }
+
+    unique_fd connectClient() {
+        unique_fd fd(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        EXPECT_NE(-1, fd.get()) << strerror(errno);
+        EXPECT_EQ(0, connect(fd.get(), reinterpret_cast<sockaddr*>(&mAddr), sizeof(mAddr)))
+                << strerror(errno);
+        return fd;
+    }
+
+    // Sends a request that is too short to be a command, and returns the server's response.
+    static int sendShortRequest(int fd) {
+        const char request = 0;
+        EXPECT_EQ(1, send(fd, &request, sizeof(request), MSG_NOSIGNAL));
+        pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+        EXPECT_EQ(1, poll(&pfd, 1, 1000 /* ms */));
+        int response = 0;
+        EXPECT_EQ(static_cast<ssize_t>(sizeof(response)),
+                  recv(fd, &response, sizeof(response), MSG_DONTWAIT));
+        return response;
+    }
+
+    // Returns the number of clients that the worker has accepted and not closed yet.
+    size_t openClients() {
+        FwmarkServer::Worker* worker = mServer.mWorkers[0].get();
+        std::lock_guard guard(worker->lock);
+        return worker->clients.size();
+    }
+
+    bool waitForOpenClients(size_t count) {
+        for (int i = 0; i < 100; i++) {
+            if (openClients() == count) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    // Returns a new fd for the server's end of the only open client, like a child forked at that
+    // time would have.
+    unique_fd dupOpenClient() {
+        FwmarkServer::Worker* worker = mServer.mWorkers[0].get();
+        std::lock_guard guard(worker->lock);
+        EXPECT_EQ(1U, worker->clients.size());
+        return unique_fd(fcntl(worker->clients.front().fd.get(), F_DUPFD_CLOEXEC, 0));
+    }
+
+    uint64_t served() { return mServer.mWorkers[0]->served; }
+
+    // Interleaves clients of the given UIDs, and returns the positions the clients had before.
+    static std::vector<size_t> interleaveByUid(const std::vector<uid_t>& uids) {
+        std::list<FwmarkServer::Client> clients;
+        std::vector<FwmarkServer::Client*> ready;
+        for (uid_t uid : uids) {
+            clients.push_back({unique_fd(), uid, FwmarkServer::clock::now(), {}});
+            ready.push_back(&clients.back());
+        }
+        const std::vector<FwmarkServer::Client*> original = ready;
+        FwmarkServer::interleaveByUid(&ready);
+
+        std::vector<size_t> positions;
+        for (FwmarkServer::Client* client : ready) {
+            positions.push_back(std::find(original.begin(), original.end(), client) -
+                                original.begin());
+        }
+        return positions;
+    }
+
+    TemporaryDir mDir;
+    sockaddr_un mAddr = {};
+    FwmarkServer mServer{nullptr /* networkController */, nullptr /* eventReporter */,
+                         1 /* numWorkers */};
+};
+
+TEST_F(FwmarkServerTest, InterleaveByUid) {
+    EXPECT_EQ(std::vector<size_t>{}, interleaveByUid({}));
+    EXPECT_EQ(std::vector<size_t>({0}), interleaveByUid({1000}));
+    // Clients of a single UID keep their order.
+    EXPECT_EQ(std::vector<size_t>({0, 1, 2}), interleaveByUid({1000, 1000, 1000}));
+    // One client of each UID per round, with the UIDs in the order of their first client.
+    EXPECT_EQ(std::vector<size_t>({0, 3, 5, 1, 4, 2}),
+              interleaveByUid({1000, 1000, 1000, 2000, 2000, 3000}));
+    EXPECT_EQ(std::vector<size_t>({0, 1, 3, 2, 4}),
+              interleaveByUid({2000, 1000, 1000, 2000, 1000}));
+}
+
+TEST_F(FwmarkServerTest, ClientDisconnectsEarly) {
+    // A client that goes away without sending its request is closed...
+    unique_fd early = connectClient();
+    ASSERT_TRUE(waitForOpenClients(1));
+    early.reset();
+    ASSERT_TRUE(waitForOpenClients(0));
+    EXPECT_EQ(1U, served());
+
+    // ... and doesn't stop the worker from serving other clients.
+    unique_fd client = connectClient();
+    EXPECT_EQ(-EBADMSG, sendShortRequest(client.get()));
+    ASSERT_TRUE(waitForOpenClients(0));
+    EXPECT_EQ(2U, served());
+}
+
+TEST_F(FwmarkServerTest, ClosedClientLeavesEpollSet) {
+    unique_fd client = connectClient();
+    ASSERT_TRUE(waitForOpenClients(1));
+    // Keeps the server's end of the connection open after the server closes its fd.
+    unique_fd child = dupOpenClient();
+    ASSERT_NE(-1, child.get());
+
+    EXPECT_EQ(-EBADMSG, sendShortRequest(client.get()));
+    ASSERT_TRUE(waitForOpenClients(0));
+
+    // This makes the connection readable again. If it were still in the epoll set, the worker
+    // would be woken up for the client it already freed.
+    client.reset();
+    unique_fd other = connectClient();
+    EXPECT_EQ(-EBADMSG, sendShortRequest(other.get()));
+    ASSERT_TRUE(waitForOpenClients(0));
+    EXPECT_EQ(2U, served());
+}
+
+}  // namespace net
+}  // namespace android
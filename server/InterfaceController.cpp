@@ -21,14 +21,24 @@
 #include <net/if_arp.h>
 #include <sys/socket.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <set>
 
 #define LOG_TAG "InterfaceController"
 #include <android-base/file.h>
 #include <android-base/properties.h>
+#include <android-base/scopeguard.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/thread_annotations.h>
+#include <linux/if_addr.h>
 #include <linux/if_ether.h>
+#include <linux/rtnetlink.h>
 #include <log/log.h>
 #include <netutils/ifc.h>
 
@@ -38,12 +48,15 @@
 #include <netdutils/Syscalls.h>
 
 #include "InterfaceController.h"
+#include "NetlinkCommands.h"
 #include "RouteController.h"
 
+using android::base::make_scope_guard;
 using android::base::ReadFileToString;
 using android::base::StringPrintf;
 using android::base::Trim;
 using android::base::WriteStringToFile;
+using android::netdutils::Fd;
 using android::netdutils::isOk;
 using android::netdutils::makeSlice;
 using android::netdutils::sSyscalls;
@@ -51,7 +64,10 @@ using android::netdutils::Status;
 using android::netdutils::statusFromErrno;
 using android::netdutils::StatusOr;
 using android::netdutils::toString;
+using android::netdutils::UniqueFd;
 using android::netdutils::status::ok;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 
 namespace {
 
@@ -361,12 +377,14 @@ int InterfaceController::setMtu(const char *interface, const char *mtu)
 // Returns zero on success and negative errno on failure.
 int InterfaceController::addAddress(const char *interface,
         const char *addrString, int prefixLength) {
+    const auto update = make_scope_guard([interface] { updateConfigCache(interface, 0); });
     return ifc_add_address(interface, addrString, prefixLength);
 }
 
 // Returns zero on success and negative errno on failure.
 int InterfaceController::delAddress(const char *interface,
         const char *addrString, int prefixLength) {
+    const auto update = make_scope_guard([interface] { updateConfigCache(interface, 0); });
     return ifc_del_address(interface, addrString, prefixLength);
 }
 
@@ -416,7 +434,17 @@ void InterfaceController::setIPv6OptimisticMode(const char *value) {
 
 namespace {
 
-std::string hwAddrToStr(unsigned char* hwaddr) {
+// The parts of an interface's state that are reported by getCfg().
+struct InterfaceState {
+    unsigned ifIndex = 0;
+    unsigned flags = 0;
+    unsigned char hwaddr[ETH_ALEN] = {};
+    in_addr addr = {};
+    int prefixLength = 0;
+    bool hasAddr = false;
+};
+
+std::string hwAddrToStr(const unsigned char* hwaddr) {
     return StringPrintf("%02x:%02x:%02x:%02x:%02x:%02x", hwaddr[0], hwaddr[1], hwaddr[2], hwaddr[3],
                         hwaddr[4], hwaddr[5]);
 }
@@ -435,9 +463,216 @@ std::string toStdString(const String16& s) {
     return std::string(String8(s.c_str()));
 }
 
+InterfaceConfigurationParcel makeCfg(const std::string& ifName, const InterfaceState& state) {
+    InterfaceConfigurationParcel cfgResult;
+    const unsigned flags = state.flags;
+
+    cfgResult.ifName = ifName;
+    cfgResult.hwAddr = hwAddrToStr(state.hwaddr);
+    cfgResult.ipv4Addr = std::string(inet_ntoa(state.addr));
+    cfgResult.prefixLength = state.prefixLength;
+    cfgResult.flags.push_back(flags & IFF_UP ? toStdString(INetd::IF_STATE_UP())
+                                             : toStdString(INetd::IF_STATE_DOWN()));
+
+    if (flags & IFF_BROADCAST) cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_BROADCAST()));
+    if (flags & IFF_LOOPBACK) cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_LOOPBACK()));
+    if (flags & IFF_POINTOPOINT)
+        cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_POINTOPOINT()));
+    if (flags & IFF_RUNNING) cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_RUNNING()));
+    if (flags & IFF_MULTICAST) cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_MULTICAST()));
+
+    return cfgResult;
+}
+
+// Fills |interfaces| with the state of every interface, keyed by interface name, using one
+// RTM_GETLINK and one RTM_GETADDR dump. Returns 0 on success or negative errno on failure.
+int dumpInterfaceStates(std::map<std::string, InterfaceState>* interfaces) {
+    std::map<int, std::string> names;
+
+    NetlinkDumpCallback linkCallback = [&](nlmsghdr* nlh) {
+        if (nlh->nlmsg_type != RTM_NEWLINK) return;
+        ifinfomsg* ifi = reinterpret_cast<ifinfomsg*>(NLMSG_DATA(nlh));
+        InterfaceState state = {.ifIndex = static_cast<unsigned>(ifi->ifi_index),
+                                .flags = ifi->ifi_flags};
+        const char* name = nullptr;
+        int len = IFLA_PAYLOAD(nlh);
+        for (rtattr* rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == IFLA_IFNAME) {
+                name = reinterpret_cast<const char*>(RTA_DATA(rta));
+            } else if (rta->rta_type == IFLA_ADDRESS) {
+                // Same as SIOCGIFHWADDR: the first ETH_ALEN bytes, zero-padded.
+                memcpy(state.hwaddr, RTA_DATA(rta),
+                       std::min<size_t>(RTA_PAYLOAD(rta), sizeof(state.hwaddr)));
+            }
+        }
+        if (name == nullptr) return;
+        names[ifi->ifi_index] = name;
+        (*interfaces)[name] = state;
+    };
+
+    NetlinkDumpCallback addrCallback = [&](nlmsghdr* nlh) {
+        if (nlh->nlmsg_type != RTM_NEWADDR) return;
+        ifaddrmsg* ifa = reinterpret_cast<ifaddrmsg*>(NLMSG_DATA(nlh));
+        const auto name = names.find(ifa->ifa_index);
+        if (ifa->ifa_family != AF_INET || name == names.end()) return;
+        const char* label = nullptr;
+        const in_addr* local = nullptr;
+        int len = IFA_PAYLOAD(nlh);
+        for (rtattr* rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == IFA_LABEL) {
+                label = reinterpret_cast<const char*>(RTA_DATA(rta));
+            } else if (rta->rta_type == IFA_LOCAL && RTA_PAYLOAD(rta) == sizeof(*local)) {
+                local = reinterpret_cast<const in_addr*>(RTA_DATA(rta));
+            }
+        }
+        // Same as SIOCGIFADDR: the first address whose label is the interface name. Addresses
+        // labelled with an alias such as "wlan0:1" are not reported.
+        if (local == nullptr || (label != nullptr && name->second != label)) return;
+        InterfaceState& state = (*interfaces)[name->second];
+        if (state.hasAddr) return;
+        state.addr = *local;
+        state.prefixLength = ifa->ifa_prefixlen;
+        state.hasAddr = true;
+    };
+
+    ifinfomsg ifi = {.ifi_family = AF_UNSPEC};
+    iovec linkIov[] = {
+        { nullptr, 0 },
+        { &ifi, sizeof(ifi) },
+    };
+    if (int ret = sendNetlinkRequest(RTM_GETLINK, NETLINK_DUMP_FLAGS, linkIov,
+                                     std::size(linkIov), &linkCallback)) {
+        return ret;
+    }
+
+    ifaddrmsg ifa = {.ifa_family = AF_INET};
+    iovec addrIov[] = {
+        { nullptr, 0 },
+        { &ifa, sizeof(ifa) },
+    };
+    return sendNetlinkRequest(RTM_GETADDR, NETLINK_DUMP_FLAGS, addrIov, std::size(addrIov),
+                              &addrCallback);
+}
+
+// Fills |state| with the ioctls on |fd| that getCfg() used before there was a table. Returns false
+// if there is no interface called |ifName|.
+bool readInterfaceState(Fd fd, const std::string& ifName, InterfaceState* state) {
+    const auto& sys = sSyscalls.get();
+    struct ifreq ifr = {};
+    strlcpy(ifr.ifr_name, ifName.c_str(), IFNAMSIZ);
+
+    if (isOk(sys.ioctl(fd, SIOCGIFADDR, &ifr))) {
+        state->addr.s_addr = ((struct sockaddr_in*) &ifr.ifr_addr)->sin_addr.s_addr;
+        state->hasAddr = true;
+    }
+
+    if (isOk(sys.ioctl(fd, SIOCGIFNETMASK, &ifr))) {
+        state->prefixLength =
+                ipv4NetmaskToPrefixLength(((struct sockaddr_in*) &ifr.ifr_addr)->sin_addr.s_addr);
+    }
+
+    const bool exists = isOk(sys.ioctl(fd, SIOCGIFFLAGS, &ifr));
+    if (exists) {
+        state->flags = ifr.ifr_flags;
+    }
+
+    // ETH_ALEN is for ARPHRD_ETHER, it is better to check the sa_family.
+    // However, we keep old design for the consistency.
+    if (isOk(sys.ioctl(fd, SIOCGIFHWADDR, &ifr))) {
+        memcpy((void*) state->hwaddr, &ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    } else if (exists) {
+        ALOGW("Failed to retrieve HW addr for %s (%s)", ifName.c_str(), strerror(errno));
+    }
+
+    if (exists && isOk(sys.ioctl(fd, SIOCGIFINDEX, &ifr))) {
+        state->ifIndex = ifr.ifr_ifindex;
+    }
+    return exists;
+}
+
+std::atomic<bool> sConfigCacheEnabled = false;
+// Incremented every time the state of interfaces that are not known by name or index might have
+// changed.
+std::atomic<uint64_t> sConfigGeneration = 1;
+
+// The interfaces whose state has changed since the last lookup, by name or by index. Has its own
+// lock so that the netlink thread never waits for a dump.
+std::mutex sChangedInterfacesLock;
+std::set<std::string> sChangedNames GUARDED_BY(sChangedInterfacesLock);
+std::set<unsigned> sChangedIndexes GUARDED_BY(sChangedInterfacesLock);
+
+std::mutex sConfigCacheLock;
+// The value of sConfigGeneration when sConfigCache was dumped, and when that was.
+uint64_t sConfigCacheGeneration GUARDED_BY(sConfigCacheLock) = 0;
+steady_clock::time_point sConfigCacheDumpTime GUARDED_BY(sConfigCacheLock);
+// Events can be lost without the listener noticing, e.g., ones that NetlinkEvent does not decode,
+// so the table is never trusted for longer than this.
+milliseconds sConfigCacheMaxAge GUARDED_BY(sConfigCacheLock) = std::chrono::minutes(1);
+std::map<std::string, InterfaceState> sConfigCache GUARDED_BY(sConfigCacheLock);
+uint64_t sConfigCacheDumps GUARDED_BY(sConfigCacheLock) = 0;
+uint64_t sConfigCacheRereads GUARDED_BY(sConfigCacheLock) = 0;
+
+// Brings sConfigCache up to date: dumps every interface if the generation has moved on or the
+// table is too old, and otherwise reads again only the interfaces that changed. Returns 0 on
+// success.
+int refreshConfigCacheLocked() REQUIRES(sConfigCacheLock) {
+    // Changes reported while we're reading are left for the next lookup.
+    std::set<std::string> names;
+    std::set<unsigned> indexes;
+    {
+        std::lock_guard guard(sChangedInterfacesLock);
+        names.swap(sChangedNames);
+        indexes.swap(sChangedIndexes);
+    }
+
+    const uint64_t generation = sConfigGeneration;
+    const steady_clock::time_point now = steady_clock::now();
+    if (sConfigCacheGeneration != generation || now - sConfigCacheDumpTime >= sConfigCacheMaxAge) {
+        std::map<std::string, InterfaceState> interfaces;
+        if (int ret = dumpInterfaceStates(&interfaces)) {
+            ALOGE("Error dumping interfaces: %s", strerror(-ret));
+            return ret;
+        }
+        sConfigCache = std::move(interfaces);
+        sConfigCacheGeneration = generation;
+        sConfigCacheDumpTime = now;
+        sConfigCacheDumps++;
+        return 0;
+    }
+
+    // An interface that was renamed or deleted is still in the table under its old name, which
+    // the event might not mention.
+    if (!indexes.empty()) {
+        for (const auto& [ifName, state] : sConfigCache) {
+            if (indexes.count(state.ifIndex)) names.insert(ifName);
+        }
+    }
+    if (names.empty()) return 0;
+
+    const auto& sys = sSyscalls.get();
+    const StatusOr<UniqueFd> fd = sys.socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (!isOk(fd)) {
+        ALOGE("Error reading interfaces: %s", toString(fd.status()).c_str());
+        // Dump them all on the next lookup instead.
+        sConfigGeneration++;
+        return -EBADF;
+    }
+    for (const std::string& ifName : names) {
+        InterfaceState state;
+        if (readInterfaceState(fd.value(), ifName, &state)) {
+            sConfigCache[ifName] = state;
+        } else {
+            sConfigCache.erase(ifName);
+        }
+    }
+    sConfigCacheRereads += names.size();
+    return 0;
+}
+
 }  // namespace
 
 Status InterfaceController::setCfg(const InterfaceConfigurationParcel& cfg) {
+    const auto update = make_scope_guard([&cfg] { updateConfigCache(cfg.ifName, 0); });
     const auto& sys = sSyscalls.get();
     ASSIGN_OR_RETURN(auto fd, sys.socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0));
     struct ifreq ifr = {
@@ -474,57 +709,101 @@ Status InterfaceController::setCfg(const InterfaceConfigurationParcel& cfg) {
 }
 
 StatusOr<InterfaceConfigurationParcel> InterfaceController::getCfg(const std::string& ifName) {
-    struct in_addr addr = {};
-    int prefixLength = 0;
-    unsigned char hwaddr[ETH_ALEN] = {};
-    unsigned flags = 0;
-    InterfaceConfigurationParcel cfgResult;
-
-    const auto& sys = sSyscalls.get();
-    ASSIGN_OR_RETURN(auto fd, sys.socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0));
-
-    struct ifreq ifr = {};
-    strlcpy(ifr.ifr_name, ifName.c_str(), IFNAMSIZ);
-
-    if (isOk(sys.ioctl(fd, SIOCGIFADDR, &ifr))) {
-        addr.s_addr = ((struct sockaddr_in*) &ifr.ifr_addr)->sin_addr.s_addr;
+    if (sConfigCacheEnabled) {
+        std::lock_guard guard(sConfigCacheLock);
+        if (refreshConfigCacheLocked() == 0) {
+            if (const auto it = sConfigCache.find(ifName); it != sConfigCache.end()) {
+                return makeCfg(ifName, it->second);
+            }
+        }
+    }
+    // Not an interface name the kernel knows about (e.g., an alias), or the dump failed.
+    return getCfgFromKernel(ifName);
+}
+
+StatusOr<std::vector<InterfaceConfigurationParcel>> InterfaceController::getAllCfgs() {
+    std::vector<InterfaceConfigurationParcel> cfgs;
+    if (sConfigCacheEnabled) {
+        std::lock_guard guard(sConfigCacheLock);
+        if (refreshConfigCacheLocked() == 0) {
+            cfgs.reserve(sConfigCache.size());
+            for (const auto& [ifName, state] : sConfigCache) {
+                cfgs.push_back(makeCfg(ifName, state));
+            }
+            return cfgs;
+        }
     }
 
-    if (isOk(sys.ioctl(fd, SIOCGIFNETMASK, &ifr))) {
-        prefixLength =
-                ipv4NetmaskToPrefixLength(((struct sockaddr_in*) &ifr.ifr_addr)->sin_addr.s_addr);
+    ASSIGN_OR_RETURN(auto ifNames, netdutils::getIfaceNames());
+    for (const auto& ifName : ifNames) {
+        ASSIGN_OR_RETURN(auto cfg, getCfgFromKernel(ifName));
+        cfgs.push_back(std::move(cfg));
     }
+    return cfgs;
+}
 
-    if (isOk(sys.ioctl(fd, SIOCGIFFLAGS, &ifr))) {
-        flags = ifr.ifr_flags;
+StatusOr<std::vector<std::string>> InterfaceController::getInterfaceNames() {
+    if (sConfigCacheEnabled) {
+        std::lock_guard guard(sConfigCacheLock);
+        if (refreshConfigCacheLocked() == 0) {
+            std::vector<std::string> ifNames;
+            ifNames.reserve(sConfigCache.size());
+            for (const auto& [ifName, state] : sConfigCache) {
+                ifNames.push_back(ifName);
+            }
+            return ifNames;
+        }
     }
+    return netdutils::getIfaceNames();
+}
 
-    // ETH_ALEN is for ARPHRD_ETHER, it is better to check the sa_family.
-    // However, we keep old design for the consistency.
-    if (isOk(sys.ioctl(fd, SIOCGIFHWADDR, &ifr))) {
-        memcpy((void*) hwaddr, &ifr.ifr_hwaddr.sa_data, ETH_ALEN);
-    } else {
-        ALOGW("Failed to retrieve HW addr for %s (%s)", ifName.c_str(), strerror(errno));
+void InterfaceController::enableConfigCache() {
+    sConfigCacheEnabled = true;
+}
+
+void InterfaceController::updateConfigCache(const std::string& ifName, unsigned ifIndex) {
+    if (ifName.empty() && ifIndex == 0) {
+        invalidateConfigCache();
+        return;
     }
+    std::lock_guard guard(sChangedInterfacesLock);
+    if (!ifName.empty()) sChangedNames.insert(ifName);
+    if (ifIndex != 0) sChangedIndexes.insert(ifIndex);
+}
 
-    cfgResult.ifName = ifName;
-    cfgResult.hwAddr = hwAddrToStr(hwaddr);
-    cfgResult.ipv4Addr = std::string(inet_ntoa(addr));
-    cfgResult.prefixLength = prefixLength;
-    cfgResult.flags.push_back(flags & IFF_UP ? toStdString(INetd::IF_STATE_UP())
-                                             : toStdString(INetd::IF_STATE_DOWN()));
+void InterfaceController::invalidateConfigCache() {
+    sConfigGeneration++;
+}
 
-    if (flags & IFF_BROADCAST) cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_BROADCAST()));
-    if (flags & IFF_LOOPBACK) cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_LOOPBACK()));
-    if (flags & IFF_POINTOPOINT)
-        cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_POINTOPOINT()));
-    if (flags & IFF_RUNNING) cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_RUNNING()));
-    if (flags & IFF_MULTICAST) cfgResult.flags.push_back(toStdString(INetd::IF_FLAG_MULTICAST()));
+uint64_t InterfaceController::configCacheDumps() {
+    std::lock_guard guard(sConfigCacheLock);
+    return sConfigCacheDumps;
+}
 
-    return cfgResult;
+uint64_t InterfaceController::configCacheRereads() {
+    std::lock_guard guard(sConfigCacheLock);
+    return sConfigCacheRereads;
+}
+
+void InterfaceController::setConfigCacheMaxAge(milliseconds maxAge) {
+    std::lock_guard guard(sConfigCacheLock);
+    sConfigCacheMaxAge = maxAge;
+}
+
+StatusOr<InterfaceConfigurationParcel> InterfaceController::getCfgFromKernel(
+        const std::string& ifName) {
+    InterfaceState state;
+
+    const auto& sys = sSyscalls.get();
+    ASSIGN_OR_RETURN(auto fd, sys.socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    // As before, an interface that does not exist is reported with no flags.
+    readInterfaceState(fd, ifName, &state);
+
+    return makeCfg(ifName, state);
 }
 
 int InterfaceController::clearAddrs(const std::string& ifName) {
+    const auto update = make_scope_guard([&ifName] { updateConfigCache(ifName, 0); });
     return ifc_clear_addresses(ifName.c_str());
 }
 
@@ -17,9 +17,11 @@
 #ifndef _INTERFACE_CONTROLLER_H
 #define _INTERFACE_CONTROLLER_H
 
+#include <chrono>
 #include <functional>
 #include <map>
 #include <string>
+#include <vector>
 
 #include <android/net/InterfaceConfigurationParcel.h>
 #include <netdutils/Status.h>
@@ -29,6 +31,7 @@ namespace android {
 namespace net {
 
 class StablePrivacyTest;
+class InterfaceConfigCacheTest;
 
 class InterfaceController {
 public:
@@ -47,8 +50,26 @@ public:
     static android::netdutils::Status setCfg(const InterfaceConfigurationParcel& cfg);
     static android::netdutils::StatusOr<InterfaceConfigurationParcel> getCfg(
             const std::string& ifName);
+    // Returns the configuration of every interface.
+    static android::netdutils::StatusOr<std::vector<InterfaceConfigurationParcel>> getAllCfgs();
+    // Returns the names of all interfaces.
+    static android::netdutils::StatusOr<std::vector<std::string>> getInterfaceNames();
     static int clearAddrs(const std::string& ifName);
 
+    // Once enableConfigCache() has been called, getCfg(), getAllCfgs() and getInterfaceNames() are
+    // served from an in-memory table filled by one RTM_GETLINK and one RTM_GETADDR dump, instead of
+    // issuing several ioctls per interface. updateConfigCache() must be called whenever the kernel
+    // reports a link or address change, and the next lookup then reads again only the interfaces
+    // that changed. After invalidateConfigCache(), e.g., when the netlink listener has lost
+    // events, and at least once a minute, the next lookup dumps every interface again. Changes
+    // made through this class update the table themselves.
+    static void enableConfigCache();
+    // Notes that the interface called |ifName|, or whose index is |ifIndex|, has changed. Either
+    // may be empty or 0 if unknown, e.g., the name of an interface that was deleted. If both are,
+    // the whole table is dumped again.
+    static void updateConfigCache(const std::string& ifName, unsigned ifIndex);
+    static void invalidateConfigCache();
+
     // Read and write values in files of the form:
     //     /proc/sys/net/<family>/<which>/<ifName>/<parameter>
     //
@@ -63,6 +84,7 @@ public:
 
   private:
     friend class android::net::StablePrivacyTest;
+    friend class android::net::InterfaceConfigCacheTest;
 
     using GetPropertyFn =
             std::function<std::string(const std::string& key, const std::string& dflt)>;
@@ -79,6 +101,16 @@ public:
     static void setBaseReachableTimeMs(unsigned int millis);
     static void setIPv6OptimisticMode(const char* value);
 
+    // For testing: the number of times the table was dumped, and of interfaces read again, and
+    // how long a dump is used for.
+    static uint64_t configCacheDumps();
+    static uint64_t configCacheRereads();
+    static void setConfigCacheMaxAge(std::chrono::milliseconds maxAge);
+
+    // Implementation of getCfg() that doesn't use the cache.
+    static android::netdutils::StatusOr<InterfaceConfigurationParcel> getCfgFromKernel(
+            const std::string& ifName);
+
     InterfaceController() = delete;
     ~InterfaceController() = delete;
 };
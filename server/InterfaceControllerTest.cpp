@@ -18,6 +18,8 @@
 #include <net/if.h>
 #include <sys/types.h>
 
+#include <chrono>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
@@ -26,6 +28,7 @@
 #include <netdutils/Utils.h>
 
 #include "InterfaceController.h"
+#include "tun_interface.h"
 
 using testing::ByMove;
 using testing::Invoke;
@@ -211,5 +214,111 @@ TEST_F(GetIfaceListTest, IfaceExist) {
     freeifaddrs(ifaddr);
 }
 
+class InterfaceConfigCacheTest : public NetNativeTestBase {
+  protected:
+    InterfaceConfigCacheTest() {
+        InterfaceController::enableConfigCache();
+        InterfaceController::invalidateConfigCache();
+    }
+
+    ~InterfaceConfigCacheTest() { InterfaceController::setConfigCacheMaxAge(kDefaultMaxAge); }
+
+    static constexpr std::chrono::milliseconds kDefaultMaxAge = std::chrono::minutes(1);
+
+    StatusOr<InterfaceConfigurationParcel> getCfgFromKernel(const std::string& ifName) {
+        return InterfaceController::getCfgFromKernel(ifName);
+    }
+
+    uint64_t configCacheDumps() { return InterfaceController::configCacheDumps(); }
+    uint64_t configCacheRereads() { return InterfaceController::configCacheRereads(); }
+
+    bool isCached(const std::string& ifName) {
+        StatusOr<std::vector<std::string>> names = InterfaceController::getInterfaceNames();
+        EXPECT_EQ(ok, names.status());
+        return std::find(names.value().begin(), names.value().end(), ifName) !=
+               names.value().end();
+    }
+};
+
+TEST_F(InterfaceConfigCacheTest, MatchesKernel) {
+    StatusOr<std::vector<std::string>> ifaceNames = getIfaceNames();
+    ASSERT_EQ(ok, ifaceNames.status());
+    std::sort(ifaceNames.value().begin(), ifaceNames.value().end());
+
+    StatusOr<std::vector<std::string>> cachedNames = InterfaceController::getInterfaceNames();
+    ASSERT_EQ(ok, cachedNames.status());
+    EXPECT_EQ(ifaceNames.value(), cachedNames.value());
+
+    StatusOr<std::vector<InterfaceConfigurationParcel>> cfgs = InterfaceController::getAllCfgs();
+    ASSERT_EQ(ok, cfgs.status());
+    EXPECT_EQ(ifaceNames.value().size(), cfgs.value().size());
+    for (const auto& cfg : cfgs.value()) {
+        SCOPED_TRACE(cfg.ifName);
+        StatusOr<InterfaceConfigurationParcel> expected = getCfgFromKernel(cfg.ifName);
+        ASSERT_EQ(ok, expected.status());
+        EXPECT_EQ(expected.value().hwAddr, cfg.hwAddr);
+        EXPECT_EQ(expected.value().ipv4Addr, cfg.ipv4Addr);
+        EXPECT_EQ(expected.value().prefixLength, cfg.prefixLength);
+        EXPECT_EQ(expected.value().flags, cfg.flags);
+
+        StatusOr<InterfaceConfigurationParcel> single = InterfaceController::getCfg(cfg.ifName);
+        ASSERT_EQ(ok, single.status());
+        EXPECT_EQ(cfg.ipv4Addr, single.value().ipv4Addr);
+        EXPECT_EQ(cfg.flags, single.value().flags);
+    }
+}
+
+TEST_F(InterfaceConfigCacheTest, UpdatesOnlyChangedInterface) {
+    // Fill the table.
+    ASSERT_EQ(ok, InterfaceController::getInterfaceNames().status());
+    const uint64_t dumps = configCacheDumps();
+    const uint64_t rereads = configCacheRereads();
+
+    TunInterface tun;
+    ASSERT_EQ(0, tun.init());
+    const std::string ifName = tun.name();
+    const unsigned ifIndex = tun.ifindex();
+    EXPECT_FALSE(isCached(ifName));
+
+    InterfaceController::updateConfigCache(ifName, ifIndex);
+    EXPECT_TRUE(isCached(ifName));
+    StatusOr<InterfaceConfigurationParcel> cfg = InterfaceController::getCfg(ifName);
+    ASSERT_EQ(ok, cfg.status());
+    StatusOr<InterfaceConfigurationParcel> expected = getCfgFromKernel(ifName);
+    ASSERT_EQ(ok, expected.status());
+    EXPECT_EQ(expected.value().flags, cfg.value().flags);
+    EXPECT_EQ(dumps, configCacheDumps());
+    EXPECT_EQ(rereads + 1, configCacheRereads());
+
+    // The kernel no longer knows the name of a deleted interface, only its index.
+    tun.destroy();
+    InterfaceController::updateConfigCache("", ifIndex);
+    EXPECT_FALSE(isCached(ifName));
+    EXPECT_EQ(dumps, configCacheDumps());
+    EXPECT_EQ(rereads + 2, configCacheRereads());
+}
+
+TEST_F(InterfaceConfigCacheTest, DumpsAgainWhenTooOld) {
+    ASSERT_EQ(ok, InterfaceController::getInterfaceNames().status());
+    const uint64_t dumps = configCacheDumps();
+
+    // An interface whose events were lost.
+    TunInterface tun;
+    ASSERT_EQ(0, tun.init());
+    EXPECT_FALSE(isCached(tun.name()));
+    EXPECT_EQ(dumps, configCacheDumps());
+
+    InterfaceController::setConfigCacheMaxAge(std::chrono::milliseconds(0));
+    EXPECT_TRUE(isCached(tun.name()));
+    EXPECT_EQ(dumps + 1, configCacheDumps());
+
+    InterfaceController::setConfigCacheMaxAge(kDefaultMaxAge);
+    tun.destroy();
+    EXPECT_TRUE(isCached(tun.name()));
+    InterfaceController::invalidateConfigCache();
+    EXPECT_FALSE(isCached(tun.name()));
+    EXPECT_EQ(dumps + 2, configCacheDumps());
+}
+
 }  // namespace net
 }  // namespace android
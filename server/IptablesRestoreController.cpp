@@ -33,9 +33,6 @@
 using android::netdutils::StatusOr;
 using android::netdutils::sSyscalls;
 
-constexpr char IPTABLES_RESTORE_PATH[] = "/system/bin/iptables-restore";
-constexpr char IP6TABLES_RESTORE_PATH[] = "/system/bin/ip6tables-restore";
-
 constexpr char PING[] = "#PING\n";
 
 constexpr size_t PING_SIZE = sizeof(PING) - 1;
@@ -44,6 +41,9 @@ constexpr size_t PING_SIZE = sizeof(PING) - 1;
 int IptablesRestoreController::MAX_RETRIES = 50;
 int IptablesRestoreController::POLL_TIMEOUT_MS = 100 * android::base::HwTimeoutMultiplier();
 
+const char* IptablesRestoreController::IPTABLES_RESTORE_PATH = "/system/bin/iptables-restore";
+const char* IptablesRestoreController::IP6TABLES_RESTORE_PATH = "/system/bin/ip6tables-restore";
+
 class IptablesProcess {
 public:
     IptablesProcess(const IptablesRestoreController::IptablesProcessType type,
@@ -57,6 +57,7 @@ class IptablesRestoreController final : public IptablesRestoreInterface {
 
 protected:
     friend class IptablesRestoreControllerTest;
+    friend class ControllerBenchmark;
     pid_t getIpRestorePid(const IptablesProcessType type);
 
     // The maximum number of times we poll(2) for a response on our set of polled
@@ -68,6 +69,11 @@ protected:
     // |POLL_TIMEOUT_MS * MAX_RETRIES|. Chosen so that the overall timeout is 1s.
     static int POLL_TIMEOUT_MS;
 
+    // The iptables-restore and ip6tables-restore binaries that are run. Replaced by a stub in
+    // benchmarks.
+    static const char* IPTABLES_RESTORE_PATH;
+    static const char* IP6TABLES_RESTORE_PATH;
+
     void Init();
 
 private:
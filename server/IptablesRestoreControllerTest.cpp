@@ -25,6 +25,7 @@
 #include <sys/un.h>
 
 #include <cinttypes>
+#include <functional>
 #include <iostream>
 #include <string>
 
@@ -35,7 +36,9 @@
 #include <netdutils/NetNativeTestBase.h>
 #include <netdutils/Stopwatch.h>
 
+#include "FirewallController.h"
 #include "NetdConstants.h"
+#include "StrictController.h"
 
 #define XT_LOCK_NAME "/system/etc/xtables.lock"
 #define XT_LOCK_ATTEMPTS 10
@@ -50,6 +53,10 @@
 using android::base::Join;
 using android::base::StringAppendF;
 using android::base::StringPrintf;
+using android::net::ALLOW;
+using android::net::ALLOWLIST;
+using android::net::DENY;
+using android::net::FirewallController;
 using android::netdutils::ScopedMockSyscalls;
 using android::netdutils::Stopwatch;
 using testing::Return;
@@ -72,6 +79,9 @@ public:
   void TearDown() {
     con.MAX_RETRIES = mDefaultMaxRetries;
     con.POLL_TIMEOUT_MS = mDefaultPollTimeoutMs;
+    StrictController::execIptablesRestore = ::execIptablesRestore;
+    FirewallController::execIptablesRestore = ::execIptablesRestore;
+    sController = nullptr;
     deleteTestChain();
   }
 
@@ -195,6 +205,48 @@ public:
     con.MAX_RETRIES = maxRetries;
     con.POLL_TIMEOUT_MS = pollTimeoutMs;
   }
+
+  // Makes StrictController run its commands with |con|, on the chains that netd set up.
+  void useRealStrictChains() {
+    sController = &con;
+    StrictController::execIptablesRestore = execWithController;
+  }
+
+  // Makes |fw| run its commands with |con|, on the chains that netd set up. |fw| is put in
+  // allowlist mode without flushing them, so that interface rules can be set.
+  void useRealFirewallChains(FirewallController* fw) {
+    sController = &con;
+    FirewallController::execIptablesRestore = execWithController;
+    fw->mFirewallType = ALLOWLIST;
+  }
+
+  static int execWithController(IptablesTarget target, const std::string& commands) {
+    return sController->execute(target, commands, nullptr);
+  }
+
+  // Times |update| adding and then removing the rules of |count| items, first with one call per
+  // item and then with one call for all of them. |update| changes the items in [begin, end).
+  void benchmarkBulkUpdates(const char* items, int count,
+                            const std::function<int(int begin, int end, bool add)>& update) {
+    Stopwatch s;
+    for (int i = 0; i < count; i++) {
+      EXPECT_EQ(0, update(i, i + 1, true));
+    }
+    for (int i = 0; i < count; i++) {
+      EXPECT_EQ(0, update(i, i + 1, false));
+    }
+    int64_t timeTaken = s.getTimeAndResetUs();
+    std::cerr << "    Add/del " << count << " " << items << " one at a time: " << timeTaken
+              << "us (" << (timeTaken / 2 / count) << "us each)" << std::endl;
+
+    EXPECT_EQ(0, update(0, count, true));
+    EXPECT_EQ(0, update(0, count, false));
+    timeTaken = s.getTimeAndResetUs();
+    std::cerr << "    Add/del " << count << " " << items << " in one call: " << timeTaken
+              << "us (" << (timeTaken / 2 / count) << "us each)" << std::endl;
+  }
+
+  static inline IptablesRestoreController* sController = nullptr;
 };
 
 TEST_F(IptablesRestoreControllerTest, TestBasicCommand) {
@@ -316,6 +368,39 @@ TEST_F(IptablesRestoreControllerTest, TestUidRuleBenchmark) {
     }
 }
 
+TEST_F(IptablesRestoreControllerTest, TestStrictControllerBenchmark) {
+    // Penalizes UIDs that no app has in the real st_ chains, and then accepts them again.
+    constexpr uid_t kFirstUid = 2000000000;
+    useRealStrictChains();
+    StrictController strictCtrl;
+
+    for (const int numUids : {10, 100, 1000}) {
+        benchmarkBulkUpdates("UID penalties", numUids, [&](int begin, int end, bool add) {
+            std::vector<std::pair<uid_t, StrictPenalty>> penalties;
+            for (int i = begin; i < end; i++) {
+                penalties.push_back({kFirstUid + i, add ? REJECT : ACCEPT});
+            }
+            return strictCtrl.setUidCleartextPenalties(penalties);
+        });
+    }
+}
+
+TEST_F(IptablesRestoreControllerTest, TestFirewallControllerBenchmark) {
+    // Allows interfaces that don't exist in the real fw_ chains, and then removes them again.
+    FirewallController fw;
+    useRealFirewallChains(&fw);
+
+    for (const int numInterfaces : {10, 100, 1000}) {
+        benchmarkBulkUpdates("interface rules", numInterfaces, [&](int begin, int end, bool add) {
+            std::vector<std::string> interfaces;
+            for (int i = begin; i < end; i++) {
+                interfaces.push_back(StringPrintf("fwbench%d", i));
+            }
+            return fw.setInterfaceRules(interfaces, add ? ALLOW : DENY);
+        });
+    }
+}
+
 TEST_F(IptablesRestoreControllerTest, TestStartup) {
   // Tests that IptablesRestoreController::Init never sets its processes to null pointers if
   // fork() succeeds.
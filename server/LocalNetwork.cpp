@@ -31,7 +31,7 @@ LocalNetwork::LocalNetwork(unsigned netId) : Network(netId) {
 LocalNetwork::~LocalNetwork() {
 }
 
-int LocalNetwork::addInterface(const std::string& interface) {
+int LocalNetwork::applyAddInterface(const std::string& interface) const {
     if (hasInterface(interface)) {
         return 0;
     }
@@ -39,11 +39,10 @@ int LocalNetwork::addInterface(const std::string& interface) {
         ALOGE("failed to add interface %s to local netId %u", interface.c_str(), mNetId);
         return ret;
     }
-    mInterfaces.insert(interface);
     return 0;
 }
 
-int LocalNetwork::removeInterface(const std::string& interface) {
+int LocalNetwork::applyRemoveInterface(const std::string& interface) const {
     if (!hasInterface(interface)) {
         return 0;
     }
@@ -51,7 +50,6 @@ int LocalNetwork::removeInterface(const std::string& interface) {
         ALOGE("failed to remove interface %s from local netId %u", interface.c_str(), mNetId);
         return ret;
     }
-    mInterfaces.erase(interface);
     return 0;
 }
 
@@ -28,8 +28,8 @@ public:
 
 private:
     std::string getTypeString() const override { return "LOCAL"; };
-    [[nodiscard]] int addInterface(const std::string& interface) override;
-    [[nodiscard]] int removeInterface(const std::string& interface) override;
+    [[nodiscard]] int applyAddInterface(const std::string& interface) const override;
+    [[nodiscard]] int applyRemoveInterface(const std::string& interface) const override;
 };
 
 }  // namespace android::net
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "MDnsDaemon"
+
+#include <errno.h>
+#include <inttypes.h>
+
+#include <android-base/properties.h>
+#include <log/log.h>
+
+#include "MDnsDaemon.h"
+
+using android::netdutils::DumpWriter;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+
+namespace android {
+namespace net {
+
+namespace {
+
+const char* const MDNS_SERVICE_NAME = "mdnsd";
+const char* const MDNS_SERVICE_STATUS = "init.svc.mdnsd";
+
+const char* stateName(MDnsDaemon::State state) {
+    switch (state) {
+        case MDnsDaemon::State::STOPPED:
+            return "stopped";
+        case MDnsDaemon::State::STARTING:
+            return "starting";
+        case MDnsDaemon::State::RUNNING:
+            return "running";
+        case MDnsDaemon::State::STOPPING:
+            return "stopping";
+    }
+    return "unknown";
+}
+
+std::string getProperty(const std::string& key, const std::string& defaultValue) {
+    return android::base::GetProperty(key, defaultValue);
+}
+
+bool setProperty(const std::string& key, const std::string& value) {
+    return android::base::SetProperty(key, value);
+}
+
+bool waitForProperty(const std::string& key, const std::string& value,
+                     std::chrono::milliseconds timeout) {
+    return android::base::WaitForProperty(key, value, timeout);
+}
+
+}  // namespace
+
+std::string (*MDnsDaemon::getPropertyFunction)(const std::string&, const std::string&) =
+        getProperty;
+bool (*MDnsDaemon::setPropertyFunction)(const std::string&, const std::string&) = setProperty;
+bool (*MDnsDaemon::waitForPropertyFunction)(const std::string&, const std::string&,
+                                            milliseconds) = waitForProperty;
+
+MDnsDaemon::MDnsDaemon() {
+    const bool running = getPropertyFunction(MDNS_SERVICE_STATUS, "") == "running";
+    std::lock_guard guard(mLock);
+    mState = running ? State::RUNNING : State::STOPPED;
+    mWantRunning = running;
+}
+
+MDnsDaemon::~MDnsDaemon() {
+    {
+        std::lock_guard guard(mLock);
+        mExiting = true;
+    }
+    mCv.notify_all();
+    // If a transition is in progress, this waits for it to end or time out.
+    if (mThread.joinable()) mThread.join();
+}
+
+int MDnsDaemon::start() {
+    {
+        std::lock_guard guard(mLock);
+        mStartRequests++;
+        if (mWantRunning && mState == State::RUNNING) {
+            // mdnsd is a oneshot service, so it may have exited since it was started. Reading the
+            // property is cheap, unlike waiting for init.
+            if (getPropertyFunction(MDNS_SERVICE_STATUS, "") == "running") return -EBUSY;
+            ALOGW("MDNSD is no longer running, starting it again");
+            mState = State::STOPPED;
+            ensureThreadLocked();
+            mCv.notify_all();
+            return 0;
+        }
+        if (mWantRunning) {
+            mCoalesced++;
+            return 0;
+        }
+        mWantRunning = true;
+        // If a stop is queued but not begun, this cancels it.
+        if (mState == State::RUNNING || mState == State::STARTING) mCoalesced++;
+        ensureThreadLocked();
+    }
+    mCv.notify_all();
+    return 0;
+}
+
+void MDnsDaemon::stop() {
+    {
+        std::lock_guard guard(mLock);
+        mStopRequests++;
+        if (!mWantRunning) {
+            mCoalesced++;
+            return;
+        }
+        mWantRunning = false;
+        // If a start is queued but not begun, this cancels it.
+        if (mState == State::STOPPED || mState == State::STOPPING) mCoalesced++;
+        ensureThreadLocked();
+    }
+    mCv.notify_all();
+}
+
+MDnsDaemon::State MDnsDaemon::getState() const {
+    std::lock_guard guard(mLock);
+    return mState;
+}
+
+void MDnsDaemon::ensureThreadLocked() {
+    if (!mThread.joinable()) {
+        mThread = std::thread([this] { run(); });
+    }
+}
+
+void MDnsDaemon::waitForIdle() {
+    std::unique_lock lock(mLock);
+    mCv.wait(lock, [this]() REQUIRES(mLock) {
+        return mState == (mWantRunning ? State::RUNNING : State::STOPPED);
+    });
+}
+
+void MDnsDaemon::run() {
+    std::unique_lock lock(mLock);
+    while (true) {
+        mCv.wait(lock, [this]() REQUIRES(mLock) {
+            return mExiting || mState != (mWantRunning ? State::RUNNING : State::STOPPED);
+        });
+        if (mExiting) break;
+
+        const bool start = mWantRunning;
+        mState = start ? State::STARTING : State::STOPPING;
+        const milliseconds timeout = mTransitionTimeout;
+        const auto began = steady_clock::now();
+
+        lock.unlock();
+        ALOGD("%s MDNSD", start ? "Starting" : "Stopping");
+        setPropertyFunction(start ? "ctl.start" : "ctl.stop", MDNS_SERVICE_NAME);
+        const bool succeeded = waitForPropertyFunction(MDNS_SERVICE_STATUS,
+                                                       start ? "running" : "stopped", timeout);
+        const bool running =
+                succeeded ? start : getPropertyFunction(MDNS_SERVICE_STATUS, "") == "running";
+        const auto duration = duration_cast<milliseconds>(steady_clock::now() - began);
+        lock.lock();
+
+        mState = running ? State::RUNNING : State::STOPPED;
+        if (!succeeded) {
+            ALOGE("Timed out %s MDNSD after %" PRId64 "ms, it is %s",
+                  start ? "starting" : "stopping", static_cast<int64_t>(duration.count()),
+                  stateName(mState));
+            // Don't retry until the next request.
+            if (mWantRunning == start) mWantRunning = running;
+        }
+        mTransitions.push_back({
+                .start = start,
+                .succeeded = succeeded,
+                .began = began,
+                .duration = duration,
+        });
+        if (mTransitions.size() > kMaxTransitions) mTransitions.pop_front();
+        mCv.notify_all();
+    }
+}
+
+void MDnsDaemon::dump(DumpWriter& dw) const {
+    std::lock_guard guard(mLock);
+    dw.println("mdnsd: %s, requested %s", stateName(mState),
+               mWantRunning ? "running" : "stopped");
+    dw.println("mdnsd requests: start %" PRIu64 " stop %" PRIu64 " coalesced %" PRIu64,
+               mStartRequests, mStopRequests, mCoalesced);
+    if (mTransitions.empty()) return;
+
+    dw.println("mdnsd transitions:");
+    dw.incIndent();
+    const auto now = steady_clock::now();
+    for (const auto& transition : mTransitions) {
+        dw.println("%s %s after %" PRId64 "ms, %" PRId64 "s ago",
+                   transition.start ? "start" : "stop",
+                   transition.succeeded ? "completed" : "timed out",
+                   static_cast<int64_t>(transition.duration.count()),
+                   static_cast<int64_t>(
+                           duration_cast<std::chrono::seconds>(now - transition.began).count()));
+    }
+    dw.decIndent();
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <android-base/thread_annotations.h>
+
+#include "netdutils/DumpWriter.h"
+
+namespace android {
+namespace net {
+
+// Starts and stops mdnsd through init on a dedicated thread, so that the binder threads that
+// request it never wait for init.
+//
+// Requests only set whether mdnsd should be running. The thread then starts or stops it until it
+// is in that state, so a request that arrives while another is in progress is merged with it: a
+// start during a start, or a start followed by a stop before the thread got to either, costs
+// nothing. If mdnsd does not reach the requested state in time, the thread gives up until the
+// next request instead of retrying.
+class MDnsDaemon {
+  public:
+    using milliseconds = std::chrono::milliseconds;
+
+    static constexpr milliseconds kDefaultTransitionTimeout = milliseconds(5000);
+    // Number of transitions kept for dump().
+    static constexpr size_t kMaxTransitions = 16;
+
+    enum class State { STOPPED, STARTING, RUNNING, STOPPING };
+
+    // Reads the current state of mdnsd, which a previous instance of netd may have started.
+    MDnsDaemon();
+    ~MDnsDaemon();
+
+    MDnsDaemon(const MDnsDaemon&) = delete;
+    MDnsDaemon& operator=(const MDnsDaemon&) = delete;
+
+    // Requests that mdnsd run, and returns without waiting for it. Returns 0, or -EBUSY if mdnsd
+    // is already running and no stop is pending. If mdnsd exited since it was started, it is
+    // started again.
+    [[nodiscard]] int start();
+    // Requests that mdnsd stop, and returns without waiting for it.
+    void stop();
+
+    State getState() const;
+
+    void dump(netdutils::DumpWriter& dw) const;
+
+  private:
+    struct Transition {
+        // True for a start, false for a stop.
+        bool start;
+        bool succeeded;
+        std::chrono::steady_clock::time_point began;
+        milliseconds duration;
+    };
+
+    void run();
+    // Starts the transition thread if it is not running yet.
+    void ensureThreadLocked() REQUIRES(mLock);
+
+    mutable std::mutex mLock;
+    // Signalled when a request changes mWantRunning, when a transition ends, and on destruction.
+    std::condition_variable mCv;
+    std::thread mThread;
+    State mState GUARDED_BY(mLock);
+    bool mWantRunning GUARDED_BY(mLock);
+    bool mExiting GUARDED_BY(mLock) = false;
+    milliseconds mTransitionTimeout GUARDED_BY(mLock) = kDefaultTransitionTimeout;
+
+    uint64_t mStartRequests GUARDED_BY(mLock) = 0;
+    uint64_t mStopRequests GUARDED_BY(mLock) = 0;
+    // Requests that did not cause a transition of their own.
+    uint64_t mCoalesced GUARDED_BY(mLock) = 0;
+    // The last kMaxTransitions transitions, oldest first.
+    std::deque<Transition> mTransitions GUARDED_BY(mLock);
+
+    // For testing.
+    friend class MDnsDaemonTest;
+    // Waits until mdnsd is in the requested state, or the thread has given up.
+    void waitForIdle();
+    static std::string (*getPropertyFunction)(const std::string& key,
+                                              const std::string& defaultValue);
+    static bool (*setPropertyFunction)(const std::string& key, const std::string& value);
+    static bool (*waitForPropertyFunction)(const std::string& key, const std::string& value,
+                                           milliseconds timeout);
+};
+
+}  // namespace net
+}  // namespace android
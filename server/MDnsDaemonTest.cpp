@@ -0,0 +1,255 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MDnsDaemonTest.cpp - unit tests for MDnsDaemon.cpp
+ */
+
+#include <errno.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <netdutils/NetNativeTestBase.h>
+
+#include "MDnsDaemon.h"
+
+using namespace std::chrono_literals;
+
+namespace android {
+namespace net {
+
+using State = MDnsDaemon::State;
+
+// Fakes init: ctl.start and ctl.stop take effect when the test releases them.
+class MDnsDaemonTest : public NetNativeTestBase {
+  public:
+    MDnsDaemonTest() {
+        MDnsDaemon::getPropertyFunction = fakeGetProperty;
+        MDnsDaemon::setPropertyFunction = fakeSetProperty;
+        MDnsDaemon::waitForPropertyFunction = fakeWaitForProperty;
+        std::lock_guard guard(sLock);
+        sProperties = {{"init.svc.mdnsd", "stopped"}};
+        sCommands.clear();
+        sBlocked = false;
+        sTimeOut = false;
+    }
+
+    ~MDnsDaemonTest() {
+        MDnsDaemon::getPropertyFunction = sRealGetProperty;
+        MDnsDaemon::setPropertyFunction = sRealSetProperty;
+        MDnsDaemon::waitForPropertyFunction = sRealWaitForProperty;
+    }
+
+  protected:
+    static std::string fakeGetProperty(const std::string& key, const std::string& defaultValue) {
+        std::lock_guard guard(sLock);
+        auto it = sProperties.find(key);
+        return it == sProperties.end() ? defaultValue : it->second;
+    }
+
+    static bool fakeSetProperty(const std::string& key, const std::string& value) {
+        std::lock_guard guard(sLock);
+        sCommands.push_back(key + " " + value);
+        return true;
+    }
+
+    static bool fakeWaitForProperty(const std::string& key, const std::string& value,
+                                    std::chrono::milliseconds) {
+        std::unique_lock lock(sLock);
+        sCv.wait(lock, [] { return !sBlocked; });
+        if (sTimeOut) return false;
+        sProperties[key] = value;
+        return true;
+    }
+
+    static void setRunning() {
+        std::lock_guard guard(sLock);
+        sProperties["init.svc.mdnsd"] = "running";
+    }
+
+    // mdnsd exits, without netd asking init to stop it.
+    static void setExited() {
+        std::lock_guard guard(sLock);
+        sProperties["init.svc.mdnsd"] = "stopped";
+    }
+
+    static void block() {
+        std::lock_guard guard(sLock);
+        sBlocked = true;
+    }
+
+    static void release() {
+        {
+            std::lock_guard guard(sLock);
+            sBlocked = false;
+        }
+        sCv.notify_all();
+    }
+
+    static void timeOut() {
+        std::lock_guard guard(sLock);
+        sTimeOut = true;
+    }
+
+    static std::vector<std::string> commands() {
+        std::lock_guard guard(sLock);
+        return sCommands;
+    }
+
+    static void waitForState(const MDnsDaemon& daemon, State state) {
+        for (int i = 0; i < 100 && daemon.getState() != state; i++) {
+            std::this_thread::sleep_for(10ms);
+        }
+        ASSERT_EQ(state, daemon.getState());
+    }
+
+    static void waitForIdle(MDnsDaemon& daemon) { daemon.waitForIdle(); }
+
+    static uint64_t coalesced(const MDnsDaemon& daemon) {
+        std::lock_guard guard(daemon.mLock);
+        return daemon.mCoalesced;
+    }
+
+    static size_t transitions(const MDnsDaemon& daemon) {
+        std::lock_guard guard(daemon.mLock);
+        return daemon.mTransitions.size();
+    }
+
+    static inline std::mutex sLock;
+    static inline std::condition_variable sCv;
+    static inline std::map<std::string, std::string> sProperties;
+    static inline std::vector<std::string> sCommands;
+    static inline bool sBlocked;
+    static inline bool sTimeOut;
+
+    static inline const auto sRealGetProperty = MDnsDaemon::getPropertyFunction;
+    static inline const auto sRealSetProperty = MDnsDaemon::setPropertyFunction;
+    static inline const auto sRealWaitForProperty = MDnsDaemon::waitForPropertyFunction;
+};
+
+TEST_F(MDnsDaemonTest, StartAndStopReturnBeforeInit) {
+    MDnsDaemon daemon;
+    EXPECT_EQ(State::STOPPED, daemon.getState());
+
+    block();
+    EXPECT_EQ(0, daemon.start());
+    waitForState(daemon, State::STARTING);
+    release();
+    waitForIdle(daemon);
+    EXPECT_EQ(State::RUNNING, daemon.getState());
+
+    block();
+    daemon.stop();
+    waitForState(daemon, State::STOPPING);
+    release();
+    waitForIdle(daemon);
+    EXPECT_EQ(State::STOPPED, daemon.getState());
+
+    const std::vector<std::string> expected = {"ctl.start mdnsd", "ctl.stop mdnsd"};
+    EXPECT_EQ(expected, commands());
+    EXPECT_EQ(2U, transitions(daemon));
+}
+
+TEST_F(MDnsDaemonTest, AlreadyRunning) {
+    setRunning();
+    MDnsDaemon daemon;
+    EXPECT_EQ(State::RUNNING, daemon.getState());
+    EXPECT_EQ(-EBUSY, daemon.start());
+    EXPECT_TRUE(commands().empty());
+}
+
+TEST_F(MDnsDaemonTest, StartsAgainAfterExit) {
+    MDnsDaemon daemon;
+    EXPECT_EQ(0, daemon.start());
+    waitForIdle(daemon);
+    EXPECT_EQ(State::RUNNING, daemon.getState());
+    EXPECT_EQ(-EBUSY, daemon.start());
+
+    setExited();
+    EXPECT_EQ(0, daemon.start());
+    waitForIdle(daemon);
+    EXPECT_EQ(State::RUNNING, daemon.getState());
+    const std::vector<std::string> expected = {"ctl.start mdnsd", "ctl.start mdnsd"};
+    EXPECT_EQ(expected, commands());
+    EXPECT_EQ(-EBUSY, daemon.start());
+}
+
+TEST_F(MDnsDaemonTest, CoalescesRequests) {
+    MDnsDaemon daemon;
+    block();
+    EXPECT_EQ(0, daemon.start());
+    waitForState(daemon, State::STARTING);
+
+    // Requests that arrive while mdnsd is starting only change what it ends up as.
+    EXPECT_EQ(0, daemon.start());
+    EXPECT_EQ(0, daemon.start());
+    daemon.stop();
+    EXPECT_EQ(0, daemon.start());
+    release();
+    waitForIdle(daemon);
+
+    EXPECT_EQ(State::RUNNING, daemon.getState());
+    const std::vector<std::string> expected = {"ctl.start mdnsd"};
+    EXPECT_EQ(expected, commands());
+    EXPECT_EQ(3U, coalesced(daemon));
+
+    // Stopping twice only stops once.
+    block();
+    daemon.stop();
+    daemon.stop();
+    release();
+    waitForIdle(daemon);
+    EXPECT_EQ(State::STOPPED, daemon.getState());
+    EXPECT_EQ(2U, commands().size());
+}
+
+TEST_F(MDnsDaemonTest, StopWhileStarting) {
+    MDnsDaemon daemon;
+    block();
+    EXPECT_EQ(0, daemon.start());
+    waitForState(daemon, State::STARTING);
+    daemon.stop();
+    release();
+    waitForIdle(daemon);
+
+    EXPECT_EQ(State::STOPPED, daemon.getState());
+    const std::vector<std::string> expected = {"ctl.start mdnsd", "ctl.stop mdnsd"};
+    EXPECT_EQ(expected, commands());
+}
+
+TEST_F(MDnsDaemonTest, GivesUpOnTimeout) {
+    MDnsDaemon daemon;
+    timeOut();
+    EXPECT_EQ(0, daemon.start());
+    waitForIdle(daemon);
+
+    // mdnsd never reported running, and is not started again until the next request.
+    EXPECT_EQ(State::STOPPED, daemon.getState());
+    EXPECT_EQ(1U, commands().size());
+    EXPECT_EQ(0, daemon.start());
+    waitForIdle(daemon);
+    EXPECT_EQ(2U, commands().size());
+    EXPECT_EQ(2U, transitions(daemon));
+}
+
+}  // namespace net
+}  // namespace android
@@ -18,23 +18,21 @@
 
 #include "MDnsService.h"
 
-#include <android-base/properties.h>
+#include <unistd.h>
+
 #include <binder/Status.h>
 #include <binder_utils/BinderUtil.h>
+#include <netdutils/DumpWriter.h>
 
 using android::net::mdns::aidl::DiscoveryInfo;
 using android::net::mdns::aidl::GetAddressInfo;
 using android::net::mdns::aidl::IMDnsEventListener;
 using android::net::mdns::aidl::RegistrationInfo;
 using android::net::mdns::aidl::ResolutionInfo;
-
-using std::literals::chrono_literals::operator""s;
+using android::netdutils::DumpWriter;
 
 namespace android::net {
 
-#define MDNS_SERVICE_NAME "mdnsd"
-#define MDNS_SERVICE_STATUS "init.svc.mdnsd"
-
 // TODO: DnsResolver has same macro definition but returns ScopedAStatus. Move these macros to
 // BinderUtil.h to do the same permission check.
 #define ENFORCE_ANY_PERMISSION(...)                                \
@@ -57,24 +55,30 @@ status_t MDnsService::start() {
     return android::OK;
 }
 
+status_t MDnsService::dump(int fd, const Vector<String16>&) {
+    const binder::Status dump_permission = checkAnyPermission({PERM_DUMP});
+    if (!dump_permission.isOk()) {
+        const String8 msg(dump_permission.toString8());
+        write(fd, msg.c_str(), msg.size());
+        return PERMISSION_DENIED;
+    }
+
+    DumpWriter dw(fd);
+    mDaemon.dump(dw);
+    return NO_ERROR;
+}
+
 binder::Status MDnsService::startDaemon() {
     ENFORCE_NETWORK_STACK_PERMISSIONS();
-    if (android::base::GetProperty(MDNS_SERVICE_STATUS, "") == "running") {
-        return android::binder::Status::fromServiceSpecificError(EBUSY, strerror(EBUSY));
+    if (int ret = mDaemon.start()) {
+        return android::binder::Status::fromServiceSpecificError(-ret, strerror(-ret));
     }
-
-    ALOGD("Starting MDNSD");
-    android::base::SetProperty("ctl.start", MDNS_SERVICE_NAME);
-    // To maintain the same behavior as before, the returned value is not checked.
-    android::base::WaitForProperty(MDNS_SERVICE_STATUS, "running", 5s);
     return binder::Status::ok();
 }
 
 binder::Status MDnsService::stopDaemon() {
     ENFORCE_NETWORK_STACK_PERMISSIONS();
-    ALOGD("Stopping MDNSD");
-    android::base::SetProperty("ctl.stop", MDNS_SERVICE_NAME);
-    android::base::WaitForProperty(MDNS_SERVICE_STATUS, "stopped", 5s);
+    mDaemon.stop();
     return binder::Status::ok();
 }
 
@@ -19,13 +19,18 @@
 #include <android/net/mdns/aidl/BnMDns.h>
 #include <binder/BinderService.h>
 
+#include "MDnsDaemon.h"
+
 namespace android::net {
 
 class MDnsService : public BinderService<MDnsService>, public android::net::mdns::aidl::BnMDns {
   public:
     static status_t start();
     static char const* getServiceName() { return "mdns"; }
+    status_t dump(int fd, const Vector<String16>& args) override;
 
+    // Only request that mdnsd be started or stopped, and return before it is. Callers that need
+    // to know when mdnsd is running should wait for init.svc.mdnsd.
     binder::Status startDaemon() override;
     binder::Status stopDaemon() override;
     binder::Status registerService(
@@ -39,6 +44,9 @@ class MDnsService : public BinderService<MDnsService>, public android::net::mdns
             const android::sp<android::net::mdns::aidl::IMDnsEventListener>& listener) override;
     binder::Status unregisterEventListener(
             const android::sp<android::net::mdns::aidl::IMDnsEventListener>& listener) override;
+
+  private:
+    MDnsDaemon mDaemon;
 };
 
 }  // namespace android::net
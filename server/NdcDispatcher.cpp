@@ -26,10 +26,12 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <chrono>
 #include <cinttypes>
 #include <string>
 #include <vector>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
 #include <android-base/stringprintf.h>
@@ -47,6 +49,7 @@
 #include "netid_client.h"
 
 using android::base::Join;
+using android::base::ReadFdToString;
 using android::base::StringPrintf;
 using android::binder::Status;
 
@@ -113,6 +116,21 @@ int stringToINetdPermission(const char* arg) {
     return INetd::PERMISSION_NONE;
 }
 
+// Whether a command whose last response had |code| succeeded. Commands that send no response
+// succeed.
+bool isSuccessCode(int code) {
+    return code == 0 || (ResponseCode::CommandOkay <= code && code < 300);
+}
+
+std::vector<char*> toArgv(const std::vector<std::string>& args) {
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    return argv;
+}
+
 }  // namespace
 
 sp<INetd> NdcDispatcher::mNetd;
@@ -161,6 +179,133 @@ int NdcDispatcher::dispatchCommand(int argc, char** argv) {
     return 0;
 }
 
+bool NdcDispatcher::parseBatch(const std::string& script, bool nulSeparated,
+                               std::vector<BatchCommand>* commands) {
+    commands->clear();
+    if (nulSeparated) {
+        if (!script.empty() && script.back() != '\0') return false;
+        BatchCommand command = {.line = 1};
+        for (size_t start = 0; start < script.size();) {
+            const size_t end = script.find('\0', start);
+            if (end == start) {
+                if (command.args.empty()) return false;
+                commands->push_back(std::move(command));
+                command = {.line = commands->size() + 1};
+            } else {
+                command.args.push_back(script.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+        return command.args.empty();
+    }
+
+    size_t line = 0;
+    for (const auto& text : android::base::Split(script, "\n")) {
+        line++;
+        const std::string trimmed = android::base::Trim(text);
+        if (trimmed.empty() || trimmed[0] == '#') continue;
+        BatchCommand command = {.line = line};
+        for (auto& arg : android::base::Split(trimmed, " \t")) {
+            if (!arg.empty()) command.args.push_back(std::move(arg));
+        }
+        commands->push_back(std::move(command));
+    }
+    return true;
+}
+
+int NdcDispatcher::dispatchBatch(FILE* script, bool nulSeparated) {
+    const auto start = std::chrono::steady_clock::now();
+    std::string contents;
+    std::vector<BatchCommand> commands;
+    if (!ReadFdToString(fileno(script), &contents)) {
+        fprintf(stderr, "Cannot read commands: %s\n", strerror(errno));
+        return -1;
+    }
+    if (!parseBatch(contents, nulSeparated, &commands)) {
+        fprintf(stderr, "Commands are not terminated by an empty argument\n");
+        return -1;
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < commands.size();) {
+        if (size_t n = dispatchUsersBatch(commands, i, &failed)) {
+            i += n;
+            continue;
+        }
+        mNdc.setPrefix(StringPrintf("%zu: ", commands[i].line));
+        mNdc.resetLastCode();
+        std::vector<char*> argv = toArgv(commands[i].args);
+        dispatchCommand(commands[i].args.size(), argv.data());
+        if (!isSuccessCode(mNdc.lastCode())) failed++;
+        i++;
+    }
+    mNdc.setPrefix("");
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+    printf("%zu commands, %d failed, %.3f ms\n", commands.size(), failed,
+           elapsed.count() / 1000.0);
+    return failed;
+}
+
+size_t NdcDispatcher::getUsersBatchSize(const std::vector<BatchCommand>& commands, size_t first,
+                                        UidRanges* uidRanges) {
+    //    0      1     2       3           4
+    // network users  add   <netId> [<uid>[-<uid>]] ...
+    // network users remove <netId> [<uid>[-<uid>]] ...
+    const auto parseUsers = [](const std::vector<std::string>& args, UidRanges* uidRanges) {
+        if (args.size() < 4 || args[0] != "network" || args[1] != "users" ||
+            (args[2] != "add" && args[2] != "remove")) {
+            return false;
+        }
+        std::vector<char*> argv = toArgv(args);
+        return uidRanges->parseFrom(args.size() - 4, argv.data() + 4);
+    };
+
+    if (!parseUsers(commands[first].args, uidRanges)) return 0;
+    const std::string& op = commands[first].args[2];
+    const std::string& network = commands[first].args[3];
+
+    size_t last = first;
+    while (last + 1 < commands.size()) {
+        const auto& args = commands[last + 1].args;
+        UidRanges more;
+        if (!parseUsers(args, &more) || args[2] != op || args[3] != network) break;
+        UidRanges combined = *uidRanges;
+        combined.add(more);
+        if (combined.overlapsSelf()) break;
+        *uidRanges = std::move(combined);
+        last++;
+    }
+    return last == first ? 0 : last - first + 1;
+}
+
+size_t NdcDispatcher::dispatchUsersBatch(const std::vector<BatchCommand>& commands, size_t first,
+                                         int* failed) {
+    UidRanges uidRanges;
+    const size_t count = getUsersBatchSize(commands, first, &uidRanges);
+    if (count == 0) return 0;
+    const size_t last = first + count - 1;
+
+    const bool add = commands[first].args[2] == "add";
+    const unsigned netId = stringToNetId(commands[first].args[3].c_str());
+    const Status status = add ? mNetd->networkAddUidRanges(netId, uidRanges.getRanges())
+                              : mNetd->networkRemoveUidRanges(netId, uidRanges.getRanges());
+    for (size_t i = first; i <= last; i++) {
+        mNdc.setPrefix(StringPrintf("%zu: ", commands[i].line));
+        if (status.isOk()) {
+            mNdc.sendMsg(ResponseCode::CommandOkay, "success", false);
+        } else {
+            errno = status.serviceSpecificErrorCode();
+            mNdc.sendMsg(ResponseCode::OperationFailed,
+                         add ? "addUsersToNetwork() failed" : "removeUsersFromNetwork() failed",
+                         true);
+            (*failed)++;
+        }
+    }
+    return count;
+}
+
 NdcDispatcher::InterfaceCmd::InterfaceCmd() : NdcNetdCommand("interface") {}
 
 int NdcDispatcher::InterfaceCmd::runCommand(NdcClient* cli, int argc, char** argv) const {
@@ -17,7 +17,10 @@
 #ifndef _NDC_DISPATCHER_H__
 #define _NDC_DISPATCHER_H__
 
+#include <stdio.h>
+
 #include <string>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <android/net/IDnsResolver.h>
@@ -29,19 +32,33 @@
 namespace android {
 namespace net {
 
+class UidRanges;
+
 class NdcClient {
   public:
     NdcClient() = default;
     ~NdcClient() = default;
 
     int sendMsg(int code, const char* msg, bool addErrno) {
+        mLastCode = code;
         if (addErrno) {
-            printf("%d 0 %s (%s)\n", code, msg, strerror(errno));
+            printf("%s%d 0 %s (%s)\n", mPrefix.c_str(), code, msg, strerror(errno));
         } else {
-            printf("%d 0 %s\n", code, msg);
+            printf("%s%d 0 %s\n", mPrefix.c_str(), code, msg);
         }
         return 0;
     }
+
+    // Printed before every message, e.g., the line of the command in a batch.
+    void setPrefix(std::string prefix) { mPrefix = std::move(prefix); }
+
+    // The code of the last message sent since the last call to resetLastCode(), or 0 if none.
+    int lastCode() const { return mLastCode; }
+    void resetLastCode() { mLastCode = 0; }
+
+  private:
+    std::string mPrefix;
+    int mLastCode = 0;
 };
 
 class NdcNetdCommand {
@@ -74,7 +91,44 @@ class NdcDispatcher {
     int dispatchCommand(int argc, char** argv);
     void registerCmd(NdcNetdCommand* cmd);
 
+    // Runs every command in |script| over the binder connection of this dispatcher, and prints
+    // the responses of each command prefixed with its line, followed by the total time taken.
+    //
+    // Commands are separated by newlines and their arguments by whitespace. Empty lines and lines
+    // that start with '#' are ignored. If |nulSeparated| is true, each argument is instead
+    // terminated by a NUL byte, and each command by an empty argument, so that arguments may
+    // contain whitespace; "lines" are then counted in commands.
+    //
+    // Consecutive "network users add" or "network users remove" commands for the same network are
+    // sent as a single networkAddUidRanges() or networkRemoveUidRanges() call, as long as their
+    // UID ranges do not overlap, and succeed or fail together.
+    //
+    // Returns the number of commands that failed, or -1 if |script| cannot be read.
+    int dispatchBatch(FILE* script, bool nulSeparated);
+
   private:
+    struct BatchCommand {
+        size_t line;
+        std::vector<std::string> args;
+    };
+
+    // Splits |script| into commands as described for dispatchBatch(). Returns false if
+    // |nulSeparated| is true and the last command is not terminated.
+    static bool parseBatch(const std::string& script, bool nulSeparated,
+                           std::vector<BatchCommand>* commands);
+    // Returns the number of consecutive "network users" commands, starting at |commands[first]|,
+    // that can be sent as one call, and sets |uidRanges| to their UID ranges. Returns 0 if there
+    // are fewer than two.
+    static size_t getUsersBatchSize(const std::vector<BatchCommand>& commands, size_t first,
+                                    UidRanges* uidRanges);
+    // Runs the commands of a group of "network users" commands that starts at |commands[first]|.
+    // Returns the number of commands run, or 0 if the group has fewer than two commands.
+    size_t dispatchUsersBatch(const std::vector<BatchCommand>& commands, size_t first,
+                              int* failed);
+
+    // For testing.
+    friend class NdcDispatcherTest;
+
     std::vector<NdcNetdCommand*> mCommands;
 
     class InterfaceCmd : public NdcNetdCommand {
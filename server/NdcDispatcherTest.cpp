@@ -0,0 +1,147 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * NdcDispatcherTest.cpp - unit tests for the batch mode of NdcDispatcher.cpp
+ */
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <android-base/strings.h>
+
+#include "NdcDispatcher.h"
+#include "UidRanges.h"
+
+using namespace std::string_literals;
+
+namespace android {
+namespace net {
+
+// The batch parsing and merging don't need a binder connection, so the tests never create an
+// NdcDispatcher.
+class NdcDispatcherTest : public ::testing::Test {
+  protected:
+    // Parses |script|, and returns each command as its line and its arguments joined by '|'.
+    static std::vector<std::string> parse(const std::string& script, bool nulSeparated) {
+        std::vector<NdcDispatcher::BatchCommand> commands;
+        EXPECT_TRUE(NdcDispatcher::parseBatch(script, nulSeparated, &commands));
+        std::vector<std::string> result;
+        for (const auto& command : commands) {
+            result.push_back(std::to_string(command.line) + ": " +
+                             android::base::Join(command.args, '|'));
+        }
+        return result;
+    }
+
+    static bool parses(const std::string& script, bool nulSeparated) {
+        std::vector<NdcDispatcher::BatchCommand> commands;
+        return NdcDispatcher::parseBatch(script, nulSeparated, &commands);
+    }
+
+    // Returns how many of |lines|, from the first, are sent as one "network users" call.
+    static size_t usersBatchSize(const std::vector<std::string>& lines) {
+        std::vector<NdcDispatcher::BatchCommand> commands;
+        EXPECT_TRUE(NdcDispatcher::parseBatch(android::base::Join(lines, '\n'),
+                                              false /* nulSeparated */, &commands));
+        UidRanges uidRanges;
+        return NdcDispatcher::getUsersBatchSize(commands, 0, &uidRanges);
+    }
+};
+
+TEST_F(NdcDispatcherTest, ParseLines) {
+    const std::vector<std::string> expected = {
+            "3: network|create|100",
+            "6: network|users|add|100|10000-10099",
+    };
+    EXPECT_EQ(expected, parse("# Comment\n"
+                              "\n"
+                              "network create 100\n"
+                              "  \t\n"
+                              "  # Indented comment\n"
+                              "\tnetwork  users add\t100 10000-10099  \n",
+                              false));
+    EXPECT_TRUE(parse("", false).empty());
+    // The last line doesn't need a newline.
+    EXPECT_EQ(std::vector<std::string>{"1: interface|list"}, parse("interface list", false));
+}
+
+TEST_F(NdcDispatcherTest, ParseNulSeparated) {
+    // Arguments may contain whitespace and '#', and commands are counted instead of lines.
+    const std::vector<std::string> expected = {
+            "1: interface|setcfg|wlan 0|# not a comment",
+            "2: interface|list",
+    };
+    EXPECT_EQ(expected,
+              parse("interface\0setcfg\0wlan 0\0# not a comment\0\0interface\0list\0\0"s, true));
+    EXPECT_TRUE(parse("", true).empty());
+}
+
+TEST_F(NdcDispatcherTest, ParseUnterminated) {
+    // Not terminated by a NUL.
+    EXPECT_FALSE(parses("interface\0list"s, true));
+    // The last command is not terminated by an empty argument.
+    EXPECT_FALSE(parses("interface\0list\0"s, true));
+    EXPECT_FALSE(parses("interface\0list\0\0network\0list\0"s, true));
+    // An empty command.
+    EXPECT_FALSE(parses("\0"s, true));
+    EXPECT_FALSE(parses("interface\0list\0\0\0"s, true));
+}
+
+TEST_F(NdcDispatcherTest, MergeUsersCommands) {
+    EXPECT_EQ(3U, usersBatchSize({
+                          "network users add 100 10000-10099",
+                          "network users add 100 10100",
+                          "network users add 100 10200-10299 10400",
+                  }));
+    // A single command is not merged.
+    EXPECT_EQ(0U, usersBatchSize({"network users remove 100 10000-10099"}));
+    EXPECT_EQ(0U, usersBatchSize({"network create 100", "network users add 100 10000"}));
+}
+
+TEST_F(NdcDispatcherTest, MergeUsersCommandsBreaks) {
+    // Overlapping ranges.
+    EXPECT_EQ(2U, usersBatchSize({
+                          "network users add 100 10000-10099",
+                          "network users add 100 10100-10199",
+                          "network users add 100 10150-10249",
+                  }));
+    EXPECT_EQ(0U, usersBatchSize({
+                          "network users add 100 10000-10099",
+                          "network users add 100 10099",
+                  }));
+    // A different operation.
+    EXPECT_EQ(0U, usersBatchSize({
+                          "network users add 100 10000-10099",
+                          "network users remove 100 10100-10199",
+                  }));
+    // A different netId.
+    EXPECT_EQ(2U, usersBatchSize({
+                          "network users remove 100 10000-10099",
+                          "network users remove 100 10100-10199",
+                          "network users remove 101 10200-10299",
+                  }));
+    // Another command.
+    EXPECT_EQ(2U, usersBatchSize({
+                          "network users add 100 10000-10099",
+                          "network users add 100 10100-10199",
+                          "network create 101",
+                          "network users add 100 10200-10299",
+                  }));
+}
+
+}  // namespace net
+}  // namespace android
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <errno.h>
 #include <ifaddrs.h>
 #include <netdb.h>
 #include <stddef.h>
@@ -23,6 +24,7 @@
 
 #include <mutex>
 #include <string>
+#include <string_view>
 
 #include "android/net/INetd.h"
 
@@ -38,6 +40,131 @@ int execIptablesRestoreCommand(IptablesTarget target, const std::string& table,
                                const std::string& command, std::string *output);
 bool isIfaceName(const std::string& name);
 int parsePrefix(const char *prefix, uint8_t *family, void *address, int size, uint8_t *prefixlen);
+
+// Parses a dotted-quad IPv4 address into 4 bytes at |address|. Accepts the same strings as
+// inet_pton(AF_INET), but doesn't need a null-terminated string and can run at compile time.
+constexpr bool parseIpv4Address(std::string_view str, uint8_t* address) {
+    size_t i = 0;
+    for (int octet = 0; octet < 4; octet++) {
+        if (octet > 0) {
+            if (i == str.size() || str[i] != '.') return false;
+            i++;
+        }
+        const size_t start = i;
+        unsigned value = 0;
+        while (i < str.size() && str[i] >= '0' && str[i] <= '9') {
+            value = value * 10 + (str[i] - '0');
+            if (value > 255) return false;
+            i++;
+        }
+        // Octets must not be empty and must not have leading zeroes, which could mean octal.
+        if (i == start || (i - start > 1 && str[start] == '0')) return false;
+        address[octet] = value;
+    }
+    return i == str.size();
+}
+
+// Parses an IPv6 address into 16 bytes at |address|. Accepts the same strings as
+// inet_pton(AF_INET6), but doesn't need a null-terminated string and can run at compile time.
+constexpr bool parseIpv6Address(std::string_view str, uint8_t* address) {
+    constexpr auto hexValue = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+
+    uint8_t bytes[16] = {};
+    size_t len = 0;  // Number of bytes in |bytes|.
+    int gap = -1;    // Offset in |bytes| at which "::" inserts zeroes, if present.
+    size_t i = 0;
+    if (str.substr(0, 2) == "::") {
+        gap = 0;
+        i = 2;
+    } else if (str.substr(0, 1) == ":") {
+        return false;
+    }
+
+    while (i < str.size()) {
+        const size_t start = i;
+        unsigned value = 0;
+        while (i < str.size() && i - start < 4 && hexValue(str[i]) >= 0) {
+            value = value * 16 + hexValue(str[i]);
+            i++;
+        }
+        if (i < str.size() && str[i] == '.') {
+            // An IPv4 address in dotted-quad notation can only appear at the end.
+            if (len + 4 > sizeof(bytes) || !parseIpv4Address(str.substr(start), bytes + len)) {
+                return false;
+            }
+            len += 4;
+            break;
+        }
+        if (i == start || len + 2 > sizeof(bytes)) return false;
+        bytes[len++] = value >> 8;
+        bytes[len++] = value & 0xff;
+        if (i == str.size()) break;
+
+        // Groups are separated by ':', and "::" can appear at most once.
+        if (str[i++] != ':' || i == str.size()) return false;
+        if (str[i] == ':') {
+            if (gap >= 0) return false;
+            gap = len;
+            i++;
+        }
+    }
+
+    if (gap < 0 ? len != sizeof(bytes) : len > sizeof(bytes) - 2) return false;
+    const size_t zeroes = sizeof(bytes) - len;
+    const size_t head = gap < 0 ? len : gap;
+    for (size_t j = 0; j < sizeof(bytes); j++) {
+        if (j < head) {
+            address[j] = bytes[j];
+        } else if (j < head + zeroes) {
+            address[j] = 0;
+        } else {
+            address[j] = bytes[j - zeroes];
+        }
+    }
+    return true;
+}
+
+// Same as parsePrefix(), but takes a string_view, does not allocate memory and can run at compile
+// time. Only accepts the address notations that inet_pton() accepts.
+constexpr int parseIpPrefix(std::string_view prefix, uint8_t* family, uint8_t* address,
+                            size_t size, uint8_t* prefixlen) {
+    const size_t slash = prefix.find('/');
+    if (slash == std::string_view::npos || slash + 1 == prefix.size()) return -EINVAL;
+
+    unsigned length = 0;
+    for (const char c : prefix.substr(slash + 1)) {
+        if (c < '0' || c > '9') return -EINVAL;
+        length = length * 10 + (c - '0');
+        if (length > 255) return -EINVAL;
+    }
+
+    const std::string_view addressString = prefix.substr(0, slash);
+    uint8_t rawAddress[16] = {};
+    size_t rawLength = 0;
+    if (addressString.find(':') != std::string_view::npos) {
+        if (!parseIpv6Address(addressString, rawAddress)) return -EINVAL;
+        if (length > 128) return -EINVAL;
+        *family = AF_INET6;
+        rawLength = 16;
+    } else {
+        if (!parseIpv4Address(addressString, rawAddress)) return -EINVAL;
+        if (length > 32) return -EINVAL;
+        *family = AF_INET;
+        rawLength = 4;
+    }
+
+    if (rawLength > size) return -ENOSPC;
+    for (size_t i = 0; i < rawLength; i++) {
+        address[i] = rawAddress[i];
+    }
+    *prefixlen = length;
+    return rawLength;
+}
 void blockSigpipe();
 void setCloseOnExec(const char *sock);
 
@@ -38,6 +38,7 @@
 
 #include "Controllers.h"
 #include "Fwmark.h"
+#include "FwmarkServer.h"
 #include "InterfaceController.h"
 #include "NetdNativeService.h"
 #include "OemNetdListener.h"
@@ -57,7 +58,6 @@ using android::net::TetherStatsParcel;
 using android::net::UidRangeParcel;
 using android::net::netd::aidl::NativeUidRangeConfig;
 using android::netdutils::DumpWriter;
-using android::netdutils::getIfaceNames;
 using android::netdutils::ScopedIndent;
 using android::os::ParcelFileDescriptor;
 
@@ -166,6 +166,9 @@ status_t NetdNativeService::dump(int fd, const Vector<String16> &args) {
     gCtls->netCtrl.dump(dw);
     dw.blankline();
 
+    FwmarkServer::dumpRunningServer(dw);
+    dw.blankline();
+
     gCtls->xfrmCtrl.dump(dw);
     dw.blankline();
 
@@ -821,7 +824,10 @@ std::string addCurlyBrackets(const std::string& s) {
 
 binder::Status NetdNativeService::interfaceGetList(std::vector<std::string>* interfaceListResult) {
     NETD_LOCKING_RPC(InterfaceController::mutex, PERM_NETWORK_STACK, PERM_MAINLINE_NETWORK_STACK);
-    const auto& ifaceList = getIfaceNames();
+    const auto& ifaceList = InterfaceController::getInterfaceNames();
+    if (!isOk(ifaceList)) {
+        return asBinderStatus(ifaceList.status());
+    }
 
     interfaceListResult->clear();
     interfaceListResult->reserve(ifaceList.value().size());
@@ -17,11 +17,14 @@
 #include <errno.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #define LOG_TAG "Netd"
 #include <log/log.h>
 
@@ -31,7 +34,156 @@
 namespace android {
 namespace net {
 
-int openNetlinkSocket(int protocol) {
+namespace {
+
+// The batch that sendNetlinkRequest() queues requests to on this thread, if any.
+thread_local NetlinkBatch* sCurrentBatch = nullptr;
+
+// Receives |count| netlink ACKs and stores the error code of each one in |results|, indexed by the
+// sequence number of the request minus one. Returns 0 on success or negative errno if receiving the
+// ACKs failed.
+int recvNetlinkAcks(int sock, size_t count, std::vector<int>* results) {
+    struct {
+        nlmsghdr msg;
+        nlmsgerr err;
+    } acks[kNetlinkBatchWindow];
+    iovec iov[kNetlinkBatchWindow];
+    mmsghdr msgs[kNetlinkBatchWindow];
+
+    while (count > 0) {
+        const size_t want = std::min(count, static_cast<size_t>(kNetlinkBatchWindow));
+        for (size_t i = 0; i < want; i++) {
+            iov[i] = {&acks[i], sizeof(acks[i])};
+            msgs[i] = {.msg_hdr = {.msg_iov = &iov[i], .msg_iovlen = 1}};
+        }
+
+        // Error ACKs carry a copy of the request and are truncated here; we only need the header.
+        int received = recvmmsg(sock, msgs, want, MSG_WAITFORONE, nullptr);
+        if (received == -1) {
+            if (errno == EINTR) continue;
+            int ret = -errno;
+            ALOGE("netlink recvmmsg failed (%s)", strerror(-ret));
+            return ret;
+        }
+
+        for (int i = 0; i < received; i++) {
+            if (msgs[i].msg_len < sizeof(acks[i]) || acks[i].msg.nlmsg_type != NLMSG_ERROR) {
+                ALOGE("bad netlink ACK (size %u, type %d)", msgs[i].msg_len,
+                      acks[i].msg.nlmsg_type);
+                return -EBADMSG;
+            }
+            const uint32_t seq = acks[i].err.msg.nlmsg_seq;
+            if (seq == 0 || seq > results->size()) {
+                ALOGE("netlink ACK for unknown request %u", seq);
+                return -EBADMSG;
+            }
+            int error = acks[i].err.error;  // Netlink errors are negative errno.
+            // Trying to add a route that already exists isn't an error, see
+            // RouteController::modifyRoute.
+            if (error == -EEXIST && acks[i].err.msg.nlmsg_type == RTM_NEWROUTE) {
+                error = 0;
+            }
+            (*results)[seq - 1] = error;
+        }
+        count -= received;
+    }
+
+    return 0;
+}
+
+}  // namespace
+
+NetlinkBatch::NetlinkBatch() : mNested(sCurrentBatch != nullptr), mDetached(false) {
+    if (!mNested) {
+        sCurrentBatch = this;
+    }
+}
+
+NetlinkBatch::NetlinkBatch(Detached) : mNested(false), mDetached(true) {}
+
+NetlinkBatch::~NetlinkBatch() {
+    if (mNested) return;
+    if (!mDetached) sCurrentBatch = nullptr;
+    if (int ret = flush()) {
+        ALOGE("failed to flush netlink batch (%s)", strerror(-ret));
+    }
+}
+
+NetlinkBatch* NetlinkBatch::current() {
+    return sCurrentBatch;
+}
+
+void NetlinkBatch::add(uint16_t action, uint16_t flags, const iovec* iov, int iovlen) {
+    const size_t offset = mBuffer.size();
+    nlmsghdr nlmsg = {
+        .nlmsg_len = sizeof(nlmsg),
+        .nlmsg_type = action,
+        .nlmsg_flags = flags,
+        // Sequence numbers identify the request that each ACK refers to.
+        .nlmsg_seq = static_cast<uint32_t>(mOffsets.size() + 1),
+    };
+    for (int i = 0; i < iovlen; ++i) {
+        nlmsg.nlmsg_len += iov[i].iov_len;
+    }
+
+    mBuffer.resize(offset + NLMSG_ALIGN(nlmsg.nlmsg_len));
+    uint8_t* p = mBuffer.data() + offset;
+    memcpy(p, &nlmsg, sizeof(nlmsg));
+    p += sizeof(nlmsg);
+    for (int i = 0; i < iovlen; ++i) {
+        if (iov[i].iov_len == 0) continue;
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    mOffsets.push_back(offset);
+}
+
+int NetlinkBatch::flush() {
+    if (mNested) return 0;
+
+    const size_t count = mOffsets.size();
+    mResults.assign(count, 0);
+    if (count == 0) return 0;
+
+    int ret = 0;
+    int sock = openNetlinkSocket(NETLINK_ROUTE);
+    if (sock < 0) {
+        ret = sock;
+        mResults.assign(count, ret);
+    }
+
+    for (size_t start = 0; sock >= 0 && start < count; start += kNetlinkBatchWindow) {
+        const size_t end = std::min(count, start + kNetlinkBatchWindow);
+        const size_t len = (end < count ? mOffsets[end] : mBuffer.size()) - mOffsets[start];
+        if (send(sock, mBuffer.data() + mOffsets[start], len, 0) != static_cast<ssize_t>(len)) {
+            ret = -errno;
+            ALOGE("netlink batch send failed (%s)", strerror(-ret));
+        } else {
+            ret = recvNetlinkAcks(sock, end - start, &mResults);
+        }
+        if (ret) {
+            std::fill(mResults.begin() + start, mResults.end(), ret);
+            break;
+        }
+    }
+    if (sock >= 0) close(sock);
+
+    mBuffer.clear();
+    mOffsets.clear();
+
+    for (size_t i = 0; i < count; i++) {
+        if (mResults[i] != 0) {
+            if (mDetached) return mResults[i];
+            ALOGE("netlink batch: %zu of %zu requests failed, first at %zu (%s)",
+                  std::count_if(mResults.begin(), mResults.end(), [](int r) { return r != 0; }),
+                  count, i, strerror(-mResults[i]));
+            return mResults[i];
+        }
+    }
+    return 0;
+}
+
+static int openKernelNetlinkSocket(int protocol) {
     int sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, protocol);
     if (sock == -1) {
         return -errno;
@@ -44,6 +196,20 @@ int openNetlinkSocket(int protocol) {
     return sock;
 }
 
+int (*openNetlinkSocketFunction)(int) = openKernelNetlinkSocket;
+
+int openNetlinkSocket(int protocol) {
+    return openNetlinkSocketFunction(protocol);
+}
+
+int enableNetlinkStrictCheck(int sock) {
+    const int on = 1;
+    if (setsockopt(sock, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &on, sizeof(on)) == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
 int recvNetlinkAck(int sock) {
     struct {
         nlmsghdr msg;
@@ -85,6 +251,11 @@ int recvNetlinkAck(int sock) {
 // Returns -errno if there was an error or if the kernel reported an error.
 OPTNONE int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int iovlen,
                                const NetlinkDumpCallback* callback) {
+    if (NetlinkBatch* batch = NetlinkBatch::current(); batch && (flags & NLM_F_ACK)) {
+        batch->add(action, flags, iov, iovlen);
+        return 0;
+    }
+
     int sock = openNetlinkSocket(NETLINK_ROUTE);
     if (sock < 0) {
         return sock;
@@ -126,89 +297,159 @@ int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int iovlen)
     return sendNetlinkRequest(action, flags, iov, iovlen, nullptr);
 }
 
-int processNetlinkDump(int sock, const NetlinkDumpCallback& callback) {
-    char buf[kNetlinkDumpBufferSize];
+int NetlinkDumpReader::receive() {
+    if (mEof) return 0;
 
-    ssize_t bytesread;
+    if (mBuffer == nullptr) {
+        // The first datagram is already queued, or about to be. Make sure it fits.
+        ssize_t len;
+        do {
+            len = recv(mSock, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+        } while (len == -1 && errno == EINTR);
+        if (len == -1) {
+            return -errno;
+        }
+        mDatagramSize = std::max(kMinDatagramSize, static_cast<size_t>(NLMSG_ALIGN(len)));
+        mDatagrams = 1;
+        mBuffer.reset(new uint8_t[mDatagramSize]);
+    } else if (mReceived == mDatagrams && mDatagrams < kMaxDatagrams) {
+        // The last call filled every buffer, so this is a large dump. Receive more at once.
+        mDatagrams = std::min(mDatagrams * 2, kMaxDatagrams);
+        mBuffer.reset(new uint8_t[mDatagramSize * mDatagrams]);
+    }
+
+    for (int i = 0; i < mDatagrams; i++) {
+        mIov[i] = {datagram(i), mDatagramSize};
+        mMsgs[i] = {.msg_hdr = {.msg_iov = &mIov[i], .msg_iovlen = 1}};
+    }
+
+    int received;
     do {
-        bytesread = read(sock, buf, sizeof(buf));
+        received = recvmmsg(mSock, mMsgs, mDatagrams, MSG_WAITFORONE, nullptr);
+    } while (received == -1 && errno == EINTR);
+    if (received == -1) {
+        return -errno;
+    }
+    mReceived = received;
 
-        if (bytesread < 0) {
-            return -errno;
+    for (int i = 0; i < received; i++) {
+        if (mMsgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            ALOGE("netlink dump datagram larger than %zu bytes", mDatagramSize);
+            return -EMSGSIZE;
         }
+        if (mMsgs[i].msg_len == 0) {
+            mEof = true;
+            return i;
+        }
+    }
+    return received;
+}
 
-        uint32_t len = bytesread;
-        for (nlmsghdr *nlh = reinterpret_cast<nlmsghdr *>(buf);
-             NLMSG_OK(nlh, len);
-             nlh = NLMSG_NEXT(nlh, len)) {
-            switch (nlh->nlmsg_type) {
-              case NLMSG_DONE:
-                return 0;
-              case NLMSG_ERROR: {
-                nlmsgerr *err = reinterpret_cast<nlmsgerr *>(NLMSG_DATA(nlh));
-                return err->error;
-              }
-              default:
-                callback(nlh);
-            }
+int rtNetlinkDump(uint16_t getAction, const NetlinkDumpCallback& callback, uint32_t table) {
+    // Only route dumps can be filtered by table.
+    const bool filterTable = (table != RT_TABLE_UNSPEC && getAction == RTM_GETROUTE);
+
+    int ret = 0;
+    for (const int family : { AF_INET, AF_INET6 }) {
+        int dumpSock = openNetlinkSocket(NETLINK_ROUTE);
+        if (dumpSock < 0) {
+            return dumpSock;
         }
-    } while (bytesread > 0);
+        const bool strict = filterTable && enableNetlinkStrictCheck(dumpSock) == 0;
 
-    return 0;
+        // struct fib_rule_hdr and struct rtmsg are functionally identical.
+        struct {
+            nlmsghdr hdr;
+            rtmsg msg;
+            rtattr tableAttr;
+            uint32_t table;
+        } request = {
+            .hdr = {
+                .nlmsg_len = NLMSG_LENGTH(sizeof(rtmsg)),
+                .nlmsg_type = getAction,
+                .nlmsg_flags = NETLINK_DUMP_FLAGS,
+            },
+            .msg = {
+                .rtm_family = static_cast<uint8_t>(family),
+            },
+            .tableAttr = {
+                .rta_len = RTA_LENGTH(sizeof(uint32_t)),
+                .rta_type = RTA_TABLE,
+            },
+            .table = table,
+        };
+        if (strict) {
+            request.hdr.nlmsg_len = sizeof(request);
+        }
+
+        if (write(dumpSock, &request, request.hdr.nlmsg_len) == -1) {
+            ret = -errno;
+            ALOGE("netlink dump request failed (%s)", strerror(-ret));
+        } else {
+            ret = processNetlinkDump(dumpSock, callback);
+            // With strict checking, IPv4 reports a table that doesn't exist as ENOENT.
+            if (strict && ret == -ENOENT) ret = 0;
+        }
+        close(dumpSock);
+        if (ret != 0) {
+            break;
+        }
+    }
+    return ret;
 }
 
 int rtNetlinkFlush(uint16_t getAction, uint16_t deleteAction, const char* what,
-                   const NetlinkDumpFilter& shouldDelete) {
+                   const NetlinkDumpFilter& shouldDelete, uint32_t table) {
     // RTM_GETxxx is always RTM_DELxxx + 1, see <linux/rtnetlink.h>.
     if (getAction != deleteAction + 1) {
         ALOGE("Unknown flush type getAction=%d deleteAction=%d", getAction, deleteAction);
         return -EINVAL;
     }
 
-    int writeSock = openNetlinkSocket(NETLINK_ROUTE);
-    if (writeSock < 0) {
-        return writeSock;
-    }
+    // The body of every object to delete, and where it is in |objects|. Rules and routes are
+    // deleted with the same message they are dumped with.
+    struct PendingDelete {
+        uint32_t table;
+        size_t offset;
+        size_t len;
+    };
+    std::vector<uint8_t> objects;
+    std::vector<PendingDelete> pending;
 
-    NetlinkDumpCallback callback = [writeSock, deleteAction, shouldDelete, what] (nlmsghdr *nlh) {
+    NetlinkDumpCallback callback = [&shouldDelete, &objects, &pending] (nlmsghdr *nlh) {
         if (!shouldDelete(nlh)) return;
 
-        nlh->nlmsg_type = deleteAction;
-        nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-        if (write(writeSock, nlh, nlh->nlmsg_len) == -1) {
-            ALOGE("Error writing flush request: %s", strerror(errno));
-            return;
-        }
-
-        int ret = recvNetlinkAck(writeSock);
-        // A flush works by dumping routes and deleting each route as it's returned, and it can
-        // fail if something else deletes the route between the dump and the delete. This can
-        // happen, for example, if an interface goes down while we're trying to flush its routes.
-        // So ignore ENOENT.
-        if (ret != 0 && ret != -ENOENT) {
-            ALOGW("Flushing %s: %s", what, strerror(-ret));
-        }
+        const uint8_t* data = static_cast<const uint8_t*>(NLMSG_DATA(nlh));
+        const size_t len = nlh->nlmsg_len - NLMSG_HDRLEN;
+        // FRA_TABLE and RTA_TABLE are the same attribute, so this works for rules and routes.
+        pending.push_back({getRtmU32Attribute(nlh, RTA_TABLE), objects.size(), len});
+        objects.insert(objects.end(), data, data + len);
     };
-
-    int ret = 0;
-    for (const int family : { AF_INET, AF_INET6 }) {
-        // struct fib_rule_hdr and struct rtmsg are functionally identical.
-        rtmsg rule = {
-            .rtm_family = static_cast<uint8_t>(family),
-        };
-        iovec iov[] = {
-            { nullptr,  0 },
-            { &rule, sizeof(rule) },
-        };
-        uint16_t flags = NETLINK_DUMP_FLAGS;
-
-        if ((ret = sendNetlinkRequest(getAction, flags, iov, ARRAY_SIZE(iov), &callback)) != 0) {
-            break;
+    const int ret = rtNetlinkDump(getAction, callback, table);
+
+    // Even if a dump failed, delete what it returned before failing, as objects were deleted as
+    // they were dumped before.
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const PendingDelete& a, const PendingDelete& b) {
+                         return a.table < b.table;
+                     });
+    NetlinkBatch batch(NetlinkBatch::kDetached);
+    for (const PendingDelete& object : pending) {
+        iovec iov = {objects.data() + object.offset, object.len};
+        batch.add(deleteAction, NETLINK_REQUEST_FLAGS, &iov, 1);
+    }
+    (void) batch.flush();
+
+    for (const int error : batch.results()) {
+        // A flush works by dumping objects and then deleting them, and a delete can fail if
+        // something else deletes the object between the dump and the delete. This can happen, for
+        // example, if an interface goes down while we're trying to flush its routes. So ignore
+        // ENOENT.
+        if (error != 0 && error != -ENOENT) {
+            ALOGW("Flushing %s: %s", what, strerror(-error));
         }
     }
 
-    close(writeSock);
-
     return ret;
 }
 
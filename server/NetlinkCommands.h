@@ -17,8 +17,12 @@
 #pragma once
 
 #include <functional>
+#include <memory>
+#include <vector>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "NetdConstants.h"
 
@@ -38,13 +42,26 @@ const uint16_t NETLINK_RULE_CREATE_FLAGS = NETLINK_REQUEST_FLAGS | NLM_F_CREATE;
 const uint16_t NETLINK_DUMP_FLAGS = NLM_F_REQUEST | NLM_F_DUMP;
 
 // Generic code for processing netlink dumps.
-const int kNetlinkDumpBufferSize = 8192;
 typedef std::function<void(nlmsghdr *)> NetlinkDumpCallback;
 typedef std::function<bool(nlmsghdr *)> NetlinkDumpFilter;
 
+// Maximum number of batched requests whose ACKs can be outstanding at any one time. Bounds the
+// amount of ACK data queued on the socket, so the kernel never has to drop ACKs with ENOBUFS.
+const int kNetlinkBatchWindow = 64;
+
 // Opens an RTNetlink socket and connects it to the kernel.
 [[nodiscard]] int openNetlinkSocket(int protocol);
 
+// For benchmarks. Opens the sockets returned by openNetlinkSocket(). Returns a socket or negative
+// errno.
+extern int (*openNetlinkSocketFunction)(int protocol);
+
+// Enables NETLINK_GET_STRICT_CHK on |sock|. The kernel then validates dump requests strictly and
+// only returns the objects that match the filters in the request header and attributes, e.g., the
+// table of an RTM_GETROUTE dump, instead of every object. Returns 0, or negative errno if the kernel
+// does not support it (before 4.20), in which case the filters are ignored.
+[[nodiscard]] int enableNetlinkStrictCheck(int sock);
+
 // Receives a netlink ACK. Returns 0 if the command succeeded or negative errno if the command
 // failed or receiving the ACK failed.
 [[nodiscard]] int recvNetlinkAck(int sock);
@@ -55,15 +72,142 @@ typedef std::function<bool(nlmsghdr *)> NetlinkDumpFilter;
 [[nodiscard]] int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int iovlen,
                                      const NetlinkDumpCallback* callback);
 
-// Processes a netlink dump, passing every message to the specified |callback|.
-[[nodiscard]] int processNetlinkDump(int sock, const NetlinkDumpCallback& callback);
+// Receives the datagrams of a netlink dump, several at a time.
+//
+// The kernel fills each dump datagram up to the size of the buffer that the reader passed to the
+// previous recvmsg(), capped at 32 KiB, unless a single object needs more. Each datagram is
+// received into a buffer of at least kMinDatagramSize bytes, or larger if the first datagram of the
+// dump is larger. The number of datagrams received per recvmmsg() call starts at one, so small
+// dumps only use one buffer, and doubles up to kMaxDatagrams while the dump keeps filling them.
+class NetlinkDumpReader {
+  public:
+    static constexpr size_t kMinDatagramSize = 65536;
+    static constexpr int kMaxDatagrams = 4;
+
+    explicit NetlinkDumpReader(int sock) : mSock(sock) {}
+
+    NetlinkDumpReader(const NetlinkDumpReader&) = delete;
+    NetlinkDumpReader& operator=(const NetlinkDumpReader&) = delete;
+
+    // Receives the next datagrams of the dump, waiting for the first one. Returns the number of
+    // datagrams received, 0 if the peer sent an empty datagram, or negative errno.
+    [[nodiscard]] int receive();
+
+    // The |i|th datagram received by the last call to receive(), and its length.
+    nlmsghdr* datagram(int i) const {
+        return reinterpret_cast<nlmsghdr*>(mBuffer.get() + i * mDatagramSize);
+    }
+    uint32_t length(int i) const { return mMsgs[i].msg_len; }
+
+  private:
+    const int mSock;
+    std::unique_ptr<uint8_t[]> mBuffer;
+    size_t mDatagramSize = 0;
+    // Number of datagrams that fit in mBuffer, and number received by the last call to receive().
+    int mDatagrams = 0;
+    int mReceived = 0;
+    bool mEof = false;
+    iovec mIov[kMaxDatagrams];
+    mmsghdr mMsgs[kMaxDatagrams];
+};
+
+// Processes a netlink dump, passing every message to |callback|, which is called as
+// callback(nlmsghdr*). Stops at NLMSG_DONE, and returns 0 or the error in an NLMSG_ERROR message.
+// This is a template so that lambdas are called directly rather than through a std::function.
+template <typename Callback>
+[[nodiscard]] int processNetlinkDump(int sock, Callback&& callback) {
+    NetlinkDumpReader reader(sock);
+    int count;
+    while ((count = reader.receive()) > 0) {
+        for (int i = 0; i < count; i++) {
+            uint32_t len = reader.length(i);
+            for (nlmsghdr* nlh = reader.datagram(i); NLMSG_OK(nlh, len);
+                 nlh = NLMSG_NEXT(nlh, len)) {
+                switch (nlh->nlmsg_type) {
+                    case NLMSG_DONE:
+                        return 0;
+                    case NLMSG_ERROR:
+                        return reinterpret_cast<nlmsgerr*>(NLMSG_DATA(nlh))->error;
+                    default:
+                        callback(nlh);
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// Dumps the IPv4 and then the IPv6 netlink objects that take an rtmsg structure (FIB rules,
+// routes...), and passes every one to |callback|. |getAction| is the type of the dump, e.g.,
+// RTM_GETRULE. |table| is a hint, as in rtNetlinkFlush(). Returns 0 or negative errno.
+[[nodiscard]] int rtNetlinkDump(uint16_t getAction, const NetlinkDumpCallback& callback,
+                                uint32_t table = RT_TABLE_UNSPEC);
 
 // Flushes netlink objects that take an rtmsg structure (FIB rules, routes...). |getAction| and
 // |deleteAction| specify the netlink message types, e.g., RTM_GETRULE and RTM_DELRULE.
 // |shouldDelete| specifies whether a given object should be deleted or not. |what| is a
 // human-readable name for the objects being flushed, e.g. "rules".
+// The objects to delete are collected from the dumps first, and then deleted table by table with
+// one NetlinkBatch, so flushing a large table takes a handful of system calls per
+// kNetlinkBatchWindow objects instead of a write and a read each.
+// If |table| is not RT_TABLE_UNSPEC, kernels that support NETLINK_GET_STRICT_CHK only dump the
+// routes in that table. Other kernels dump everything, so |shouldDelete| must still check the table.
 [[nodiscard]] int rtNetlinkFlush(uint16_t getAction, uint16_t deleteAction, const char* what,
-                                 const NetlinkDumpFilter& shouldDelete);
+                                 const NetlinkDumpFilter& shouldDelete,
+                                 uint32_t table = RT_TABLE_UNSPEC);
+
+// Batches rtnetlink requests, so that many objects can be created or deleted with a handful of
+// system calls instead of one socket, one write and one read each.
+//
+// While a NetlinkBatch is in scope, sendNetlinkRequest() calls made on the same thread that expect
+// an ACK are queued and return 0 instead of being sent. The queued requests are sent on a single
+// socket, in order and at most kNetlinkBatchWindow at a time, when flush() is called or when the
+// batch goes out of scope. The kernel processes them in the order in which they were queued, but
+// does not stop at the first error, so a failed request does not prevent later ones from running.
+// As in RouteController, adding a route that already exists is not considered an error.
+//
+// A batch created while another batch is already active on the same thread joins the outer batch:
+// its requests are sent when the outer batch is flushed, and its own flush() is a no-op.
+//
+// A batch constructed with kDetached is only ever filled by add(). sendNetlinkRequest() does not
+// queue to it, it does not join an outer batch, and flush() does not log failed requests, leaving
+// the caller to check results().
+class NetlinkBatch {
+  public:
+    struct Detached {};
+    static constexpr Detached kDetached{};
+
+    NetlinkBatch();
+    explicit NetlinkBatch(Detached);
+    ~NetlinkBatch();
+
+    NetlinkBatch(const NetlinkBatch&) = delete;
+    NetlinkBatch& operator=(const NetlinkBatch&) = delete;
+
+    // Sends all queued requests and waits for their ACKs. Returns 0 if every request succeeded,
+    // otherwise the error of the first request that failed. The result of each request is
+    // available from results() until the next flush.
+    [[nodiscard]] int flush();
+
+    // Number of requests queued since the last flush.
+    size_t size() const { return mOffsets.size(); }
+
+    // Per-request results of the last flush, in the order in which the requests were queued.
+    const std::vector<int>& results() const { return mResults; }
+
+    // Returns the batch that sendNetlinkRequest() queues requests to on this thread, if any.
+    static NetlinkBatch* current();
+
+    // Queues a request. |iov| has the same layout as in sendNetlinkRequest().
+    void add(uint16_t action, uint16_t flags, const iovec* iov, int iovlen);
+
+  private:
+    const bool mNested;
+    const bool mDetached;
+    std::vector<uint8_t> mBuffer;
+    std::vector<size_t> mOffsets;
+    std::vector<int> mResults;
+};
 
 // Returns the value of the specific __u32 attribute, or 0 if the attribute was not present.
 uint32_t getRtmU32Attribute(const nlmsghdr *nlh, int attribute);
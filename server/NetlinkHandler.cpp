@@ -29,8 +29,10 @@
 #include <netutils/ifc.h>
 #include <sysutils/NetlinkEvent.h>
 #include "Controllers.h"
+#include "NetdConstants.h"
 #include "NetlinkHandler.h"
 #include "NetlinkManager.h"
+#include "RouteController.h"
 #include "SockDiag.h"
 
 #include <charconv>
@@ -100,6 +102,40 @@ static long parseIfIndex(const char* ifIndex) {
     return ifaceIndex;
 }
 
+// Parses the ADDRESS parameter of an address event, e.g., "192.0.2.1/24", into a binary address.
+// IPv4 addresses are returned as IPv4-mapped IPv6 addresses.
+static bool parseEventAddress(const char* address, in6_addr* rawAddress) {
+    if (address == nullptr) {
+        return false;
+    }
+    uint8_t family;
+    uint8_t prefixLength;
+    uint8_t bytes[sizeof(in6_addr)];
+    int len = parseIpPrefix(address, &family, bytes, sizeof(bytes), &prefixLength);
+    if (len == sizeof(in6_addr)) {
+        memcpy(rawAddress, bytes, sizeof(in6_addr));
+    } else if (len == sizeof(in_addr)) {
+        *rawAddress = {};
+        rawAddress->s6_addr[10] = 0xff;
+        rawAddress->s6_addr[11] = 0xff;
+        memcpy(&rawAddress->s6_addr[12], bytes, sizeof(in_addr));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool NetlinkHandler::onDataAvailable(SocketClient* cli) {
+    if (NetlinkListener::onDataAvailable(cli)) {
+        return true;
+    }
+    // The read failed, e.g., with ENOBUFS because the socket's receive buffer overflowed. Events
+    // might have been lost, so the interface configuration can't be updated one interface at a
+    // time anymore.
+    InterfaceController::invalidateConfigCache();
+    return false;
+}
+
 void NetlinkHandler::onEvent(NetlinkEvent *evt) {
     const char *subsys = evt->getSubsystem();
     if (!subsys) {
@@ -110,6 +146,19 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
     if (!strcmp(subsys, "net")) {
         NetlinkEvent::Action action = evt->getAction();
         const char *iface = evt->findParam("INTERFACE") ?: "";
+        const long eventIfIndex = parseIfIndex(evt->findParam("IFINDEX"));
+        if (action != NetlinkEvent::Action::kRdnss &&
+            action != NetlinkEvent::Action::kRouteUpdated &&
+            action != NetlinkEvent::Action::kRouteRemoved) {
+            // Only the interface that changed is read again.
+            InterfaceController::updateConfigCache(iface, eventIfIndex);
+        }
+        if (action == NetlinkEvent::Action::kAdd || action == NetlinkEvent::Action::kRemove ||
+            action == NetlinkEvent::Action::kLinkUp || action == NetlinkEvent::Action::kLinkDown) {
+            // The interface was created, deleted or renamed, or its link changed. Do this before
+            // notifying the framework, so that it never acts on the event with a stale ifindex.
+            RouteController::invalidateIfIndex(iface, eventIfIndex);
+        }
         if (action == NetlinkEvent::Action::kAdd) {
             notifyInterfaceAdded(iface);
         } else if (action == NetlinkEvent::Action::kRemove) {
@@ -138,11 +187,18 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
             if (!ifaceIndex) {
                 ALOGE("invalid interface index: %s(%s)", iface, ifIndex);
             }
+            in6_addr rawAddress;
+            const bool validAddress = parseEventAddress(address, &rawAddress);
+            if (!validAddress) {
+                ALOGE("invalid address: %s(%s)", iface, address ?: "");
+            }
             const bool addrUpdated = (action == NetlinkEvent::Action::kAddressUpdated);
             if (addrUpdated) {
-                gCtls->netCtrl.addInterfaceAddress(ifaceIndex, address);
+                if (validAddress) gCtls->netCtrl.addInterfaceAddress(ifaceIndex, rawAddress);
             } else {  // action == NetlinkEvent::Action::kAddressRemoved
-                bool shouldDestroy = gCtls->netCtrl.removeInterfaceAddress(ifaceIndex, address);
+                bool shouldDestroy =
+                        !validAddress ||
+                        gCtls->netCtrl.removeInterfaceAddress(ifaceIndex, rawAddress);
                 if (shouldDestroy) {
                     SockDiag sd;
                     if (sd.open()) {
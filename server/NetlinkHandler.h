@@ -39,6 +39,7 @@ public:
     int stop();
 
   protected:
+    virtual bool onDataAvailable(SocketClient* cli);
     virtual void onEvent(NetlinkEvent *evt);
 
     void notifyInterfaceAdded(const std::string& ifName);
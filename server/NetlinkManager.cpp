@@ -37,6 +37,7 @@
 
 #include <arpa/inet.h>
 
+#include "InterfaceController.h"
 #include "NetlinkManager.h"
 #include "NetlinkHandler.h"
 
@@ -144,6 +145,9 @@ int NetlinkManager::start() {
          NetlinkListener::NETLINK_FORMAT_BINARY, false)) == nullptr) {
         return -1;
     }
+    // Link and address changes are now reported to NetlinkHandler, which keeps the interface
+    // configuration cache up to date.
+    InterfaceController::enableConfigCache();
 
     if ((mQuotaHandler = setupSocket(&mQuotaSock, NETLINK_NFLOG,
             NFLOG_QUOTA_GROUP, NetlinkListener::NETLINK_FORMAT_BINARY, false)) == nullptr) {
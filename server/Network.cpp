@@ -46,15 +46,20 @@ const std::set<std::string>& Network::getInterfaces() const {
 }
 
 int Network::clearInterfaces() {
-    while (!mInterfaces.empty()) {
-        // Make a copy of the string, so removeInterface() doesn't lose its parameter when it
-        // removes the string from the set.
-        std::string interface = *mInterfaces.begin();
-        if (int ret = removeInterface(interface)) {
-            return ret;
+    // Iterate over a copy, since commitRemoveInterface() removes the interface from the set. An
+    // interface that can't be removed must not keep the ones after it from being removed.
+    const std::set<std::string> interfaces = mInterfaces;
+    int ret = 0;
+    for (const std::string& interface : interfaces) {
+        if (int err = applyRemoveInterface(interface)) {
+            if (!ret) {
+                ret = err;
+            }
+            continue;
         }
+        commitRemoveInterface(interface);
     }
-    return 0;
+    return ret;
 }
 
 std::string Network::toString() const {
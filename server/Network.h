@@ -41,34 +41,49 @@ public:
     bool hasInterface(const std::string& interface) const;
     const std::set<std::string>& getInterfaces() const;
 
-    // These return 0 on success or negative errno on failure.
-    [[nodiscard]] virtual int addInterface(const std::string&) { return -EINVAL; }
-    [[nodiscard]] virtual int removeInterface(const std::string&) { return -EINVAL; }
+    // Tries to remove every interface, keeping the ones that fail. Returns 0 on success or the
+    // first negative errno on failure.
     [[nodiscard]] int clearInterfaces();
 
     std::string toString() const;
     std::string uidRangesToString() const;
     std::string allowedUidsToString() const;
     bool appliesToUser(uid_t uid, int32_t* subPriority) const;
+    const UidRangeMap& getUidRangeMap() const { return mUidRangeMap; }
     virtual Permission getPermission() const = 0;
-    [[nodiscard]] virtual int addUsers(const UidRanges&, int32_t /*subPriority*/) {
-        return -EINVAL;
-    };
-    [[nodiscard]] virtual int removeUsers(const UidRanges&, int32_t /*subPriority*/) {
-        return -EINVAL;
-    };
     bool isSecure() const;
     virtual bool isPhysical() { return false; }
     virtual bool isUnreachable() { return false; }
     virtual bool isVirtual() { return false; }
     virtual bool canAddUsers() { return false; }
-    virtual bool isValidSubPriority(int32_t /*priority*/) { return false; }
+    virtual bool isValidSubPriority(int32_t /*priority*/) const { return false; }
     virtual void addToUidRangeMap(const UidRanges& uidRanges, int32_t subPriority);
     virtual void removeFromUidRangeMap(const UidRanges& uidRanges, int32_t subPriority);
     void clearAllowedUids();
     void setAllowedUids(const UidRanges& uidRanges);
+    const std::optional<UidRanges>& getAllowedUids() const { return mAllowedUids; }
     bool isUidAllowed(uid_t uid);
 
+    // Adding and removing interfaces and users takes two steps, so that NetworkController can
+    // program the kernel without holding the lock that readers of this object take. The apply
+    // methods program the kernel as if the change had been made, and do not change this object.
+    // They return 0 on success or negative errno on failure. Once one succeeds, the matching commit
+    // method, or addToUidRangeMap() or removeFromUidRangeMap() for users, makes the change to this
+    // object without touching the kernel.
+    [[nodiscard]] virtual int applyAddInterface(const std::string&) const { return -EINVAL; }
+    [[nodiscard]] virtual int applyRemoveInterface(const std::string&) const { return -EINVAL; }
+    [[nodiscard]] virtual int applyAddUsers(const UidRanges&, int32_t /*subPriority*/) const {
+        return -EINVAL;
+    }
+    [[nodiscard]] virtual int applyRemoveUsers(const UidRanges&, int32_t /*subPriority*/) const {
+        return -EINVAL;
+    }
+    // NetworkController also calls these when it restores networks from a NetworkSnapshot after a
+    // restart, because the kernel still has their rules and routes.
+    void commitAddInterface(const std::string& interface) { mInterfaces.insert(interface); }
+    void commitRemoveInterface(const std::string& interface) { mInterfaces.erase(interface); }
+    void forgetInterfaces() { mInterfaces.clear(); }
+
   protected:
     explicit Network(unsigned netId, bool secure = false);
     bool canAddUidRanges(const UidRanges& uidRanges) const;
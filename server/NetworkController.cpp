@@ -22,6 +22,9 @@
 // Public functions accessible by external callers should be thread-safe and are responsible for
 // acquiring the lock. Private functions in this file should call xxxLocked() methods and access
 // internal state directly.
+//
+// Public functions that change the networks also take mWriteLock, and program the kernel without
+// holding mRWLock. See NetworkController.h.
 
 #define LOG_TAG "Netd"
 
@@ -30,13 +33,19 @@
 #include <android-base/strings.h>
 #include <cutils/misc.h>  // FIRST_APPLICATION_UID
 #include <netd_resolv/resolv.h>
+#include <arpa/inet.h>
 #include <net/if.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+#include <set>
 #include "log/log.h"
 
 #include "Controllers.h"
 #include "DummyNetwork.h"
 #include "Fwmark.h"
 #include "LocalNetwork.h"
+#include "NetlinkCommands.h"
 #include "PhysicalNetwork.h"
 #include "RouteController.h"
 #include "TcUtils.h"
@@ -59,16 +68,94 @@ namespace {
 const unsigned MIN_NET_ID = 100;
 const unsigned MAX_NET_ID = 65535;
 
+// Whether |netId| is one that the framework creates networks with, as opposed to the networks that
+// NetworkController creates itself.
+bool isFrameworkNetId(unsigned netId) {
+    return (MIN_NET_ID <= netId && netId <= MAX_NET_ID) ||
+           (NetworkController::MIN_OEM_ID <= netId && netId <= NetworkController::MAX_OEM_ID);
+}
+
+// Snapshot records store UID ranges as the first and last UID of each range.
+std::vector<uint32_t> uidRangesToValues(const UidRanges& uidRanges) {
+    std::vector<uint32_t> values;
+    for (const auto& range : uidRanges.getRanges()) {
+        values.push_back(range.start);
+        values.push_back(range.stop);
+    }
+    return values;
+}
+
+UidRanges valuesToUidRanges(const std::vector<uint32_t>& values) {
+    std::vector<UidRangeParcel> ranges;
+    for (size_t i = 0; i + 1 < values.size(); i += 2) {
+        UidRangeParcel range;
+        range.start = values[i];
+        range.stop = values[i + 1];
+        ranges.push_back(range);
+    }
+    return UidRanges(ranges);
+}
+
+// The permission of a UID that has not been given one by setPermissionForUsers().
+Permission getDefaultPermissionForUser(uid_t uid) {
+    return uid < FIRST_APPLICATION_UID ? PERMISSION_SYSTEM : PERMISSION_NONE;
+}
+
+std::string addressToString(const in6_addr& address) {
+    char addrstr[INET6_ADDRSTRLEN];
+    if (IN6_IS_ADDR_V4MAPPED(&address)) {
+        inet_ntop(AF_INET, &address.s6_addr[12], addrstr, sizeof(addrstr));
+    } else {
+        inet_ntop(AF_INET6, &address, addrstr, sizeof(addrstr));
+    }
+    return addrstr;
+}
+
 }  // namespace
 
-// All calls to methods here are made while holding a write lock on mRWLock.
+bool IfindexSet::insert(unsigned ifindex) {
+    if (std::find(begin(), end(), ifindex) != end()) return false;
+    if (mOverflow.empty() && mSize < kInlineSize) {
+        mInline[mSize++] = ifindex;
+        return true;
+    }
+    if (mOverflow.empty()) {
+        mOverflow.assign(mInline, mInline + mSize);
+    }
+    mOverflow.push_back(ifindex);
+    mSize++;
+    return true;
+}
+
+bool IfindexSet::erase(unsigned ifindex) {
+    unsigned* data = mOverflow.empty() ? mInline : mOverflow.data();
+    unsigned* last = data + mSize;
+    unsigned* it = std::find(data, last, ifindex);
+    if (it == last) return false;
+    *it = *(last - 1);
+    mSize--;
+    if (!mOverflow.empty()) mOverflow.pop_back();
+    return true;
+}
+
+size_t In6AddrHash::operator()(const in6_addr& addr) const {
+    uint64_t words[2];
+    memcpy(words, &addr, sizeof(words));
+    return std::hash<uint64_t>()(words[0] ^ (words[1] * 0x9e3779b97f4a7c15ULL));
+}
+
+bool In6AddrEqual::operator()(const in6_addr& a, const in6_addr& b) const {
+    return IN6_ARE_ADDR_EQUAL(&a, &b);
+}
+
+// All calls to methods here are made while holding mWriteLock, which is enough to read mNetworks.
 // They are mostly not called directly from this class, but from methods in PhysicalNetwork.cpp.
 // However, we're the only user of that class, so all calls to those methods come from here and are
 // made under lock.
-// For example, PhysicalNetwork::setPermission ends up calling addFallthrough and removeFallthrough,
-// but it's only called from here under lock (specifically, from createPhysicalNetworkLocked and
+// For example, PhysicalNetwork::applyPermission ends up calling addFallthrough and
+// removeFallthrough, but it's only called from here under lock (specifically, from
 // setPermissionForNetworks).
-// TODO: use std::mutex and GUARDED_BY instead of manual inspection.
+// TODO: use GUARDED_BY instead of manual inspection.
 class NetworkController::DelegateImpl : public PhysicalNetwork::Delegate {
   public:
     explicit DelegateImpl(NetworkController* networkController);
@@ -148,7 +235,11 @@ NetworkController::NetworkController() :
     mNetworks[LOCAL_NET_ID] = new LocalNetwork(LOCAL_NET_ID);
     mNetworks[DUMMY_NET_ID] = new DummyNetwork(DUMMY_NET_ID);
     mNetworks[UNREACHABLE_NET_ID] = new UnreachableNetwork(UNREACHABLE_NET_ID);
+    publishUidAllowlistLocked();
+    gLog.info("leave NetworkController ctor");
+}
 
+void NetworkController::removeClsactQdiscs() {
     // Clear all clsact stubs on all interfaces.
     // TODO: perhaps only remove the clsact on the interface which is added by
     // RouteController::addInterfaceToPhysicalNetwork. Currently, the netd only
@@ -162,7 +253,6 @@ NetworkController::NetworkController() :
             }
         }
     }
-    gLog.info("leave NetworkController ctor");
 }
 
 unsigned NetworkController::getDefaultNetwork() const {
@@ -171,12 +261,15 @@ unsigned NetworkController::getDefaultNetwork() const {
 }
 
 int NetworkController::setDefaultNetwork(unsigned netId) {
-    ScopedWLock lock(mRWLock);
+    std::lock_guard writeLock(mWriteLock);
 
-    if (netId == mDefaultNetId) {
+    // A restored default network must be added as the default again, because the framework may
+    // have created it again since.
+    if (netId == mDefaultNetId && !mDefaultNetworkRestored) {
         return 0;
     }
 
+    PhysicalNetwork* newDefault = nullptr;
     if (netId != NETID_UNSET) {
         Network* network = getNetworkLocked(netId);
         if (!network) {
@@ -187,23 +280,40 @@ int NetworkController::setDefaultNetwork(unsigned netId) {
             ALOGE("cannot set default to non-physical network with netId %u", netId);
             return -EINVAL;
         }
-        if (int ret = static_cast<PhysicalNetwork*>(network)->addAsDefault()) {
-            return ret;
-        }
+        newDefault = static_cast<PhysicalNetwork*>(network);
     }
 
-    if (mDefaultNetId != NETID_UNSET) {
+    PhysicalNetwork* oldDefault = nullptr;
+    if (mDefaultNetId != NETID_UNSET && mDefaultNetId != netId) {
         Network* network = getNetworkLocked(mDefaultNetId);
         if (!network || !network->isPhysical()) {
             ALOGE("cannot find previously set default network with netId %u", mDefaultNetId);
             return -ESRCH;
         }
-        if (int ret = static_cast<PhysicalNetwork*>(network)->removeAsDefault()) {
+        oldDefault = static_cast<PhysicalNetwork*>(network);
+    }
+
+    if (newDefault) {
+        if (int ret = newDefault->applyAddAsDefault()) {
             return ret;
         }
     }
+    const int ret = oldDefault ? oldDefault->applyRemoveAsDefault() : 0;
+
+    ScopedWLock lock(mRWLock);
+    if (newDefault) newDefault->commitAsDefault(true);
+    // If the old default network cannot be removed, the new one keeps its rules as the default, but
+    // mDefaultNetId does not change.
+    if (ret) {
+        return ret;
+    }
+    if (oldDefault) oldDefault->commitAsDefault(false);
 
     mDefaultNetId = netId;
+    mDefaultNetworkRestored = false;
+    updateConnectMarksLocked();
+    publishUidAllowlistLocked();
+    appendToSnapshotLocked({{.type = NetworkSnapshot::DEFAULT_NETWORK, .netId = netId}});
     return 0;
 }
 
@@ -395,32 +505,39 @@ bool NetworkController::isVirtualNetworkLocked(unsigned netId) const {
 
 int NetworkController::createPhysicalNetworkLocked(unsigned netId, Permission permission,
                                                    bool local) {
-    if (!((MIN_NET_ID <= netId && netId <= MAX_NET_ID) ||
-          (MIN_OEM_ID <= netId && netId <= MAX_OEM_ID))) {
+    if (!isFrameworkNetId(netId)) {
         ALOGE("invalid netId %u", netId);
         return -EINVAL;
     }
 
+    // A restored network with the same netId is replaced, and so must be in the snapshot.
+    NetworkSnapshot::Records records;
+    dropRestoredNetworkLocked(netId, &records);
     if (isValidNetworkLocked(netId)) {
         ALOGE("duplicate netId %u", netId);
         return -EEXIST;
     }
 
+    // A network without interfaces has no rules that depend on its permission.
     PhysicalNetwork* physicalNetwork = new PhysicalNetwork(netId, mDelegateImpl, local);
-    if (int ret = physicalNetwork->setPermission(permission)) {
-        ALOGE("inconceivable! setPermission cannot fail on an empty network");
-        delete physicalNetwork;
-        return ret;
-    }
-
+    physicalNetwork->commitPermission(permission);
     mNetworks[netId] = physicalNetwork;
 
+    publishUidAllowlistLocked();
     updateTcpSocketMonitorPolling();
+    records.push_back({
+            .type = NetworkSnapshot::PHYSICAL_NETWORK,
+            .flags = local ? NetworkSnapshot::FLAG_LOCAL : static_cast<uint16_t>(0),
+            .netId = netId,
+            .value = static_cast<uint32_t>(permission),
+    });
+    appendToSnapshotLocked(records);
 
     return 0;
 }
 
 int NetworkController::createPhysicalNetwork(unsigned netId, Permission permission, bool local) {
+    std::lock_guard writeLock(mWriteLock);
     ScopedWLock lock(mRWLock);
     return createPhysicalNetworkLocked(netId, permission, local);
 }
@@ -430,9 +547,10 @@ int NetworkController::createPhysicalOemNetwork(Permission permission, unsigned
         return -EINVAL;
     }
 
+    std::lock_guard writeLock(mWriteLock);
     ScopedWLock lock(mRWLock);
     for (*pNetId = MIN_OEM_ID; *pNetId <= MAX_OEM_ID; (*pNetId)++) {
-        if (!isValidNetworkLocked(*pNetId)) {
+        if (!isValidNetworkLocked(*pNetId) || mRestoredNetIds.count(*pNetId)) {
             break;
         }
     }
@@ -453,13 +571,21 @@ int NetworkController::createPhysicalOemNetwork(Permission permission, unsigned
 
 int NetworkController::createVirtualNetwork(unsigned netId, bool secure, NativeVpnType vpnType,
                                             bool excludeLocalRoutes) {
-    ScopedWLock lock(mRWLock);
+    std::lock_guard writeLock(mWriteLock);
 
     if (!(MIN_NET_ID <= netId && netId <= MAX_NET_ID)) {
         ALOGE("invalid netId %u", netId);
         return -EINVAL;
     }
 
+    if (mRestoredNetIds.count(netId)) {
+        // Recorded right away, so that the snapshot never brings back the restored network even if
+        // the new one fails to be created.
+        ScopedWLock lock(mRWLock);
+        NetworkSnapshot::Records records;
+        dropRestoredNetworkLocked(netId, &records);
+        appendToSnapshotLocked(records);
+    }
     if (isValidNetworkLocked(netId)) {
         ALOGE("duplicate netId %u", netId);
         return -EEXIST;
@@ -473,12 +599,23 @@ int NetworkController::createVirtualNetwork(unsigned netId, bool secure, NativeV
     if (int ret = modifyFallthroughLocked(netId, true)) {
         return ret;
     }
+
+    ScopedWLock lock(mRWLock);
     mNetworks[netId] = new VirtualNetwork(netId, secure, excludeLocalRoutes);
+    publishUidAllowlistLocked();
+    appendToSnapshotLocked({{
+            .type = NetworkSnapshot::VIRTUAL_NETWORK,
+            .flags = static_cast<uint16_t>((secure ? NetworkSnapshot::FLAG_SECURE : 0) |
+                                           (excludeLocalRoutes
+                                                    ? NetworkSnapshot::FLAG_EXCLUDE_LOCAL_ROUTES
+                                                    : 0)),
+            .netId = netId,
+    }});
     return 0;
 }
 
 int NetworkController::destroyNetwork(unsigned netId) {
-    ScopedWLock lock(mRWLock);
+    std::lock_guard writeLock(mWriteLock);
 
     if (netId == LOCAL_NET_ID || netId == UNREACHABLE_NET_ID) {
         ALOGE("cannot destroy local or unreachable network");
@@ -491,62 +628,88 @@ int NetworkController::destroyNetwork(unsigned netId) {
 
     // TODO: ioctl(SIOCKILLADDR, ...) to kill all sockets on the old network.
 
+    // Unlike the other changes, the network is removed from the model first, so that nothing
+    // selects it while its rules are being deleted. It is then only reachable from here, and
+    // mWriteLock keeps anything else from programming the kernel until it is gone.
     Network* network = getNetworkLocked(netId);
+    {
+        ScopedWLock lock(mRWLock);
+        mNetworks.erase(netId);
+        mRestoredNetIds.erase(netId);
+        if (mDefaultNetId == netId) {
+            mDefaultNetId = NETID_UNSET;
+            mDefaultNetworkRestored = false;
+        }
+
+        {
+            std::lock_guard addressLock(mAddressLock);
+            for (auto iter = mIfindexToLastNetwork.begin(); iter != mIfindexToLastNetwork.end();) {
+                if (iter->second.netId == netId) {
+                    iter = mIfindexToLastNetwork.erase(iter);
+                } else {
+                    ++iter;
+                }
+            }
+        }
+
+        updateConnectMarksLocked();
+        publishUidAllowlistLocked();
+        updateTcpSocketMonitorPolling();
+        appendToSnapshotLocked({{.type = NetworkSnapshot::DESTROY_NETWORK, .netId = netId}});
+    }
 
     // If we fail to destroy a network, things will get stuck badly. Therefore, unlike most of the
     // other network code, ignore failures and attempt to clear out as much state as possible, even
     // if we hit an error on the way. Return the first error that we see.
+    // If it was the default network, removing its interfaces also removes their default rules.
+    // clearInterfaces() goes on after an interface that fails, so the others don't keep theirs.
     int ret = network->clearInterfaces();
-
-    if (mDefaultNetId == netId) {
-        if (int err = static_cast<PhysicalNetwork*>(network)->removeAsDefault()) {
-            ALOGE("inconceivable! removeAsDefault cannot fail on an empty network");
-            if (!ret) {
-                ret = err;
-            }
-        }
-        mDefaultNetId = NETID_UNSET;
-    } else if (network->isVirtual()) {
+    if (network->isVirtual()) {
         if (int err = modifyFallthroughLocked(netId, false)) {
             if (!ret) {
                 ret = err;
             }
         }
     }
-    mNetworks.erase(netId);
     delete network;
 
-    for (auto iter = mIfindexToLastNetId.begin(); iter != mIfindexToLastNetId.end();) {
-        if (iter->second == netId) {
-            iter = mIfindexToLastNetId.erase(iter);
-        } else {
-            ++iter;
-        }
-    }
-
-    updateTcpSocketMonitorPolling();
-
     return ret;
 }
 
 int NetworkController::addInterfaceToNetwork(unsigned netId, const char* interface) {
-    ScopedWLock lock(mRWLock);
+    std::lock_guard writeLock(mWriteLock);
 
-    if (!isValidNetworkLocked(netId)) {
+    Network* network = getNetworkLocked(netId);
+    if (!network) {
         ALOGE("no such netId %u", netId);
         return -ENONET;
     }
 
     unsigned existingNetId = getNetworkForInterfaceLocked(interface);
-    if (existingNetId != NETID_UNSET && existingNetId != netId) {
+    // A network restored from the snapshot that the framework has not created again gives up the
+    // interface. Its rules and routes are deleted when reconciling, so there is nothing to remove.
+    const bool takeFromRestored = existingNetId != NETID_UNSET && existingNetId != netId &&
+                                  mRestoredNetIds.count(existingNetId);
+    if (existingNetId != NETID_UNSET && existingNetId != netId && !takeFromRestored) {
         ALOGE("interface %s already assigned to netId %u", interface, existingNetId);
         return -EBUSY;
     }
-    if (int ret = getNetworkLocked(netId)->addInterface(interface)) {
+    if (int ret = network->applyAddInterface(interface)) {
         return ret;
     }
 
-    // Only populate mIfindexToLastNetId for non-local networks, because for these getIfIndex will
+    ScopedWLock lock(mRWLock);
+    if (takeFromRestored) {
+        ALOGI("Moving interface %s from restored netId %u to netId %u", interface, existingNetId,
+              netId);
+        getNetworkLocked(existingNetId)->commitRemoveInterface(interface);
+        appendToSnapshotLocked({{.type = NetworkSnapshot::REMOVE_INTERFACE,
+                                 .netId = existingNetId,
+                                 .interface = interface}});
+    }
+    network->commitAddInterface(interface);
+
+    // Only populate mIfindexToLastNetwork for non-local networks, because for these getIfIndex will
     // return 0. That's fine though, because that map is only used to prevent force-closing sockets
     // when the same IP address is handed over from one interface to another interface that is in
     // the same network but not in the same netId (for now this is done only on VPNs). That is not
@@ -555,24 +718,40 @@ int NetworkController::addInterfaceToNetwork(unsigned netId, const char* interfa
     if (netId != LOCAL_NET_ID) {
         int ifIndex = RouteController::getIfIndex(interface);
         if (ifIndex) {
-            mIfindexToLastNetId[ifIndex] = netId;
+            std::lock_guard addressLock(mAddressLock);
+            mIfindexToLastNetwork[ifIndex] = {netId, network->isVirtual()};
         } else {
-            // Cannot happen, since addInterface() above will have failed.
+            // Cannot happen, since applyAddInterface() above will have failed.
             ALOGE("inconceivable! added interface %s with no index", interface);
         }
+        appendToSnapshotLocked({{
+                .type = NetworkSnapshot::ADD_INTERFACE,
+                .netId = netId,
+                .value = static_cast<uint32_t>(ifIndex),
+                .interface = interface,
+        }});
     }
     return 0;
 }
 
 int NetworkController::removeInterfaceFromNetwork(unsigned netId, const char* interface) {
-    ScopedWLock lock(mRWLock);
+    std::lock_guard writeLock(mWriteLock);
 
-    if (!isValidNetworkLocked(netId)) {
+    Network* network = getNetworkLocked(netId);
+    if (!network) {
         ALOGE("no such netId %u", netId);
         return -ENONET;
     }
 
-    return getNetworkLocked(netId)->removeInterface(interface);
+    if (int ret = network->applyRemoveInterface(interface)) {
+        return ret;
+    }
+
+    ScopedWLock lock(mRWLock);
+    network->commitRemoveInterface(interface);
+    appendToSnapshotLocked(
+            {{.type = NetworkSnapshot::REMOVE_INTERFACE, .netId = netId, .interface = interface}});
+    return 0;
 }
 
 Permission NetworkController::getPermissionForUser(uid_t uid) const {
@@ -582,10 +761,17 @@ Permission NetworkController::getPermissionForUser(uid_t uid) const {
 
 void NetworkController::setPermissionForUsers(Permission permission,
                                               const std::vector<uid_t>& uids) {
+    std::lock_guard writeLock(mWriteLock);
     ScopedWLock lock(mRWLock);
     for (uid_t uid : uids) {
         mUsers[uid] = permission;
     }
+    updateConnectMarksLocked();
+    appendToSnapshotLocked({{
+            .type = NetworkSnapshot::USER_PERMISSION,
+            .value = static_cast<uint32_t>(permission),
+            .values = std::vector<uint32_t>(uids.begin(), uids.end()),
+    }});
 }
 
 int NetworkController::checkUserNetworkAccess(uid_t uid, unsigned netId) const {
@@ -595,7 +781,8 @@ int NetworkController::checkUserNetworkAccess(uid_t uid, unsigned netId) const {
 
 int NetworkController::setPermissionForNetworks(Permission permission,
                                                 const std::vector<unsigned>& netIds) {
-    ScopedWLock lock(mRWLock);
+    std::lock_guard writeLock(mWriteLock);
+    std::vector<PhysicalNetwork*> networks;
     for (unsigned netId : netIds) {
         Network* network = getNetworkLocked(netId);
         if (!network) {
@@ -606,12 +793,75 @@ int NetworkController::setPermissionForNetworks(Permission permission,
             ALOGE("cannot set permissions on non-physical network with netId %u", netId);
             return -EINVAL;
         }
+        networks.push_back(static_cast<PhysicalNetwork*>(network));
+    }
 
-        if (int ret = static_cast<PhysicalNetwork*>(network)->setPermission(permission)) {
-            return ret;
+    // Only networks that have interfaces have rules to change and sockets to destroy.
+    std::map<unsigned, Permission> changes;
+    for (const PhysicalNetwork* network : networks) {
+        if (network->getPermission() != permission && !network->getInterfaces().empty()) {
+            changes[network->getNetId()] = permission;
         }
     }
-    return 0;
+
+    // Destroy the sockets of all the networks with one dump, and commit all their rule changes
+    // with one netlink batch, instead of doing both once per network.
+    PhysicalNetwork::destroySocketsLackingPermission(changes);
+    int ret = 0;
+    // The batch requests of each network that was applied, so that a failed request is only held
+    // against the network that it was for.
+    std::vector<std::pair<size_t, size_t>> requests;
+    std::vector<bool> changed(networks.size(), false);
+    {
+        NetlinkBatch batch;
+        for (const PhysicalNetwork* network : networks) {
+            const size_t first = batch.size();
+            if ((ret = network->applyPermission(permission))) {
+                break;
+            }
+            requests.push_back({first, batch.size()});
+        }
+        if (int err = batch.flush()) {
+            ALOGE("failed to change permission of %zu networks to %s", changes.size(),
+                  permissionToName(permission));
+            if (!ret) ret = err;
+        }
+
+        const std::vector<int>& results = batch.results();
+        for (size_t i = 0; i < requests.size(); i++) {
+            changed[i] = true;
+            for (size_t j = requests[i].first; j < requests[i].second && j < results.size(); j++) {
+                if (results[j]) changed[i] = false;
+            }
+        }
+    }
+
+    std::map<unsigned, Permission> committedChanges;
+    {
+        // Only the networks whose requests all succeeded have changed.
+        ScopedWLock lock(mRWLock);
+        NetworkSnapshot::Records records;
+        for (size_t i = 0; i < networks.size(); i++) {
+            const unsigned netId = networks[i]->getNetId();
+            if (changed[i]) {
+                networks[i]->commitPermission(permission);
+                if (changes.count(netId)) committedChanges[netId] = permission;
+            }
+            records.push_back({
+                    .type = NetworkSnapshot::NETWORK_PERMISSION,
+                    .netId = netId,
+                    .value = static_cast<uint32_t>(networks[i]->getPermission()),
+            });
+        }
+        appendToSnapshotLocked(records);
+    }
+
+    // Destroy sockets again in case any were opened after the first pass and before the rules
+    // changed. These sockets won't be able to send any RST packets because they are now no longer
+    // routed, but at least the apps will get errors. The networks that kept their permission keep
+    // their sockets too.
+    PhysicalNetwork::destroySocketsLackingPermission(committedChanges);
+    return ret;
 }
 
 namespace {
@@ -633,22 +883,48 @@ int isWrongNetworkForUidRanges(unsigned netId, Network* network) {
 
 int NetworkController::addUsersToNetwork(unsigned netId, const UidRanges& uidRanges,
                                          int32_t subPriority) {
-    ScopedWLock lock(mRWLock);
+    std::lock_guard writeLock(mWriteLock);
     Network* network = getNetworkLocked(netId);
     if (int ret = isWrongNetworkForUidRanges(netId, network)) {
         return ret;
     }
-    return network->addUsers(uidRanges, subPriority);
+    if (int ret = network->applyAddUsers(uidRanges, subPriority)) {
+        return ret;
+    }
+
+    ScopedWLock lock(mRWLock);
+    network->addToUidRangeMap(uidRanges, subPriority);
+    updateConnectMarksLocked();
+    appendToSnapshotLocked({{
+            .type = NetworkSnapshot::ADD_USERS,
+            .netId = netId,
+            .value = static_cast<uint32_t>(subPriority),
+            .values = uidRangesToValues(uidRanges),
+    }});
+    return 0;
 }
 
 int NetworkController::removeUsersFromNetwork(unsigned netId, const UidRanges& uidRanges,
                                               int32_t subPriority) {
-    ScopedWLock lock(mRWLock);
+    std::lock_guard writeLock(mWriteLock);
     Network* network = getNetworkLocked(netId);
     if (int ret = isWrongNetworkForUidRanges(netId, network)) {
         return ret;
     }
-    return network->removeUsers(uidRanges, subPriority);
+    if (int ret = network->applyRemoveUsers(uidRanges, subPriority)) {
+        return ret;
+    }
+
+    ScopedWLock lock(mRWLock);
+    network->removeFromUidRangeMap(uidRanges, subPriority);
+    updateConnectMarksLocked();
+    appendToSnapshotLocked({{
+            .type = NetworkSnapshot::REMOVE_USERS,
+            .netId = netId,
+            .value = static_cast<uint32_t>(subPriority),
+            .values = uidRangesToValues(uidRanges),
+    }});
+    return 0;
 }
 
 int NetworkController::addRoute(unsigned netId, const char* interface, const char* destination,
@@ -656,6 +932,81 @@ int NetworkController::addRoute(unsigned netId, const char* interface, const cha
     return modifyRoute(netId, interface, destination, nexthop, ROUTE_ADD, legacy, uid, mtu);
 }
 
+int NetworkController::addRoutes(unsigned netId, const std::vector<RouteInfoParcel>& routes,
+                                 std::vector<int>* results) {
+    // Routes are added with mWriteLock, so that they cannot race with an interface being added to
+    // or removed from the network.
+    std::lock_guard writeLock(mWriteLock);
+
+    results->assign(routes.size(), 0);
+    if (!isValidNetworkLocked(netId)) {
+        ALOGE("no such netId %u", netId);
+        results->assign(routes.size(), -ENONET);
+        return -ENONET;
+    }
+
+    // Check every route before installing any of them, so that a bad route doesn't leave the
+    // network with half of the set.
+    int ret = 0;
+    for (size_t i = 0; i < routes.size(); i++) {
+        const RouteInfoParcel& route = routes[i];
+        int err = 0;
+        uint8_t family;
+        uint8_t prefixLength;
+        uint8_t rawAddress[sizeof(in6_addr)];
+        unsigned existingNetId = getNetworkForInterfaceLocked(route.ifName.c_str());
+        if (existingNetId == NETID_UNSET) {
+            err = -ENODEV;
+        } else if (existingNetId != netId) {
+            err = -ENOENT;
+        } else if (int len = parsePrefix(route.destination.c_str(), &family, rawAddress,
+                                         sizeof(rawAddress), &prefixLength);
+                   len < 0) {
+            err = len;
+        }
+        if (err) {
+            ALOGE("cannot add route %s via %s to netId %u: %s", route.destination.c_str(),
+                  route.ifName.c_str(), netId, strerror(-err));
+            (*results)[i] = err;
+            if (!ret) ret = err;
+        }
+    }
+    if (ret) {
+        for (int& result : *results) {
+            if (!result) result = -ECANCELED;
+        }
+        return ret;
+    }
+
+    const RouteController::TableType tableType =
+            (netId == LOCAL_NET_ID) ? RouteController::LOCAL_NETWORK : RouteController::INTERFACE;
+
+    // Each route queues one or two requests. Remember which ones, so that the result of every
+    // route can be found in the batch results.
+    NetlinkBatch batch;
+    std::vector<std::pair<size_t, size_t>> requests(routes.size());
+    for (size_t i = 0; i < routes.size(); i++) {
+        const RouteInfoParcel& route = routes[i];
+        const size_t first = batch.size();
+        (*results)[i] = RouteController::addRoute(
+                route.ifName.c_str(), route.destination.c_str(),
+                route.nextHop.empty() ? nullptr : route.nextHop.c_str(), tableType, route.mtu,
+                0 /* priority */);
+        requests[i] = {first, batch.size()};
+    }
+    ret = batch.flush();
+
+    const std::vector<int>& batchResults = batch.results();
+    for (size_t i = 0; i < routes.size(); i++) {
+        for (size_t j = requests[i].first; j < requests[i].second && j < batchResults.size();
+             j++) {
+            if (!(*results)[i]) (*results)[i] = batchResults[j];
+        }
+        if (!ret) ret = (*results)[i];
+    }
+    return ret;
+}
+
 int NetworkController::updateRoute(unsigned netId, const char* interface, const char* destination,
                                    const char* nexthop, bool legacy, uid_t uid, int mtu) {
     return modifyRoute(netId, interface, destination, nexthop, ROUTE_UPDATE, legacy, uid, mtu);
@@ -666,48 +1017,52 @@ int NetworkController::removeRoute(unsigned netId, const char* interface, const
     return modifyRoute(netId, interface, destination, nexthop, ROUTE_REMOVE, legacy, uid, 0);
 }
 
-void NetworkController::addInterfaceAddress(unsigned ifIndex, const char* address) {
-    ScopedWLock lock(mRWLock);
+void NetworkController::addInterfaceAddress(unsigned ifIndex, const in6_addr& address) {
+    std::lock_guard lock(mAddressLock);
     if (ifIndex == 0) {
-        ALOGE("Attempting to add address %s without ifindex", address);
+        ALOGE("Attempting to add address %s without ifindex", addressToString(address).c_str());
         return;
     }
     mAddressToIfindices[address].insert(ifIndex);
 }
 
 // Returns whether we should call SOCK_DESTROY on the removed address.
-bool NetworkController::removeInterfaceAddress(unsigned ifindex, const char* address) {
-    ScopedWLock lock(mRWLock);
+bool NetworkController::removeInterfaceAddress(unsigned ifindex, const in6_addr& address) {
+    std::lock_guard lock(mAddressLock);
     // First, update mAddressToIfindices map
     auto ifindicesIter = mAddressToIfindices.find(address);
     if (ifindicesIter == mAddressToIfindices.end()) {
-        ALOGE("Removing unknown address %s from ifindex %u", address, ifindex);
+        ALOGE("Removing unknown address %s from ifindex %u", addressToString(address).c_str(),
+              ifindex);
         return true;
     }
-    std::unordered_set<unsigned>& ifindices = ifindicesIter->second;
-    if (ifindices.erase(ifindex) > 0) {
-        if (ifindices.size() == 0) {
+    IfindexSet& ifindices = ifindicesIter->second;
+    if (ifindices.erase(ifindex)) {
+        if (ifindices.empty()) {
             mAddressToIfindices.erase(ifindicesIter);  // Invalidates ifindices
             // The address is no longer configured on any interface.
             return true;
         }
     } else {
-        ALOGE("No record of address %s on interface %u", address, ifindex);
+        ALOGE("No record of address %s on interface %u", addressToString(address).c_str(),
+              ifindex);
         return true;
     }
     // Then, check for VPN handover condition
-    if (mIfindexToLastNetId.find(ifindex) == mIfindexToLastNetId.end()) {
+    auto lastNetworkIter = mIfindexToLastNetwork.find(ifindex);
+    if (lastNetworkIter == mIfindexToLastNetwork.end()) {
         ALOGW("Interface index %u was never in a currently-connected non-local netId", ifindex);
         return true;
     }
-    unsigned lastNetId = mIfindexToLastNetId[ifindex];
+    const unsigned lastNetId = lastNetworkIter->second.netId;
     for (unsigned idx : ifindices) {
-        unsigned activeNetId = mIfindexToLastNetId[idx];
+        auto activeNetworkIter = mIfindexToLastNetwork.find(idx);
+        if (activeNetworkIter == mIfindexToLastNetwork.end()) continue;
         // If this IP address is still assigned to another interface in the same network,
         // then we don't need to destroy sockets on it because they are likely still valid.
         // For now we do this only on VPNs.
         // TODO: evaluate extending this to all network types.
-        if (lastNetId == activeNetId && isVirtualNetworkLocked(activeNetId)) {
+        if (lastNetId == activeNetworkIter->second.netId && activeNetworkIter->second.isVirtual) {
             return false;
         }
     }
@@ -725,13 +1080,23 @@ bool NetworkController::canProtect(uid_t uid) const {
 }
 
 void NetworkController::allowProtect(uid_t uid) {
+    std::lock_guard writeLock(mWriteLock);
     ScopedWLock lock(mRWLock);
     mProtectableUsers.insert(uid);
+    appendToSnapshotLocked({{
+            .type = NetworkSnapshot::PROTECTABLE_USERS,
+            .values = std::vector<uint32_t>(mProtectableUsers.begin(), mProtectableUsers.end()),
+    }});
 }
 
 void NetworkController::denyProtect(uid_t uid) {
+    std::lock_guard writeLock(mWriteLock);
     ScopedWLock lock(mRWLock);
     mProtectableUsers.erase(uid);
+    appendToSnapshotLocked({{
+            .type = NetworkSnapshot::PROTECTABLE_USERS,
+            .values = std::vector<uint32_t>(mProtectableUsers.begin(), mProtectableUsers.end()),
+    }});
 }
 
 void NetworkController::dump(DumpWriter& dw) {
@@ -769,22 +1134,29 @@ void NetworkController::dump(DumpWriter& dw) {
     }
     dw.decIndent();
 
-    dw.blankline();
-    dw.println("Interface <-> last network map:");
-    dw.incIndent();
-    for (const auto& i : mIfindexToLastNetId) {
-        dw.println("Ifindex: %u NetId: %u", i.first, i.second);
+    {
+        std::lock_guard addressLock(mAddressLock);
+        dw.blankline();
+        dw.println("Interface <-> last network map:");
+        dw.incIndent();
+        for (const auto& i : mIfindexToLastNetwork) {
+            dw.println("Ifindex: %u NetId: %u", i.first, i.second.netId);
+        }
+        dw.decIndent();
+
+        dw.blankline();
+        dw.println("Interface addresses:");
+        dw.incIndent();
+        for (const auto& i : mAddressToIfindices) {
+            dw.println("address: %s ifindices: [%s]", addressToString(i.first).c_str(),
+                       android::base::Join(std::vector<unsigned>(i.second.begin(), i.second.end()),
+                                           ", ").c_str());
+        }
+        dw.decIndent();
     }
-    dw.decIndent();
 
     dw.blankline();
-    dw.println("Interface addresses:");
-    dw.incIndent();
-    for (const auto& i : mAddressToIfindices) {
-        dw.println("address: %s ifindices: [%s]", i.first.c_str(),
-                android::base::Join(i.second, ", ").c_str());
-    }
-    dw.decIndent();
+    RouteController::dump(dw);
 
     dw.blankline();
     dw.println("Permission of users:");
@@ -805,11 +1177,352 @@ void NetworkController::dump(DumpWriter& dw) {
     dw.blankline();
     dw.println("Protectable users: %s", android::base::Join(mProtectableUsers, ", ").c_str());
 
+    dw.blankline();
+    mConnectMarkMap.dump(dw);
+    mUidAllowlist.dump(dw);
+    mSnapshot.dump(dw);
+    if (!mRestoredNetIds.empty()) {
+        dw.println("Restored networks not created again: %s",
+                   android::base::Join(mRestoredNetIds, ", ").c_str());
+    }
+
     dw.decIndent();
 
     dw.decIndent();
 }
 
+int NetworkController::enableConnectMarkMap() {
+    std::lock_guard writeLock(mWriteLock);
+    ScopedWLock lock(mRWLock);
+    if (int ret = mConnectMarkMap.init()) {
+        return ret;
+    }
+    return mConnectMarkMap.update(getConnectMarksLocked());
+}
+
+// Returns the connect mark map entries for the current state. Each UID maps to the netId and
+// permission bits that FwmarkServer sets on ON_CONNECT for a socket that has neither selected a
+// network explicitly nor been protected from VPNs.
+ConnectMarkMap::Entries NetworkController::getConnectMarksLocked() const {
+    const auto connectMark = [](unsigned netId, Permission permission) {
+        Fwmark fwmark;
+        fwmark.netId = netId;
+        fwmark.permission = permission;
+        fwmark.kernelMarked = true;
+        return fwmark.intValue;
+    };
+
+    // getNetworkForConnectLocked() can only change at the edges of the UID ranges that select a
+    // default network, and the default permission only changes at FIRST_APPLICATION_UID. Between
+    // two consecutive boundaries, every UID without a permission of its own has the same mark.
+    std::set<uint64_t> boundaries = {0, FIRST_APPLICATION_UID, 1ULL << 32};
+    for (const auto& [_, network] : mNetworks) {
+        if (!network->isPhysical() && !network->isUnreachable()) continue;
+        for (const auto& [subPriority, uidRanges] : network->getUidRangeMap()) {
+            if (subPriority == UidRanges::SUB_PRIORITY_NO_DEFAULT) continue;
+            for (const auto& range : uidRanges.getRanges()) {
+                boundaries.insert(static_cast<uint32_t>(range.start));
+                boundaries.insert(static_cast<uint64_t>(static_cast<uint32_t>(range.stop)) + 1);
+            }
+        }
+    }
+
+    ConnectMarkMap::Entries entries;
+    // The network of the UIDs from each boundary up to the next one.
+    std::map<uid_t, unsigned> networks;
+    uid_t runStart = 0;
+    uint32_t runMark = 0;
+    for (auto it = boundaries.begin(); *it < (1ULL << 32); ++it) {
+        const uid_t uid = static_cast<uid_t>(*it);
+        const unsigned netId = getNetworkForConnectLocked(uid);
+        const uint32_t mark = connectMark(netId, getDefaultPermissionForUser(uid));
+        networks[uid] = netId;
+        if (uid != 0 && mark != runMark) {
+            ConnectMarkMap::addRange(&entries, runStart, uid - 1, runMark);
+            runStart = uid;
+        }
+        runMark = mark;
+    }
+    ConnectMarkMap::addRange(&entries, runStart, UINT32_MAX, runMark);
+
+    // UIDs that were given a permission of their own override the range that they are in.
+    for (const auto& [uid, permission] : mUsers) {
+        if (permission == getDefaultPermissionForUser(uid)) continue;
+        const unsigned netId = std::prev(networks.upper_bound(uid))->second;
+        ConnectMarkMap::addRange(&entries, uid, uid, connectMark(netId, permission));
+    }
+    return entries;
+}
+
+void NetworkController::updateConnectMarksLocked() {
+    if (!mConnectMarkMap.isEnabled()) return;
+    // On failure, the map empties and disables itself, and fwmarkd marks every socket again.
+    (void)mConnectMarkMap.update(getConnectMarksLocked());
+}
+
+int NetworkController::openSnapshot(const std::string& path, bool restore) {
+    std::lock_guard writeLock(mWriteLock);
+    ScopedWLock lock(mRWLock);
+    if (restore) {
+        NetworkSnapshot::Records records;
+        if (int ret = NetworkSnapshot::read(path, &records); ret == 0) {
+            restoreSnapshotLocked(records);
+            ALOGI("Restored %zu networks from %zu snapshot records", mRestoredNetIds.size(),
+                  records.size());
+            updateConnectMarksLocked();
+            publishUidAllowlistLocked();
+            updateTcpSocketMonitorPolling();
+        } else if (ret != -ENOENT) {
+            ALOGW("Not restoring networks from %s: %s", path.c_str(), strerror(-ret));
+        }
+    }
+    return mSnapshot.open(path, getSnapshotRecordsLocked());
+}
+
+void NetworkController::finishRestore() {
+    std::lock_guard writeLock(mWriteLock);
+    ScopedWLock lock(mRWLock);
+    finishRestoreLocked();
+}
+
+NetworkSnapshot::Records NetworkController::getSnapshotRecordsLocked() const {
+    NetworkSnapshot::Records records;
+    for (const auto& [netId, network] : mNetworks) {
+        if (!isFrameworkNetId(netId)) continue;
+        if (network->isPhysical()) {
+            const auto* physicalNetwork = static_cast<const PhysicalNetwork*>(network);
+            records.push_back({
+                    .type = NetworkSnapshot::PHYSICAL_NETWORK,
+                    .flags = physicalNetwork->isLocalNetwork() ? NetworkSnapshot::FLAG_LOCAL
+                                                               : static_cast<uint16_t>(0),
+                    .netId = netId,
+                    .value = static_cast<uint32_t>(physicalNetwork->getPermission()),
+            });
+        } else if (network->isVirtual()) {
+            const auto* virtualNetwork = static_cast<const VirtualNetwork*>(network);
+            records.push_back({
+                    .type = NetworkSnapshot::VIRTUAL_NETWORK,
+                    .flags = static_cast<uint16_t>(
+                            (virtualNetwork->isSecure() ? NetworkSnapshot::FLAG_SECURE : 0) |
+                            (virtualNetwork->getExcludeLocalRoutes()
+                                     ? NetworkSnapshot::FLAG_EXCLUDE_LOCAL_ROUTES
+                                     : 0)),
+                    .netId = netId,
+            });
+        } else {
+            continue;
+        }
+        for (const std::string& interface : network->getInterfaces()) {
+            records.push_back({
+                    .type = NetworkSnapshot::ADD_INTERFACE,
+                    .netId = netId,
+                    .value = static_cast<uint32_t>(RouteController::getIfIndex(interface.c_str())),
+                    .interface = interface,
+            });
+        }
+        for (const auto& [subPriority, uidRanges] : network->getUidRangeMap()) {
+            records.push_back({
+                    .type = NetworkSnapshot::ADD_USERS,
+                    .netId = netId,
+                    .value = static_cast<uint32_t>(subPriority),
+                    .values = uidRangesToValues(uidRanges),
+            });
+        }
+        if (const auto& allowedUids = network->getAllowedUids()) {
+            records.push_back({
+                    .type = NetworkSnapshot::ALLOWED_UIDS,
+                    .netId = netId,
+                    .values = uidRangesToValues(*allowedUids),
+            });
+        }
+    }
+    records.push_back({.type = NetworkSnapshot::DEFAULT_NETWORK, .netId = mDefaultNetId});
+
+    std::map<Permission, std::vector<uint32_t>> usersByPermission;
+    for (const auto& [uid, permission] : mUsers) {
+        usersByPermission[permission].push_back(uid);
+    }
+    for (auto& [permission, uids] : usersByPermission) {
+        records.push_back({
+                .type = NetworkSnapshot::USER_PERMISSION,
+                .value = static_cast<uint32_t>(permission),
+                .values = std::move(uids),
+        });
+    }
+    records.push_back({
+            .type = NetworkSnapshot::PROTECTABLE_USERS,
+            .values = std::vector<uint32_t>(mProtectableUsers.begin(), mProtectableUsers.end()),
+    });
+
+    std::lock_guard addressLock(mAddressLock);
+    for (const auto& [ifindex, lastNetwork] : mIfindexToLastNetwork) {
+        if (!isFrameworkNetId(lastNetwork.netId)) continue;
+        records.push_back({
+                .type = NetworkSnapshot::LAST_NETWORK,
+                .flags = lastNetwork.isVirtual ? NetworkSnapshot::FLAG_VIRTUAL
+                                               : static_cast<uint16_t>(0),
+                .netId = lastNetwork.netId,
+                .value = ifindex,
+        });
+    }
+    return records;
+}
+
+void NetworkController::appendToSnapshotLocked(const NetworkSnapshot::Records& records) {
+    if (!mSnapshot.isOpen()) return;
+    int ret = mSnapshot.append(records);
+    if (ret == -ENOSPC) {
+        // The current state already includes |records|.
+        ret = mSnapshot.rewrite(getSnapshotRecordsLocked());
+    }
+    if (ret) {
+        // A snapshot that is missing a change must not be restored.
+        ALOGE("Cannot update the network snapshot, deleting it: %s", strerror(-ret));
+        mSnapshot.close();
+    }
+}
+
+// Only the networks that the framework created are restored, along with the users. The networks
+// that NetworkController creates itself, and the UID ranges of the unreachable network, are left
+// for the framework to set up again.
+void NetworkController::restoreSnapshotLocked(const NetworkSnapshot::Records& records) {
+    for (const auto& record : records) {
+        const unsigned netId = record.netId;
+        Network* network = mRestoredNetIds.count(netId) ? getNetworkLocked(netId) : nullptr;
+        switch (record.type) {
+            case NetworkSnapshot::PHYSICAL_NETWORK: {
+                if (!isFrameworkNetId(netId) || isValidNetworkLocked(netId)) break;
+                auto* physicalNetwork = new PhysicalNetwork(
+                        netId, mDelegateImpl, record.flags & NetworkSnapshot::FLAG_LOCAL);
+                physicalNetwork->commitPermission(static_cast<Permission>(record.value));
+                mNetworks[netId] = physicalNetwork;
+                mRestoredNetIds.insert(netId);
+                break;
+            }
+            case NetworkSnapshot::VIRTUAL_NETWORK:
+                if (!isFrameworkNetId(netId) || isValidNetworkLocked(netId)) break;
+                mNetworks[netId] = new VirtualNetwork(
+                        netId, record.flags & NetworkSnapshot::FLAG_SECURE,
+                        record.flags & NetworkSnapshot::FLAG_EXCLUDE_LOCAL_ROUTES);
+                mRestoredNetIds.insert(netId);
+                break;
+            case NetworkSnapshot::DESTROY_NETWORK:
+                dropRestoredNetworkLocked(netId, nullptr);
+                break;
+            case NetworkSnapshot::ADD_INTERFACE:
+                if (!network) break;
+                // An interface that was removed and created again has another ifindex, and its
+                // routes were deleted with it.
+                if (RouteController::ifNameToIndexFunction(record.interface.c_str()) !=
+                    record.value) {
+                    ALOGW("Not restoring interface %s of netId %u, which no longer exists",
+                          record.interface.c_str(), netId);
+                    break;
+                }
+                network->commitAddInterface(record.interface);
+                RouteController::restoreInterface(record.interface.c_str());
+                {
+                    std::lock_guard addressLock(mAddressLock);
+                    mIfindexToLastNetwork[record.value] = {netId, network->isVirtual()};
+                }
+                break;
+            case NetworkSnapshot::REMOVE_INTERFACE:
+                if (network) network->commitRemoveInterface(record.interface);
+                break;
+            case NetworkSnapshot::DEFAULT_NETWORK:
+                if (netId == NETID_UNSET || (network && network->isPhysical())) {
+                    mDefaultNetId = netId;
+                }
+                break;
+            case NetworkSnapshot::NETWORK_PERMISSION:
+                if (network && network->isPhysical()) {
+                    static_cast<PhysicalNetwork*>(network)->commitPermission(
+                            static_cast<Permission>(record.value));
+                }
+                break;
+            case NetworkSnapshot::USER_PERMISSION:
+                for (uint32_t uid : record.values) {
+                    mUsers[uid] = static_cast<Permission>(record.value);
+                }
+                break;
+            case NetworkSnapshot::PROTECTABLE_USERS:
+                mProtectableUsers = std::set<uid_t>(record.values.begin(), record.values.end());
+                break;
+            case NetworkSnapshot::ADD_USERS:
+                if (network) {
+                    network->addToUidRangeMap(valuesToUidRanges(record.values),
+                                              static_cast<int32_t>(record.value));
+                }
+                break;
+            case NetworkSnapshot::REMOVE_USERS:
+                if (network) {
+                    network->removeFromUidRangeMap(valuesToUidRanges(record.values),
+                                                   static_cast<int32_t>(record.value));
+                }
+                break;
+            case NetworkSnapshot::CLEAR_ALLOWED_UIDS:
+                clearAllowedUidsForAllNetworksLocked();
+                break;
+            case NetworkSnapshot::ALLOWED_UIDS:
+                if (network) network->setAllowedUids(valuesToUidRanges(record.values));
+                break;
+            case NetworkSnapshot::LAST_NETWORK:
+                if (network) {
+                    std::lock_guard addressLock(mAddressLock);
+                    mIfindexToLastNetwork[record.value] = {
+                            netId, (record.flags & NetworkSnapshot::FLAG_VIRTUAL) != 0};
+                }
+                break;
+        }
+    }
+
+    if (mDefaultNetId != NETID_UNSET) {
+        static_cast<PhysicalNetwork*>(getNetworkLocked(mDefaultNetId))->commitAsDefault(true);
+        mDefaultNetworkRestored = true;
+    }
+}
+
+void NetworkController::dropRestoredNetworkLocked(unsigned netId,
+                                                  NetworkSnapshot::Records* records) {
+    if (!mRestoredNetIds.erase(netId)) return;
+    Network* network = getNetworkLocked(netId);
+    network->forgetInterfaces();
+    mNetworks.erase(netId);
+    delete network;
+    if (records) records->push_back({.type = NetworkSnapshot::DESTROY_NETWORK, .netId = netId});
+
+    if (mDefaultNetId == netId) {
+        mDefaultNetId = NETID_UNSET;
+        mDefaultNetworkRestored = false;
+        if (records) {
+            records->push_back({.type = NetworkSnapshot::DEFAULT_NETWORK, .netId = NETID_UNSET});
+        }
+    }
+    {
+        std::lock_guard addressLock(mAddressLock);
+        std::erase_if(mIfindexToLastNetwork,
+                      [netId](const auto& entry) { return entry.second.netId == netId; });
+    }
+
+    updateConnectMarksLocked();
+    publishUidAllowlistLocked();
+    updateTcpSocketMonitorPolling();
+}
+
+void NetworkController::finishRestoreLocked() {
+    if (mRestoredNetIds.empty()) return;
+
+    // RouteController has deleted the rules and routes of these networks, because nothing added
+    // them again.
+    NetworkSnapshot::Records records;
+    const std::set<unsigned> restoredNetIds = mRestoredNetIds;
+    for (unsigned netId : restoredNetIds) {
+        dropRestoredNetworkLocked(netId, &records);
+    }
+    ALOGI("Dropped %zu restored networks that were not created again", restoredNetIds.size());
+    appendToSnapshotLocked(records);
+}
+
 void NetworkController::clearAllowedUidsForAllNetworksLocked() {
     for (const auto& [_, network] : mNetworks) {
         network->clearAllowedUids();
@@ -818,6 +1531,7 @@ void NetworkController::clearAllowedUidsForAllNetworksLocked() {
 
 int NetworkController::setNetworkAllowlist(
         const std::vector<netd::aidl::NativeUidRangeConfig>& rangeConfigs) {
+    std::lock_guard writeLock(mWriteLock);
     const ScopedWLock lock(mRWLock);
 
     for (const auto& config : rangeConfigs) {
@@ -825,23 +1539,34 @@ int NetworkController::setNetworkAllowlist(
         if (!network) return -ENONET;
     }
 
+    NetworkSnapshot::Records records = {{.type = NetworkSnapshot::CLEAR_ALLOWED_UIDS}};
     clearAllowedUidsForAllNetworksLocked();
     for (const auto& config : rangeConfigs) {
         Network* network = getNetworkLocked(config.netId);
-        network->setAllowedUids(UidRanges(config.uidRanges));
-    }
+        const UidRanges uidRanges(config.uidRanges);
+        network->setAllowedUids(uidRanges);
+        records.push_back({
+                .type = NetworkSnapshot::ALLOWED_UIDS,
+                .netId = static_cast<unsigned>(config.netId),
+                .values = uidRangesToValues(uidRanges),
+        });
+    }
+    publishUidAllowlistLocked();
+    appendToSnapshotLocked(records);
     return 0;
 }
 
 bool NetworkController::isUidAllowed(unsigned netId, uid_t uid) const {
-    const ScopedRLock lock(mRWLock);
-    Network* network = getNetworkLocked(netId);
-    // Exempt when no netId is specified and there is no default network, so that apps or tests can
-    // do DNS lookups for hostnames in etc/hosts.
-    if (netId == NETID_UNSET && mDefaultNetId == NETID_UNSET) {
-        return true;
+    return mUidAllowlist.isAllowed(netId, uid);
+}
+
+void NetworkController::publishUidAllowlistLocked() {
+    UidAllowlist::Table table;
+    table.setDefaultNetwork(mDefaultNetId);
+    for (const auto& [netId, network] : mNetworks) {
+        table.addNetwork(netId, network->getAllowedUids());
     }
-    return network && network->isUidAllowed(uid);
+    mUidAllowlist.publish(std::move(table));
 }
 
 bool NetworkController::isValidNetworkLocked(unsigned netId) const {
@@ -896,7 +1621,7 @@ Permission NetworkController::getPermissionForUserLocked(uid_t uid) const {
     if (iter != mUsers.end()) {
         return iter->second;
     }
-    return uid < FIRST_APPLICATION_UID ? PERMISSION_SYSTEM : PERMISSION_NONE;
+    return getDefaultPermissionForUser(uid);
 }
 
 int NetworkController::checkUserNetworkAccessLocked(uid_t uid, unsigned netId) const {
@@ -951,7 +1676,8 @@ int NetworkController::checkUserNetworkAccessLocked(uid_t uid, unsigned netId) c
 int NetworkController::modifyRoute(unsigned netId, const char* interface, const char* destination,
                                    const char* nexthop, enum RouteOperation op, bool legacy,
                                    uid_t uid, int mtu) {
-    ScopedRLock lock(mRWLock);
+    // See addRoutes().
+    std::lock_guard writeLock(mWriteLock);
 
     if (!isValidNetworkLocked(netId)) {
         ALOGE("no such netId %u", netId);
@@ -1026,6 +1752,9 @@ void NetworkController::updateTcpSocketMonitorPolling() {
         }
     }
 
+    // Tests and benchmarks create their own NetworkController, without the other controllers.
+    if (android::net::gCtls == nullptr) return;
+
     if (physicalNetworkExists) {
         android::net::gCtls->tcpSocketMonitor.resumePolling();
     } else {
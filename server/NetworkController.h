@@ -19,16 +19,21 @@
 #include <android-base/thread_annotations.h>
 #include <android/multinetwork.h>
 
+#include "ConnectMarkMap.h"
 #include "NetdConstants.h"
+#include "NetworkSnapshot.h"
 #include "Permission.h"
 #include "PhysicalNetwork.h"
+#include "UidAllowlist.h"
 #include "UnreachableNetwork.h"
 #include "android/net/INetd.h"
 #include "netdutils/DumpWriter.h"
 
+#include <netinet/in.h>
 #include <sys/types.h>
 #include <list>
 #include <map>
+#include <mutex>
 #include <set>
 #include <shared_mutex>
 #include <unordered_map>
@@ -75,6 +80,36 @@ class Network;
 class UidRanges;
 class VirtualNetwork;
 
+// A set of interface indices that doesn't allocate memory while it has at most kInlineSize
+// members. Almost every address is configured on a single interface.
+class IfindexSet {
+  public:
+    // Returns true if |ifindex| was added, false if it was already present.
+    bool insert(unsigned ifindex);
+    // Returns true if |ifindex| was removed, false if it was not present.
+    bool erase(unsigned ifindex);
+
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+    const unsigned* begin() const { return mOverflow.empty() ? mInline : mOverflow.data(); }
+    const unsigned* end() const { return begin() + mSize; }
+
+  private:
+    static constexpr size_t kInlineSize = 2;
+    // Once the set outgrows mInline, all its members live in mOverflow until it's empty again.
+    unsigned mInline[kInlineSize] = {};
+    std::vector<unsigned> mOverflow;
+    size_t mSize = 0;
+};
+
+struct In6AddrHash {
+    size_t operator()(const in6_addr& addr) const;
+};
+
+struct In6AddrEqual {
+    bool operator()(const in6_addr& a, const in6_addr& b) const;
+};
+
 /*
  * Keeps track of default, per-pid, and per-uid-range network selection, as
  * well as the mark associated with each network. Networks are identified
@@ -95,6 +130,11 @@ public:
 
     NetworkController();
 
+    // Removes the clsact qdiscs from all interfaces. Called once when netd starts, rather than by
+    // the constructor, so that benchmarks can create a NetworkController without touching the
+    // interfaces of the device.
+    void removeClsactQdiscs();
+
     unsigned getDefaultNetwork() const;
     [[nodiscard]] int setDefaultNetwork(unsigned netId);
 
@@ -132,23 +172,50 @@ public:
     // |netId| is given only to sanity check that the interface has the correct netId.
     [[nodiscard]] int addRoute(unsigned netId, const char* interface, const char* destination,
                                const char* nexthop, bool legacy, uid_t uid, int mtu);
+    // Adds all of |routes| to |netId| with one batch of netlink requests. If any route is invalid
+    // or its interface is not in |netId|, no route is added. Stores the result of every route in
+    // |results|, in the same order as |routes|: 0 if it was added, -ECANCELED if it was not
+    // attempted because another route was invalid, or negative errno. Returns 0 if every route was
+    // added, or else the first error.
+    [[nodiscard]] int addRoutes(unsigned netId, const std::vector<RouteInfoParcel>& routes,
+                                std::vector<int>* results);
     [[nodiscard]] int updateRoute(unsigned netId, const char* interface, const char* destination,
                                   const char* nexthop, bool legacy, uid_t uid, int mtu);
     [[nodiscard]] int removeRoute(unsigned netId, const char* interface, const char* destination,
                                   const char* nexthop, bool legacy, uid_t uid);
 
-    // Notes that the specified address has appeared on the specified interface.
-    void addInterfaceAddress(unsigned ifIndex, const char* address);
+    // Notes that the specified address has appeared on the specified interface. IPv4 addresses
+    // are passed as IPv4-mapped IPv6 addresses.
+    void addInterfaceAddress(unsigned ifIndex, const in6_addr& address);
     // Notes that the specified address has been removed from the specified interface.
     // Returns true if we should destroy sockets on this address.
-    bool removeInterfaceAddress(unsigned ifIndex, const char* address);
+    bool removeInterfaceAddress(unsigned ifIndex, const in6_addr& address);
 
     bool canProtect(uid_t uid) const;
     void allowProtect(uid_t uid);
     void denyProtect(uid_t uid);
 
+    // Starts publishing the mark that ON_CONNECT would set for each UID to the connect mark map, if
+    // the BPF loader provides it. Returns 0, -ENOENT if there is no such map, or negative errno.
+    [[nodiscard]] int enableConnectMarkMap();
+
+    // Where the networks and users are snapshotted, so that they survive a restart of netd.
+    static constexpr const char* SNAPSHOT_PATH = "/dev/netd/network_snapshot";
+
+    // Starts snapshotting the networks and users to |path|. If |restore| is true, first restores
+    // the networks and users in the snapshot left by the previous instance of netd. The interfaces
+    // of restored networks are only restored if they still have the same ifindex. The rules and
+    // routes of restored networks are not touched, so the caller must only restore if the kernel
+    // still has them. A restored network is used until the framework creates it again, or until
+    // finishRestore() is called. Returns 0 or negative errno.
+    [[nodiscard]] int openSnapshot(const std::string& path, bool restore);
+    // Drops the restored networks that the framework has not created again, and unsets the
+    // restored default network if the framework has not set one.
+    void finishRestore();
+
     void dump(netdutils::DumpWriter& dw);
     int setNetworkAllowlist(const std::vector<netd::aidl::NativeUidRangeConfig>& rangeConfigs);
+    // Called by the resolver for every DNS query. Does not take mRWLock.
     bool isUidAllowed(unsigned netId, uid_t uid) const;
 
   private:
@@ -177,30 +244,75 @@ public:
     [[nodiscard]] int modifyFallthroughLocked(unsigned vpnNetId, bool add);
     void updateTcpSocketMonitorPolling();
     void clearAllowedUidsForAllNetworksLocked();
+    ConnectMarkMap::Entries getConnectMarksLocked() const;
+    // Brings the connect mark map in line with mDefaultNetId, the UID ranges of the physical and
+    // unreachable networks, and mUsers. Must be called after every change to any of them.
+    void updateConnectMarksLocked();
+    // Publishes mDefaultNetId and the networks and their allowed UIDs to mUidAllowlist. Must be
+    // called after every change to any of them.
+    void publishUidAllowlistLocked();
+    // Returns the snapshot records that recreate the current networks and users.
+    NetworkSnapshot::Records getSnapshotRecordsLocked() const;
+    // Records a change in mSnapshot, rewriting it if it is full.
+    void appendToSnapshotLocked(const NetworkSnapshot::Records& records);
+    void restoreSnapshotLocked(const NetworkSnapshot::Records& records);
+    // Deletes the restored network |netId|, if any, without touching its rules and routes, as if
+    // it had been destroyed. Adds the snapshot records of the change to |records|, if not null.
+    void dropRestoredNetworkLocked(unsigned netId, NetworkSnapshot::Records* records);
+    void finishRestoreLocked();
 
     class DelegateImpl;
     DelegateImpl* const mDelegateImpl;
 
+    // mWriteLock serializes the methods that change any of the state that mRWLock guards, or
+    // program the kernel for the networks. Those methods take mWriteLock first, check the request
+    // and program the kernel with only mWriteLock held, and then take mRWLock for writing just to
+    // make the change to mNetworks and the rest. Nothing else can change that state while they hold
+    // mWriteLock, so they read it without mRWLock. Readers that only take mRWLock, such as
+    // getNetworkContext() for every DNS query and getNetworkForConnect() for every connect(), see
+    // the state from before the change until it is complete, and are not blocked while the kernel
+    // is programmed. If both locks are needed, mWriteLock must be taken first.
+    std::mutex mWriteLock;
     // mRWLock guards all accesses to mDefaultNetId, mNetworks, mUsers, mProtectableUsers,
-    // mIfindexToLastNetId and mAddressToIfindices.
+    // mConnectMarkMap, mSnapshot, mRestoredNetIds and mDefaultNetworkRestored.
     mutable std::shared_mutex mRWLock;
     unsigned mDefaultNetId;
     std::map<unsigned, Network*> mNetworks;  // Map keys are NetIds.
     std::map<uid_t, Permission> mUsers;
     std::set<uid_t> mProtectableUsers;
-    // Map interface (ifIndex) to its current NetId, or the last NetId if the interface was removed
-    // from the network and not added to another network. This state facilitates the interface to
-    // NetId lookup during RTM_DELADDR (NetworkController::removeInterfaceAddress), when the
-    // interface in question might already have been removed from the network.
+    ConnectMarkMap mConnectMarkMap;
+    NetworkSnapshot mSnapshot;
+    // Networks restored from the snapshot that the framework has not created again.
+    std::set<unsigned> mRestoredNetIds;
+    // Whether mDefaultNetId was restored from the snapshot, and the framework has not set the
+    // default network since.
+    bool mDefaultNetworkRestored = false;
+    // Published under mRWLock, and read without it.
+    UidAllowlist mUidAllowlist;
+    // mAddressLock guards all accesses to mIfindexToLastNetwork and mAddressToIfindices. These are
+    // only used to decide whether to destroy sockets when an address is removed, which happens on
+    // the netlink thread for every RTM_DELADDR, so they have their own lock instead of blocking
+    // every reader of mRWLock. If both locks are needed, mRWLock must be taken first.
+    mutable std::mutex mAddressLock;
+    // The network that an interface is in, or was last in.
+    struct LastNetwork {
+        unsigned netId;
+        bool isVirtual;
+    };
+    // Map interface (ifIndex) to its current network, or the last network if the interface was
+    // removed from the network and not added to another network. This state facilitates the
+    // interface to network lookup during RTM_DELADDR (NetworkController::removeInterfaceAddress),
+    // when the interface in question might already have been removed from the network.
     // An interface is added to this map when it is added to a network and removed from this map
     // when its network is destroyed.
-    std::unordered_map<unsigned, unsigned> mIfindexToLastNetId;
-    // Map IP address to the list of active interfaces (ifIndex) that have that address.
+    std::unordered_map<unsigned, LastNetwork> mIfindexToLastNetwork;
+    // Map IP address (IPv4 addresses are IPv4-mapped) to the list of active interfaces (ifIndex)
+    // that have that address.
     // Also contains IP addresses configured on interfaces that have not been added to any network.
     // TODO: Does not track IP addresses present when netd is started or restarts after a crash.
     // This is not a problem for its intended use (tracking IP addresses on VPN interfaces), but
     // we should fix it.
-    std::unordered_map<std::string, std::unordered_set<unsigned>> mAddressToIfindices;
+    std::unordered_map<in6_addr, IfindexSet, In6AddrHash, In6AddrEqual> mAddressToIfindices;
 
 };
 
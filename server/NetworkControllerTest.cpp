@@ -0,0 +1,528 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * NetworkControllerTest.cpp - unit tests for NetworkController.cpp
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/fib_rules.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+
+#include "IptablesBaseTest.h"
+#include "NetlinkCommands.h"
+#include "NetworkController.h"
+#include "RouteController.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+constexpr unsigned kNetId = 100;
+constexpr unsigned kOtherNetId = 101;
+constexpr char kInterface[] = "netdtest1";
+constexpr char kOtherInterface[] = "netdtest2";
+// Not the ifindex of any real interface, so that the qdisc changes made for them fail harmlessly.
+constexpr uint32_t kIfIndex = 4001;
+constexpr uint32_t kOtherIfIndex = 4002;
+constexpr uid_t kAppUid = 10000;
+
+RouteInfoParcel makeRoute(const char* destination, const char* interface) {
+    RouteInfoParcel route;
+    route.ifName = interface;
+    route.destination = destination;
+    return route;
+}
+
+in6_addr ipv6Address(const char* address) {
+    in6_addr raw;
+    EXPECT_EQ(1, inet_pton(AF_INET6, address, &raw)) << address;
+    return raw;
+}
+
+// Returns the raw form of |address|, as found in a route request.
+std::string rawAddress(int family, const char* address) {
+    in6_addr raw;
+    EXPECT_EQ(1, inet_pton(family, address, &raw)) << address;
+    return std::string(reinterpret_cast<const char*>(&raw),
+                       family == AF_INET ? sizeof(in_addr) : sizeof(in6_addr));
+}
+
+}  // namespace
+
+TEST(IfindexSetTest, InsertAndErase) {
+    IfindexSet set;
+    EXPECT_TRUE(set.empty());
+    EXPECT_TRUE(set.insert(1));
+    EXPECT_TRUE(set.insert(2));
+    EXPECT_FALSE(set.insert(1));
+    EXPECT_EQ((std::vector<unsigned>{1, 2}), std::vector<unsigned>(set.begin(), set.end()));
+
+    // A third member moves them all out of line.
+    EXPECT_TRUE(set.insert(3));
+    EXPECT_FALSE(set.insert(3));
+    EXPECT_EQ((std::vector<unsigned>{1, 2, 3}), std::vector<unsigned>(set.begin(), set.end()));
+    EXPECT_TRUE(set.erase(1));
+    EXPECT_FALSE(set.erase(1));
+    EXPECT_EQ((std::vector<unsigned>{3, 2}), std::vector<unsigned>(set.begin(), set.end()));
+    EXPECT_TRUE(set.insert(4));
+    EXPECT_EQ(3U, set.size());
+
+    EXPECT_TRUE(set.erase(2));
+    EXPECT_TRUE(set.erase(3));
+    EXPECT_TRUE(set.erase(4));
+    EXPECT_TRUE(set.empty());
+    EXPECT_EQ(set.begin(), set.end());
+
+    // Once empty, members are kept in line again.
+    EXPECT_TRUE(set.insert(5));
+    EXPECT_EQ(std::vector<unsigned>{5}, std::vector<unsigned>(set.begin(), set.end()));
+    EXPECT_FALSE(set.erase(6));
+    EXPECT_TRUE(set.erase(5));
+    EXPECT_TRUE(set.empty());
+}
+
+// Runs NetworkController against a fake kernel that ACKs every netlink request, or fails the ones
+// that a test chooses, and answers every dump with nothing. It remembers the rules it was asked
+// to add or delete.
+class NetworkControllerTest : public IptablesBaseTest {
+  public:
+    NetworkControllerTest() {
+        openNetlinkSocketFunction = openFakeNetlinkSocket;
+        RouteController::iptablesRestoreCommandFunction = fakeExecIptablesRestoreCommand;
+        RouteController::ifNameToIndexFunction = fakeIfNameToIndex;
+        failRequests(0, 0);
+        mSnapshotPath = std::string(mDir.path) + "/network_snapshot";
+    }
+
+    ~NetworkControllerTest() {
+        openNetlinkSocketFunction = sRealOpenNetlinkSocket;
+        RouteController::ifNameToIndexFunction = sRealIfNameToIndex;
+    }
+
+  protected:
+    struct Rule {
+        uint16_t type;
+        uint32_t priority;
+        uint32_t table;
+    };
+
+    // Fails every request of |type| with |error| from now on, or only the ones that name
+    // |interface|, e.g., in FRA_OIFNAME, if it is not null. A |type| of 0 fails nothing.
+    static void failRequests(uint16_t type, int error, const char* interface = nullptr) {
+        failRequestsContaining(type, error,
+                               interface ? std::string(interface, strlen(interface) + 1) : "");
+    }
+
+    // Same, but only fails the requests that contain |bytes|, e.g., the address of a route, if
+    // they are not empty.
+    static void failRequestsContaining(uint16_t type, int error, const std::string& bytes) {
+        std::lock_guard lock(sFailedLock);
+        sFailedType = type;
+        sFailedError = error;
+        sFailedBytes = bytes;
+    }
+
+    // Returns the error that the request in |nlh| fails with, or 0.
+    static int requestError(const nlmsghdr* nlh) {
+        std::lock_guard lock(sFailedLock);
+        if (sFailedType == 0 || nlh->nlmsg_type != sFailedType) return 0;
+        if (!sFailedBytes.empty() && memmem(NLMSG_DATA(nlh), nlh->nlmsg_len - NLMSG_HDRLEN,
+                                            sFailedBytes.data(), sFailedBytes.size()) == nullptr) {
+            return 0;
+        }
+        return sFailedError;
+    }
+
+    // Returns how many times a rule with |priority| and |table| was successfully added or deleted,
+    // depending on |type|.
+    static int countRules(uint16_t type, uint32_t priority, uint32_t table) {
+        std::lock_guard lock(sRulesLock);
+        return std::count_if(sRules.begin(), sRules.end(), [&](const Rule& rule) {
+            return rule.type == type && rule.priority == priority && rule.table == table;
+        });
+    }
+
+    static Rule parseRule(const nlmsghdr* nlh) {
+        Rule rule = {.type = nlh->nlmsg_type};
+        const auto* hdr = reinterpret_cast<const fib_rule_hdr*>(NLMSG_DATA(nlh));
+        int len = nlh->nlmsg_len - NLMSG_SPACE(sizeof(*hdr));
+        for (const rtattr* rta = reinterpret_cast<const rtattr*>(hdr + 1); RTA_OK(rta, len);
+             rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == FRA_PRIORITY) {
+                rule.priority = *reinterpret_cast<const uint32_t*>(RTA_DATA(rta));
+            } else if (rta->rta_type == FRA_TABLE) {
+                rule.table = *reinterpret_cast<const uint32_t*>(RTA_DATA(rta));
+            }
+        }
+        return rule;
+    }
+
+    static uint32_t fakeIfNameToIndex(const char* interface) {
+        if (!strcmp(interface, kInterface)) return kIfIndex;
+        if (!strcmp(interface, kOtherInterface)) return kOtherIfIndex;
+        return 0;
+    }
+
+    static int openFakeNetlinkSocket(int) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) {
+            return -errno;
+        }
+        std::thread(serveFakeNetlinkSocket, fds[1]).detach();
+        return fds[0];
+    }
+
+    // Answers the requests on |fd| until netd closes the other end.
+    static void serveFakeNetlinkSocket(int fd) {
+        uint8_t buffer[65536];
+        ssize_t len;
+        while ((len = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            uint32_t remaining = len;
+            for (const nlmsghdr* nlh = reinterpret_cast<const nlmsghdr*>(buffer);
+                 NLMSG_OK(nlh, remaining); nlh = NLMSG_NEXT(nlh, remaining)) {
+                struct {
+                    nlmsghdr hdr;
+                    nlmsgerr err;
+                } reply = {
+                        .hdr = {.nlmsg_len = sizeof(reply),
+                                .nlmsg_type = NLMSG_ERROR,
+                                .nlmsg_seq = nlh->nlmsg_seq},
+                        .err = {.error = 0, .msg = *nlh},
+                };
+                // NLM_F_DUMP is two flags, one of which is NLM_F_EXCL in a request for a change.
+                if ((nlh->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP) {
+                    // NLMSG_DONE carries only the error.
+                    reply.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(reply.err.error));
+                    reply.hdr.nlmsg_type = NLMSG_DONE;
+                    reply.hdr.nlmsg_flags = NLM_F_MULTI;
+                } else if (!(nlh->nlmsg_flags & NLM_F_ACK)) {
+                    continue;
+                } else if (int error = requestError(nlh)) {
+                    reply.err.error = error;
+                } else if (nlh->nlmsg_type == RTM_NEWRULE || nlh->nlmsg_type == RTM_DELRULE) {
+                    const Rule rule = parseRule(nlh);
+                    // No test adds tethering rules, and they are deleted until there are none.
+                    if (rule.type == RTM_DELRULE && rule.priority == RULE_PRIORITY_TETHERING) {
+                        reply.err.error = -ENOENT;
+                    } else {
+                        std::lock_guard lock(sRulesLock);
+                        sRules.push_back(rule);
+                    }
+                }
+                send(fd, &reply, reply.hdr.nlmsg_len, MSG_NOSIGNAL);
+            }
+        }
+        close(fd);
+    }
+
+    static NetworkSnapshot::Records readSnapshot(const std::string& path) {
+        NetworkSnapshot::Records records;
+        EXPECT_EQ(0, NetworkSnapshot::read(path, &records));
+        return records;
+    }
+
+    TemporaryDir mDir;
+    std::string mSnapshotPath;
+
+    static inline std::mutex sFailedLock;
+    static inline uint16_t sFailedType;
+    static inline int sFailedError;
+    static inline std::string sFailedBytes;
+    static inline std::mutex sRulesLock;
+    static inline std::vector<Rule> sRules;
+
+    static inline const auto sRealOpenNetlinkSocket = openNetlinkSocketFunction;
+    static inline const auto sRealIfNameToIndex = RouteController::ifNameToIndexFunction;
+};
+
+TEST_F(NetworkControllerTest, SetPermissionForNetworksFailure) {
+    NetworkController netCtrl;
+    ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, false /* restore */));
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NONE, false /* local */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kOtherNetId, PERMISSION_NONE, false /* local */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kOtherNetId, kOtherInterface));
+
+    // The rules are changed in one batch, so the failure is only seen when it is flushed.
+    failRequests(RTM_NEWRULE, -ENOBUFS);
+    EXPECT_EQ(-ENOBUFS,
+              netCtrl.setPermissionForNetworks(PERMISSION_NETWORK, {kNetId, kOtherNetId}));
+
+    // Neither network changed, and neither did the snapshot.
+    EXPECT_EQ(0, netCtrl.checkUserNetworkAccess(kAppUid, kNetId));
+    EXPECT_EQ(0, netCtrl.checkUserNetworkAccess(kAppUid, kOtherNetId));
+    int permissionRecords = 0;
+    for (const auto& record : readSnapshot(mSnapshotPath)) {
+        if (record.type != NetworkSnapshot::NETWORK_PERMISSION) continue;
+        EXPECT_EQ(static_cast<uint32_t>(PERMISSION_NONE), record.value) << record.netId;
+        permissionRecords++;
+    }
+    EXPECT_EQ(2, permissionRecords);
+
+    failRequests(0, 0);
+    EXPECT_EQ(0, netCtrl.setPermissionForNetworks(PERMISSION_NETWORK, {kNetId, kOtherNetId}));
+    EXPECT_EQ(-EACCES, netCtrl.checkUserNetworkAccess(kAppUid, kNetId));
+    EXPECT_EQ(-EACCES, netCtrl.checkUserNetworkAccess(kAppUid, kOtherNetId));
+}
+
+TEST_F(NetworkControllerTest, SetPermissionForNetworksPartialFailure) {
+    NetworkController netCtrl;
+    ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, false /* restore */));
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NONE, false /* local */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kOtherNetId, PERMISSION_NONE, false /* local */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kOtherNetId, kOtherInterface));
+
+    // Only the rules of the other network fail, so the first network changes.
+    failRequests(RTM_NEWRULE, -ENOBUFS, kOtherInterface);
+    EXPECT_EQ(-ENOBUFS,
+              netCtrl.setPermissionForNetworks(PERMISSION_NETWORK, {kNetId, kOtherNetId}));
+    EXPECT_EQ(-EACCES, netCtrl.checkUserNetworkAccess(kAppUid, kNetId));
+    EXPECT_EQ(0, netCtrl.checkUserNetworkAccess(kAppUid, kOtherNetId));
+
+    // The snapshot matches.
+    failRequests(0, 0);
+    NetworkController restarted;
+    ASSERT_EQ(0, restarted.openSnapshot(mSnapshotPath, true /* restore */));
+    EXPECT_EQ(-EACCES, restarted.checkUserNetworkAccess(kAppUid, kNetId));
+    EXPECT_EQ(0, restarted.checkUserNetworkAccess(kAppUid, kOtherNetId));
+}
+
+TEST_F(NetworkControllerTest, AddInterfaceToNetworkFailure) {
+    NetworkController netCtrl;
+    ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, false /* restore */));
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NONE, false /* local */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+    ASSERT_EQ(0, netCtrl.setDefaultNetwork(kNetId));
+
+    // The rules of the second interface fail, so the network keeps only the first one.
+    failRequests(RTM_NEWRULE, -ENOBUFS, kOtherInterface);
+    EXPECT_EQ(-ENOBUFS, netCtrl.addInterfaceToNetwork(kNetId, kOtherInterface));
+    EXPECT_EQ(kNetId, netCtrl.getNetworkForInterface(kInterface));
+    EXPECT_EQ(NETID_UNSET, netCtrl.getNetworkForInterface(kOtherInterface));
+    EXPECT_EQ(kNetId, netCtrl.getDefaultNetwork());
+
+    // The snapshot matches, and the interface can be added once the kernel accepts its rules.
+    failRequests(0, 0);
+    NetworkController restarted;
+    ASSERT_EQ(0, restarted.openSnapshot(mSnapshotPath, true /* restore */));
+    EXPECT_EQ(kNetId, restarted.getNetworkForInterface(kInterface));
+    EXPECT_EQ(NETID_UNSET, restarted.getNetworkForInterface(kOtherInterface));
+    EXPECT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kOtherInterface));
+    EXPECT_EQ(kNetId, netCtrl.getNetworkForInterface(kOtherInterface));
+}
+
+TEST_F(NetworkControllerTest, DestroyNetworkFailure) {
+    NetworkController netCtrl;
+    ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, false /* restore */));
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NONE, false /* local */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kOtherInterface));
+    ASSERT_EQ(0, netCtrl.setDefaultNetwork(kNetId));
+
+    // Removing the first interface fails, after its default rules have been deleted.
+    failRequests(RTM_DELRULE, -ENOBUFS, kInterface);
+    const uint32_t otherTable = kOtherIfIndex + RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX;
+    const int defaultRulesDeleted =
+            countRules(RTM_DELRULE, RULE_PRIORITY_DEFAULT_NETWORK, otherTable);
+    EXPECT_EQ(-ENOBUFS, netCtrl.destroyNetwork(kNetId));
+
+    // The network is gone anyway, and the other interface lost its default rules, one per family.
+    EXPECT_EQ(NETID_UNSET, netCtrl.getDefaultNetwork());
+    EXPECT_EQ(NETID_UNSET, netCtrl.getNetworkForInterface(kInterface));
+    EXPECT_EQ(NETID_UNSET, netCtrl.getNetworkForInterface(kOtherInterface));
+    EXPECT_EQ(-ENONET, netCtrl.destroyNetwork(kNetId));
+    EXPECT_EQ(defaultRulesDeleted + 2,
+              countRules(RTM_DELRULE, RULE_PRIORITY_DEFAULT_NETWORK, otherTable));
+
+    failRequests(0, 0);
+    NetworkController restarted;
+    ASSERT_EQ(0, restarted.openSnapshot(mSnapshotPath, true /* restore */));
+    EXPECT_EQ(NETID_UNSET, restarted.getDefaultNetwork());
+    EXPECT_EQ(NETID_UNSET, restarted.getNetworkForInterface(kOtherInterface));
+}
+
+TEST_F(NetworkControllerTest, AddRoutes) {
+    NetworkController netCtrl;
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NONE, false /* local */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kOtherNetId, PERMISSION_NONE, false /* local */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kOtherNetId, kOtherInterface));
+
+    // A route whose interface is in another network, or with a bad prefix, cancels the others.
+    std::vector<int> results;
+    EXPECT_EQ(-ENOENT, netCtrl.addRoutes(kNetId,
+                                         {makeRoute("192.0.2.0/24", kInterface),
+                                          makeRoute("198.51.100.0/24", kOtherInterface),
+                                          makeRoute("2001:db8::/129", kInterface)},
+                                         &results));
+    EXPECT_EQ((std::vector<int>{-ECANCELED, -ENOENT, -EINVAL}), results);
+    EXPECT_EQ(-ENONET, netCtrl.addRoutes(kNetId + 10, {makeRoute("192.0.2.0/24", kInterface)},
+                                         &results));
+    EXPECT_EQ(std::vector<int>{-ENONET}, results);
+
+    // A route to an IPv6 prefix is also added to the local table, so it takes two requests, and
+    // the results of the routes after it are not at their own index in the batch.
+    const std::vector<RouteInfoParcel> routes = {
+            makeRoute("2001:db8::/64", kInterface),
+            makeRoute("192.0.2.0/24", kInterface),
+            makeRoute("198.51.100.0/24", kInterface),
+    };
+    EXPECT_EQ(0, netCtrl.addRoutes(kNetId, routes, &results));
+    EXPECT_EQ((std::vector<int>{0, 0, 0}), results);
+
+    failRequestsContaining(RTM_NEWROUTE, -ENOBUFS, rawAddress(AF_INET, "198.51.100.0"));
+    EXPECT_EQ(-ENOBUFS, netCtrl.addRoutes(kNetId, routes, &results));
+    EXPECT_EQ((std::vector<int>{0, 0, -ENOBUFS}), results);
+
+    failRequestsContaining(RTM_NEWROUTE, -ENOBUFS, rawAddress(AF_INET6, "2001:db8::"));
+    EXPECT_EQ(-ENOBUFS, netCtrl.addRoutes(kNetId, routes, &results));
+    EXPECT_EQ((std::vector<int>{-ENOBUFS, 0, 0}), results);
+}
+
+TEST_F(NetworkControllerTest, RemoveInterfaceAddress) {
+    NetworkController netCtrl;
+    ASSERT_EQ(0, netCtrl.createVirtualNetwork(kNetId, true /* secure */, NativeVpnType::SERVICE,
+                                              false /* excludeLocalRoutes */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kOtherInterface));
+    const in6_addr address = ipv6Address("2001:db8::1");
+    const in6_addr otherAddress = ipv6Address("2001:db8::2");
+    // IPv4 addresses are tracked as IPv4-mapped IPv6 addresses.
+    const in6_addr ipv4Address = ipv6Address("::ffff:192.0.2.1");
+
+    // An address that is still on another interface of the same VPN was handed over, so its
+    // sockets are kept.
+    netCtrl.addInterfaceAddress(kIfIndex, address);
+    netCtrl.addInterfaceAddress(kOtherIfIndex, address);
+    netCtrl.addInterfaceAddress(kIfIndex, ipv4Address);
+    netCtrl.addInterfaceAddress(kOtherIfIndex, ipv4Address);
+    netCtrl.addInterfaceAddress(kIfIndex, otherAddress);
+    EXPECT_FALSE(netCtrl.removeInterfaceAddress(kIfIndex, address));
+    EXPECT_FALSE(netCtrl.removeInterfaceAddress(kOtherIfIndex, ipv4Address));
+
+    // Sockets are destroyed if the address is on no other interface, is unknown, or was not on
+    // the interface.
+    EXPECT_TRUE(netCtrl.removeInterfaceAddress(kIfIndex, otherAddress));
+    EXPECT_TRUE(netCtrl.removeInterfaceAddress(kIfIndex, otherAddress));
+    EXPECT_TRUE(netCtrl.removeInterfaceAddress(kIfIndex, address));
+    EXPECT_TRUE(netCtrl.removeInterfaceAddress(kOtherIfIndex, address));
+    EXPECT_TRUE(netCtrl.removeInterfaceAddress(kIfIndex, ipv4Address));
+
+    // Sockets are not kept for a handover between physical networks, or networks that are gone.
+    ASSERT_EQ(0, netCtrl.destroyNetwork(kNetId));
+    netCtrl.addInterfaceAddress(kIfIndex, address);
+    netCtrl.addInterfaceAddress(kOtherIfIndex, address);
+    EXPECT_TRUE(netCtrl.removeInterfaceAddress(kIfIndex, address));
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NONE, false /* local */));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+    ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kOtherInterface));
+    netCtrl.addInterfaceAddress(kIfIndex, address);
+    EXPECT_TRUE(netCtrl.removeInterfaceAddress(kOtherIfIndex, address));
+}
+
+TEST_F(NetworkControllerTest, AddInterfaceOfRestoredNetwork) {
+    {
+        NetworkController netCtrl;
+        ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, false /* restore */));
+        ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NONE, false /* local */));
+        ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+    }
+
+    // After a restart, the framework puts the interface in a network with another netId before
+    // it creates the old network again, if it ever does.
+    NetworkController netCtrl;
+    ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, true /* restore */));
+    EXPECT_EQ(kNetId, netCtrl.getNetworkForInterface(kInterface));
+    ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kOtherNetId, PERMISSION_NONE, false /* local */));
+    EXPECT_EQ(0, netCtrl.addInterfaceToNetwork(kOtherNetId, kInterface));
+    EXPECT_EQ(kOtherNetId, netCtrl.getNetworkForInterface(kInterface));
+
+    // The restored network no longer has the interface in the snapshot either.
+    NetworkController restarted;
+    ASSERT_EQ(0, restarted.openSnapshot(mSnapshotPath, true /* restore */));
+    EXPECT_EQ(kOtherNetId, restarted.getNetworkForInterface(kInterface));
+}
+
+TEST_F(NetworkControllerTest, CreateRestoredNetworkAgainWithAnotherType) {
+    {
+        NetworkController netCtrl;
+        ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, false /* restore */));
+        ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NONE, false /* local */));
+        ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+        ASSERT_EQ(0, netCtrl.setDefaultNetwork(kNetId));
+    }
+
+    // After a restart, the framework reuses the netId of the old default network for a VPN.
+    {
+        NetworkController netCtrl;
+        ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, true /* restore */));
+        EXPECT_EQ(kNetId, netCtrl.getDefaultNetwork());
+        ASSERT_EQ(0, netCtrl.createVirtualNetwork(kNetId, true /* secure */,
+                                                  NativeVpnType::SERVICE,
+                                                  false /* excludeLocalRoutes */));
+        EXPECT_TRUE(netCtrl.isVirtualNetwork(kNetId));
+        EXPECT_EQ(NETID_UNSET, netCtrl.getDefaultNetwork());
+        EXPECT_EQ(NETID_UNSET, netCtrl.getNetworkForInterface(kInterface));
+    }
+
+    // The snapshot has the VPN, not the physical network it replaced.
+    {
+        NetworkController netCtrl;
+        ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, true /* restore */));
+        EXPECT_TRUE(netCtrl.isVirtualNetwork(kNetId));
+        EXPECT_EQ(NETID_UNSET, netCtrl.getDefaultNetwork());
+        EXPECT_EQ(NETID_UNSET, netCtrl.getNetworkForInterface(kInterface));
+
+        // The same happens when the netId is reused for a physical network with other settings.
+        ASSERT_EQ(0, netCtrl.destroyNetwork(kNetId));
+        ASSERT_EQ(0, netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NONE, false /* local */));
+        ASSERT_EQ(0, netCtrl.addInterfaceToNetwork(kNetId, kInterface));
+        ASSERT_EQ(0, netCtrl.setDefaultNetwork(kNetId));
+    }
+    {
+        NetworkController netCtrl;
+        ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, true /* restore */));
+        ASSERT_EQ(0,
+                  netCtrl.createPhysicalNetwork(kNetId, PERMISSION_NETWORK, false /* local */));
+        EXPECT_EQ(NETID_UNSET, netCtrl.getDefaultNetwork());
+        EXPECT_EQ(NETID_UNSET, netCtrl.getNetworkForInterface(kInterface));
+    }
+    NetworkController netCtrl;
+    ASSERT_EQ(0, netCtrl.openSnapshot(mSnapshotPath, true /* restore */));
+    EXPECT_FALSE(netCtrl.isVirtualNetwork(kNetId));
+    EXPECT_EQ(-EACCES, netCtrl.checkUserNetworkAccess(kAppUid, kNetId));
+    EXPECT_EQ(NETID_UNSET, netCtrl.getDefaultNetwork());
+    EXPECT_EQ(NETID_UNSET, netCtrl.getNetworkForInterface(kInterface));
+}
+
+}  // namespace net
+}  // namespace android
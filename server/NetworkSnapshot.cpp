@@ -0,0 +1,264 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NetworkSnapshot"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <log/log.h>
+
+#include "NetworkSnapshot.h"
+
+using android::base::ReadFileToString;
+using android::base::Trim;
+using android::base::unique_fd;
+using android::netdutils::DumpWriter;
+
+namespace android {
+namespace net {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x4e534e50;
+const char* const BOOT_ID_PATH = "/proc/sys/kernel/random/boot_id";
+
+// The header of each record, followed by the interface name, padded to 4 bytes, and |valueCount|
+// values.
+struct RecordHeader {
+    uint16_t type;
+    uint16_t flags;
+    uint32_t netId;
+    uint32_t value;
+    uint32_t interfaceLength;
+    uint32_t valueCount;
+};
+
+size_t align4(size_t len) {
+    return (len + 3) & ~static_cast<size_t>(3);
+}
+
+size_t encodedSize(const NetworkSnapshot::Record& record) {
+    return sizeof(RecordHeader) + align4(record.interface.size()) +
+           record.values.size() * sizeof(uint32_t);
+}
+
+size_t encodedSize(const NetworkSnapshot::Records& records) {
+    size_t size = 0;
+    for (const auto& record : records) {
+        size += encodedSize(record);
+    }
+    return size;
+}
+
+// Writes |records| to |dst|, which must have room for encodedSize(records) bytes.
+void encode(const NetworkSnapshot::Records& records, uint8_t* dst) {
+    for (const auto& record : records) {
+        const RecordHeader header = {
+                .type = record.type,
+                .flags = record.flags,
+                .netId = record.netId,
+                .value = record.value,
+                .interfaceLength = static_cast<uint32_t>(record.interface.size()),
+                .valueCount = static_cast<uint32_t>(record.values.size()),
+        };
+        memcpy(dst, &header, sizeof(header));
+        dst += sizeof(header);
+        memcpy(dst, record.interface.data(), record.interface.size());
+        memset(dst + record.interface.size(), 0, align4(record.interface.size()) -
+                                                       record.interface.size());
+        dst += align4(record.interface.size());
+        memcpy(dst, record.values.data(), record.values.size() * sizeof(uint32_t));
+        dst += record.values.size() * sizeof(uint32_t);
+    }
+}
+
+int decode(const uint8_t* data, size_t size, NetworkSnapshot::Records* records) {
+    size_t offset = 0;
+    while (offset < size) {
+        RecordHeader header;
+        if (size - offset < sizeof(header)) return -EBADMSG;
+        memcpy(&header, data + offset, sizeof(header));
+        offset += sizeof(header);
+
+        if (header.type < NetworkSnapshot::PHYSICAL_NETWORK ||
+            header.type > NetworkSnapshot::LAST_NETWORK || header.interfaceLength >= IFNAMSIZ ||
+            size - offset < align4(header.interfaceLength) ||
+            (size - offset - align4(header.interfaceLength)) / sizeof(uint32_t) <
+                    header.valueCount) {
+            return -EBADMSG;
+        }
+        NetworkSnapshot::Record& record = records->emplace_back(NetworkSnapshot::Record{
+                .type = static_cast<NetworkSnapshot::RecordType>(header.type),
+                .flags = header.flags,
+                .netId = header.netId,
+                .value = header.value,
+                .interface = std::string(reinterpret_cast<const char*>(data + offset),
+                                         header.interfaceLength),
+        });
+        offset += align4(header.interfaceLength);
+        record.values.resize(header.valueCount);
+        memcpy(record.values.data(), data + offset, header.valueCount * sizeof(uint32_t));
+        offset += header.valueCount * sizeof(uint32_t);
+    }
+    return 0;
+}
+
+std::string readBootId() {
+    std::string bootId;
+    if (!ReadFileToString(BOOT_ID_PATH, &bootId)) {
+        ALOGE("Cannot read %s: %s", BOOT_ID_PATH, strerror(errno));
+    }
+    return Trim(bootId);
+}
+
+}  // namespace
+
+std::string (*NetworkSnapshot::readBootIdFunction)() = readBootId;
+
+NetworkSnapshot::~NetworkSnapshot() {
+    unmap();
+}
+
+int NetworkSnapshot::read(const std::string& path, Records* records) {
+    records->clear();
+    std::string contents;
+    if (!ReadFileToString(path, &contents, false /* follow_symlinks */)) {
+        return -errno;
+    }
+
+    Header header;
+    if (contents.size() < sizeof(header)) return -EBADMSG;
+    memcpy(&header, contents.data(), sizeof(header));
+    if (header.magic != kMagic) return -EBADMSG;
+    if (header.version != kVersion) return -EPROTONOSUPPORT;
+    if (strncmp(header.bootId, readBootIdFunction().c_str(), sizeof(header.bootId)) != 0) {
+        return -ESTALE;
+    }
+    if (header.capacity > contents.size() - sizeof(header) || header.size > header.capacity) {
+        return -EBADMSG;
+    }
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(contents.data()) + sizeof(header);
+    if (int ret = decode(data, header.size, records)) {
+        records->clear();
+        return ret;
+    }
+    return 0;
+}
+
+int NetworkSnapshot::open(const std::string& path, const Records& records) {
+    unmap();
+    mPath = path;
+    return rewrite(records);
+}
+
+int NetworkSnapshot::append(const Records& records) {
+    if (!isOpen()) return -EBADF;
+
+    const size_t size = encodedSize(records);
+    const uint32_t used = mHeader->size;
+    if (size > mHeader->capacity - used) return -ENOSPC;
+
+    encode(records, mHeader->records() + used);
+    __atomic_store_n(&mHeader->size, used + size, __ATOMIC_RELEASE);
+    mAppends++;
+    return 0;
+}
+
+int NetworkSnapshot::rewrite(const Records& records) {
+    // Leave room to append at least as much again before the next rewrite.
+    const size_t size = encodedSize(records);
+    const size_t capacity = std::max(kMinCapacity, 2 * size);
+    const size_t mapSize = sizeof(Header) + capacity;
+
+    // The new contents are written to a temporary file that then replaces the snapshot, so that a
+    // crash leaves either the old snapshot or the new one.
+    const std::string tmpPath = mPath + ".tmp";
+    unique_fd fd(::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+                        0600));
+    void* map = MAP_FAILED;
+    if (fd == -1 || ftruncate(fd.get(), mapSize) == -1 ||
+        (map = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0)) ==
+                MAP_FAILED) {
+        const int err = errno;
+        ALOGE("Cannot create %s: %s", tmpPath.c_str(), strerror(err));
+        unlink(tmpPath.c_str());
+        close();
+        return -err;
+    }
+
+    Header* header = static_cast<Header*>(map);
+    header->magic = kMagic;
+    header->version = kVersion;
+    strlcpy(header->bootId, readBootIdFunction().c_str(), sizeof(header->bootId));
+    header->capacity = capacity;
+    encode(records, header->records());
+    header->size = size;
+
+    if (rename(tmpPath.c_str(), mPath.c_str()) == -1) {
+        const int err = errno;
+        ALOGE("Cannot replace %s: %s", mPath.c_str(), strerror(err));
+        munmap(map, mapSize);
+        unlink(tmpPath.c_str());
+        close();
+        return -err;
+    }
+
+    unmap();
+    mHeader = header;
+    mMapSize = mapSize;
+    mRewrites++;
+    return 0;
+}
+
+void NetworkSnapshot::close() {
+    unmap();
+    if (mPath.empty()) return;
+    if (unlink(mPath.c_str()) == -1 && errno != ENOENT) {
+        ALOGE("Cannot delete %s: %s", mPath.c_str(), strerror(errno));
+    }
+}
+
+void NetworkSnapshot::unmap() {
+    if (mHeader != nullptr) {
+        munmap(mHeader, mMapSize);
+        mHeader = nullptr;
+        mMapSize = 0;
+    }
+}
+
+void NetworkSnapshot::dump(DumpWriter& dw) const {
+    if (!isOpen()) {
+        dw.println("Network snapshot: closed");
+        return;
+    }
+    dw.println("Network snapshot: %s, %u of %u bytes, %" PRIu64 " appends, %" PRIu64 " rewrites",
+               mPath.c_str(), mHeader->size, mHeader->capacity, mAppends, mRewrites);
+}
+
+}  // namespace net
+}  // namespace android
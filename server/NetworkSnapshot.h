@@ -0,0 +1,150 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "netdutils/DumpWriter.h"
+
+namespace android {
+namespace net {
+
+// A journal of the changes that NetworkController makes to its networks and users, kept in a
+// memory-mapped file on tmpfs so that it survives a restart of netd but not a reboot.
+//
+// Every change is appended as one or more records, and becomes visible to read() only once all of
+// them have been written, so a crash in the middle of an append loses that change but nothing
+// else. When the file is full, NetworkController rewrites it with the records that recreate its
+// current state, which replaces the file atomically.
+class NetworkSnapshot {
+  public:
+    // Incremented whenever the format of the records changes. Snapshots written with another
+    // version are ignored.
+    static constexpr uint32_t kVersion = 1;
+
+    enum RecordType : uint16_t {
+        // netId, value = permission, flags = FLAG_LOCAL.
+        PHYSICAL_NETWORK = 1,
+        // netId, flags = FLAG_SECURE | FLAG_EXCLUDE_LOCAL_ROUTES.
+        VIRTUAL_NETWORK = 2,
+        // netId.
+        DESTROY_NETWORK = 3,
+        // netId, interface, value = ifindex.
+        ADD_INTERFACE = 4,
+        // netId, interface.
+        REMOVE_INTERFACE = 5,
+        // netId, which may be NETID_UNSET.
+        DEFAULT_NETWORK = 6,
+        // netId, value = permission.
+        NETWORK_PERMISSION = 7,
+        // value = permission, values = UIDs.
+        USER_PERMISSION = 8,
+        // values = every UID that can protect its sockets from VPNs.
+        PROTECTABLE_USERS = 9,
+        // netId, value = sub-priority, values = first and last UID of each range.
+        ADD_USERS = 10,
+        // netId, value = sub-priority, values = first and last UID of each range.
+        REMOVE_USERS = 11,
+        // Clears the allowed UIDs of every network.
+        CLEAR_ALLOWED_UIDS = 12,
+        // netId, values = first and last UID of each allowed range.
+        ALLOWED_UIDS = 13,
+        // netId, value = ifindex of an interface that was in the network, flags = FLAG_VIRTUAL.
+        LAST_NETWORK = 14,
+    };
+
+    static constexpr uint16_t FLAG_LOCAL = 1 << 0;
+    static constexpr uint16_t FLAG_SECURE = 1 << 1;
+    static constexpr uint16_t FLAG_EXCLUDE_LOCAL_ROUTES = 1 << 2;
+    static constexpr uint16_t FLAG_VIRTUAL = 1 << 3;
+
+    struct Record {
+        RecordType type;
+        uint16_t flags = 0;
+        unsigned netId = 0;
+        uint32_t value = 0;
+        std::string interface;
+        std::vector<uint32_t> values;
+
+        bool operator==(const Record& other) const = default;
+    };
+    typedef std::vector<Record> Records;
+
+    NetworkSnapshot() = default;
+    ~NetworkSnapshot();
+    NetworkSnapshot(const NetworkSnapshot&) = delete;
+    NetworkSnapshot& operator=(const NetworkSnapshot&) = delete;
+
+    // Reads the records of the snapshot at |path|, in the order in which they were appended.
+    // Returns 0, -ENOENT if there is no snapshot, -ESTALE if it was written before the last boot,
+    // -EPROTONOSUPPORT if it was written with another kVersion, -EBADMSG if it is corrupt, or
+    // negative errno. |records| is left empty on failure.
+    [[nodiscard]] static int read(const std::string& path, Records* records);
+
+    // Replaces the snapshot at |path| with one that contains |records|, and appends to it from
+    // then on. Returns 0 or negative errno.
+    [[nodiscard]] int open(const std::string& path, const Records& records);
+    bool isOpen() const { return mHeader != nullptr; }
+
+    // Appends |records| as a single change. Returns 0, -ENOSPC if the file is full, in which case
+    // the caller should rewrite() it, or -EBADF if the snapshot is not open.
+    [[nodiscard]] int append(const Records& records);
+
+    // Replaces the contents of the snapshot with |records|, in a larger file if needed. Returns 0
+    // or negative errno.
+    [[nodiscard]] int rewrite(const Records& records);
+
+    // Deletes the snapshot, so that a restart does not read records that no longer match the
+    // state of netd, and stops appending to it.
+    void close();
+
+    void dump(netdutils::DumpWriter& dw) const;
+
+  private:
+    // The start of the file, followed by the records.
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        // The boot_id of the kernel that the snapshot was written on, NUL-terminated.
+        char bootId[40];
+        // Bytes of records that fit in the file after the header.
+        uint32_t capacity;
+        // Bytes of records that have been appended. Only updated, with release ordering, once all
+        // the records of a change are in place.
+        uint32_t size;
+
+        uint8_t* records() { return reinterpret_cast<uint8_t*>(this + 1); }
+    };
+
+    // For testing.
+    friend class NetworkSnapshotTest;
+    static constexpr size_t kMinCapacity = 64 * 1024;
+    static std::string (*readBootIdFunction)();
+
+    void unmap();
+
+    std::string mPath;
+    Header* mHeader = nullptr;
+    size_t mMapSize = 0;
+    uint64_t mAppends = 0;
+    uint64_t mRewrites = 0;
+};
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * NetworkSnapshotTest.cpp - unit tests for NetworkSnapshot.cpp
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+#include <netdutils/NetNativeTestBase.h>
+
+#include "NetworkSnapshot.h"
+
+namespace android {
+namespace net {
+
+using Records = NetworkSnapshot::Records;
+
+class NetworkSnapshotTest : public NetNativeTestBase {
+  public:
+    NetworkSnapshotTest() {
+        NetworkSnapshot::readBootIdFunction = fakeReadBootId;
+        sBootId = "11111111-2222-3333-4444-555555555555";
+    }
+
+    ~NetworkSnapshotTest() { NetworkSnapshot::readBootIdFunction = sRealReadBootId; }
+
+  protected:
+    static std::string fakeReadBootId() { return sBootId; }
+
+    static Records makeRecords(unsigned netId) {
+        return {
+                {.type = NetworkSnapshot::PHYSICAL_NETWORK, .netId = netId, .value = 1},
+                {.type = NetworkSnapshot::ADD_INTERFACE,
+                 .netId = netId,
+                 .value = 42,
+                 .interface = "wlan0"},
+                {.type = NetworkSnapshot::ADD_USERS,
+                 .netId = netId,
+                 .value = 998,
+                 .values = {10000, 10099, 10200, 10200}},
+                {.type = NetworkSnapshot::DEFAULT_NETWORK, .netId = netId},
+        };
+    }
+
+    static Records read(const std::string& path) {
+        Records records;
+        EXPECT_EQ(0, NetworkSnapshot::read(path, &records));
+        return records;
+    }
+
+    static uint32_t capacity(const NetworkSnapshot& snapshot) {
+        return snapshot.mHeader->capacity;
+    }
+
+    static uint32_t size(const NetworkSnapshot& snapshot) { return snapshot.mHeader->size; }
+
+    static void setSize(NetworkSnapshot& snapshot, uint32_t size) {
+        snapshot.mHeader->size = size;
+    }
+
+    static void setVersion(NetworkSnapshot& snapshot, uint32_t version) {
+        snapshot.mHeader->version = version;
+    }
+
+    static constexpr size_t kMinCapacity = NetworkSnapshot::kMinCapacity;
+
+    TemporaryDir mDir;
+    const std::string mPath = std::string(mDir.path) + "/network_snapshot";
+
+    static inline std::string sBootId;
+    static inline const auto sRealReadBootId = NetworkSnapshot::readBootIdFunction;
+};
+
+TEST_F(NetworkSnapshotTest, ReadsOpenedAndAppendedRecords) {
+    NetworkSnapshot snapshot;
+    Records records;
+    EXPECT_EQ(-ENOENT, NetworkSnapshot::read(mPath, &records));
+
+    ASSERT_EQ(0, snapshot.open(mPath, makeRecords(100)));
+    EXPECT_TRUE(snapshot.isOpen());
+    EXPECT_EQ(makeRecords(100), read(mPath));
+
+    const Records change = {
+            {.type = NetworkSnapshot::CLEAR_ALLOWED_UIDS},
+            {.type = NetworkSnapshot::ALLOWED_UIDS, .netId = 100, .values = {0, 9999}},
+    };
+    ASSERT_EQ(0, snapshot.append(change));
+    ASSERT_EQ(0, snapshot.append({{.type = NetworkSnapshot::DESTROY_NETWORK, .netId = 100}}));
+
+    Records expected = makeRecords(100);
+    expected.insert(expected.end(), change.begin(), change.end());
+    expected.push_back({.type = NetworkSnapshot::DESTROY_NETWORK, .netId = 100});
+    EXPECT_EQ(expected, read(mPath));
+
+    // Only the owner can read the snapshot.
+    struct stat st;
+    ASSERT_EQ(0, stat(mPath.c_str(), &st));
+    EXPECT_EQ(0600U, st.st_mode & 0777);
+}
+
+TEST_F(NetworkSnapshotTest, IgnoresUncommittedRecords) {
+    NetworkSnapshot snapshot;
+    ASSERT_EQ(0, snapshot.open(mPath, makeRecords(100)));
+    const uint32_t committed = size(snapshot);
+
+    // Simulate a crash after the records of a change were written but before they were committed.
+    ASSERT_EQ(0, snapshot.append(makeRecords(101)));
+    setSize(snapshot, committed);
+    EXPECT_EQ(makeRecords(100), read(mPath));
+
+    // A size that ends in the middle of a record is corrupt.
+    Records records;
+    setSize(snapshot, committed + sizeof(uint32_t));
+    EXPECT_EQ(-EBADMSG, NetworkSnapshot::read(mPath, &records));
+    EXPECT_TRUE(records.empty());
+}
+
+TEST_F(NetworkSnapshotTest, RewritesWhenFull) {
+    NetworkSnapshot snapshot;
+    ASSERT_EQ(0, snapshot.open(mPath, {}));
+    EXPECT_EQ(kMinCapacity, capacity(snapshot));
+
+    const Records change = {{
+            .type = NetworkSnapshot::USER_PERMISSION,
+            .value = 3,
+            .values = std::vector<uint32_t>(1000, 10000),
+    }};
+    int appended = 0;
+    int ret;
+    while ((ret = snapshot.append(change)) == 0) {
+        appended++;
+    }
+    EXPECT_EQ(-ENOSPC, ret);
+    EXPECT_EQ(static_cast<size_t>(appended), read(mPath).size());
+
+    // A full snapshot is replaced by the current state, with room to spare.
+    Records big(kMinCapacity / 4000, change[0]);
+    ASSERT_EQ(0, snapshot.rewrite(big));
+    EXPECT_EQ(big, read(mPath));
+    EXPECT_LT(kMinCapacity, capacity(snapshot));
+    EXPECT_EQ(0, snapshot.append(change));
+    EXPECT_EQ(big.size() + 1, read(mPath).size());
+}
+
+TEST_F(NetworkSnapshotTest, RejectsOtherBootsAndVersions) {
+    NetworkSnapshot snapshot;
+    ASSERT_EQ(0, snapshot.open(mPath, makeRecords(100)));
+
+    Records records;
+    sBootId = "66666666-7777-8888-9999-000000000000";
+    EXPECT_EQ(-ESTALE, NetworkSnapshot::read(mPath, &records));
+    EXPECT_TRUE(records.empty());
+
+    ASSERT_EQ(0, snapshot.rewrite(makeRecords(100)));
+    EXPECT_EQ(makeRecords(100), read(mPath));
+
+    setVersion(snapshot, NetworkSnapshot::kVersion + 1);
+    EXPECT_EQ(-EPROTONOSUPPORT, NetworkSnapshot::read(mPath, &records));
+
+    ASSERT_TRUE(android::base::WriteStringToFile("not a snapshot", mPath));
+    EXPECT_EQ(-EBADMSG, NetworkSnapshot::read(mPath, &records));
+}
+
+TEST_F(NetworkSnapshotTest, CloseDeletesSnapshot) {
+    NetworkSnapshot snapshot;
+    ASSERT_EQ(0, snapshot.open(mPath, makeRecords(100)));
+    snapshot.close();
+    EXPECT_FALSE(snapshot.isOpen());
+    EXPECT_EQ(-EBADF, snapshot.append(makeRecords(101)));
+
+    Records records;
+    EXPECT_EQ(-ENOENT, NetworkSnapshot::read(mPath, &records));
+}
+
+}  // namespace net
+}  // namespace android
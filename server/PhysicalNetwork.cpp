@@ -69,18 +69,22 @@ Permission PhysicalNetwork::getPermission() const {
     return mPermission;
 }
 
-int PhysicalNetwork::destroySocketsLackingPermission(Permission permission) {
-    if (permission == PERMISSION_NONE) return 0;
+int PhysicalNetwork::destroySocketsLackingPermission(
+        const std::map<unsigned, Permission>& permissions) {
+    std::map<unsigned, Permission> restricted;
+    for (const auto& [netId, permission] : permissions) {
+        if (permission != PERMISSION_NONE) restricted[netId] = permission;
+    }
+    if (restricted.empty()) return 0;
 
     SockDiag sd;
     if (!sd.open()) {
-       ALOGE("Error closing sockets for netId %d permission change", mNetId);
+       ALOGE("Error closing sockets for permission change of %zu networks", restricted.size());
        return -EBADFD;
     }
-    if (int ret = sd.destroySocketsLackingPermission(mNetId, permission,
-                                                     true /* excludeLoopback */)) {
-        ALOGE("Failed to close sockets changing netId %d to permission %d: %s",
-              mNetId, permission, strerror(-ret));
+    if (int ret = sd.destroySocketsLackingPermission(restricted, true /* excludeLoopback */)) {
+        ALOGE("Failed to close sockets changing permission of %zu networks: %s",
+              restricted.size(), strerror(-ret));
         return ret;
     }
     return 0;
@@ -104,16 +108,11 @@ void PhysicalNetwork::invalidateRouteCache(const std::string& interface) {
     }
 }
 
-int PhysicalNetwork::setPermission(Permission permission) {
+int PhysicalNetwork::applyPermission(Permission permission) const {
     if (permission == mPermission) {
         return 0;
     }
-    if (mInterfaces.empty()) {
-        mPermission = permission;
-        return 0;
-    }
 
-    destroySocketsLackingPermission(permission);
     for (const std::string& interface : mInterfaces) {
         if (int ret = RouteController::modifyPhysicalNetworkPermission(
                     mNetId, interface.c_str(), mPermission, permission, mIsLocalNetwork)) {
@@ -133,15 +132,10 @@ int PhysicalNetwork::setPermission(Permission permission) {
             }
         }
     }
-    // Destroy sockets again in case any were opened after we called destroySocketsLackingPermission
-    // above and before we changed the permissions. These sockets won't be able to send any RST
-    // packets because they are now no longer routed, but at least the apps will get errors.
-    destroySocketsLackingPermission(permission);
-    mPermission = permission;
     return 0;
 }
 
-int PhysicalNetwork::addAsDefault() {
+int PhysicalNetwork::applyAddAsDefault() const {
     if (mIsDefault) {
         return 0;
     }
@@ -150,11 +144,10 @@ int PhysicalNetwork::addAsDefault() {
             return ret;
         }
     }
-    mIsDefault = true;
     return 0;
 }
 
-int PhysicalNetwork::removeAsDefault() {
+int PhysicalNetwork::applyRemoveAsDefault() const {
     if (!mIsDefault) {
         return 0;
     }
@@ -163,11 +156,10 @@ int PhysicalNetwork::removeAsDefault() {
             return ret;
         }
     }
-    mIsDefault = false;
     return 0;
 }
 
-int PhysicalNetwork::addUsers(const UidRanges& uidRanges, int32_t subPriority) {
+int PhysicalNetwork::applyAddUsers(const UidRanges& uidRanges, int32_t subPriority) const {
     if (!isValidSubPriority(subPriority) || !canAddUidRanges(uidRanges)) {
         return -EINVAL;
     }
@@ -180,11 +172,10 @@ int PhysicalNetwork::addUsers(const UidRanges& uidRanges, int32_t subPriority) {
             return ret;
         }
     }
-    addToUidRangeMap(uidRanges, subPriority);
     return 0;
 }
 
-int PhysicalNetwork::removeUsers(const UidRanges& uidRanges, int32_t subPriority) {
+int PhysicalNetwork::applyRemoveUsers(const UidRanges& uidRanges, int32_t subPriority) const {
     if (!isValidSubPriority(subPriority)) return -EINVAL;
 
     for (const std::string& interface : mInterfaces) {
@@ -195,11 +186,10 @@ int PhysicalNetwork::removeUsers(const UidRanges& uidRanges, int32_t subPriority
             return ret;
         }
     }
-    removeFromUidRangeMap(uidRanges, subPriority);
     return 0;
 }
 
-int PhysicalNetwork::addInterface(const std::string& interface) {
+int PhysicalNetwork::applyAddInterface(const std::string& interface) const {
     if (hasInterface(interface)) {
         return 0;
     }
@@ -213,11 +203,10 @@ int PhysicalNetwork::addInterface(const std::string& interface) {
             return ret;
         }
     }
-    mInterfaces.insert(interface);
     return 0;
 }
 
-int PhysicalNetwork::removeInterface(const std::string& interface) {
+int PhysicalNetwork::applyRemoveInterface(const std::string& interface) const {
     if (!hasInterface(interface)) {
         return 0;
     }
@@ -235,11 +224,10 @@ int PhysicalNetwork::removeInterface(const std::string& interface) {
         ALOGE("failed to remove interface %s from netId %u", interface.c_str(), mNetId);
         return ret;
     }
-    mInterfaces.erase(interface);
     return 0;
 }
 
-bool PhysicalNetwork::isValidSubPriority(int32_t priority) {
+bool PhysicalNetwork::isValidSubPriority(int32_t priority) const {
     // SUB_PRIORITY_NO_DEFAULT is a special value, see UidRanges.h.
     return (priority >= UidRanges::SUB_PRIORITY_HIGHEST &&
             priority <= UidRanges::SUB_PRIORITY_LOWEST) ||
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <map>
+
 #include "Network.h"
 #include "Permission.h"
 
@@ -38,22 +40,33 @@ class PhysicalNetwork : public Network {
 
     // These refer to permissions that apps must have in order to use this network.
     Permission getPermission() const;
-    [[nodiscard]] int setPermission(Permission permission);
+    // Changes the permission in two steps, like Network::applyAddInterface(). Does not destroy
+    // sockets; callers destroy the sockets that lack the new permission before and after, with
+    // destroySocketsLackingPermission().
+    [[nodiscard]] int applyPermission(Permission permission) const;
+    void commitPermission(Permission permission) { mPermission = permission; }
+    // Destroys sockets that lack the permissions that each network will require. Each key of
+    // |permissions| is a netId and each value the new permission of that network.
+    static int destroySocketsLackingPermission(const std::map<unsigned, Permission>& permissions);
 
-    [[nodiscard]] int addAsDefault();
-    [[nodiscard]] int removeAsDefault();
-    [[nodiscard]] int addUsers(const UidRanges& uidRanges, int32_t subPriority) override;
-    [[nodiscard]] int removeUsers(const UidRanges& uidRanges, int32_t subPriority) override;
+    // Makes this network the default network or stops it being one, in two steps like
+    // Network::applyAddInterface().
+    [[nodiscard]] int applyAddAsDefault() const;
+    [[nodiscard]] int applyRemoveAsDefault() const;
+    void commitAsDefault(bool isDefault) { mIsDefault = isDefault; }
+    bool isLocalNetwork() const { return mIsLocalNetwork; }
+    [[nodiscard]] int applyAddUsers(const UidRanges& uidRanges, int32_t subPriority) const override;
+    [[nodiscard]] int applyRemoveUsers(const UidRanges& uidRanges,
+                                       int32_t subPriority) const override;
     bool isPhysical() override { return true; }
     bool canAddUsers() override { return true; }
 
   private:
     std::string getTypeString() const override { return "PHYSICAL"; };
-    [[nodiscard]] int addInterface(const std::string& interface) override;
-    [[nodiscard]] int removeInterface(const std::string& interface) override;
-    int destroySocketsLackingPermission(Permission permission);
-    void invalidateRouteCache(const std::string& interface);
-    bool isValidSubPriority(int32_t priority) override;
+    [[nodiscard]] int applyAddInterface(const std::string& interface) const override;
+    [[nodiscard]] int applyRemoveInterface(const std::string& interface) const override;
+    static void invalidateRouteCache(const std::string& interface);
+    bool isValidSubPriority(int32_t priority) const override;
 
     Delegate* const mDelegate;
     Permission mPermission;
@@ -20,12 +20,22 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/fib_rules.h>
+#include <linux/ipv6_route.h>
 #include <net/if.h>
 #include <netdutils/InternetAddresses.h>
 #include <private/android_filesystem_config.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
 #include <map>
+#include <string_view>
+#include <thread>
 
 #include "DummyNetwork.h"
 #include "Fwmark.h"
@@ -34,15 +44,18 @@
 #include "TcUtils.h"
 
 #include <android-base/file.h>
+#include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include "log/log.h"
 #include "netid_client.h"
 #include "netutils/ifc.h"
 
+using android::base::GetIntProperty;
 using android::base::StartsWith;
 using android::base::StringPrintf;
 using android::base::WriteStringToFile;
+using android::netdutils::DumpWriter;
 using android::netdutils::IPPrefix;
 
 namespace android::net {
@@ -85,6 +98,13 @@ const bool ACTION_DEL = false;
 const bool MODIFY_NON_UID_BASED_RULES = true;
 
 const mode_t RT_TABLES_MODE = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;  // mode 0644, rw-r--r--
+// How long to wait for more changes before writing RT_TABLES_PATH. Interfaces are often added and
+// removed in bursts, e.g., when a VPN or clat starts.
+const std::chrono::milliseconds TABLE_NAMES_WRITE_DELAY(100);
+// If this is set to a number of seconds, Init() reconciles the rules and routes left by a previous
+// instance of netd instead of flushing them, and deletes the ones that are not added again within
+// that time. See RouteController::beginReconcile().
+const char* const RECONCILE_TIMEOUT_PROPERTY = "persist.netd.route_reconcile_timeout_secs";
 
 // Avoids "non-constant-expression cannot be narrowed from type 'unsigned int' to 'unsigned short'"
 // warnings when using RTA_LENGTH(x) inside static initializers (even when x is already uint16_t).
@@ -142,6 +162,64 @@ static uint32_t getRouteTableIndexFromGlobalRouteTableIndex(uint32_t index, bool
     return local ? index + localTableOffset : index;
 }
 
+// Returns the value of |interface| in |map|, or 0 if there is none. 0 is neither a valid routing
+// table nor a valid ifindex.
+static uint32_t findInterface(const std::vector<std::pair<std::string, uint32_t>>& map,
+                              std::string_view interface) {
+    auto iter = std::lower_bound(map.begin(), map.end(), interface,
+                                 [](const auto& entry, std::string_view name) {
+                                     return entry.first < name;
+                                 });
+    return (iter != map.end() && iter->first == interface) ? iter->second : 0;
+}
+
+const RouteController::InterfaceTables& RouteController::getInterfaceTables() {
+    // Each thread keeps a reference to the tables it last used, so looking up an interface only
+    // costs an atomic load unless the tables changed since.
+    thread_local std::shared_ptr<const InterfaceTables> tTables;
+    thread_local uint64_t tGeneration = 0;
+
+    if (tTables == nullptr ||
+        tGeneration != sInterfaceTablesGeneration.load(std::memory_order_acquire)) {
+        std::lock_guard lock(sInterfaceToTableLock);
+        tTables = sInterfaceTables;
+        tGeneration = sInterfaceTablesGeneration.load(std::memory_order_relaxed);
+    }
+    return *tTables;
+}
+
+void RouteController::updateInterfaceTables(InterfaceMap InterfaceTables::*map,
+                                            const char* interface, uint32_t value) {
+    const InterfaceMap& current = (*sInterfaceTables).*map;
+    if (findInterface(current, interface) == value) return;
+
+    auto tables = std::make_shared<InterfaceTables>(*sInterfaceTables);
+    InterfaceMap& entries = (*tables).*map;
+    auto iter = std::lower_bound(entries.begin(), entries.end(), std::string_view(interface),
+                                 [](const auto& entry, std::string_view name) {
+                                     return entry.first < name;
+                                 });
+    const bool found = (iter != entries.end() && iter->first == interface);
+    if (value == 0) {
+        entries.erase(iter);
+    } else if (found) {
+        iter->second = value;
+    } else {
+        entries.emplace(iter, interface, value);
+    }
+
+    sInterfaceTables = std::move(tables);
+    sInterfaceTablesGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void RouteController::setInterfaceTable(const char* interface, uint32_t value) {
+    updateInterfaceTables(&InterfaceTables::tables, interface, value);
+}
+
+void RouteController::setCachedIfIndex(const char* interface, uint32_t value) {
+    updateInterfaceTables(&InterfaceTables::ifindexes, interface, value);
+}
+
 // Caller must hold sInterfaceToTableLock.
 uint32_t RouteController::getRouteTableForInterfaceLocked(const char* interface, bool local) {
     // If we already know the routing table for this interface name, use it.
@@ -154,28 +232,29 @@ uint32_t RouteController::getRouteTableForInterfaceLocked(const char* interface,
     // when the reconnect happens the interface will not be in the map, and the code will
     // determine the new routing table from the interface ID, below.
     //
-    // sInterfaceToTable stores the *global* routing table for the interface, and the local table is
-    // "global table - ROUTE_TABLE_OFFSET_FROM_INDEX + ROUTE_TABLE_OFFSET_FROM_INDEX_FOR_LOCAL"
-    auto iter = sInterfaceToTable.find(interface);
-    if (iter != sInterfaceToTable.end()) {
-        return getRouteTableIndexFromGlobalRouteTableIndex(iter->second, local);
+    // The interface tables store the *global* routing table for the interface, and the local table
+    // is "global table - ROUTE_TABLE_OFFSET_FROM_INDEX + ROUTE_TABLE_OFFSET_FROM_INDEX_FOR_LOCAL"
+    if (uint32_t table = findInterface(sInterfaceTables->tables, interface)) {
+        sInterfaceTableHits.fetch_add(1, std::memory_order_relaxed);
+        return getRouteTableIndexFromGlobalRouteTableIndex(table, local);
     }
 
+    // The interface is being added, so don't trust the cached ifindex: a link event for it may
+    // not have been processed yet.
+    sInterfaceTableMisses.fetch_add(1, std::memory_order_relaxed);
     uint32_t index = RouteController::ifNameToIndexFunction(interface);
     if (index == 0) {
         ALOGE("cannot find interface %s: %s", interface, strerror(errno));
         return RT_TABLE_UNSPEC;
     }
     index += RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX;
-    sInterfaceToTable[interface] = index;
+    setInterfaceTable(interface, index);
     return getRouteTableIndexFromGlobalRouteTableIndex(index, local);
 }
 
 uint32_t RouteController::getIfIndex(const char* interface) {
-    std::lock_guard lock(sInterfaceToTableLock);
-
-    auto iter = sInterfaceToTable.find(interface);
-    if (iter == sInterfaceToTable.end()) {
+    const uint32_t table = findInterface(getInterfaceTables().tables, interface);
+    if (table == 0) {
         ALOGE("getIfIndex: cannot find interface %s", interface);
         return 0;
     }
@@ -185,19 +264,87 @@ uint32_t RouteController::getIfIndex(const char* interface) {
     // way to know the interface index from this table. Return 0 here so callers of this method do
     // not get confused.
     // TODO: stop calling this method from any caller that only wants interfaces in client mode.
-    int ifindex = iter->second;
-    if (ifindex == ROUTE_TABLE_LOCAL_NETWORK) {
+    if (table == ROUTE_TABLE_LOCAL_NETWORK) {
         return 0;
     }
 
-    return ifindex - ROUTE_TABLE_OFFSET_FROM_INDEX;
+    return table - ROUTE_TABLE_OFFSET_FROM_INDEX;
+}
+
+uint32_t RouteController::ifNameToIndexCached(const char* interface) {
+    const InterfaceTables& tables = getInterfaceTables();
+    const uint32_t table = findInterface(tables.tables, interface);
+    if (table != 0 && table != ROUTE_TABLE_LOCAL_NETWORK) {
+        sInterfaceTableHits.fetch_add(1, std::memory_order_relaxed);
+        return table - ROUTE_TABLE_OFFSET_FROM_INDEX;
+    }
+    if (uint32_t ifindex = findInterface(tables.ifindexes, interface)) {
+        sInterfaceTableHits.fetch_add(1, std::memory_order_relaxed);
+        return ifindex;
+    }
+
+    // Look the interface up under the lock, so that a concurrent invalidateIfIndex() either sees
+    // the result or happens before the lookup.
+    std::lock_guard lock(sInterfaceToTableLock);
+    if (uint32_t ifindex = findInterface(sInterfaceTables->ifindexes, interface)) {
+        sInterfaceTableHits.fetch_add(1, std::memory_order_relaxed);
+        return ifindex;
+    }
+    sInterfaceTableMisses.fetch_add(1, std::memory_order_relaxed);
+    const uint32_t ifindex = ifNameToIndexFunction(interface);
+    if (ifindex != 0) {
+        setCachedIfIndex(interface, ifindex);
+    }
+    return ifindex;
+}
+
+void RouteController::invalidateIfIndex(const char* interface, uint32_t ifindex) {
+    std::lock_guard lock(sInterfaceToTableLock);
+    setCachedIfIndex(interface, 0);
+    if (ifindex == 0) return;
+
+    // A renamed interface is still cached under its old name, which the event doesn't mention.
+    const auto isStale = [ifindex](const auto& entry) { return entry.second == ifindex; };
+    const InterfaceMap& current = sInterfaceTables->ifindexes;
+    if (std::none_of(current.begin(), current.end(), isStale)) return;
+
+    auto tables = std::make_shared<InterfaceTables>(*sInterfaceTables);
+    std::erase_if(tables->ifindexes, isStale);
+    sInterfaceTables = std::move(tables);
+    sInterfaceTablesGeneration.fetch_add(1, std::memory_order_release);
 }
 
 uint32_t RouteController::getRouteTableForInterface(const char* interface, bool local) {
+    if (uint32_t table = findInterface(getInterfaceTables().tables, interface)) {
+        sInterfaceTableHits.fetch_add(1, std::memory_order_relaxed);
+        return getRouteTableIndexFromGlobalRouteTableIndex(table, local);
+    }
     std::lock_guard lock(sInterfaceToTableLock);
     return getRouteTableForInterfaceLocked(interface, local);
 }
 
+void RouteController::dump(DumpWriter& dw) {
+    const InterfaceTables& tables = getInterfaceTables();
+
+    dw.println("Interface routing tables:");
+    dw.incIndent();
+    for (const auto& [ifName, table] : tables.tables) {
+        dw.println("%s: %u", ifName.c_str(), table);
+    }
+    dw.decIndent();
+
+    dw.println("Cached ifindices:");
+    dw.incIndent();
+    for (const auto& [ifName, ifindex] : tables.ifindexes) {
+        dw.println("%s: %u", ifName.c_str(), ifindex);
+    }
+    dw.decIndent();
+
+    dw.println("Interface lookups: %" PRIu64 " hits, %" PRIu64 " misses",
+               sInterfaceTableHits.load(std::memory_order_relaxed),
+               sInterfaceTableMisses.load(std::memory_order_relaxed));
+}
+
 void addTableName(uint32_t table, const std::string& name, std::string* contents) {
     char tableString[UINT32_STRLEN];
     snprintf(tableString, sizeof(tableString), "%u", table);
@@ -207,8 +354,76 @@ void addTableName(uint32_t table, const std::string& name, std::string* contents
     *contents += "\n";
 }
 
-// Doesn't return success/failure as the file is optional; it's okay if we fail to update it.
+namespace {
+
+// State of the thread that writes RT_TABLES_PATH. Never destroyed, because the thread never exits.
+struct TableNamesWriter {
+    std::mutex lock;
+    std::condition_variable cv;
+    bool started GUARDED_BY(lock) = false;
+    // Whether the file needs to be written again.
+    bool pending GUARDED_BY(lock) = false;
+    bool writing GUARDED_BY(lock) = false;
+    // Number of flushTableNamesFile() calls waiting for the file.
+    int waiters GUARDED_BY(lock) = 0;
+    uint64_t writes GUARDED_BY(lock) = 0;
+};
+
+TableNamesWriter& tableNamesWriter() {
+    static auto* writer = new TableNamesWriter();
+    return *writer;
+}
+
+}  // namespace
+
 void RouteController::updateTableNamesFile() {
+    TableNamesWriter& writer = tableNamesWriter();
+    std::lock_guard lock(writer.lock);
+    writer.pending = true;
+    if (!writer.started) {
+        writer.started = true;
+        std::thread(runTableNamesWriter).detach();
+    }
+    writer.cv.notify_all();
+}
+
+void RouteController::runTableNamesWriter() {
+    TableNamesWriter& writer = tableNamesWriter();
+    std::unique_lock lock(writer.lock);
+    while (true) {
+        writer.cv.wait(lock, [&writer]() REQUIRES(writer.lock) { return writer.pending; });
+        // Wait for the rest of a burst of changes, unless someone is waiting for the file.
+        writer.cv.wait_for(lock, TABLE_NAMES_WRITE_DELAY,
+                           [&writer]() REQUIRES(writer.lock) { return writer.waiters > 0; });
+        writer.pending = false;
+        writer.writing = true;
+
+        // The contents come from the latest interface tables, so changes requested while writing
+        // are either in this write or cause another one.
+        lock.unlock();
+        writeTableNamesFile();
+        lock.lock();
+
+        writer.writing = false;
+        writer.writes++;
+        writer.cv.notify_all();
+    }
+}
+
+uint64_t RouteController::flushTableNamesFile() {
+    TableNamesWriter& writer = tableNamesWriter();
+    std::unique_lock lock(writer.lock);
+    writer.waiters++;
+    writer.cv.notify_all();
+    writer.cv.wait(lock, [&writer]() REQUIRES(writer.lock) {
+        return !writer.pending && !writer.writing;
+    });
+    writer.waiters--;
+    return writer.writes;
+}
+
+// Doesn't return success/failure as the file is optional; it's okay if we fail to update it.
+void RouteController::writeTableNamesFile() {
     std::string contents;
 
     addTableName(RT_TABLE_LOCAL, ROUTE_TABLE_NAME_LOCAL, &contents);
@@ -218,8 +433,7 @@ void RouteController::updateTableNamesFile() {
     addTableName(ROUTE_TABLE_LEGACY_NETWORK, ROUTE_TABLE_NAME_LEGACY_NETWORK, &contents);
     addTableName(ROUTE_TABLE_LEGACY_SYSTEM,  ROUTE_TABLE_NAME_LEGACY_SYSTEM,  &contents);
 
-    std::lock_guard lock(sInterfaceToTableLock);
-    for (const auto& [ifName, table] : sInterfaceToTable) {
+    for (const auto& [ifName, table] : getInterfaceTables().tables) {
         if (table <= ROUTE_TABLE_OFFSET_FROM_INDEX) {
             continue;
         }
@@ -231,10 +445,17 @@ void RouteController::updateTableNamesFile() {
         addTableName(offset + table, ifName + INTERFACE_LOCAL_SUFFIX, &contents);
     }
 
-    if (!WriteStringToFile(contents, RT_TABLES_PATH, RT_TABLES_MODE, AID_SYSTEM, AID_WIFI)) {
-        ALOGE("failed to write to %s (%s)", RT_TABLES_PATH, strerror(errno));
+    // Write a new file and rename it over the old one, so that readers never see a partial file.
+    const std::string tmpPath = std::string(RT_TABLES_PATH) + ".tmp";
+    if (!WriteStringToFile(contents, tmpPath, RT_TABLES_MODE, AID_SYSTEM, AID_WIFI)) {
+        ALOGE("failed to write to %s (%s)", tmpPath.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
         return;
     }
+    if (rename(tmpPath.c_str(), RT_TABLES_PATH) == -1) {
+        ALOGE("failed to rename %s to %s (%s)", tmpPath.c_str(), RT_TABLES_PATH, strerror(errno));
+        unlink(tmpPath.c_str());
+    }
 }
 
 // Returns 0 on success or negative errno on failure.
@@ -253,6 +474,253 @@ int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* pa
     return 0;
 }
 
+namespace {
+
+// A rule or route that was there when Init() started reconciling, and that no request has added or
+// deleted since.
+struct StaleObject {
+    uint16_t deleteAction;
+    uint32_t table;
+    // The dumped message, without its nlmsghdr. Objects are deleted with the message they are
+    // dumped with, as in rtNetlinkFlush().
+    std::vector<uint8_t> body;
+};
+
+// State of the restart mode of Init(). Never destroyed, because the deadline thread may outlive
+// everything else.
+struct Reconciler {
+    std::mutex lock;
+    std::condition_variable cv;
+    // Incremented every time reconciling starts or finishes, so that the deadline thread of an
+    // earlier reconcile does nothing.
+    uint64_t generation GUARDED_BY(lock) = 0;
+    // Keyed by reconcileKey(). Several routes can have the same key.
+    std::multimap<std::string, StaleObject> stale GUARDED_BY(lock);
+    // Checked without the lock by every rule and route request.
+    std::atomic<bool> active = false;
+    std::function<void()> onFinished GUARDED_BY(lock);
+};
+
+Reconciler& reconciler() {
+    static auto* r = new Reconciler();
+    return *r;
+}
+
+template <typename T>
+void appendKey(std::string* key, const T& value) {
+    key->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint32_t rtaU32(const rtattr* rta) {
+    uint32_t value = 0;
+    memcpy(&value, RTA_DATA(rta), std::min<size_t>(RTA_PAYLOAD(rta), sizeof(value)));
+    return value;
+}
+
+// Returns the identity of the rule or route in |data|, the body of a message of type |action|
+// that netd sends or that the kernel dumps. The kernel dumps attributes that netd never sets, and
+// omits some that are set to their defaults, so only the fields that netd sets are compared.
+//
+// Rules are identified by every field that netd sets, because that is how the kernel tells them
+// apart. The key of a route starts with its identity, i.e., its table, destination and priority,
+// which is |*identityLen| bytes long. It ends with the interface, gateway and MTU, so that a route
+// that changed while netd was not running is not kept as it is. The interface and gateway of
+// routes that are not unicast are ignored, because the kernel reports IPv6 unreachable routes with
+// the loopback interface.
+std::string reconcileKey(uint16_t action, const uint8_t* data, size_t len,
+                         size_t* identityLen = nullptr) {
+    std::string key;
+    rtmsg msg;
+    if (len < sizeof(msg)) {
+        return key;
+    }
+    // struct fib_rule_hdr and struct rtmsg are functionally identical.
+    memcpy(&msg, data, sizeof(msg));
+    const bool isRule = (action == RTM_NEWRULE || action == RTM_DELRULE);
+
+    uint32_t table = msg.rtm_table;
+    uint32_t priority = 0;
+    uint32_t fwmark = 0;
+    uint32_t fwmask = 0;
+    fib_rule_uid_range uidRange = {0, UINT32_MAX};
+    std::string_view iif, oif, dst, gateway;
+    uint32_t oifIndex = 0;
+    uint32_t mtu = 0;
+
+    auto rta = reinterpret_cast<const rtattr*>(data + NLMSG_ALIGN(sizeof(msg)));
+    auto rtaLen = static_cast<unsigned int>(len - std::min(len, NLMSG_ALIGN(sizeof(msg))));
+    for (; RTA_OK(rta, rtaLen); rta = RTA_NEXT(rta, rtaLen)) {
+        const auto* value = static_cast<const char*>(RTA_DATA(rta));
+        const size_t valueLen = RTA_PAYLOAD(rta);
+        // FRA_TABLE and FRA_PRIORITY are the same as RTA_TABLE and RTA_PRIORITY.
+        switch (rta->rta_type) {
+            case RTA_TABLE:
+                table = rtaU32(rta);
+                break;
+            case RTA_PRIORITY:
+                priority = rtaU32(rta);
+                break;
+        }
+        if (isRule) {
+            switch (rta->rta_type) {
+                case FRA_FWMARK:
+                    fwmark = rtaU32(rta);
+                    break;
+                case FRA_FWMASK:
+                    fwmask = rtaU32(rta);
+                    break;
+                case FRA_UID_RANGE:
+                    memcpy(&uidRange, value, std::min(valueLen, sizeof(uidRange)));
+                    break;
+                case FRA_IIFNAME:
+                    iif = std::string_view(value, strnlen(value, valueLen));
+                    break;
+                case FRA_OIFNAME:
+                    oif = std::string_view(value, strnlen(value, valueLen));
+                    break;
+            }
+        } else if (rta->rta_type == RTA_DST && msg.rtm_dst_len > 0) {
+            dst = std::string_view(value, valueLen);
+        } else if (rta->rta_type == RTA_OIF && msg.rtm_type == RTN_UNICAST) {
+            oifIndex = rtaU32(rta);
+        } else if (rta->rta_type == RTA_GATEWAY && msg.rtm_type == RTN_UNICAST) {
+            gateway = std::string_view(value, valueLen);
+            // An all-zero gateway is the same as none.
+            if (std::all_of(gateway.begin(), gateway.end(), [](char c) { return c == 0; })) {
+                gateway = {};
+            }
+        } else if (rta->rta_type == RTA_METRICS) {
+            auto metric = reinterpret_cast<const rtattr*>(RTA_DATA(rta));
+            auto metricsLen = static_cast<unsigned int>(valueLen);
+            for (; RTA_OK(metric, metricsLen); metric = RTA_NEXT(metric, metricsLen)) {
+                if (metric->rta_type == RTAX_MTU) mtu = rtaU32(metric);
+            }
+        }
+    }
+
+    key += isRule ? 'r' : 'R';
+    appendKey(&key, msg.rtm_family);
+    appendKey(&key, table);
+    if (isRule) {
+        // fib_rule_hdr.action.
+        appendKey(&key, msg.rtm_type);
+        appendKey(&key, priority);
+        appendKey(&key, fwmark);
+        appendKey(&key, fwmask);
+        appendKey(&key, uidRange);
+        appendKey(&key, iif.size());
+        key += iif;
+        key += oif;
+    } else {
+        // The kernel assigns this priority to IPv6 routes that are added without one.
+        if (msg.rtm_family == AF_INET6 && priority == 0) {
+            priority = IP6_RT_PRIO_USER;
+        }
+        appendKey(&key, priority);
+        appendKey(&key, msg.rtm_tos);
+        appendKey(&key, msg.rtm_dst_len);
+        key += dst;
+        if (identityLen) *identityLen = key.size();
+        appendKey(&key, oifIndex);
+        appendKey(&key, mtu);
+        key += gateway;
+    }
+    return key;
+}
+
+// Called with every rule and route request before it is sent. While Init() is reconciling, the
+// requested object is no longer stale: it is either wanted again, or deleted. Returns true if the
+// request adds a rule that is already there, which must not be sent, because the kernel would fail
+// it with EEXIST. Routes are always sent, because the kernel deletes the routes of an interface
+// when it goes down, and adding a route that is already there is not an error.
+//
+// If |replace| is not null, the request adds a route, and a stale route with the same identity
+// but another interface, gateway or MTU is there, sets |*replace| to true: the request must then
+// replace that route, which the kernel would otherwise keep, failing the request with EEXIST.
+bool isReconciledRequest(uint16_t action, const iovec* iov, int iovlen, bool* replace = nullptr) {
+    Reconciler& r = reconciler();
+    if (!r.active.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    std::vector<uint8_t> body;
+    for (int i = 0; i < iovlen; ++i) {
+        const auto* base = static_cast<const uint8_t*>(iov[i].iov_base);
+        body.insert(body.end(), base, base + iov[i].iov_len);
+    }
+    size_t identityLen = 0;
+    const std::string key = reconcileKey(action, body.data(), body.size(), &identityLen);
+
+    std::lock_guard lock(r.lock);
+    // Several objects can have the same key, and each request accounts for one of them.
+    if (auto it = r.stale.find(key); it != r.stale.end()) {
+        r.stale.erase(it);
+        return action == RTM_NEWRULE;
+    }
+    if (replace && action == RTM_NEWROUTE && identityLen > 0) {
+        // The identity of a route has a fixed length for each family, so the routes with the same
+        // identity are the ones whose keys start with it.
+        const std::string_view identity(key.data(), identityLen);
+        if (auto it = r.stale.lower_bound(std::string(identity));
+            it != r.stale.end() && it->first.starts_with(identity)) {
+            r.stale.erase(it);
+            *replace = true;
+        }
+    }
+    return false;
+}
+
+// Deletes the objects that are still stale, and stops reconciling. Returns the number of objects
+// deleted.
+int finishReconcileLocked(Reconciler& r) REQUIRES(r.lock) {
+    if (!r.active) {
+        return 0;
+    }
+    r.active = false;
+    r.generation++;
+    r.cv.notify_all();
+
+    // The lock is held until the stale objects are gone, so that a request to add one of them
+    // again is only sent after it has been deleted.
+    NetlinkBatch batch(NetlinkBatch::kDetached);
+    for (const auto& [key, object] : r.stale) {
+        iovec iov = {const_cast<uint8_t*>(object.body.data()), object.body.size()};
+        batch.add(object.deleteAction, NETLINK_REQUEST_FLAGS, &iov, 1);
+    }
+    (void) batch.flush();
+    r.stale.clear();
+
+    int deleted = 0;
+    for (const int error : batch.results()) {
+        // As in rtNetlinkFlush(), something else may have deleted the object since the dump.
+        if (error == 0) {
+            deleted++;
+        } else if (error != -ENOENT && error != -ESRCH) {
+            ALOGW("Deleting stale rule or route: %s", strerror(-error));
+        }
+    }
+    ALOGI("Reconciled rules and routes, deleted %d stale ones", deleted);
+    return deleted;
+}
+
+void runReconcileDeadline(uint64_t generation, std::chrono::steady_clock::time_point deadline) {
+    Reconciler& r = reconciler();
+    std::function<void()> onFinished;
+    {
+        std::unique_lock lock(r.lock);
+        if (r.cv.wait_until(lock, deadline, [&r, generation]() REQUIRES(r.lock) {
+                return r.generation != generation;
+            })) {
+            return;
+        }
+        (void) finishReconcileLocked(r);
+        onFinished = r.onFinished;
+    }
+    if (onFinished) onFinished();
+}
+
+}  // namespace
+
 // Adds or removes a routing rule for IPv4 and IPv6.
 //
 // + If |table| is non-zero, the rule points at the specified routing table. Otherwise, the table is
@@ -343,6 +811,9 @@ int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* pa
     uint16_t flags = (action == RTM_NEWRULE) ? NETLINK_RULE_CREATE_FLAGS : NETLINK_REQUEST_FLAGS;
     for (size_t i = 0; i < ARRAY_SIZE(AF_FAMILIES); ++i) {
         rule.family = AF_FAMILIES[i];
+        if (isReconciledRequest(action, iov, ARRAY_SIZE(iov))) {
+            continue;
+        }
         if (int ret = sendNetlinkRequest(action, flags, iov, ARRAY_SIZE(iov), nullptr)) {
             if (!(action == RTM_DELRULE && ret == -ENOENT && priority == RULE_PRIORITY_TETHERING)) {
                 // Don't log when deleting a tethering rule that's not there. This matches the
@@ -364,8 +835,8 @@ int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* pa
                         uidEnd);
 }
 
-[[nodiscard]] static int modifyIpRule(uint16_t action, int32_t priority, uint32_t table,
-                                      uint32_t fwmark, uint32_t mask) {
+int modifyIpRule(uint16_t action, int32_t priority, uint32_t table, uint32_t fwmark,
+                 uint32_t mask) {
     return modifyIpRule(action, priority, table, fwmark, mask, IIF_NONE, OIF_NONE, INVALID_UID,
                         INVALID_UID);
 }
@@ -414,7 +885,7 @@ int modifyIpRoute(uint16_t action, uint16_t flags, uint32_t table, const char* i
     } else {
         // If an interface was specified, find the ifindex.
         if (interface != OIF_NONE) {
-            ifindex = RouteController::ifNameToIndexFunction(interface);
+            ifindex = RouteController::ifNameToIndexCached(interface);
 
             if (!ifindex) {
                 ALOGE("cannot find interface %s", interface);
@@ -465,6 +936,14 @@ int modifyIpRoute(uint16_t action, uint16_t flags, uint32_t table, const char* i
         flags &= ~NLM_F_EXCL;
     }
 
+    // Only a request that excludes other routes with the same identity replaces a stale one. The
+    // link-local routes above are told apart by their interface.
+    bool replace = false;
+    (void) isReconciledRequest(action, iov, ARRAY_SIZE(iov),
+                               (flags & NLM_F_EXCL) ? &replace : nullptr);
+    if (replace) {
+        flags = (flags & ~(NLM_F_EXCL | NLM_F_CREATE)) | NLM_F_REPLACE;
+    }
     int ret = sendNetlinkRequest(action, flags, iov, ARRAY_SIZE(iov), nullptr);
     if (ret) {
         ALOGE("Error %s route %s -> %s %s to table %u: %s",
@@ -1216,12 +1695,34 @@ uint32_t getRouteTable(const nlmsghdr *nlh) {
     return getRtmU32Attribute(nlh, RTA_TABLE);
 }
 
-[[nodiscard]] static int flushRules() {
-    NetlinkDumpFilter shouldDelete = [] (nlmsghdr *nlh) {
-        // Don't touch rules at priority 0 because by default they are used for local input.
-        return getRulePriority(nlh) != 0;
+static bool isNetdRule(nlmsghdr* nlh) {
+    // Don't touch rules at priority 0 because by default they are used for local input.
+    return getRulePriority(nlh) != 0;
+}
+
+// Only the routes that netd added to its own tables. Other routes in them, e.g., the routes that
+// the kernel adds for router advertisements, are not netd's to delete.
+static bool isNetdRoute(nlmsghdr* nlh) {
+    if (reinterpret_cast<const rtmsg*>(NLMSG_DATA(nlh))->rtm_protocol != RTPROT_STATIC) {
+        return false;
+    }
+    const uint32_t table = getRouteTable(nlh);
+    return table == ROUTE_TABLE_LOCAL_NETWORK || table == ROUTE_TABLE_LEGACY_NETWORK ||
+           table == ROUTE_TABLE_LEGACY_SYSTEM ||
+           table > RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX;
+}
+
+// Whether an earlier instance of netd has initialized the rules since boot.
+static bool hasUnreachableRule() {
+    bool found = false;
+    NetlinkDumpCallback callback = [&found](nlmsghdr* nlh) {
+        found |= (getRulePriority(nlh) == RULE_PRIORITY_UNREACHABLE);
     };
-    return rtNetlinkFlush(RTM_GETRULE, RTM_DELRULE, "rules", shouldDelete);
+    return rtNetlinkDump(RTM_GETRULE, callback) == 0 && found;
+}
+
+[[nodiscard]] static int flushRules() {
+    return rtNetlinkFlush(RTM_GETRULE, RTM_DELRULE, "rules", isNetdRule);
 }
 
 int RouteController::flushRoutes(uint32_t table) {
@@ -1229,13 +1730,23 @@ int RouteController::flushRoutes(uint32_t table) {
         return getRouteTable(nlh) == table;
     };
 
-    return rtNetlinkFlush(RTM_GETROUTE, RTM_DELROUTE, "routes", shouldDelete);
+    // Routes that are flushed must be added again, even if they were there when Init() started
+    // reconciling.
+    Reconciler& r = reconciler();
+    if (r.active.load(std::memory_order_acquire)) {
+        std::lock_guard lock(r.lock);
+        std::erase_if(r.stale, [table](const auto& entry) {
+            return entry.second.deleteAction == RTM_DELROUTE && entry.second.table == table;
+        });
+    }
+
+    return rtNetlinkFlush(RTM_GETROUTE, RTM_DELROUTE, "routes", shouldDelete, table);
 }
 
 int RouteController::flushRoutes(const char* interface) {
     // Try to flush both local and global routing tables.
     //
-    // Flush local first because flush global routing tables may erase the sInterfaceToTable map.
+    // Flush local first because flush global routing tables may erase the interface's table.
     // Then the fake <iface>_local interface will be unable to find the index because the local
     // interface depends physical interface to find the correct index.
     int ret = flushRoutes(interface, true);
@@ -1245,9 +1756,7 @@ int RouteController::flushRoutes(const char* interface) {
 
 // Returns 0 on success or negative errno on failure.
 int RouteController::flushRoutes(const char* interface, bool local) {
-    std::lock_guard lock(sInterfaceToTableLock);
-
-    uint32_t table = getRouteTableForInterfaceLocked(interface, local);
+    uint32_t table = getRouteTableForInterface(interface, local);
     if (table == RT_TABLE_UNSPEC) {
         return -ESRCH;
     }
@@ -1256,18 +1765,100 @@ int RouteController::flushRoutes(const char* interface, bool local) {
 
     // If we failed to flush routes, the caller may elect to keep this interface around, so keep
     // track of its name.
-    // Skip erasing local fake interface since it does not exist in sInterfaceToTable.
+    // Skip erasing local fake interface since it does not exist in the interface tables.
     if (ret == 0 && !local) {
-        sInterfaceToTable.erase(interface);
+        std::lock_guard lock(sInterfaceToTableLock);
+        setInterfaceTable(interface, 0);
     }
 
     return ret;
 }
 
-int RouteController::Init(unsigned localNetId) {
-    if (int ret = flushRules()) {
+// Restart mode of Init().
+//
+// When netd restarts, the rules and routes of the previous instance are still there. Flushing them
+// leaves every app without routing until the framework has added all the networks again. Instead,
+// the rules and routes that netd owns are dumped and kept, and every rule and route request marks
+// the object it adds or deletes as no longer stale. Adding a rule that is still there is skipped.
+// Whatever is still stale when finishReconcile() is called, by the deadline thread |timeout| after
+// reconciling starts, is deleted in one netlink batch.
+int RouteController::beginReconcile(const NetlinkDumpFilter& isOwnRule,
+                                    const NetlinkDumpFilter& isOwnRoute,
+                                    std::chrono::milliseconds timeout) {
+    std::multimap<std::string, StaleObject> stale;
+    const auto collect = [&stale](uint16_t deleteAction, const NetlinkDumpFilter& isOwn) {
+        return [&stale, deleteAction, &isOwn](nlmsghdr* nlh) {
+            if (!isOwn(nlh)) return;
+            const uint8_t* data = static_cast<const uint8_t*>(NLMSG_DATA(nlh));
+            const size_t len = nlh->nlmsg_len - NLMSG_HDRLEN;
+            stale.emplace(reconcileKey(nlh->nlmsg_type, data, len),
+                          StaleObject{
+                                  .deleteAction = deleteAction,
+                                  .table = getRtmU32Attribute(nlh, RTA_TABLE),
+                                  .body = std::vector<uint8_t>(data, data + len),
+                          });
+        };
+    };
+    if (int ret = rtNetlinkDump(RTM_GETRULE, collect(RTM_DELRULE, isOwnRule))) {
+        ALOGE("Error dumping rules to reconcile: %s", strerror(-ret));
         return ret;
     }
+    if (int ret = rtNetlinkDump(RTM_GETROUTE, collect(RTM_DELROUTE, isOwnRoute))) {
+        ALOGE("Error dumping routes to reconcile: %s", strerror(-ret));
+        return ret;
+    }
+
+    Reconciler& r = reconciler();
+    std::lock_guard lock(r.lock);
+    ALOGI("Reconciling %zu rules and routes, deleting the stale ones in %lld ms", stale.size(),
+          static_cast<long long>(timeout.count()));
+    r.stale = std::move(stale);
+    const uint64_t generation = ++r.generation;
+    r.active = true;
+    std::thread(runReconcileDeadline, generation, std::chrono::steady_clock::now() + timeout)
+            .detach();
+    return 0;
+}
+
+int RouteController::finishReconcile() {
+    Reconciler& r = reconciler();
+    std::function<void()> onFinished;
+    int deleted;
+    {
+        std::lock_guard lock(r.lock);
+        if (r.active) onFinished = r.onFinished;
+        deleted = finishReconcileLocked(r);
+    }
+    if (onFinished) onFinished();
+    return deleted;
+}
+
+void RouteController::restoreInterface(const char* interface) {
+    (void) getRouteTableForInterface(interface, false);
+}
+
+bool RouteController::isReconciling() {
+    return reconciler().active;
+}
+
+void RouteController::setReconcileFinishedCallback(std::function<void()> callback) {
+    Reconciler& r = reconciler();
+    std::lock_guard lock(r.lock);
+    r.onFinished = std::move(callback);
+}
+
+int RouteController::Init(unsigned localNetId) {
+    const int reconcileTimeoutSecs = GetIntProperty(RECONCILE_TIMEOUT_PROPERTY, 0);
+    bool reconciling = false;
+    if (reconcileTimeoutSecs > 0 && hasUnreachableRule()) {
+        reconciling = beginReconcile(isNetdRule, isNetdRoute,
+                                     std::chrono::seconds(reconcileTimeoutSecs)) == 0;
+    }
+    if (!reconciling) {
+        if (int ret = flushRules()) {
+            return ret;
+        }
+    }
     if (int ret = addLegacyRouteRules()) {
         return ret;
     }
@@ -1289,7 +1880,7 @@ int RouteController::addInterfaceToLocalNetwork(unsigned netId, const char* inte
         return ret;
     }
     std::lock_guard lock(sInterfaceToTableLock);
-    sInterfaceToTable[interface] = ROUTE_TABLE_LOCAL_NETWORK;
+    setInterfaceTable(interface, ROUTE_TABLE_LOCAL_NETWORK);
     return 0;
 }
 
@@ -1298,7 +1889,7 @@ int RouteController::removeInterfaceFromLocalNetwork(unsigned netId, const char*
         return ret;
     }
     std::lock_guard lock(sInterfaceToTableLock);
-    sInterfaceToTable.erase(interface);
+    setInterfaceTable(interface, 0);
     return 0;
 }
 
@@ -1523,8 +2114,12 @@ int RouteController::removeUsersFromUnreachableNetwork(unsigned netId,
     return modifyUnreachableNetwork(netId, uidRangeMap, ACTION_DEL);
 }
 
-// Protects sInterfaceToTable.
+// Serializes changes to sInterfaceTables.
 std::mutex RouteController::sInterfaceToTableLock;
-std::map<std::string, uint32_t> RouteController::sInterfaceToTable;
+std::shared_ptr<const RouteController::InterfaceTables> RouteController::sInterfaceTables =
+        std::make_shared<const InterfaceTables>();
+std::atomic<uint64_t> RouteController::sInterfaceTablesGeneration;
+std::atomic<uint64_t> RouteController::sInterfaceTableHits;
+std::atomic<uint64_t> RouteController::sInterfaceTableMisses;
 
 }  // namespace android::net
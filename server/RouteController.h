@@ -18,15 +18,24 @@
 
 #include "InterfaceController.h"  // getParameter
 #include "NetdConstants.h"        // IptablesTarget
+#include "NetlinkCommands.h"      // NetlinkDumpFilter
 #include "Network.h"              // UidRangeMap
 #include "Permission.h"
 
 #include <android-base/thread_annotations.h>
+#include <netdutils/DumpWriter.h>
 
 #include <linux/netlink.h>
 #include <sys/types.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace android::net {
 
@@ -107,7 +116,18 @@ public:
 
     [[nodiscard]] static int Init(unsigned localNetId);
 
-    // Returns an ifindex given the interface name, by looking up in sInterfaceToTable.
+    // Whether Init() kept the rules and routes of a previous instance of netd, and has not yet
+    // deleted the ones that were not added again. See beginReconcile().
+    static bool isReconciling();
+    // Sets a function that is called, without any lock held, after the stale rules and routes have
+    // been deleted.
+    static void setReconcileFinishedCallback(std::function<void()> callback);
+    // For interfaces of networks that NetworkController restores after a restart. Looks up the
+    // routing table of |interface| as adding it to a network does, so that getIfIndex() and later
+    // changes find it.
+    static void restoreInterface(const char* interface) EXCLUDES(sInterfaceToTableLock);
+
+    // Returns an ifindex given the interface name, by looking up in the interface tables.
     // This is currently only used by NetworkController::addInterfaceToNetwork
     // and should probabaly be changed to passing the ifindex into RouteController instead.
     // We do this instead of calling if_nametoindex because the same interface name can
@@ -116,6 +136,24 @@ public:
     // used to add them.
     static uint32_t getIfIndex(const char* interface) EXCLUDES(sInterfaceToTableLock);
 
+    // Returns the ifindex of |interface|, or 0 if there is no such interface. Like getIfIndex(),
+    // uses the index the interface had when it was added to its network, so adding many routes
+    // doesn't cost one if_nametoindex call each. Falls back to ifNameToIndexFunction for
+    // interfaces that are not in any network, and caches the result until invalidateIfIndex() is
+    // called for the interface. Never logs. Adding an interface to a network doesn't use the
+    // cache, and always looks up the current ifindex.
+    static uint32_t ifNameToIndexCached(const char* interface) EXCLUDES(sInterfaceToTableLock);
+
+    // Forgets the cached ifindex of |interface|, and of any interface cached with index |ifindex|.
+    // Called for every RTM_NEWLINK and RTM_DELLINK event, because the interface may have been
+    // created, renamed or deleted. |ifindex| may be 0 if the event did not carry it. The routing
+    // tables of interfaces in networks are kept, so that their routes and rules can still be
+    // removed.
+    static void invalidateIfIndex(const char* interface, uint32_t ifindex)
+            EXCLUDES(sInterfaceToTableLock);
+
+    static void dump(netdutils::DumpWriter& dw) EXCLUDES(sInterfaceToTableLock);
+
     [[nodiscard]] static int addInterfaceToLocalNetwork(unsigned netId, const char* interface);
     [[nodiscard]] static int removeInterfaceFromLocalNetwork(unsigned netId, const char* interface);
 
@@ -197,6 +235,9 @@ public:
     static int (*iptablesRestoreCommandFunction)(IptablesTarget, const std::string&,
                                                  const std::string&, std::string *);
     static uint32_t (*ifNameToIndexFunction)(const char*);
+    // Waits until RT_TABLES_PATH has been written with every change requested so far. Returns the
+    // number of times it has been written.
+    static uint64_t flushTableNamesFile();
 
   private:
     friend class RouteControllerTest;
@@ -209,8 +250,50 @@ public:
             "224.0.0.0/24"  // Link-local multicast; non-internet routable
     };
 
+    // Flat maps from interface name to value, sorted by name.
+    typedef std::vector<std::pair<std::string, uint32_t>> InterfaceMap;
+
+    // The global routing table of each interface that is or was being added to a network, and
+    // the ifindex of other interfaces looked up by ifNameToIndexCached().
+    //
+    // Every rule and route change looks up the table of its interface, often several times, so
+    // lookups must not contend on a lock. A published InterfaceTables is never modified: writers
+    // hold sInterfaceToTableLock, copy sInterfaceTables, modify the copy and publish it. Readers
+    // call getInterfaceTables(), which only takes the lock after a writer published a new copy.
+    struct InterfaceTables {
+        InterfaceMap tables;
+        InterfaceMap ifindexes;
+    };
+
     static std::mutex sInterfaceToTableLock;
-    static std::map<std::string, uint32_t> sInterfaceToTable GUARDED_BY(sInterfaceToTableLock);
+    static std::shared_ptr<const InterfaceTables> sInterfaceTables
+            GUARDED_BY(sInterfaceToTableLock);
+    // Incremented every time sInterfaceTables is replaced.
+    static std::atomic<uint64_t> sInterfaceTablesGeneration;
+    // Lookups answered by the interface tables, and lookups that needed ifNameToIndexFunction.
+    static std::atomic<uint64_t> sInterfaceTableHits;
+    static std::atomic<uint64_t> sInterfaceTableMisses;
+
+    // Returns the latest interface tables. The reference is valid until the next call on the same
+    // thread.
+    static const InterfaceTables& getInterfaceTables() EXCLUDES(sInterfaceToTableLock);
+    // Publishes a copy of the interface tables in which |interface| maps to |value| in |tables|
+    // or |ifindexes|, or is removed from it if |value| is 0.
+    static void setInterfaceTable(const char* interface, uint32_t value)
+            REQUIRES(sInterfaceToTableLock);
+    static void setCachedIfIndex(const char* interface, uint32_t value)
+            REQUIRES(sInterfaceToTableLock);
+    static void updateInterfaceTables(InterfaceMap InterfaceTables::*map, const char* interface,
+                                      uint32_t value) REQUIRES(sInterfaceToTableLock);
+
+    // Restart mode of Init(). Keeps the rules and routes for which |isOwnRule| and |isOwnRoute|
+    // return true until finishReconcile() is called, |timeout| from now, and then deletes the ones
+    // that were not added or deleted since. Returns 0 or negative errno.
+    [[nodiscard]] static int beginReconcile(const NetlinkDumpFilter& isOwnRule,
+                                            const NetlinkDumpFilter& isOwnRoute,
+                                            std::chrono::milliseconds timeout);
+    // Returns the number of stale rules and routes that were deleted.
+    static int finishReconcile();
 
     static int configureDummyNetwork();
     [[nodiscard]] static int flushRoutes(const char* interface) EXCLUDES(sInterfaceToTableLock);
@@ -236,7 +319,12 @@ public:
     static int modifyVirtualNetwork(unsigned netId, const char* interface,
                                     const UidRangeMap& uidRangeMap, bool secure, bool add,
                                     bool modifyNonUidBasedRules, bool excludeLocalRoutes);
-    static void updateTableNamesFile() EXCLUDES(sInterfaceToTableLock);
+    // Asks the table names writer thread to rewrite RT_TABLES_PATH, so that ip(8) can show the
+    // names of the interface tables. Changes made in quick succession are written together, and
+    // the file is never written by the caller, which may hold network locks.
+    static void updateTableNamesFile();
+    static void runTableNamesWriter();
+    static void writeTableNamesFile() EXCLUDES(sInterfaceToTableLock);
     static int modifyVpnLocalExclusionRule(bool add, const char* physicalInterface);
 
     static int modifyUidLocalNetworkRule(const char* interface, uid_t uidStart, uid_t uidEnd,
@@ -252,6 +340,8 @@ public:
 [[nodiscard]] int modifyIpRoute(uint16_t action, uint16_t flags, uint32_t table,
                                 const char* interface, const char* destination, const char* nexthop,
                                 uint32_t mtu, uint32_t priority);
+[[nodiscard]] int modifyIpRule(uint16_t action, int32_t priority, uint32_t table, uint32_t fwmark,
+                               uint32_t mask);
 uint32_t getRulePriority(const nlmsghdr *nlh);
 [[nodiscard]] int modifyIncomingPacketMark(unsigned netId, const char* interface,
                                            Permission permission, bool add);
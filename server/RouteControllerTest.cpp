@@ -16,17 +16,29 @@
  * RouteControllerTest.cpp - unit tests for RouteController.cpp
  */
 
+#include <arpa/inet.h>
+#include <unistd.h>
 #include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
 
 #include "Fwmark.h"
 #include "IptablesBaseTest.h"
 #include "NetlinkCommands.h"
 #include "RouteController.h"
 
+#include <android-base/file.h>
 #include <android-base/stringprintf.h>
+#include <netdutils/Stopwatch.h>
 
 using android::base::StringPrintf;
+using android::netdutils::Stopwatch;
 
 static const char* TEST_IFACE1 = "netdtest1";
 static const char* TEST_IFACE2 = "netdtest2";
@@ -49,6 +61,28 @@ public:
         return RouteController::flushRoutes(a);
     }
 
+    uint32_t getRouteTableForInterface(const char* iface, bool local) {
+        return RouteController::getRouteTableForInterface(iface, local);
+    }
+
+    // Forgets everything the interface tables know about |iface|.
+    void resetInterfaceTables(const char* iface) {
+        std::lock_guard lock(RouteController::sInterfaceToTableLock);
+        RouteController::setInterfaceTable(iface, 0);
+        RouteController::setCachedIfIndex(iface, 0);
+    }
+
+    void updateTableNamesFile() { RouteController::updateTableNamesFile(); }
+
+    // The deadline is never reached; tests call finishReconcile().
+    int beginReconcile(const NetlinkDumpFilter& isOwnRule, const NetlinkDumpFilter& isOwnRoute) {
+        return RouteController::beginReconcile(isOwnRule, isOwnRoute, std::chrono::hours(1));
+    }
+    int finishReconcile() { return RouteController::finishReconcile(); }
+
+    uint64_t interfaceTableHits() { return RouteController::sInterfaceTableHits; }
+    uint64_t interfaceTableMisses() { return RouteController::sInterfaceTableMisses; }
+
     uint32_t static fakeIfaceNameToIndexFunction(const char* iface) {
         // "lo" is the same as the real one
         if (!strcmp(iface, "lo")) return LOOPBACK_IFINDEX;
@@ -113,6 +147,256 @@ TEST_F(RouteControllerTest, TestRouteFlush) {
                                "192.0.2.4/32", nullptr, 0 /* mtu */, 0 /* priority */));
 }
 
+TEST_F(RouteControllerTest, TestNetlinkBatch) {
+    // Pick a table number that's not used by the system.
+    const uint32_t table = 500;
+    const int numRoutes = 3 * kNetlinkBatchWindow + 1;
+
+    NetlinkBatch batch;
+    for (int i = 0; i < numRoutes; i++) {
+        const std::string dst = StringPrintf("192.0.2.%d/32", i);
+        // Queued requests report success until the batch is flushed.
+        EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                                   dst.c_str(), nullptr, 0 /* mtu */, 0 /* priority */));
+    }
+    EXPECT_EQ(0, modifyIpRoute(RTM_DELROUTE, NETLINK_REQUEST_FLAGS, table, "lo", "192.0.2.255/32",
+                               nullptr, 0 /* mtu */, 0 /* priority */));
+    EXPECT_EQ(static_cast<size_t>(numRoutes + 1), batch.size());
+
+    // The route that was never added fails to delete; all the others are created.
+    EXPECT_EQ(-ESRCH, batch.flush());
+    ASSERT_EQ(static_cast<size_t>(numRoutes + 1), batch.results().size());
+    for (int i = 0; i < numRoutes; i++) {
+        EXPECT_EQ(0, batch.results()[i]) << "route " << i;
+    }
+    EXPECT_EQ(-ESRCH, batch.results()[numRoutes]);
+    EXPECT_EQ(0U, batch.size());
+
+    EXPECT_EQ(0, flushRoutes(table));
+}
+
+TEST_F(RouteControllerTest, TestBulkRouteBenchmark) {
+    // Installs and removes 10000 routes, one request at a time and in one netlink batch, as
+    // happens when a VPN with a large split-tunnel configuration connects.
+    const uint32_t table = 500;
+    constexpr int kNumRoutes = 10000;
+
+    std::vector<std::string> destinations;
+    for (int i = 0; i < kNumRoutes; i++) {
+        destinations.push_back(StringPrintf("10.%d.%d.0/24", i / 256, i % 256));
+    }
+
+    Stopwatch s;
+    for (const auto& dst : destinations) {
+        EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                                   dst.c_str(), nullptr, 0 /* mtu */, 0 /* priority */));
+    }
+    for (const auto& dst : destinations) {
+        EXPECT_EQ(0, modifyIpRoute(RTM_DELROUTE, NETLINK_REQUEST_FLAGS, table, "lo", dst.c_str(),
+                                   nullptr, 0 /* mtu */, 0 /* priority */));
+    }
+    int64_t timeTaken = s.getTimeAndResetUs();
+    std::cerr << "    Add/del " << kNumRoutes << " routes one at a time: " << timeTaken << "us ("
+              << (timeTaken / 2 / kNumRoutes) << "us per route)" << std::endl;
+
+    {
+        NetlinkBatch batch;
+        for (const auto& dst : destinations) {
+            EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                                       dst.c_str(), nullptr, 0 /* mtu */, 0 /* priority */));
+        }
+        EXPECT_EQ(0, batch.flush());
+        for (const auto& dst : destinations) {
+            EXPECT_EQ(0, modifyIpRoute(RTM_DELROUTE, NETLINK_REQUEST_FLAGS, table, "lo",
+                                       dst.c_str(), nullptr, 0 /* mtu */, 0 /* priority */));
+        }
+        EXPECT_EQ(0, batch.flush());
+    }
+    timeTaken = s.getTimeAndResetUs();
+    std::cerr << "    Add/del " << kNumRoutes << " routes in one batch: " << timeTaken << "us ("
+              << (timeTaken / 2 / kNumRoutes) << "us per route)" << std::endl;
+
+    EXPECT_EQ(0, flushRoutes(table));
+}
+
+TEST_F(RouteControllerTest, TestFlushRoutesBenchmark) {
+    // Flushes a table of 10000 routes, as happens when a VPN with a large split-tunnel
+    // configuration disconnects. Routes in other tables must survive.
+    const uint32_t table = 500;
+    const uint32_t otherTable = 501;
+    constexpr int kNumRoutes = 10000;
+
+    {
+        NetlinkBatch batch;
+        for (int i = 0; i < kNumRoutes; i++) {
+            const std::string dst = StringPrintf("10.%d.%d.0/24", i / 256, i % 256);
+            EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                                       dst.c_str(), nullptr, 0 /* mtu */, 0 /* priority */));
+        }
+        EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, otherTable, "lo",
+                                   "10.0.0.0/24", nullptr, 0 /* mtu */, 0 /* priority */));
+        ASSERT_EQ(0, batch.flush());
+    }
+
+    Stopwatch s;
+    EXPECT_EQ(0, flushRoutes(table));
+    const int64_t timeTaken = s.getTimeAndResetUs();
+    std::cerr << "    Flush " << kNumRoutes << " routes: " << timeTaken << "us ("
+              << (timeTaken / kNumRoutes) << "us per route)" << std::endl;
+
+    EXPECT_EQ(-ESRCH, modifyIpRoute(RTM_DELROUTE, NETLINK_REQUEST_FLAGS, table, "lo",
+                                    "10.0.0.0/24", nullptr, 0 /* mtu */, 0 /* priority */));
+    EXPECT_EQ(-ESRCH, modifyIpRoute(RTM_DELROUTE, NETLINK_REQUEST_FLAGS, table, "lo",
+                                    "10.39.15.0/24", nullptr, 0 /* mtu */, 0 /* priority */));
+    EXPECT_EQ(0, modifyIpRoute(RTM_DELROUTE, NETLINK_REQUEST_FLAGS, otherTable, "lo",
+                               "10.0.0.0/24", nullptr, 0 /* mtu */, 0 /* priority */));
+}
+
+TEST_F(RouteControllerTest, TestInterfaceTables) {
+    static int sLookups;
+    sLookups = 0;
+    RouteController::ifNameToIndexFunction = [](const char* iface) {
+        sLookups++;
+        return fakeIfaceNameToIndexFunction(iface);
+    };
+    resetInterfaceTables(TEST_IFACE2);
+    const uint64_t hits = interfaceTableHits();
+    const uint64_t misses = interfaceTableMisses();
+
+    // The ifindex of an interface that is not in any network is looked up once...
+    EXPECT_EQ(TEST_IFACE2_INDEX, RouteController::ifNameToIndexCached(TEST_IFACE2));
+    EXPECT_EQ(TEST_IFACE2_INDEX, RouteController::ifNameToIndexCached(TEST_IFACE2));
+    EXPECT_EQ(1, sLookups);
+
+    // ... until a link event for the interface.
+    RouteController::invalidateIfIndex(TEST_IFACE2, TEST_IFACE2_INDEX);
+    EXPECT_EQ(TEST_IFACE2_INDEX, RouteController::ifNameToIndexCached(TEST_IFACE2));
+    EXPECT_EQ(2, sLookups);
+
+    // A renamed interface is forgotten by its index, because the event only has the new name.
+    RouteController::invalidateIfIndex("netdtest3", TEST_IFACE2_INDEX);
+    EXPECT_EQ(TEST_IFACE2_INDEX, RouteController::ifNameToIndexCached(TEST_IFACE2));
+    EXPECT_EQ(3, sLookups);
+
+    // Assigning a routing table always looks the ifindex up again, because the interface may
+    // have been recreated since it was cached. The table is kept across link events, so that the
+    // routes and rules of an interface that went away can still be removed.
+    const uint32_t table = TEST_IFACE2_INDEX + RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX;
+    EXPECT_EQ(table, getRouteTableForInterface(TEST_IFACE2, false));
+    EXPECT_EQ(4, sLookups);
+    RouteController::invalidateIfIndex(TEST_IFACE2, TEST_IFACE2_INDEX);
+    EXPECT_EQ(table, getRouteTableForInterface(TEST_IFACE2, false));
+    EXPECT_EQ(TEST_IFACE2_INDEX, RouteController::getIfIndex(TEST_IFACE2));
+    EXPECT_EQ(TEST_IFACE2_INDEX, RouteController::ifNameToIndexCached(TEST_IFACE2));
+    EXPECT_EQ(4, sLookups);
+
+    EXPECT_EQ(hits + 3, interfaceTableHits());
+    EXPECT_EQ(misses + 4, interfaceTableMisses());
+
+    resetInterfaceTables(TEST_IFACE2);
+    RouteController::ifNameToIndexFunction = fakeIfaceNameToIndexFunction;
+}
+
+TEST_F(RouteControllerTest, TestInterfaceTableLookupBenchmark) {
+    // Looks up the routing table of an interface from several threads, while another thread keeps
+    // replacing the interface tables.
+    constexpr int kNumThreads = 4;
+    constexpr int kLookupsPerThread = 250000;
+    const uint32_t table = TEST_IFACE1_INDEX + RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX;
+    resetInterfaceTables(TEST_IFACE1);
+    resetInterfaceTables(TEST_IFACE2);
+    ASSERT_EQ(table, getRouteTableForInterface(TEST_IFACE1, false));
+
+    std::atomic<bool> done = false;
+    std::thread writer([&done] {
+        while (!done) {
+            RouteController::ifNameToIndexCached(TEST_IFACE2);
+            RouteController::invalidateIfIndex(TEST_IFACE2, TEST_IFACE2_INDEX);
+        }
+    });
+
+    Stopwatch s;
+    std::vector<std::thread> readers;
+    std::atomic<int> wrongTables = 0;
+    for (int i = 0; i < kNumThreads; i++) {
+        readers.emplace_back([this, table, &wrongTables] {
+            for (int j = 0; j < kLookupsPerThread; j++) {
+                if (getRouteTableForInterface(TEST_IFACE1, false) != table) wrongTables++;
+            }
+        });
+    }
+    for (auto& reader : readers) reader.join();
+    const int64_t timeTaken = s.getTimeAndResetUs();
+    done = true;
+    writer.join();
+
+    EXPECT_EQ(0, wrongTables);
+    std::cerr << "    " << kNumThreads * kLookupsPerThread << " lookups on " << kNumThreads
+              << " threads: " << timeTaken << "us ("
+              << (timeTaken * 1000 / kLookupsPerThread) << "ns per lookup per thread)"
+              << std::endl;
+
+    resetInterfaceTables(TEST_IFACE1);
+    resetInterfaceTables(TEST_IFACE2);
+}
+
+TEST_F(RouteControllerTest, TestParsePrefix) {
+    static_assert([] {
+        uint8_t family = 0, prefixLength = 0, address[16] = {};
+        return parseIpPrefix("2001:db8::1/64", &family, address, sizeof(address),
+                             &prefixLength) == 16 &&
+               family == AF_INET6 && prefixLength == 64 && address[0] == 0x20 &&
+               address[1] == 0x01 && address[15] == 0x01;
+    }());
+
+    struct {
+        const char* prefix;
+        int expectedLength;
+        uint8_t expectedFamily;
+        uint8_t expectedPrefixLength;
+    } kTestData[] = {
+            {"192.0.2.0/24", 4, AF_INET, 24},
+            {"0.0.0.0/0", 4, AF_INET, 0},
+            {"255.255.255.255/32", 4, AF_INET, 32},
+            {"::/0", 16, AF_INET6, 0},
+            {"2001:db8::/32", 16, AF_INET6, 32},
+            {"fe80::1/128", 16, AF_INET6, 128},
+            {"::ffff:192.0.2.1/128", 16, AF_INET6, 128},
+            {"1:2:3:4:5:6:7:8/64", 16, AF_INET6, 64},
+            {"192.0.2.0", -EINVAL},
+            {"192.0.2.0/", -EINVAL},
+            {"192.0.2.0/33", -EINVAL},
+            {"192.0.2/24", -EINVAL},
+            {"192.0.2.256/32", -EINVAL},
+            {"192.0.2.0/24x", -EINVAL},
+            {"2001:db8::/129", -EINVAL},
+            {"2001:db8:::/64", -EINVAL},
+            {"1::2::3/64", -EINVAL},
+            {"1:2:3:4:5:6:7:8:9/64", -EINVAL},
+            {"fe80::1%lo/64", -EINVAL},
+            {"example.com/24", -EINVAL},
+    };
+
+    for (const auto& td : kTestData) {
+        SCOPED_TRACE(td.prefix);
+        uint8_t family = 0, prefixLength = 0;
+        uint8_t address[16], expectedAddress[16];
+        EXPECT_EQ(td.expectedLength,
+                  parsePrefix(td.prefix, &family, address, sizeof(address), &prefixLength));
+        if (td.expectedLength < 0) continue;
+
+        const std::string addressString(td.prefix, strchr(td.prefix, '/'));
+        ASSERT_EQ(1, inet_pton(td.expectedFamily, addressString.c_str(), expectedAddress));
+        EXPECT_EQ(td.expectedFamily, family);
+        EXPECT_EQ(td.expectedPrefixLength, prefixLength);
+        EXPECT_EQ(0, memcmp(expectedAddress, address, td.expectedLength));
+    }
+
+    uint8_t family, prefixLength, address[4];
+    EXPECT_EQ(-ENOSPC, parsePrefix("2001:db8::/32", &family, address, sizeof(address),
+                                   &prefixLength));
+}
+
 TEST_F(RouteControllerTest, TestModifyIncomingPacketMark) {
   uint32_t mask = ~Fwmark::getUidBillingMask();
 
@@ -133,6 +417,8 @@ TEST_F(RouteControllerTest, TestModifyIncomingPacketMark) {
 }
 
 bool hasLocalInterfaceInRouteTable(const char* iface) {
+    RouteController::flushTableNamesFile();
+
     // Calculate the table index from interface index
     std::string index = std::to_string(RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX_FOR_LOCAL +
                                        RouteController::ifNameToIndexFunction(iface));
@@ -173,5 +459,240 @@ TEST_F(RouteControllerTest, TestCreateVirtualLocalInterfaceTable) {
     EXPECT_FALSE(hasLocalInterfaceInRouteTable(TEST_IFACE2));
 }
 
+TEST_F(RouteControllerTest, TestTableNamesFileCoalescesUpdates) {
+    const uint64_t writes = RouteController::flushTableNamesFile();
+
+    // A burst of changes doesn't wait for the file, and is written once, or twice if the writer
+    // thread happens to start writing in the middle of it.
+    Stopwatch s;
+    for (int i = 0; i < 100; i++) {
+        updateTableNamesFile();
+    }
+    const int64_t timeTaken = s.getTimeAndResetUs();
+    EXPECT_LT(timeTaken, 50000) << "Requesting updates should not write the file";
+
+    const uint64_t newWrites = RouteController::flushTableNamesFile();
+    EXPECT_GE(newWrites, writes + 1);
+    EXPECT_LE(newWrites, writes + 2);
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(RouteController::RT_TABLES_PATH, &contents));
+    EXPECT_NE(std::string::npos, contents.find("97 local_network\n")) << contents;
+}
+
+namespace {
+
+// Looks up the route to |dst| for packets with |mark|, like "ip route get". Returns the table of
+// the route, or 0 if there is none.
+uint32_t lookUpRouteTable(const char* dst, uint32_t mark) {
+    struct {
+        nlmsghdr hdr;
+        rtmsg msg;
+        rtattr dstAttr;
+        in_addr dst;
+        rtattr markAttr;
+        uint32_t mark;
+    } request = {
+            .hdr = {.nlmsg_len = sizeof(request), .nlmsg_type = RTM_GETROUTE,
+                    .nlmsg_flags = NLM_F_REQUEST},
+            // Report the table that the route was found in, not the table of the route.
+            .msg = {.rtm_family = AF_INET, .rtm_dst_len = 32, .rtm_flags = RTM_F_LOOKUP_TABLE},
+            .dstAttr = {.rta_len = RTA_LENGTH(sizeof(in_addr)), .rta_type = RTA_DST},
+            .markAttr = {.rta_len = RTA_LENGTH(sizeof(uint32_t)), .rta_type = RTA_MARK},
+            .mark = mark,
+    };
+    inet_pton(AF_INET, dst, &request.dst);
+
+    const int sock = openNetlinkSocket(NETLINK_ROUTE);
+    if (sock < 0) return 0;
+    uint8_t response[8192];
+    ssize_t len = -1;
+    if (write(sock, &request, sizeof(request)) == sizeof(request)) {
+        len = recv(sock, response, sizeof(response), 0);
+    }
+    close(sock);
+
+    const nlmsghdr* nlh = reinterpret_cast<const nlmsghdr*>(response);
+    if (len < static_cast<ssize_t>(sizeof(nlmsghdr)) || nlh->nlmsg_type != RTM_NEWROUTE) return 0;
+    return getRtmU32Attribute(nlh, RTA_TABLE);
+}
+
+// Looks up a route in a loop, and measures how long it is missing.
+class RouteProbe {
+  public:
+    RouteProbe(const char* dst, uint32_t mark, uint32_t table)
+        : mDst(dst), mMark(mark), mTable(table), mThread([this]() {
+              while (mRunning) check();
+          }) {
+        // Make sure that the route is probed before it is changed.
+        while (mProbes == 0) std::this_thread::yield();
+    }
+
+    // Looks up the route once. Also called between the steps of a test, in case the thread does
+    // not get to run in between, e.g., on a single CPU.
+    void check() {
+        const bool found = lookUpRouteTable(mDst, mMark) == mTable;
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard lock(mLock);
+        mProbes++;
+        if (!found && !mMissingSince) {
+            mMissingSince = now;
+        } else if (found && mMissingSince) {
+            mMissingUs += std::chrono::duration_cast<std::chrono::microseconds>(
+                                  now - *mMissingSince)
+                                  .count();
+            mMissingSince.reset();
+        }
+    }
+
+    // Returns how long the route was missing, in microseconds.
+    int64_t stop() {
+        mRunning = false;
+        mThread.join();
+        check();
+        return mMissingUs;
+    }
+
+    uint64_t probes() const { return mProbes; }
+
+  private:
+    const char* const mDst;
+    const uint32_t mMark;
+    const uint32_t mTable;
+    std::mutex mLock;
+    std::optional<std::chrono::steady_clock::time_point> mMissingSince;
+    int64_t mMissingUs = 0;
+    std::atomic<uint64_t> mProbes = 0;
+    std::atomic<bool> mRunning = true;
+    std::thread mThread;
+};
+
+}  // namespace
+
+TEST_F(RouteControllerTest, TestReconcileAfterRestart) {
+    // Simulates a restart of netd, with the rules and routes of the previous instance in a table
+    // that's not used by the system. The rules only match a netId that's never used. The route that
+    // the rule selects is probed while the rules and routes are added again, as the framework does
+    // after a restart, and it must never be missing. Compare with flushing, as Init() does when
+    // it does not reconcile.
+    const uint32_t table = 500;
+    const int32_t priority = 9900;
+    const uint32_t mark = 0xfff0;
+    const uint32_t staleMark = 0xfff1;
+    const uint32_t mask = 0xffff;
+    const char* probeDst = "192.0.2.1";
+
+    const auto install = [&]() {
+        EXPECT_EQ(0, modifyIpRule(RTM_NEWRULE, priority, table, mark, mask));
+        EXPECT_EQ(0, modifyIpRule(RTM_NEWRULE, priority + 1, table, staleMark, mask));
+        EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                                   "192.0.2.0/24", nullptr, 0 /* mtu */, 0 /* priority */));
+        EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                                   "198.51.100.0/24", nullptr, 0 /* mtu */, 0 /* priority */));
+    };
+    const NetlinkDumpFilter isOwnRule = [&](nlmsghdr* nlh) {
+        const uint32_t rulePriority = getRulePriority(nlh);
+        return rulePriority == priority || rulePriority == priority + 1;
+    };
+    const NetlinkDumpFilter isOwnRoute = [&](nlmsghdr* nlh) {
+        return getRtmU32Attribute(nlh, RTA_TABLE) == table;
+    };
+
+    install();
+    ASSERT_EQ(table, lookUpRouteTable(probeDst, mark));
+
+    RouteProbe probe(probeDst, mark, table);
+    Stopwatch s;
+    ASSERT_EQ(0, beginReconcile(isOwnRule, isOwnRoute));
+    probe.check();
+    // The rule that's still there is not added again, so this does not fail with EEXIST.
+    EXPECT_EQ(0, modifyIpRule(RTM_NEWRULE, priority, table, mark, mask));
+    probe.check();
+    // RouteController::modifyRoute() ignores EEXIST.
+    EXPECT_EQ(-EEXIST, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                                     "192.0.2.0/24", nullptr, 0 /* mtu */, 0 /* priority */));
+    probe.check();
+    // The other rule in both families, and the other route.
+    EXPECT_EQ(3, finishReconcile());
+    int64_t recoveryUs = s.getTimeAndResetUs();
+    int64_t missingUs = probe.stop();
+    std::cerr << "    Reconcile: recovered in " << recoveryUs << "us, route missing for "
+              << missingUs << "us (" << probe.probes() << " probes)" << std::endl;
+    EXPECT_EQ(0, missingUs);
+    EXPECT_GT(probe.probes(), 0U);
+
+    // Only the objects that were added again are left.
+    EXPECT_EQ(0, finishReconcile());
+    EXPECT_EQ(-ENOENT, modifyIpRule(RTM_DELRULE, priority + 1, table, staleMark, mask));
+    EXPECT_EQ(-ESRCH, modifyIpRoute(RTM_DELROUTE, NETLINK_REQUEST_FLAGS, table, "lo",
+                                    "198.51.100.0/24", nullptr, 0 /* mtu */, 0 /* priority */));
+    EXPECT_EQ(table, lookUpRouteTable(probeDst, mark));
+    EXPECT_EQ(0, modifyIpRule(RTM_DELRULE, priority, table, mark, mask));
+    EXPECT_EQ(0, flushRoutes(table));
+
+    // Flushing.
+    install();
+    RouteProbe flushProbe(probeDst, mark, table);
+    s.getTimeAndResetUs();
+    EXPECT_EQ(0, rtNetlinkFlush(RTM_GETRULE, RTM_DELRULE, "rules", isOwnRule));
+    flushProbe.check();
+    EXPECT_EQ(0, flushRoutes(table));
+    flushProbe.check();
+    EXPECT_EQ(0, modifyIpRule(RTM_NEWRULE, priority, table, mark, mask));
+    flushProbe.check();
+    EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                               "192.0.2.0/24", nullptr, 0 /* mtu */, 0 /* priority */));
+    recoveryUs = s.getTimeAndResetUs();
+    missingUs = flushProbe.stop();
+    std::cerr << "    Flush: recovered in " << recoveryUs << "us, route missing for " << missingUs
+              << "us (" << flushProbe.probes() << " probes)" << std::endl;
+
+    EXPECT_EQ(0, modifyIpRule(RTM_DELRULE, priority, table, mark, mask));
+    EXPECT_EQ(0, flushRoutes(table));
+}
+
+TEST_F(RouteControllerTest, TestReconcileChangedRoute) {
+    // A route whose MTU changed while netd was not running is replaced, instead of being kept
+    // with the old MTU because adding it again fails with EEXIST.
+    const uint32_t table = 501;
+    const auto routeMtus = [table]() {
+        std::vector<uint32_t> mtus;
+        const NetlinkDumpCallback callback = [&mtus, table](nlmsghdr* nlh) {
+            if (getRtmU32Attribute(nlh, RTA_TABLE) != table) return;
+            uint32_t mtu = 0;
+            int len = RTM_PAYLOAD(nlh);
+            for (rtattr* rta = RTM_RTA(NLMSG_DATA(nlh)); RTA_OK(rta, len);
+                 rta = RTA_NEXT(rta, len)) {
+                if (rta->rta_type != RTA_METRICS) continue;
+                int metricsLen = RTA_PAYLOAD(rta);
+                for (rtattr* metric = static_cast<rtattr*>(RTA_DATA(rta));
+                     RTA_OK(metric, metricsLen); metric = RTA_NEXT(metric, metricsLen)) {
+                    if (metric->rta_type == RTAX_MTU) memcpy(&mtu, RTA_DATA(metric), sizeof(mtu));
+                }
+            }
+            mtus.push_back(mtu);
+        };
+        EXPECT_EQ(0, rtNetlinkDump(RTM_GETROUTE, callback, table));
+        return mtus;
+    };
+    const NetlinkDumpFilter isOwnRule = [](nlmsghdr*) { return false; };
+    const NetlinkDumpFilter isOwnRoute = [table](nlmsghdr* nlh) {
+        return getRtmU32Attribute(nlh, RTA_TABLE) == table;
+    };
+
+    EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                               "192.0.2.0/24", nullptr, 1280 /* mtu */, 0 /* priority */));
+    ASSERT_EQ(std::vector<uint32_t>{1280}, routeMtus());
+
+    ASSERT_EQ(0, beginReconcile(isOwnRule, isOwnRoute));
+    EXPECT_EQ(0, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                               "192.0.2.0/24", nullptr, 1400 /* mtu */, 0 /* priority */));
+    // The old route was replaced, so there is nothing left to delete.
+    EXPECT_EQ(0, finishReconcile());
+    EXPECT_EQ(std::vector<uint32_t>{1400}, routeMtus());
+
+    EXPECT_EQ(0, flushRoutes(table));
+}
+
 }  // namespace net
 }  // namespace android
@@ -30,6 +30,7 @@
 #include <sys/uio.h>
 
 #include <cinttypes>
+#include <vector>
 
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
@@ -92,16 +93,9 @@ bool SockDiag::open() {
         return false;
     }
 
-    mSock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_INET_DIAG);
-    mWriteSock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_INET_DIAG);
-    if (!hasSocks()) {
-        closeSocks();
-        return false;
-    }
-
-    sockaddr_nl nl = { .nl_family = AF_NETLINK };
-    if ((connect(mSock, reinterpret_cast<sockaddr *>(&nl), sizeof(nl)) == -1) ||
-        (connect(mWriteSock, reinterpret_cast<sockaddr *>(&nl), sizeof(nl)) == -1)) {
+    mSock = openNetlinkSocket(NETLINK_INET_DIAG);
+    mWriteSock = openNetlinkSocket(NETLINK_INET_DIAG);
+    if (mSock < 0 || mWriteSock < 0) {
         closeSocks();
         return false;
     }
@@ -222,7 +216,7 @@ int SockDiag::sendDumpRequest(uint8_t proto, uint8_t family, const char *addrstr
 }
 
 int SockDiag::readDiagMsg(uint8_t proto, const SockDiag::DestroyFilter& shouldDestroy) {
-    NetlinkDumpCallback callback = [this, proto, shouldDestroy] (nlmsghdr *nlh) {
+    auto callback = [this, proto, &shouldDestroy] (nlmsghdr *nlh) {
         const inet_diag_msg *msg = reinterpret_cast<inet_diag_msg *>(NLMSG_DATA(nlh));
         if (shouldDestroy(proto, msg)) {
             sockDestroy(proto, msg);
@@ -232,30 +226,39 @@ int SockDiag::readDiagMsg(uint8_t proto, const SockDiag::DestroyFilter& shouldDe
     return processNetlinkDump(mSock, callback);
 }
 
+void SockDiag::parseTcpInfo(const inet_diag_msg* msg, uint32_t len,
+                            const TcpInfoReader& tcpInfoReader) {
+    if (len < sizeof(*msg)) {
+        ALOGE("short SOCK_DIAG_BY_FAMILY message: %u bytes", len);
+        return;
+    }
+    Fwmark mark;
+    struct tcp_info *tcpinfo = nullptr;
+    uint32_t tcpinfoLength = 0;
+    uint32_t attr_len = len - NLMSG_ALIGN(sizeof(*msg));
+    const struct rtattr *attr = reinterpret_cast<const struct rtattr*>(msg+1);
+    while (RTA_OK(attr, attr_len)) {
+        if (attr->rta_type == INET_DIAG_INFO) {
+            tcpinfo = reinterpret_cast<struct tcp_info*>(RTA_DATA(attr));
+            tcpinfoLength = RTA_PAYLOAD(attr);
+        }
+        if (attr->rta_type == INET_DIAG_MARK) {
+            mark.intValue = *reinterpret_cast<const uint32_t*>(RTA_DATA(attr));
+        }
+        attr = RTA_NEXT(attr, attr_len);
+    }
+
+    tcpInfoReader(mark, msg, tcpinfo, tcpinfoLength);
+}
+
 int SockDiag::readDiagMsgWithTcpInfo(const TcpInfoReader& tcpInfoReader) {
-    NetlinkDumpCallback callback = [tcpInfoReader] (nlmsghdr *nlh) {
+    auto callback = [&tcpInfoReader] (nlmsghdr *nlh) {
         if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY) {
             ALOGE("expected nlmsg_type=SOCK_DIAG_BY_FAMILY, got nlmsg_type=%d", nlh->nlmsg_type);
             return;
         }
-        Fwmark mark;
-        struct tcp_info *tcpinfo = nullptr;
-        uint32_t tcpinfoLength = 0;
         inet_diag_msg *msg = reinterpret_cast<inet_diag_msg *>(NLMSG_DATA(nlh));
-        uint32_t attr_len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*msg));
-        struct rtattr *attr = reinterpret_cast<struct rtattr*>(msg+1);
-        while (RTA_OK(attr, attr_len)) {
-            if (attr->rta_type == INET_DIAG_INFO) {
-                tcpinfo = reinterpret_cast<struct tcp_info*>(RTA_DATA(attr));
-                tcpinfoLength = RTA_PAYLOAD(attr);
-            }
-            if (attr->rta_type == INET_DIAG_MARK) {
-                mark.intValue = *reinterpret_cast<uint32_t*>(RTA_DATA(attr));
-            }
-            attr = RTA_NEXT(attr, attr_len);
-        }
-
-        tcpInfoReader(mark, msg, tcpinfo, tcpinfoLength);
+        parseTcpInfo(msg, nlh->nlmsg_len - NLMSG_HDRLEN, tcpInfoReader);
     };
 
     return processNetlinkDump(mSock, callback);
@@ -471,6 +474,11 @@ int SockDiag::destroySockets(const UidRanges& uidRanges, const std::set<uid_t>&
 // that they are now sending and receiving traffic on a network that is now restricted.
 int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permission,
                                               bool excludeLoopback) {
+    return destroySocketsLackingPermission({{netId, permission}}, excludeLoopback);
+}
+
+int SockDiag::destroySocketsLackingPermission(const std::map<unsigned, Permission>& permissions,
+                                              bool excludeLoopback) {
     struct markmatch {
         inet_diag_bc_op op;
         // TODO: switch to inet_diag_markcond
@@ -479,59 +487,22 @@ int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permiss
     } __attribute__((packed));
     constexpr uint8_t matchlen = sizeof(markmatch);
 
-    Fwmark netIdMark, netIdMask;
-    netIdMark.netId = netId;
-    netIdMask.netId = 0xffff;
-
-    Fwmark controlMark;
-    controlMark.explicitlySelected = true;
-    controlMark.permission = permission;
-
-    // A SOCK_DIAG bytecode program that accepts the sockets we intend to destroy.
-    struct bytecode {
+    // The part of the SOCK_DIAG bytecode program that handles one network. The whole program is
+    // one of these per network, and accepts the sockets we intend to destroy.
+    struct netIdProgram {
         markmatch netIdMatch;
         markmatch controlMatch;
         inet_diag_bc_op controlJump;
-    } __attribute__((packed)) bytecode;
+    } __attribute__((packed));
 
     // The length of the INET_DIAG_BC_JMP instruction.
     constexpr uint8_t jmplen = sizeof(inet_diag_bc_op);
     // Jump exactly this far past the end of the program to reject.
     constexpr uint8_t rejectoffset = sizeof(inet_diag_bc_op);
-    // Total length of the program.
-    constexpr uint8_t bytecodelen = sizeof(bytecode);
-
-    bytecode = (struct bytecode) {
-        // If netId matches, continue, otherwise, reject (i.e., leave socket alone).
-        { { INET_DIAG_BC_MARK_COND, matchlen, bytecodelen + rejectoffset },
-          netIdMark.intValue, netIdMask.intValue },
-
-        // If explicit and permission bits match, go to the JMP below which rejects the socket
-        // (i.e., we leave it alone). Otherwise, jump to the end of the program, which accepts the
-        // socket (so we destroy it).
-        { { INET_DIAG_BC_MARK_COND, matchlen, matchlen + jmplen },
-          controlMark.intValue, controlMark.intValue },
-
-        // This JMP unconditionally rejects the packet by jumping to the reject target. It is
-        // necessary to keep the kernel bytecode verifier happy. If we don't have a JMP the bytecode
-        // is invalid because the target of every no jump must always be reachable by yes jumps.
-        // Without this JMP, the accept target is not reachable by yes jumps and the program will
-        // be rejected by the validator.
-        { INET_DIAG_BC_JMP, jmplen, jmplen + rejectoffset },
-
-        // We have reached the end of the program. Accept the socket, and destroy it below.
-    };
-
-    struct nlattr nla = {
-            .nla_len = sizeof(struct nlattr) + bytecodelen,
-            .nla_type = INET_DIAG_REQ_BYTECODE,
-    };
-
-    iovec iov[] = {
-        { nullptr,   0 },
-        { &nla,      sizeof(nla) },
-        { &bytecode, bytecodelen },
-    };
+    // Length of the program for one network.
+    constexpr uint16_t proglen = sizeof(netIdProgram);
+    // Keep the whole program, and the offsets within it, within the 16-bit nlattr length.
+    constexpr size_t maxNetworksPerDump = (UINT16_MAX - sizeof(nlattr) - rejectoffset) / proglen;
 
     mSocketsDestroyed = 0;
     Stopwatch s;
@@ -540,13 +511,76 @@ int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permiss
         return msg != nullptr && !(excludeLoopback && isLoopbackSocket(msg));
     };
 
-    if (int ret = destroyLiveSockets(shouldDestroy, "permission change", iov, ARRAY_SIZE(iov))) {
-        return ret;
+    std::vector<netIdProgram> bytecode;
+    for (auto it = permissions.begin(); it != permissions.end();) {
+        bytecode.clear();
+        for (; it != permissions.end() && bytecode.size() < maxNetworksPerDump; ++it) {
+            Fwmark netIdMark, netIdMask;
+            netIdMark.netId = it->first;
+            netIdMask.netId = 0xffff;
+
+            Fwmark controlMark;
+            controlMark.explicitlySelected = true;
+            controlMark.permission = it->second;
+
+            bytecode.push_back({
+                // If netId matches, continue. Otherwise, go to the next network, whose offset is
+                // fixed up below once we know how long the program is.
+                { { INET_DIAG_BC_MARK_COND, matchlen, proglen },
+                  netIdMark.intValue, netIdMask.intValue },
+
+                // If explicit and permission bits match, go to the JMP below which rejects the
+                // socket (i.e., we leave it alone). Otherwise, jump to the end of the program,
+                // which accepts the socket (so we destroy it). Also fixed up below.
+                { { INET_DIAG_BC_MARK_COND, matchlen, matchlen + jmplen },
+                  controlMark.intValue, controlMark.intValue },
+
+                // This JMP unconditionally rejects the packet by jumping to the reject target. It
+                // is necessary to keep the kernel bytecode verifier happy. If we don't have a JMP
+                // the bytecode is invalid because the target of every no jump must always be
+                // reachable by yes jumps. Without this JMP, the accept target is not reachable by
+                // yes jumps and the program will be rejected by the validator.
+                { INET_DIAG_BC_JMP, jmplen, jmplen + rejectoffset },
+            });
+        }
+
+        // Now that the length of the program is known, make the control match and the JMP of each
+        // network jump to the end of the whole program, and make a netId mismatch on the last
+        // network reject the socket.
+        const uint16_t bytecodelen = bytecode.size() * proglen;
+        for (size_t i = 0; i < bytecode.size(); i++) {
+            const uint16_t remaining = bytecodelen - i * proglen;
+            if (i == bytecode.size() - 1) {
+                bytecode[i].netIdMatch.op.no = remaining + rejectoffset;
+            }
+            bytecode[i].controlMatch.op.no = remaining - matchlen;
+            bytecode[i].controlJump.no = remaining - 2 * matchlen + rejectoffset;
+        }
+
+        struct nlattr nla = {
+                .nla_len = static_cast<__u16>(sizeof(struct nlattr) + bytecodelen),
+                .nla_type = INET_DIAG_REQ_BYTECODE,
+        };
+
+        iovec iov[] = {
+            { nullptr,          0 },
+            { &nla,             sizeof(nla) },
+            { bytecode.data(),  bytecodelen },
+        };
+
+        if (int ret = destroyLiveSockets(shouldDestroy, "permission change", iov,
+                                         ARRAY_SIZE(iov))) {
+            return ret;
+        }
     }
 
     if (mSocketsDestroyed > 0) {
-        ALOGI("Destroyed %d sockets for netId %d permission=%d in %" PRId64 "us", mSocketsDestroyed,
-              netId, permission, s.timeTakenUs());
+        std::vector<std::string> changes;
+        for (const auto& [netId, permission] : permissions) {
+            changes.push_back(StringPrintf("%u:%s", netId, permissionToName(permission)));
+        }
+        ALOGI("Destroyed %d sockets for netId permission={%s} in %" PRId64 "us",
+              mSocketsDestroyed, android::base::Join(changes, " ").c_str(), s.timeTakenUs());
     }
 
     return 0;
@@ -25,6 +25,7 @@
 #include <linux/inet_diag.h>
 
 #include <functional>
+#include <map>
 #include <set>
 
 #include "Fwmark.h"
@@ -67,6 +68,10 @@ class SockDiag {
     int sendDumpRequest(uint8_t proto, uint8_t family, const char *addrstr);
     int readDiagMsg(uint8_t proto, const DestroyFilter& callback);
     int readDiagMsgWithTcpInfo(const TcpInfoReader& callback);
+    // Parses the |len| byte payload of a SOCK_DIAG_BY_FAMILY message, i.e., a struct
+    // inet_diag_msg followed by its attributes, and passes it to |callback|.
+    static void parseTcpInfo(const inet_diag_msg* msg, uint32_t len,
+                             const TcpInfoReader& callback);
 
     int sockDestroy(uint8_t proto, const inet_diag_msg *);
     // Destroys all sockets on the given IPv4 or IPv6 address.
@@ -80,6 +85,11 @@ class SockDiag {
     // the permissions required by the specified network.
     int destroySocketsLackingPermission(unsigned netId, Permission permission,
                                         bool excludeLoopback);
+    // Same as above, for several networks at once. Each key of |permissions| is a netId and each
+    // value the permission that network will require. All networks are handled with a single dump
+    // per address family.
+    int destroySocketsLackingPermission(const std::map<unsigned, Permission>& permissions,
+                                        bool excludeLoopback);
 
     // Dump struct tcp_info for all "live" (CONNECTED, SYN_SENT, SYN_RECV) TCP sockets.
     int getLiveTcpInfos(const TcpInfoReader& sockInfoReader);
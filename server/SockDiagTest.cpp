@@ -22,15 +22,27 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include <netdutils/NetNativeTestBase.h>
+#include <netdutils/Stopwatch.h>
 
 #include "Fwmark.h"
 #include "NetdConstants.h"
+#include "NetlinkCommands.h"
 #include "SockDiag.h"
 #include "UidRanges.h"
 
+using android::netdutils::Stopwatch;
+
 namespace android {
 namespace net {
 
@@ -39,6 +51,8 @@ protected:
     static bool isLoopbackSocket(const inet_diag_msg *msg) {
         return SockDiag::isLoopbackSocket(msg);
     };
+
+    static void setSock(SockDiag& sd, int sock) { sd.mSock = sock; }
 };
 
 uint16_t bindAndListen(int s) {
@@ -266,6 +280,192 @@ TEST_F(SockDiagTest, TestIsLoopbackSocket) {
     EXPECT_TRUE(isLoopbackSocket(&msg));
 }
 
+TEST_F(SockDiagTest, TestParseTcpDestroyBroadcast) {
+    // Listen for the messages the kernel broadcasts when IPv6 TCP sockets are destroyed.
+    int nlsock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    ASSERT_NE(-1, nlsock) << "Failed to open sock_diag socket: " << strerror(errno);
+    const sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+    ASSERT_EQ(0, bind(nlsock, (sockaddr *) &nladdr, sizeof(nladdr))) << strerror(errno);
+    const int group = SKNLGRP_INET6_TCP_DESTROY;
+    ASSERT_EQ(0, setsockopt(nlsock, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)))
+            << strerror(errno);
+
+    int listensocket = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_NE(-1, listensocket) << "Failed to open listen socket: " << strerror(errno);
+    uint16_t port = bindAndListen(listensocket);
+    ASSERT_NE(0, port) << "Can't bind to server port";
+
+    int clientsocket = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_NE(-1, clientsocket) << "Failed to open client socket: " << strerror(errno);
+    sockaddr_in6 server6 = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+    ASSERT_EQ(0, connect(clientsocket, (sockaddr *) &server6, sizeof(server6)))
+        << "IPv6 connect failed: " << strerror(errno);
+    sockaddr_in6 client6;
+    socklen_t clientlen = sizeof(client6);
+    int accepted = accept4(listensocket, (sockaddr *) &client6, &clientlen, SOCK_CLOEXEC);
+    ASSERT_NE(-1, accepted);
+
+    // Reset the connection so that the client socket is destroyed as soon as it is closed.
+    const linger l = { .l_onoff = 1, .l_linger = 0 };
+    ASSERT_EQ(0, setsockopt(clientsocket, SOL_SOCKET, SO_LINGER, &l, sizeof(l)));
+    close(clientsocket);
+    close(accepted);
+    close(listensocket);
+
+    bool seenClient = false;
+    const auto checkDestroyed = [&] (Fwmark, const inet_diag_msg *msg,
+                                     const struct tcp_info *tcpinfo, uint32_t tcpinfoLen) {
+        if (msg->id.idiag_sport != client6.sin6_port) return;
+        seenClient = true;
+        EXPECT_NE(nullptr, tcpinfo);
+        EXPECT_LT(0U, tcpinfoLen);
+        EXPECT_NE(0U, msg->id.idiag_cookie[0] | msg->id.idiag_cookie[1]);
+    };
+
+    // The kernel sends the broadcasts from a workqueue, so give it a little time.
+    pollfd pfd = { .fd = nlsock, .events = POLLIN };
+    char buf[8192];
+    while (!seenClient && poll(&pfd, 1, 1000) == 1) {
+        ssize_t len = recv(nlsock, buf, sizeof(buf), 0);
+        ASSERT_LT(0, len) << strerror(errno);
+        for (nlmsghdr *nlh = (nlmsghdr *) buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            ASSERT_EQ(SOCK_DIAG_BY_FAMILY, nlh->nlmsg_type);
+            SockDiag::parseTcpInfo((const inet_diag_msg *) NLMSG_DATA(nlh),
+                                   nlh->nlmsg_len - NLMSG_HDRLEN, checkDestroyed);
+        }
+    }
+    EXPECT_TRUE(seenClient) << "Did not receive destroy event for client socket";
+    close(nlsock);
+}
+
+// Writes a sock_diag dump of |numSockets| TCP sockets to |sock| like the kernel does, packing as
+// many SOCK_DIAG_BY_FAMILY messages as fit into each datagram of |datagramSize| bytes, followed by
+// NLMSG_DONE.
+static void writeSyntheticDump(int sock, int numSockets, size_t datagramSize) {
+    struct {
+        nlmsghdr nlh;
+        inet_diag_msg msg;
+        rtattr markAttr;
+        uint32_t mark;
+    } diagMsg = {
+        .nlh = {
+            .nlmsg_len = sizeof(diagMsg),
+            .nlmsg_type = SOCK_DIAG_BY_FAMILY,
+            .nlmsg_flags = NLM_F_MULTI,
+        },
+        .msg = {
+            .idiag_family = AF_INET6,
+            .idiag_state = TCP_ESTABLISHED,
+        },
+        .markAttr = {
+            .rta_len = RTA_LENGTH(sizeof(uint32_t)),
+            .rta_type = INET_DIAG_MARK,
+        },
+    };
+    static_assert(sizeof(diagMsg) == NLMSG_ALIGN(sizeof(diagMsg)));
+
+    std::vector<uint8_t> datagram;
+    datagram.reserve(datagramSize);
+    for (int i = 0; i < numSockets; i++) {
+        if (datagram.size() + sizeof(diagMsg) > datagramSize) {
+            ASSERT_EQ((ssize_t) datagram.size(), send(sock, datagram.data(), datagram.size(), 0));
+            datagram.clear();
+        }
+        diagMsg.msg.idiag_inode = i;
+        diagMsg.mark = i;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&diagMsg);
+        datagram.insert(datagram.end(), p, p + sizeof(diagMsg));
+    }
+    ASSERT_EQ((ssize_t) datagram.size(), send(sock, datagram.data(), datagram.size(), 0));
+
+    struct {
+        nlmsghdr nlh;
+        int error;
+    } done = {
+        .nlh = {
+            .nlmsg_len = sizeof(done),
+            .nlmsg_type = NLMSG_DONE,
+            .nlmsg_flags = NLM_F_MULTI,
+        },
+    };
+    ASSERT_EQ((ssize_t) sizeof(done), send(sock, &done, sizeof(done), 0));
+}
+
+// How dumps used to be read: one read() into an 8 KiB buffer at a time, and one std::function call
+// per message.
+static int readDumpWith8KiBReads(int sock, const NetlinkDumpCallback& callback) {
+    char buf[8192];
+    ssize_t bytesread;
+    do {
+        bytesread = read(sock, buf, sizeof(buf));
+        if (bytesread < 0) {
+            return -errno;
+        }
+        uint32_t len = bytesread;
+        for (nlmsghdr *nlh = reinterpret_cast<nlmsghdr *>(buf); NLMSG_OK(nlh, len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            switch (nlh->nlmsg_type) {
+                case NLMSG_DONE:
+                    return 0;
+                case NLMSG_ERROR:
+                    return reinterpret_cast<nlmsgerr *>(NLMSG_DATA(nlh))->error;
+                default:
+                    callback(nlh);
+            }
+        }
+    } while (bytesread > 0);
+    return 0;
+}
+
+TEST_F(SockDiagTest, TestDumpReaderBenchmark) {
+    // A datagram socket stands in for the kernel. The kernel fills each dump datagram up to the
+    // size of the reader's buffer, capped at 32 KiB.
+    constexpr int kNumSockets = 100000;
+    constexpr size_t kOldDatagramSize = 8192;
+    constexpr size_t kNewDatagramSize = 32768;
+
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds)) << strerror(errno);
+    const int writeSock = fds[1];
+    const int readSock = fds[0];
+    SockDiag sd;
+    setSock(sd, readSock);  // Closed by ~SockDiag().
+
+    int seen = 0;
+    NetlinkDumpCallback countMessages = [&seen] (nlmsghdr *nlh) {
+        if (nlh->nlmsg_type == SOCK_DIAG_BY_FAMILY) seen++;
+    };
+    std::thread writer(writeSyntheticDump, writeSock, kNumSockets, kOldDatagramSize);
+    Stopwatch s;
+    EXPECT_EQ(0, readDumpWith8KiBReads(readSock, countMessages));
+    const int64_t oldTimeUs = s.getTimeAndResetUs();
+    writer.join();
+    EXPECT_EQ(kNumSockets, seen);
+
+    seen = 0;
+    uint32_t lastMark = 0;
+    auto countSockets = [&seen, &lastMark] (Fwmark mark, const inet_diag_msg*, const tcp_info*,
+                                             uint32_t) {
+        seen++;
+        lastMark = mark.intValue;
+    };
+    writer = std::thread(writeSyntheticDump, writeSock, kNumSockets, kNewDatagramSize);
+    s.getTimeAndResetUs();
+    EXPECT_EQ(0, sd.readDiagMsgWithTcpInfo(countSockets));
+    const int64_t newTimeUs = s.getTimeAndResetUs();
+    writer.join();
+    EXPECT_EQ(kNumSockets, seen);
+    EXPECT_EQ((uint32_t) kNumSockets - 1, lastMark);
+    close(writeSock);
+
+    std::cerr << "    8 KiB read():  " << oldTimeUs / 1000.0 << " ms, "
+              << kNumSockets * 1000000LL / std::max<int64_t>(oldTimeUs, 1) << " sockets/s"
+              << std::endl;
+    std::cerr << "    recvmmsg():    " << newTimeUs / 1000.0 << " ms, "
+              << kNumSockets * 1000000LL / std::max<int64_t>(newTimeUs, 1) << " sockets/s"
+              << std::endl;
+}
+
 enum MicroBenchmarkTestType {
     ADDRESS,
     UID,
@@ -273,6 +473,7 @@ enum MicroBenchmarkTestType {
     UIDRANGE,
     UIDRANGE_EXCLUDE_LOOPBACK,
     PERMISSION,
+    PERMISSION_MULTI,
 };
 
 const char *testTypeName(MicroBenchmarkTestType mode) {
@@ -284,6 +485,7 @@ const char *testTypeName(MicroBenchmarkTestType mode) {
         TO_STRING_TYPE(UIDRANGE);
         TO_STRING_TYPE(UIDRANGE_EXCLUDE_LOOPBACK);
         TO_STRING_TYPE(PERMISSION);
+        TO_STRING_TYPE(PERMISSION_MULTI);
     }
 #undef TO_STRING_TYPE
 }
@@ -340,6 +542,7 @@ protected:
         case UIDRANGE_EXCLUDE_LOOPBACK:
             return UID_SOCKETS;
         case PERMISSION:
+        case PERMISSION_MULTI:
             return ARRAY_SIZE(permissionTestcases);
         }
     }
@@ -354,7 +557,8 @@ protected:
             uid_t uid = START_UID + i;
             return fchown(s, uid, -1);
         }
-        case PERMISSION: {
+        case PERMISSION:
+        case PERMISSION_MULTI: {
             Fwmark fwmark;
             fwmark.netId = permissionTestcases[i].netId;
             fwmark.explicitlySelected = permissionTestcases[i].explicitlySelected;
@@ -396,6 +600,12 @@ protected:
                 ret = mSd.destroySocketsLackingPermission(TEST_NETID, PERMISSION_NETWORK, false);
                 break;
             }
+            case PERMISSION_MULTI: {
+                ret = mSd.destroySocketsLackingPermission(
+                        {{TEST_NETID, PERMISSION_NETWORK}, {TEST_NETID + 1, PERMISSION_SYSTEM}},
+                        false);
+                break;
+            }
         }
         return ret;
     }
@@ -427,6 +637,14 @@ protected:
                 if (permissionTestcases[i].explicitlySelected != 1) return true;
                 Permission permission = permissionTestcases[i].permission;
                 return permission != PERMISSION_NETWORK && permission != PERMISSION_SYSTEM;
+            case PERMISSION_MULTI: {
+                if (permissionTestcases[i].explicitlySelected != 1) return true;
+                Permission permission = permissionTestcases[i].permission;
+                if (permissionTestcases[i].netId == 42) {
+                    return permission != PERMISSION_NETWORK && permission != PERMISSION_SYSTEM;
+                }
+                return permission != PERMISSION_SYSTEM;
+            }
         }
     }
 
@@ -527,7 +745,7 @@ constexpr int SockDiagMicroBenchmarkTest::CLOSE_UID;
 INSTANTIATE_TEST_CASE_P(Address, SockDiagMicroBenchmarkTest,
                         testing::Values(ADDRESS, UID, UIDRANGE,
                                         UID_EXCLUDE_LOOPBACK, UIDRANGE_EXCLUDE_LOOPBACK,
-                                        PERMISSION));
+                                        PERMISSION, PERMISSION_MULTI));
 
 }  // namespace net
 }  // namespace android
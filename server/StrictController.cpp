@@ -34,6 +34,7 @@
 #include "StrictController.h"
 
 auto StrictController::execIptablesRestore = ::execIptablesRestore;
+auto StrictController::execIptablesRestoreWithOutput = ::execIptablesRestoreWithOutput;
 
 const char* StrictController::LOCAL_OUTPUT = "st_OUTPUT";
 const char* StrictController::LOCAL_CLEAR_DETECT = "st_clear_detect";
@@ -42,8 +43,22 @@ const char* StrictController::LOCAL_PENALTY_LOG = "st_penalty_log";
 const char* StrictController::LOCAL_PENALTY_REJECT = "st_penalty_reject";
 
 using android::base::Join;
+using android::base::Split;
+using android::base::StartsWith;
 using android::base::StringPrintf;
 
+namespace {
+
+// Prefix of the per-UID chains created by earlier versions of this controller.
+const char* LEGACY_PER_UID_CHAIN_PREFIX = "st_clear_caught_";
+
+const char* penaltyChain(StrictPenalty penalty) {
+    return (penalty == REJECT) ? StrictController::LOCAL_PENALTY_REJECT
+                               : StrictController::LOCAL_PENALTY_LOG;
+}
+
+}  // namespace
+
 StrictController::StrictController(void) {
 }
 
@@ -61,7 +76,17 @@ int StrictController::setupIptablesHooks(void) {
             ConnmarkFlags::STRICT_RESOLVED_REJECT,
             ConnmarkFlags::STRICT_RESOLVED_REJECT);
 
+    // The rules outlive netd. Read back the penalties that a previous instance applied before
+    // flushing the chains, so that the UIDs keep them until the framework sets them again. The
+    // IPv4 and IPv6 rules have the same penalties.
+    std::string v4Rules, v6Rules;
+    listRules(V4, &v4Rules);
+    listRules(V6, &v6Rules);
+    const std::vector<std::pair<uid_t, StrictPenalty>> penalties = parsePenalties(v4Rules);
+
     resetChains();
+    removeLegacyChains(V4, v4Rules);
+    removeLegacyChains(V6, v6Rules);
 
     int res = 0;
     std::vector<std::string> v4, v6;
@@ -72,6 +97,10 @@ int StrictController::setupIptablesHooks(void) {
 
     CMD_V4V6("*filter");
 
+    // Connections that were already found to be encrypted never need to be looked at again. Skip
+    // them before walking the per-UID rules. This rule must stay first; per-UID rules are appended.
+    CMD_V4V6("-A %s -m connmark --mark %s -j RETURN", LOCAL_OUTPUT, connmarkFlagTestAccept);
+
     // Chain triggered when cleartext socket detected and penalty is log
     CMD_V4V6("-A %s -j CONNMARK --or-mark %s", LOCAL_PENALTY_LOG, connmarkFlagAccept);
     CMD_V4V6("-A %s -j NFLOG --nflog-group 0", LOCAL_PENALTY_LOG);
@@ -136,10 +165,20 @@ int StrictController::setupIptablesHooks(void) {
 #undef CMD_V6
 #undef CMD_V4V6
 
-    return res ? -EREMOTEIO : 0;
+    if (res) return -EREMOTEIO;
+
+    if (!penalties.empty()) {
+        ALOGI("Restoring the cleartext penalties of %zu UIDs", penalties.size());
+        if (int ret = setUidCleartextPenalties(penalties)) {
+            ALOGE("Error restoring cleartext penalties: %s", strerror(-ret));
+        }
+    }
+    return 0;
 }
 
 int StrictController::resetChains(void) {
+    mPenalties.clear();
+
     // Flush any existing rules
 #define CLEAR_CHAIN(x) StringPrintf(":%s -", (x))
     std::vector<std::string> commandList = {
@@ -156,43 +195,115 @@ int StrictController::resetChains(void) {
 #undef CLEAR_CHAIN
 }
 
-int StrictController::setUidCleartextPenalty(uid_t uid, StrictPenalty penalty) {
-    // When a penalty is set, we don't know what penalty the UID previously had. In order to be able
-    // to clear the previous penalty without causing an iptables error by deleting rules that don't
-    // exist, put each UID's rules in a chain specific to that UID. That way, the commands we need
-    // to run to clear the previous penalty don't depend on what the penalty actually was - all we
-    // need to do is clear the chain.
-    std::string perUidChain = StringPrintf("st_clear_caught_%u", uid);
+void StrictController::listRules(IptablesTarget target, std::string* rules) {
+    if (execIptablesRestoreWithOutput(target, "*filter\n-S\nCOMMIT\n", rules) != 0) {
+        ALOGE("Error listing filter table, not restoring penalties or removing legacy chains");
+        rules->clear();
+    }
+}
+
+std::vector<std::pair<uid_t, StrictPenalty>> StrictController::parsePenalties(
+        const std::string& rules) {
+    // Penalties are in st_clear_caught, or in the per-UID chains of earlier versions, which also
+    // pass the UID's traffic to the chain implementing its penalty.
+    const std::string ruleFormat =
+            StringPrintf("-A %s -m owner --uid-owner %%u -j %%31s", LOCAL_CLEAR_CAUGHT);
+    const std::string legacyRuleFormat =
+            StringPrintf("-A %s%%u -j %%31s", LEGACY_PER_UID_CHAIN_PREFIX);
+
+    std::vector<std::pair<uid_t, StrictPenalty>> penalties;
+    for (const std::string& line : Split(rules, "\n")) {
+        uid_t uid;
+        char chain[32];
+        if (sscanf(line.c_str(), ruleFormat.c_str(), &uid, chain) != 2 &&
+            sscanf(line.c_str(), legacyRuleFormat.c_str(), &uid, chain) != 2) {
+            continue;
+        }
+        if (!strcmp(chain, LOCAL_PENALTY_LOG)) {
+            penalties.push_back({uid, LOG});
+        } else if (!strcmp(chain, LOCAL_PENALTY_REJECT)) {
+            penalties.push_back({uid, REJECT});
+        }
+    }
+    return penalties;
+}
 
+void StrictController::removeLegacyChains(IptablesTarget target, const std::string& rules) {
+    // Earlier versions put each UID's penalty in its own st_clear_caught_<uid> chain. Those chains
+    // are no longer referenced once st_clear_caught has been flushed, so just delete them.
+    const std::string newChain = StringPrintf("-N %s", LEGACY_PER_UID_CHAIN_PREFIX);
     std::vector<std::string> commands;
-    if (penalty == ACCEPT) {
-        // Clean up any old rules
-        commands = {
-            "*filter",
-            StringPrintf("-D %s -m owner --uid-owner %d -j %s",
-                         LOCAL_OUTPUT, uid, LOCAL_CLEAR_DETECT),
-            StringPrintf("-D %s -m owner --uid-owner %d -j %s",
-                         LOCAL_CLEAR_CAUGHT, uid, perUidChain.c_str()),
-            StringPrintf("-F %s", perUidChain.c_str()),
-            StringPrintf("-X %s", perUidChain.c_str()),
-        };
-    } else {
-        // Always take a detour to investigate this UID
-        commands.push_back("*filter");
-        commands.push_back(StringPrintf(":%s -", perUidChain.c_str()));
-        commands.push_back(StringPrintf("-I %s -m owner --uid-owner %d -j %s",
-                                        LOCAL_OUTPUT, uid, LOCAL_CLEAR_DETECT));
-        commands.push_back(StringPrintf("-I %s -m owner --uid-owner %d -j %s",
-                                        LOCAL_CLEAR_CAUGHT, uid, perUidChain.c_str()));
-
-        if (penalty == LOG) {
-            commands.push_back(StringPrintf("-A %s -j %s", perUidChain.c_str(), LOCAL_PENALTY_LOG));
-        } else if (penalty == REJECT) {
-            commands.push_back(StringPrintf("-A %s -j %s", perUidChain.c_str(),
-                                            LOCAL_PENALTY_REJECT));
+    for (const std::string& line : Split(rules, "\n")) {
+        if (StartsWith(line, newChain)) {
+            const std::string chain = line.substr(strlen("-N "));
+            commands.push_back(StringPrintf("-F %s", chain.c_str()));
+            commands.push_back(StringPrintf("-X %s", chain.c_str()));
         }
     }
+    if (commands.empty()) return;
+
+    ALOGI("Removing %zu legacy per-UID chains", commands.size() / 2);
+    commands.insert(commands.begin(), "*filter");
+    commands.push_back("COMMIT\n");
+    if (execIptablesRestore(target, Join(commands, '\n'))) {
+        ALOGE("Error removing legacy per-UID chains");
+    }
+}
+
+int StrictController::setUidCleartextPenalty(uid_t uid, StrictPenalty penalty) {
+    return setUidCleartextPenalties({{uid, penalty}});
+}
+
+int StrictController::setUidCleartextPenalties(
+        const std::vector<std::pair<uid_t, StrictPenalty>>& penalties) {
+    // Every UID with a penalty has one rule in LOCAL_OUTPUT that sends its traffic to
+    // LOCAL_CLEAR_DETECT, and one rule in LOCAL_CLEAR_CAUGHT that sends its cleartext traffic to
+    // the chain implementing the penalty. Because we know each UID's current penalty, we only
+    // touch the rules that actually change, and never delete rules that don't exist.
+    std::map<uid_t, StrictPenalty> changed;
+    std::vector<std::string> commands = {"*filter"};
+    for (const auto& [uid, penalty] : penalties) {
+        if (penalty != ACCEPT && penalty != LOG && penalty != REJECT) {
+            return -EINVAL;
+        }
+
+        StrictPenalty oldPenalty = ACCEPT;
+        if (const auto it = changed.find(uid); it != changed.end()) {
+            oldPenalty = it->second;
+        } else if (const auto it = mPenalties.find(uid); it != mPenalties.end()) {
+            oldPenalty = it->second;
+        }
+        if (penalty == oldPenalty) continue;
+
+        if (oldPenalty == ACCEPT) {
+            commands.push_back(StringPrintf("-A %s -m owner --uid-owner %u -j %s", LOCAL_OUTPUT,
+                                            uid, LOCAL_CLEAR_DETECT));
+        } else {
+            commands.push_back(StringPrintf("-D %s -m owner --uid-owner %u -j %s",
+                                            LOCAL_CLEAR_CAUGHT, uid, penaltyChain(oldPenalty)));
+        }
+        if (penalty == ACCEPT) {
+            commands.push_back(StringPrintf("-D %s -m owner --uid-owner %u -j %s", LOCAL_OUTPUT,
+                                            uid, LOCAL_CLEAR_DETECT));
+        } else {
+            commands.push_back(StringPrintf("-A %s -m owner --uid-owner %u -j %s",
+                                            LOCAL_CLEAR_CAUGHT, uid, penaltyChain(penalty)));
+        }
+        changed[uid] = penalty;
+    }
+    if (changed.empty()) return 0;
     commands.push_back("COMMIT\n");
 
-    return (execIptablesRestore(V4V6, Join(commands, "\n")) == 0) ? 0 : -EREMOTEIO;
+    if (execIptablesRestore(V4V6, Join(commands, "\n")) != 0) {
+        return -EREMOTEIO;
+    }
+
+    for (const auto& [uid, penalty] : changed) {
+        if (penalty == ACCEPT) {
+            mPenalties.erase(uid);
+        } else {
+            mPenalties[uid] = penalty;
+        }
+    }
+    return 0;
 }
@@ -17,7 +17,10 @@
 #ifndef _STRICT_CONTROLLER_H
 #define _STRICT_CONTROLLER_H
 
+#include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "NetdConstants.h"
 
@@ -35,6 +38,9 @@ public:
     int resetChains(void);
 
     int setUidCleartextPenalty(uid_t, StrictPenalty);
+    // Applies the penalties of many UIDs in a single iptables-restore transaction. UIDs whose
+    // penalty does not change cost nothing.
+    int setUidCleartextPenalties(const std::vector<std::pair<uid_t, StrictPenalty>>& penalties);
 
     static const char* LOCAL_OUTPUT;
     static const char* LOCAL_CLEAR_DETECT;
@@ -46,7 +52,22 @@ public:
   protected:
     // For testing.
     friend class StrictControllerTest;
+    friend class IptablesRestoreControllerTest;
     static int (*execIptablesRestore)(IptablesTarget target, const std::string& commands);
+    static int (*execIptablesRestoreWithOutput)(IptablesTarget target, const std::string& commands,
+                                                std::string* output);
+
+  private:
+    // Lists the rules of the filter table in iptables-save format, or returns nothing on error.
+    void listRules(IptablesTarget target, std::string* rules);
+    // Returns the penalties found in |rules|, as listed by listRules().
+    static std::vector<std::pair<uid_t, StrictPenalty>> parsePenalties(const std::string& rules);
+    void removeLegacyChains(IptablesTarget target, const std::string& rules);
+
+    // The current penalty of every UID that is not ACCEPT. Knowing the previous penalty allows
+    // setUidCleartextPenalty to delete exactly the rules that exist, so we don't need a chain per
+    // UID. Cleared by resetChains.
+    std::map<uid_t, StrictPenalty> mPenalties;
 };
 
 #endif
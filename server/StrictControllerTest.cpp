@@ -21,15 +21,19 @@
 
 #include <gtest/gtest.h>
 
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
 #include "StrictController.h"
 #include "IptablesBaseTest.h"
 
+using android::base::StringPrintf;
+
 class StrictControllerTest : public IptablesBaseTest {
 public:
     StrictControllerTest() {
         StrictController::execIptablesRestore = fakeExecIptablesRestore;
+        StrictController::execIptablesRestoreWithOutput = fakeExecIptablesRestoreWithOutput;
     }
     StrictController mStrictCtrl;
 };
@@ -49,6 +53,7 @@ TEST_F(StrictControllerTest, TestSetupIptablesHooks) {
 
     std::vector<std::string> v4 = {
         "*filter",
+        "-A st_OUTPUT -m connmark --mark 0x1000000/0x1000000 -j RETURN",
         "-A st_penalty_log -j CONNMARK --or-mark 0x1000000",
         "-A st_penalty_log -j NFLOG --nflog-group 0",
         "-A st_penalty_reject -j CONNMARK --or-mark 0x2000000",
@@ -73,6 +78,7 @@ TEST_F(StrictControllerTest, TestSetupIptablesHooks) {
 
     std::vector<std::string> v6 = {
         "*filter",
+        "-A st_OUTPUT -m connmark --mark 0x1000000/0x1000000 -j RETURN",
         "-A st_penalty_log -j CONNMARK --or-mark 0x1000000",
         "-A st_penalty_log -j NFLOG --nflog-group 0",
         "-A st_penalty_reject -j CONNMARK --or-mark 0x2000000",
@@ -101,6 +107,8 @@ TEST_F(StrictControllerTest, TestSetupIptablesHooks) {
     std::string commands6 = android::base::Join(v6, '\n');
 
     std::vector<std::pair<IptablesTarget, std::string>> expected = {
+        { V4, "*filter\n-S\nCOMMIT\n" },
+        { V6, "*filter\n-S\nCOMMIT\n" },
         { V4V6, commandsCommon },
         { V4, commands4 },
         { V6, commands6 },
@@ -122,45 +130,175 @@ TEST_F(StrictControllerTest, TestResetChains) {
     expectIptablesRestoreCommands({ expected });
 }
 
-TEST_F(StrictControllerTest, TestSetUidCleartextPenalty) {
-    std::vector<std::string> acceptCommands = {
+TEST_F(StrictControllerTest, TestRemoveLegacyChains) {
+    addIptablesRestoreOutput(
+            "-P INPUT ACCEPT\n"
+            "-N st_OUTPUT\n"
+            "-N st_clear_caught\n"
+            "-N st_clear_caught_10012\n"
+            "-N st_clear_caught_10034\n"
+            "-A st_clear_caught_10034 -j st_penalty_reject\n",
+            "-P INPUT ACCEPT\n"
+            "-N st_clear_caught\n");
+    mStrictCtrl.setupIptablesHooks();
+
+    // The IPv4 chains are deleted, and there is nothing to do for IPv6.
+    ASSERT_EQ(7U, sRestoreCmds.size());
+    EXPECT_EQ(V6, sRestoreCmds[1].first);
+    EXPECT_EQ("*filter\n-S\nCOMMIT\n", sRestoreCmds[1].second);
+    const std::pair<IptablesTarget, std::string> expected = {
+        V4,
         "*filter\n"
-        "-D st_OUTPUT -m owner --uid-owner 12345 -j st_clear_detect\n"
-        "-D st_clear_caught -m owner --uid-owner 12345 -j st_clear_caught_12345\n"
-        "-F st_clear_caught_12345\n"
-        "-X st_clear_caught_12345\n"
+        "-F st_clear_caught_10012\n"
+        "-X st_clear_caught_10012\n"
+        "-F st_clear_caught_10034\n"
+        "-X st_clear_caught_10034\n"
+        "COMMIT\n"
+    };
+    EXPECT_EQ(expected, sRestoreCmds[3]);
+
+    // The penalty that the legacy chain implemented is kept.
+    const std::pair<IptablesTarget, std::string> restored = {
+        V4V6,
+        "*filter\n"
+        "-A st_OUTPUT -m owner --uid-owner 10034 -j st_clear_detect\n"
+        "-A st_clear_caught -m owner --uid-owner 10034 -j st_penalty_reject\n"
         "COMMIT\n"
     };
+    EXPECT_EQ(restored, sRestoreCmds[6]);
+    clearIptablesRestoreOutput();
+}
+
+TEST_F(StrictControllerTest, TestRestorePenalties) {
+    addIptablesRestoreOutput(
+            "-P INPUT ACCEPT\n"
+            "-N st_OUTPUT\n"
+            "-N st_clear_caught\n"
+            "-A st_OUTPUT -m connmark --mark 0x1000000/0x1000000 -j RETURN\n"
+            "-A st_OUTPUT -m owner --uid-owner 10012 -j st_clear_detect\n"
+            "-A st_OUTPUT -m owner --uid-owner 10034 -j st_clear_detect\n"
+            "-A st_clear_caught -m owner --uid-owner 10012 -j st_penalty_log\n"
+            "-A st_clear_caught -m owner --uid-owner 10034 -j st_penalty_reject\n",
+            "-P INPUT ACCEPT\n");
+    EXPECT_EQ(0, mStrictCtrl.setupIptablesHooks());
+
+    // The penalties of the previous netd are applied again after the chains are flushed.
+    ASSERT_EQ(6U, sRestoreCmds.size());
+    const std::pair<IptablesTarget, std::string> restored = {
+        V4V6,
+        "*filter\n"
+        "-A st_OUTPUT -m owner --uid-owner 10012 -j st_clear_detect\n"
+        "-A st_clear_caught -m owner --uid-owner 10012 -j st_penalty_log\n"
+        "-A st_OUTPUT -m owner --uid-owner 10034 -j st_clear_detect\n"
+        "-A st_clear_caught -m owner --uid-owner 10034 -j st_penalty_reject\n"
+        "COMMIT\n"
+    };
+    EXPECT_EQ(restored, sRestoreCmds[5]);
+    clearIptablesRestoreOutput();
+
+    // So the framework setting them again costs nothing.
+    sRestoreCmds.clear();
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalties({{10012, LOG}, {10034, REJECT}}));
+    expectIptablesRestoreCommands(std::vector<std::string>{});
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalty(10012, ACCEPT));
+    expectIptablesRestoreCommands(std::vector<std::string>{
+            "*filter\n"
+            "-D st_clear_caught -m owner --uid-owner 10012 -j st_penalty_log\n"
+            "-D st_OUTPUT -m owner --uid-owner 10012 -j st_clear_detect\n"
+            "COMMIT\n"});
+}
+
+TEST_F(StrictControllerTest, TestSetUidCleartextPenalty) {
     std::vector<std::string> logCommands = {
         "*filter\n"
-        ":st_clear_caught_12345 -\n"
-        "-I st_OUTPUT -m owner --uid-owner 12345 -j st_clear_detect\n"
-        "-I st_clear_caught -m owner --uid-owner 12345 -j st_clear_caught_12345\n"
-        "-A st_clear_caught_12345 -j st_penalty_log\n"
+        "-A st_OUTPUT -m owner --uid-owner 12345 -j st_clear_detect\n"
+        "-A st_clear_caught -m owner --uid-owner 12345 -j st_penalty_log\n"
         "COMMIT\n"
     };
-    std::vector<std::string> rejectCommands = {
+    std::vector<std::string> logToRejectCommands = {
         "*filter\n"
-        ":st_clear_caught_12345 -\n"
-        "-I st_OUTPUT -m owner --uid-owner 12345 -j st_clear_detect\n"
-        "-I st_clear_caught -m owner --uid-owner 12345 -j st_clear_caught_12345\n"
-        "-A st_clear_caught_12345 -j st_penalty_reject\n"
+        "-D st_clear_caught -m owner --uid-owner 12345 -j st_penalty_log\n"
+        "-A st_clear_caught -m owner --uid-owner 12345 -j st_penalty_reject\n"
+        "COMMIT\n"
+    };
+    std::vector<std::string> rejectToAcceptCommands = {
+        "*filter\n"
+        "-D st_clear_caught -m owner --uid-owner 12345 -j st_penalty_reject\n"
+        "-D st_OUTPUT -m owner --uid-owner 12345 -j st_clear_detect\n"
         "COMMIT\n"
     };
 
-    mStrictCtrl.setUidCleartextPenalty(12345, LOG);
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalty(12345, LOG));
     expectIptablesRestoreCommands(logCommands);
 
-    mStrictCtrl.setUidCleartextPenalty(12345, ACCEPT);
-    expectIptablesRestoreCommands(acceptCommands);
+    // Setting the same penalty again is a no-op.
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalty(12345, LOG));
+    expectIptablesRestoreCommands(std::vector<std::string>{});
 
-    // StrictController doesn't keep any state and it is not correct to call its methods in the
-    // wrong order (e.g., to go from LOG to REJECT without passing through ACCEPT).
-    // NetworkManagementService does keep state (not just to ensure correctness, but also so it can
-    // reprogram the rules when netd crashes).
-    mStrictCtrl.setUidCleartextPenalty(12345, REJECT);
-    expectIptablesRestoreCommands(rejectCommands);
+    // StrictController remembers the current penalty, so it can go from LOG to REJECT directly,
+    // only replacing the rule in st_clear_caught.
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalty(12345, REJECT));
+    expectIptablesRestoreCommands(logToRejectCommands);
+
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalty(12345, ACCEPT));
+    expectIptablesRestoreCommands(rejectToAcceptCommands);
+
+    // Accepting a UID that has no penalty doesn't try to delete rules that don't exist.
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalty(12345, ACCEPT));
+    expectIptablesRestoreCommands(std::vector<std::string>{});
+
+    EXPECT_EQ(-EINVAL, mStrictCtrl.setUidCleartextPenalty(12345, INVALID));
+    expectIptablesRestoreCommands(std::vector<std::string>{});
+}
 
-    mStrictCtrl.setUidCleartextPenalty(12345, ACCEPT);
-    expectIptablesRestoreCommands(acceptCommands);
+TEST_F(StrictControllerTest, TestSetUidCleartextPenalties) {
+    constexpr uid_t kFirstUid = 10000;
+    constexpr int kNumUids = 1000;
+
+    std::vector<std::pair<uid_t, StrictPenalty>> penalties;
+    std::string expected = "*filter\n";
+    for (uid_t uid = kFirstUid; uid < kFirstUid + kNumUids; uid++) {
+        const StrictPenalty penalty = (uid % 2) ? LOG : REJECT;
+        penalties.push_back({uid, penalty});
+        expected += StringPrintf("-A st_OUTPUT -m owner --uid-owner %u -j st_clear_detect\n", uid);
+        expected += StringPrintf("-A st_clear_caught -m owner --uid-owner %u -j %s\n", uid,
+                                 (penalty == LOG) ? "st_penalty_log" : "st_penalty_reject");
+    }
+    expected += "COMMIT\n";
+
+    // All the UIDs are programmed in a single transaction.
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalties(penalties));
+    expectIptablesRestoreCommands({expected});
+
+    // Only UIDs whose penalty changes are touched. A UID that appears twice ends up with the last
+    // penalty it was given.
+    penalties = {
+        {kFirstUid, REJECT},
+        {kFirstUid + 1, REJECT},
+        {kFirstUid + 2, ACCEPT},
+        {kFirstUid + 2, LOG},
+    };
+    expected =
+            "*filter\n"
+            "-D st_clear_caught -m owner --uid-owner 10001 -j st_penalty_log\n"
+            "-A st_clear_caught -m owner --uid-owner 10001 -j st_penalty_reject\n"
+            "-D st_clear_caught -m owner --uid-owner 10002 -j st_penalty_reject\n"
+            "-D st_OUTPUT -m owner --uid-owner 10002 -j st_clear_detect\n"
+            "-A st_OUTPUT -m owner --uid-owner 10002 -j st_clear_detect\n"
+            "-A st_clear_caught -m owner --uid-owner 10002 -j st_penalty_log\n"
+            "COMMIT\n";
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalties(penalties));
+    expectIptablesRestoreCommands({expected});
+
+    // An invalid penalty anywhere in the list rejects the whole list.
+    EXPECT_EQ(-EINVAL, mStrictCtrl.setUidCleartextPenalties({{kFirstUid, LOG}, {1234, INVALID}}));
+    expectIptablesRestoreCommands(std::vector<std::string>{});
+
+    // resetChains forgets all the penalties.
+    mStrictCtrl.resetChains();
+    expectIptablesRestoreCommands(std::vector<std::string>{
+            "*filter\n:st_OUTPUT -\n:st_penalty_log -\n:st_penalty_reject -\n"
+            ":st_clear_caught -\n:st_clear_detect -\nCOMMIT\n"});
+    EXPECT_EQ(0, mStrictCtrl.setUidCleartextPenalty(kFirstUid, ACCEPT));
+    expectIptablesRestoreCommands(std::vector<std::string>{});
 }
@@ -23,15 +23,24 @@
 
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
 #include <linux/tcp.h>
+#include <sys/eventfd.h>
 
 #include "Controllers.h"
 #include "SockDiag.h"
 #include "TcpSocketMonitor.h"
 #include "netdutils/DumpWriter.h"
+#include "netdutils/Syscalls.h"
 
 using android::netdutils::DumpWriter;
+using android::netdutils::NetlinkListener;
+using android::netdutils::NetlinkListenerInterface;
 using android::netdutils::ScopedIndent;
+using android::netdutils::Slice;
+using android::netdutils::sSyscalls;
+using android::netdutils::StatusOr;
 
 namespace android {
 namespace net {
@@ -98,6 +107,25 @@ static void tcpInfoPrint(DumpWriter &dw, Fwmark mark, const struct inet_diag_msg
             TCPINFO_GET(tcpinfo, tcpi_lost, tcpinfoLen, 0));
 }
 
+// Returns a listener subscribed to the sock_diag multicast groups on which the kernel broadcasts
+// the final state of every IPv4 and IPv6 TCP socket when it is destroyed.
+static StatusOr<std::unique_ptr<NetlinkListenerInterface>> makeTcpDestroyListener() {
+    const auto& sys = sSyscalls.get();
+    ASSIGN_OR_RETURN(auto event, sys.eventfd(0, EFD_CLOEXEC));
+    const auto flags = SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK;
+    ASSIGN_OR_RETURN(auto sock, sys.socket(AF_NETLINK, flags, NETLINK_SOCK_DIAG));
+
+    const sockaddr_nl addr = {.nl_family = AF_NETLINK};
+    RETURN_IF_NOT_OK(sys.bind(sock, addr));
+    for (const int32_t group : {SKNLGRP_INET_TCP_DESTROY, SKNLGRP_INET6_TCP_DESTROY}) {
+        RETURN_IF_NOT_OK(
+                sys.setsockopt<int32_t>(sock, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, group));
+    }
+
+    return std::unique_ptr<NetlinkListenerInterface>(
+            new NetlinkListener(std::move(event), std::move(sock), "TcpDestroyEvt"));
+}
+
 const String16 TcpSocketMonitor::DUMP_KEYWORD = String16("tcp_socket_info");
 const milliseconds TcpSocketMonitor::kDefaultPollingInterval = milliseconds(30000);
 
@@ -111,6 +139,10 @@ void TcpSocketMonitor::dump(DumpWriter& dw) {
     const auto d = duration_cast<milliseconds>(now - mLastPoll);
     dw.println("running=%d, suspended=%d, last poll %lld ms ago",
             mIsRunning, mIsSuspended, d.count());
+    dw.println("destroy events=%s, received=%" PRIu64 " untracked=%" PRIu64
+               ", idle sockets in last poll=%u",
+               (mDestroyListener != nullptr) ? "on" : "off", mDestroyEvents,
+               mUntrackedDestroyEvents, mIdleSockets);
 
     if (!mNetworkStats.empty()) {
         dw.blankline();
@@ -178,46 +210,120 @@ void TcpSocketMonitor::resumePolling() {
 }
 
 void TcpSocketMonitor::suspendPolling() {
-    std::lock_guard guard(mLock);
+    bool wasSuspended;
+    {
+        std::lock_guard guard(mLock);
 
-    bool wasSuspended = mIsSuspended;
-    mIsSuspended = true;
-    ALOGD("suspending tcpinfo polling");
+        wasSuspended = mIsSuspended;
+        mIsSuspended = true;
+        ALOGD("suspending tcpinfo polling");
+
+        if (!wasSuspended) {
+            mSocketEntries.clear();
+            mClosedNetworkStats.clear();
+        }
+    }
 
+    // Wakes up the polling thread so that it stops the destroy listener.
     if (!wasSuspended) {
-        mSocketEntries.clear();
+        mCv.notify_all();
     }
 }
 
-void TcpSocketMonitor::poll() {
-    std::lock_guard guard(mLock);
+void TcpSocketMonitor::updateDestroyListener() {
+    // Destroyed after releasing mLock, because the listener thread might be waiting for it.
+    std::unique_ptr<NetlinkListenerInterface> destroyListener;
+    {
+        std::lock_guard guard(mLock);
+        if (mIsSuspended) {
+            destroyListener = std::move(mDestroyListener);
+            mDestroyListenerStarted = false;
+            return;
+        }
+        if (mDestroyListenerStarted) return;
+        mDestroyListenerStarted = true;
+    }
+    startDestroyListener();
+}
 
-    if (mIsSuspended) {
+void TcpSocketMonitor::startDestroyListener() {
+    // Listening for destroy events is only worth its cost while we are polling: the kernel only
+    // builds the messages if somebody listens. If the kernel does not support it, fall back to
+    // polling only.
+    auto result = makeTcpDestroyListener();
+    if (!isOk(result)) {
+        ALOGW("Cannot listen for TCP socket destroy events, polling only: %s",
+              toString(result).c_str());
         return;
     }
-
-    SockDiag sd;
-    if (!sd.open()) {
-        ALOGE("Error opening sock diag for polling TCP socket info");
+    std::unique_ptr<NetlinkListenerInterface> destroyListener = std::move(result.value());
+    const auto rxHandler = [this](const nlmsghdr&, const Slice msg) { onSocketDestroyed(msg); };
+    if (const auto status = destroyListener->subscribe(SOCK_DIAG_BY_FAMILY, rxHandler);
+        !isOk(status)) {
+        ALOGW("Cannot subscribe to TCP socket destroy events: %s", toString(status).c_str());
         return;
     }
 
+    std::lock_guard guard(mLock);
+    // If polling was suspended again in the meantime, drop the listener (after releasing mLock).
+    if (!mIsSuspended && mDestroyListener == nullptr) {
+        mDestroyListener = std::move(destroyListener);
+    }
+}
+
+void TcpSocketMonitor::onSocketDestroyed(const Slice msg) {
     const auto now = steady_clock::now();
-    const auto tcpInfoReader = [this, now](Fwmark mark, const struct inet_diag_msg *sockinfo,
+    const auto tcpInfoReader = [this, now](Fwmark, const struct inet_diag_msg *sockinfo,
                                            const struct tcp_info *tcpinfo,
                                            uint32_t tcpinfoLen) NO_THREAD_SAFETY_ANALYSIS {
+        mDestroyEvents++;
+        // Destroy events carry neither the mark nor the UID of the socket, so only sockets seen by
+        // a previous poll can be attributed to a network.
+        const uint64_t cookie = (static_cast<uint64_t>(sockinfo->id.idiag_cookie[0]) << 32)
+                | static_cast<uint64_t>(sockinfo->id.idiag_cookie[1]);
+        const auto it = mSocketEntries.find(cookie);
+        if (it == mSocketEntries.end() || tcpinfo == nullptr || tcpinfoLen == 0) {
+            mUntrackedDestroyEvents++;
+            return;
+        }
+        updateSocketStats(now, it->second.mark, sockinfo, tcpinfo, tcpinfoLen,
+                          &mClosedNetworkStats);
+        mSocketEntries.erase(cookie);
+    };
+
+    std::lock_guard guard(mLock);
+    if (mIsSuspended) return;
+    SockDiag::parseTcpInfo(reinterpret_cast<const inet_diag_msg*>(msg.base()), msg.size(),
+                           tcpInfoReader);
+}
+
+bool TcpSocketMonitor::sampleSockets(time_point now) {
+    SockDiag sd;
+    if (!sd.open()) {
+        ALOGE("Error opening sock diag for polling TCP socket info");
+        return false;
+    }
+
+    uint32_t idleSockets = 0;
+    const auto tcpInfoReader = [this, now, &idleSockets](
+                                       Fwmark mark, const struct inet_diag_msg *sockinfo,
+                                       const struct tcp_info *tcpinfo,
+                                       uint32_t tcpinfoLen) NO_THREAD_SAFETY_ANALYSIS {
         if (sockinfo == nullptr || tcpinfo == nullptr || tcpinfoLen == 0 || mark.intValue == 0) {
             return;
         }
-        updateSocketStats(now, mark, sockinfo, tcpinfo, tcpinfoLen);
+        if (!updateSocketStats(now, mark, sockinfo, tcpinfo, tcpinfoLen, &mNetworkStats)) {
+            idleSockets++;
+        }
     };
 
-    // Reset mNetworkStats
+    // Reset mNetworkStats, starting from the sockets that were destroyed since the last poll.
     mNetworkStats.clear();
+    mNetworkStats.swap(mClosedNetworkStats);
 
     if (int ret = sd.getLiveTcpInfos(tcpInfoReader)) {
         ALOGE("Failed to poll TCP socket info: %s", strerror(-ret));
-        return;
+        return false;
     }
 
     // Remove any SocketEntry not updated
@@ -229,6 +335,26 @@ void TcpSocketMonitor::poll() {
         }
     }
 
+    mIdleSockets = idleSockets;
+    return true;
+}
+
+void TcpSocketMonitor::poll() {
+    // Resuming and suspending polling only record the change, so that callers such as
+    // NetworkController, which hold their own locks, never wait for sockets and threads.
+    updateDestroyListener();
+
+    std::lock_guard guard(mLock);
+
+    if (mIsSuspended) {
+        return;
+    }
+
+    const auto now = steady_clock::now();
+    if (!sampleSockets(now)) {
+        return;
+    }
+
     const auto listener = gCtls->eventReporter.getNetdEventListener();
     if (listener != nullptr) {
         std::vector<int> netIds;
@@ -275,10 +401,10 @@ bool TcpSocketMonitor::isRunning() {
     return mIsRunning;
 }
 
-void TcpSocketMonitor::updateSocketStats(time_point now, Fwmark mark,
+bool TcpSocketMonitor::updateSocketStats(time_point now, Fwmark mark,
                                          const struct inet_diag_msg *sockinfo,
-                                         const struct tcp_info *tcpinfo,
-                                         uint32_t tcpinfoLen) NO_THREAD_SAFETY_ANALYSIS {
+                                         const struct tcp_info *tcpinfo, uint32_t tcpinfoLen,
+                                         NetworkStatsMap* networkStats) NO_THREAD_SAFETY_ANALYSIS {
     int32_t lastAck = TCPINFO_GET(tcpinfo, tcpi_last_ack_recv, tcpinfoLen, 0);
     int32_t lastSent = TCPINFO_GET(tcpinfo, tcpi_last_data_sent, tcpinfoLen, 0);
     TcpStats diff = {
@@ -288,19 +414,29 @@ void TcpSocketMonitor::updateSocketStats(time_point now, Fwmark mark,
         .sentAckDiffMs = lastAck - lastSent,
         .nSockets = 1,
     };
+    bool idle;
 
     {
         // Update socket stats with the newest entry, computing the diff w.r.t the previous entry.
         const uint64_t cookie = (static_cast<uint64_t>(sockinfo->id.idiag_cookie[0]) << 32)
                 | static_cast<uint64_t>(sockinfo->id.idiag_cookie[1]);
-        const SocketEntry previous = mSocketEntries[cookie];
-        mSocketEntries[cookie] = {
-            .sent = diff.sent,
-            .lost = diff.lost,
-            .lastUpdate = now,
-            .mark = mark,
-            .uid = sockinfo->idiag_uid,
-        };
+        const auto [it, isNew] = mSocketEntries.try_emplace(cookie);
+        SocketEntry& entry = it->second;
+        const SocketEntry previous = entry;
+        idle = !isNew && diff.sent == previous.sent && diff.lost == previous.lost &&
+               mark.intValue == previous.mark.intValue;
+        if (idle) {
+            // Only the time of the update changed.
+            entry.lastUpdate = now;
+        } else {
+            entry = {
+                .sent = diff.sent,
+                .lost = diff.lost,
+                .lastUpdate = now,
+                .mark = mark,
+                .uid = sockinfo->idiag_uid,
+            };
+        }
 
         diff.sent -= previous.sent;
         diff.lost -= previous.lost;
@@ -308,13 +444,14 @@ void TcpSocketMonitor::updateSocketStats(time_point now, Fwmark mark,
 
     {
         // Aggregate the diff per network id.
-        auto& stats = mNetworkStats[mark.netId];
+        auto& stats = (*networkStats)[mark.netId];
         stats.sent += diff.sent;
         stats.lost += diff.lost;
         stats.rttUs += diff.rttUs;
         stats.sentAckDiffMs += diff.sentAckDiffMs;
         stats.nSockets += diff.nSockets;
     }
+    return !idle;
 }
 
 TcpSocketMonitor::TcpSocketMonitor() {
@@ -333,11 +470,14 @@ TcpSocketMonitor::TcpSocketMonitor() {
 }
 
 TcpSocketMonitor::~TcpSocketMonitor() {
+    std::unique_ptr<NetlinkListenerInterface> destroyListener;
     {
         std::lock_guard guard(mLock);
         mIsRunning = false;
         mIsSuspended = true;
+        destroyListener = std::move(mDestroyListener);
     }
+    destroyListener.reset();
     mCv.notify_all();
     mPollingThread.join();
 }
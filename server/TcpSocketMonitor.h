@@ -19,12 +19,15 @@
 
 #include <chrono>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <unordered_map>
 
 #include <android-base/thread_annotations.h>
 #include "netdutils/DumpWriter.h"
+#include "netdutils/NetlinkListener.h"
+#include "netdutils/Slice.h"
 #include "utils/String16.h"
 
 #include "Fwmark.h"
@@ -83,11 +86,25 @@ class TcpSocketMonitor {
     void suspendPolling();
 
   private:
+    friend class ControllerBenchmark;
+    using NetworkStatsMap = std::unordered_map<uint32_t, TcpStats>;
+
     void poll();
+    // Dumps all live TCP sockets and aggregates their stats in mNetworkStats. Returns false if the
+    // sockets could not be dumped.
+    bool sampleSockets(time_point now) REQUIRES(mLock);
     void waitForNextPoll();
     bool isRunning();
-    void updateSocketStats(time_point now, Fwmark mark, const struct inet_diag_msg *sockinfo,
-                           const struct tcp_info *tcpinfo, uint32_t tcpinfoLen) REQUIRES(mLock);
+    // Starts or stops the destroy listener to match whether polling is suspended. Only called by
+    // the polling thread.
+    void updateDestroyListener();
+    void startDestroyListener();
+    void onSocketDestroyed(const netdutils::Slice msg);
+    // Aggregates the socket in |networkStats|. Returns false if the socket has been idle since the
+    // last time it was sampled, in which case its entry in mSocketEntries is not rewritten.
+    bool updateSocketStats(time_point now, Fwmark mark, const struct inet_diag_msg *sockinfo,
+                           const struct tcp_info *tcpinfo, uint32_t tcpinfoLen,
+                           NetworkStatsMap* networkStats) REQUIRES(mLock);
 
     // Lock guarding all reads and writes to member variables.
     std::mutex mLock;
@@ -111,7 +128,22 @@ class TcpSocketMonitor {
     // Map of TcpStats entries aggregated per network and keyed per network id.
     // This map tracks per-network data for a single sock_diag dump and is cleared before every dump
     // operation.
-    std::unordered_map<uint32_t, TcpStats> mNetworkStats GUARDED_BY(mLock);
+    NetworkStatsMap mNetworkStats GUARDED_BY(mLock);
+    // Listens for the final tcp_info that the kernel broadcasts when a TCP socket is destroyed.
+    // Only set while polling is resumed, and only if the kernel supports it. When set, sockets that
+    // close between two polls are accounted for when they close instead of being missed.
+    std::unique_ptr<netdutils::NetlinkListenerInterface> mDestroyListener GUARDED_BY(mLock);
+    // True if the destroy listener was started, or failed to start, since polling was resumed.
+    bool mDestroyListenerStarted GUARDED_BY(mLock) = false;
+    // Stats of sockets destroyed since the last poll, aggregated per network id. Folded into
+    // mNetworkStats by the next poll.
+    NetworkStatsMap mClosedNetworkStats GUARDED_BY(mLock);
+    // Number of destroy events received, and how many of those were for sockets that were never
+    // sampled by a poll and thus have no known network.
+    uint64_t mDestroyEvents GUARDED_BY(mLock) = 0;
+    uint64_t mUntrackedDestroyEvents GUARDED_BY(mLock) = 0;
+    // Number of sockets that were idle in the last poll.
+    uint32_t mIdleSockets GUARDED_BY(mLock) = 0;
 };
 
 }  // namespace net
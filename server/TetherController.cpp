@@ -28,9 +28,14 @@
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter_ipv6/ip6_tables.h>
 
+#include <algorithm>
 #include <array>
 #include <cstdlib>
+#include <iterator>
 #include <regex>
 #include <string>
 #include <vector>
@@ -128,34 +133,38 @@ bool inBpToolsMode() {
 }  // namespace
 
 auto TetherController::iptablesRestoreFunction = execIptablesRestoreWithOutput;
+auto TetherController::readForwardChainStatsFunction =
+        TetherController::readKernelForwardChainStats;
 
 const std::string GET_TETHER_STATS_COMMAND = StringPrintf(
     "*filter\n"
     "-nvx -L %s\n"
     "COMMIT\n", android::net::TetherController::LOCAL_TETHER_COUNTERS_CHAIN);
 
-int TetherController::DnsmasqState::sendCmd(int daemonFd, const std::string& cmd) {
-    if (cmd.empty()) return 0;
-
-    gLog.log("Sending update msg to dnsmasq [%s]", cmd.c_str());
-    // Send the trailing \0 as well.
-    if (write(daemonFd, cmd.c_str(), cmd.size() + 1) < 0) {
-        gLog.error("Failed to send update command to dnsmasq (%s)", strerror(errno));
-        errno = EREMOTEIO;
-        return -1;
-    }
-    return 0;
-}
+// Flushes all forwarding rules and leaves only the rule that drops forwarded traffic.
+const std::string DEFAULT_V4_COMMANDS = StringPrintf(
+    "*filter\n"
+    ":%s -\n"
+    "-A %s -j DROP\n"
+    "COMMIT\n"
+    "*nat\n"
+    ":%s -\n"
+    "COMMIT\n", TetherController::LOCAL_FORWARD, TetherController::LOCAL_FORWARD,
+    TetherController::LOCAL_NAT_POSTROUTING);
+
+const std::string DEFAULT_V6_COMMANDS = StringPrintf(
+    "*filter\n"
+    ":%s -\n"
+    "COMMIT\n"
+    "*raw\n"
+    ":%s -\n"
+    "COMMIT\n", TetherController::LOCAL_FORWARD, TetherController::LOCAL_RAW_PREROUTING);
 
 void TetherController::DnsmasqState::clear() {
     update_ifaces_cmd.clear();
     update_dns_cmd.clear();
 }
 
-int TetherController::DnsmasqState::sendAllState(int daemonFd) const {
-    return sendCmd(daemonFd, update_ifaces_cmd) | sendCmd(daemonFd, update_dns_cmd);
-}
-
 TetherController::TetherController() {
     gLog.info("enter TetherController ctor");
     if (inBpToolsMode()) {
@@ -303,11 +312,17 @@ int TetherController::startTethering(bool usingLegacyDnsProxy, int num_addrs, ch
         ALOGE("posix_spawn failed (%s)", strerror(res));
         return -res;
     }
+    res = mDnsmasqChannel.start(std::move(pipeWrite));
+    if (res) {
+        ALOGE("Failed to start dnsmasq control channel (%s)", strerror(-res));
+        ::stopProcess(pid, "tethering(dnsmasq)");
+        return res;
+    }
     mDaemonPid = pid;
-    mDaemonFd = pipeWrite.release();
     configureForTethering(true);
     mIsTetheringStarted = true;
     applyDnsInterfaces();
+    mDnsmasqChannel.enqueue(mDnsmasqState.update_dns_cmd);
     ALOGD("Tethering services running");
 
     return 0;
@@ -352,8 +367,7 @@ int TetherController::stopTethering() {
 
     ::stopProcess(mDaemonPid, "tethering(dnsmasq)");
     mDaemonPid = 0;
-    close(mDaemonFd);
-    mDaemonFd = -1;
+    mDnsmasqChannel.stop();
     mDnsmasqState.clear();
     ALOGD("Tethering services stopped");
     return 0;
@@ -404,13 +418,7 @@ int TetherController::setDnsForwarders(unsigned netId, char **servers, int numSe
 
     mDnsNetId = netId;
     mDnsmasqState.update_dns_cmd = std::move(daemonCmd);
-    if (mDaemonFd != -1) {
-        if (mDnsmasqState.sendAllState(mDaemonFd) != 0) {
-            mDnsForwarders.clear();
-            errno = EREMOTEIO;
-            return -errno;
-        }
-    }
+    mDnsmasqChannel.enqueue(mDnsmasqState.update_dns_cmd);
     return 0;
 }
 
@@ -446,7 +454,7 @@ bool TetherController::applyDnsInterfaces() {
         mDnsmasqState.update_ifaces_cmd.clear();
     } else {
         mDnsmasqState.update_ifaces_cmd = std::move(daemonCmd);
-        if (mDaemonFd != -1) return (mDnsmasqState.sendAllState(mDaemonFd) == 0);
+        mDnsmasqChannel.enqueue(mDnsmasqState.update_ifaces_cmd);
     }
     return true;
 }
@@ -529,30 +537,12 @@ int TetherController::setupIptablesHooks() {
 }
 
 int TetherController::setDefaults() {
-    std::string v4Cmd = StringPrintf(
-        "*filter\n"
-        ":%s -\n"
-        "-A %s -j DROP\n"
-        "COMMIT\n"
-        "*nat\n"
-        ":%s -\n"
-        "COMMIT\n", LOCAL_FORWARD, LOCAL_FORWARD, LOCAL_NAT_POSTROUTING);
-
-    std::string v6Cmd = StringPrintf(
-            "*filter\n"
-            ":%s -\n"
-            "COMMIT\n"
-            "*raw\n"
-            ":%s -\n"
-            "COMMIT\n",
-            LOCAL_FORWARD, LOCAL_RAW_PREROUTING);
-
-    int res = iptablesRestoreFunction(V4, v4Cmd, nullptr);
+    int res = iptablesRestoreFunction(V4, DEFAULT_V4_COMMANDS, nullptr);
     if (res < 0) {
         return res;
     }
 
-    res = iptablesRestoreFunction(V6, v6Cmd, nullptr);
+    res = iptablesRestoreFunction(V6, DEFAULT_V6_COMMANDS, nullptr);
     if (res < 0) {
         return res;
     }
@@ -711,25 +701,26 @@ std::string TetherController::makeTetherCountingRule(const char *if1, const char
     return StringPrintf("-A %s -i %s -o %s -j RETURN", LOCAL_TETHER_COUNTERS_CHAIN, if1, if2);
 }
 
-int TetherController::setForwardRules(bool add, const char *intIface, const char *extIface) {
-    const char *op = add ? "-A" : "-D";
-
-    std::string rpfilterCmd = StringPrintf(
-        "*raw\n"
-        "%s %s -i %s -m rpfilter --invert ! -s fe80::/64 -j DROP\n"
-        "COMMIT\n", op, LOCAL_RAW_PREROUTING, intIface);
-    if (iptablesRestoreFunction(V6, rpfilterCmd, nullptr) == -1 && add) {
-        return -EREMOTEIO;
-    }
+/* static */
+std::string TetherController::makeRpfilterRule(const char* op, const char* intIface) {
+    return StringPrintf("%s %s -i %s -m rpfilter --invert ! -s fe80::/64 -j DROP", op,
+                        LOCAL_RAW_PREROUTING, intIface);
+}
 
-    std::vector<std::string> v4 = {
-            "*raw",
+/* static */
+std::vector<std::string> TetherController::makeHelperRules(const char* op, const char* intIface) {
+    return {
             StringPrintf("%s %s -p tcp --dport 21 -i %s -j CT --helper ftp", op,
                          LOCAL_RAW_PREROUTING, intIface),
             StringPrintf("%s %s -p tcp --dport 1723 -i %s -j CT --helper pptp", op,
                          LOCAL_RAW_PREROUTING, intIface),
-            "COMMIT",
-            "*filter",
+    };
+}
+
+/* static */
+std::vector<std::string> TetherController::makeForwardRules(const char* op, const char* intIface,
+                                                            const char* extIface) {
+    return {
             StringPrintf("%s %s -i %s -o %s -m state --state ESTABLISHED,RELATED -g %s", op,
                          LOCAL_FORWARD, extIface, intIface, LOCAL_TETHER_COUNTERS_CHAIN),
             StringPrintf("%s %s -i %s -o %s -m state --state INVALID -j DROP", op, LOCAL_FORWARD,
@@ -737,6 +728,23 @@ int TetherController::setForwardRules(bool add, const char *intIface, const char
             StringPrintf("%s %s -i %s -o %s -g %s", op, LOCAL_FORWARD, intIface, extIface,
                          LOCAL_TETHER_COUNTERS_CHAIN),
     };
+}
+
+int TetherController::setForwardRules(bool add, const char *intIface, const char *extIface) {
+    const char *op = add ? "-A" : "-D";
+
+    std::string rpfilterCmd = "*raw\n" + makeRpfilterRule(op, intIface) + "\nCOMMIT\n";
+    if (iptablesRestoreFunction(V6, rpfilterCmd, nullptr) == -1 && add) {
+        return -EREMOTEIO;
+    }
+
+    std::vector<std::string> v4 = {"*raw"};
+    const std::vector<std::string> helperRules = makeHelperRules(op, intIface);
+    v4.insert(v4.end(), helperRules.begin(), helperRules.end());
+    v4.push_back("COMMIT");
+    v4.push_back("*filter");
+    const std::vector<std::string> forwardRules = makeForwardRules(op, intIface, extIface);
+    v4.insert(v4.end(), forwardRules.begin(), forwardRules.end());
 
     std::vector<std::string> v6 = {
         "*filter",
@@ -780,6 +788,157 @@ int TetherController::setForwardRules(bool add, const char *intIface, const char
     return 0;
 }
 
+void TetherController::getForwardingPairsDelta(const std::set<ForwardingPair>& from,
+                                               const std::set<ForwardingPair>& to,
+                                               std::string* v4Cmds, std::string* v6Cmds) {
+    std::vector<ForwardingPair> removed;
+    std::set_difference(from.begin(), from.end(), to.begin(), to.end(),
+                        std::back_inserter(removed));
+    std::vector<ForwardingPair> added;
+    std::set_difference(to.begin(), to.end(), from.begin(), from.end(),
+                        std::back_inserter(added));
+
+    std::set<std::string> oldUpstreams;
+    for (const auto& [intIface, extIface] : from) oldUpstreams.insert(extIface);
+    std::set<std::string> newUpstreams;
+    for (const auto& [intIface, extIface] : to) newUpstreams.insert(extIface);
+
+    std::vector<std::string> raw4, filter4, nat4, raw6, filter6;
+    auto append = [](std::vector<std::string>& cmds, const std::vector<std::string>& rules) {
+        cmds.insert(cmds.end(), rules.begin(), rules.end());
+    };
+
+    // The helper and rpfilter rules only depend on the downstream, but there is one copy of them
+    // per enabled pair. Only add or delete as many copies as the number of pairs on each
+    // downstream changes by, so that moving a downstream to another upstream doesn't touch them.
+    std::map<std::string, int> downstreamDelta;
+    for (const auto& [intIface, extIface] : removed) downstreamDelta[intIface]--;
+    for (const auto& [intIface, extIface] : added) downstreamDelta[intIface]++;
+    for (const auto& [intIface, delta] : downstreamDelta) {
+        const char* op = (delta < 0) ? "-D" : "-A";
+        for (int i = 0; i < abs(delta); i++) {
+            append(raw4, makeHelperRules(op, intIface.c_str()));
+            raw6.push_back(makeRpfilterRule(op, intIface.c_str()));
+        }
+    }
+
+    // Deletions go first, so that the rules of a pair that moves to another upstream are never
+    // installed for both upstreams at the same time.
+    for (const auto& [intIface, extIface] : removed) {
+        append(filter4, makeForwardRules("-D", intIface.c_str(), extIface.c_str()));
+    }
+    for (const std::string& extIface : oldUpstreams) {
+        if (newUpstreams.find(extIface) == newUpstreams.end()) {
+            nat4.push_back(StringPrintf("-D %s -o %s -j MASQUERADE", LOCAL_NAT_POSTROUTING,
+                                        extIface.c_str()));
+        }
+    }
+    for (const std::string& extIface : newUpstreams) {
+        if (oldUpstreams.find(extIface) == oldUpstreams.end()) {
+            nat4.push_back(StringPrintf("-A %s -o %s -j MASQUERADE", LOCAL_NAT_POSTROUTING,
+                                        extIface.c_str()));
+        }
+    }
+
+    if (from.empty()) {
+        // Same as setupIPv6CountersChain() and setTetherGlobalAlertRule().
+        filter6.push_back(StringPrintf("-A %s -g %s", LOCAL_FORWARD, LOCAL_TETHER_COUNTERS_CHAIN));
+        const std::string alertRule =
+                StringPrintf("-I %s -j %s", LOCAL_FORWARD, BandwidthController::LOCAL_GLOBAL_ALERT);
+        filter4.push_back(alertRule);
+        filter6.push_back(alertRule);
+    }
+
+    // As in setForwardRules(), counting rules are only ever added, and only once per pair.
+    std::set<ForwardingPair> counted;
+    for (const auto& [intIface, extIface] : added) {
+        append(filter4, makeForwardRules("-A", intIface.c_str(), extIface.c_str()));
+
+        if (tetherCountingRuleExists(intIface, extIface) ||
+            counted.find({extIface, intIface}) != counted.end()) {
+            continue;
+        }
+        counted.insert({intIface, extIface});
+        const std::vector<std::string> countingRules = {
+                makeTetherCountingRule(intIface.c_str(), extIface.c_str()),
+                makeTetherCountingRule(extIface.c_str(), intIface.c_str()),
+        };
+        append(filter4, countingRules);
+        append(filter6, countingRules);
+    }
+
+    if (!added.empty()) {
+        filter4.push_back(StringPrintf("-D %s -j DROP", LOCAL_FORWARD));
+        filter4.push_back(StringPrintf("-A %s -j DROP", LOCAL_FORWARD));
+    }
+
+    auto table = [](const char* name, const std::vector<std::string>& rules) -> std::string {
+        if (rules.empty()) return "";
+        return StringPrintf("*%s\n%s\nCOMMIT\n", name, Join(rules, '\n').c_str());
+    };
+
+    if (to.empty()) {
+        // Nothing is left, so flush everything instead of deleting rules one by one. The IPv4
+        // helper rules are the only ones that the flush doesn't cover.
+        *v4Cmds = table("raw", raw4) + DEFAULT_V4_COMMANDS;
+        *v6Cmds = DEFAULT_V6_COMMANDS;
+        return;
+    }
+
+    *v4Cmds = table("raw", raw4) + table("filter", filter4) + table("nat", nat4);
+    *v6Cmds = table("raw", raw6) + table("filter", filter6);
+}
+
+int TetherController::setForwardingPairs(const std::vector<ForwardingPair>& pairs) {
+    std::set<ForwardingPair> desired;
+    for (const auto& [intIface, extIface] : pairs) {
+        if (!isIfaceName(intIface) || !isIfaceName(extIface)) {
+            return -ENODEV;
+        }
+        if (intIface == extIface) {
+            ALOGE("Duplicate interface specified: %s %s", intIface.c_str(), extIface.c_str());
+            return -EINVAL;
+        }
+        desired.insert({intIface, extIface});
+    }
+
+    std::set<ForwardingPair> current;
+    for (const auto& [extIface, downstream] : mFwdIfaces) {
+        if (downstream.active) current.insert({downstream.iface, extIface});
+    }
+    if (current == desired) {
+        return 0;
+    }
+
+    std::string v4Cmds, v6Cmds;
+    getForwardingPairsDelta(current, desired, &v4Cmds, &v6Cmds);
+
+    if (!v4Cmds.empty() && iptablesRestoreFunction(V4, v4Cmds, nullptr) != 0) {
+        ALOGE("Error applying IPv4 forwarding rules");
+        return -EREMOTEIO;
+    }
+    if (!v6Cmds.empty() && iptablesRestoreFunction(V6, v6Cmds, nullptr) != 0) {
+        ALOGE("Error applying IPv6 forwarding rules");
+        // Put the IPv4 rules back the way they were, but don't care about success - what more
+        // could we do?
+        std::string undoV4Cmds, unusedV6Cmds;
+        getForwardingPairsDelta(desired, current, &undoV4Cmds, &unusedV6Cmds);
+        if (!undoV4Cmds.empty()) iptablesRestoreFunction(V4, undoV4Cmds, nullptr);
+        return -EREMOTEIO;
+    }
+
+    for (const auto& [intIface, extIface] : current) {
+        if (desired.find({intIface, extIface}) == desired.end()) {
+            markForwardingPairDisabled(intIface, extIface);
+        }
+    }
+    for (const auto& [intIface, extIface] : desired) {
+        addForwardingPair(intIface, extIface);
+    }
+
+    return 0;
+}
+
 int TetherController::disableNat(const char* intIface, const char* extIface) {
     if (!isIfaceName(intIface) || !isIfaceName(extIface)) {
         errno = ENODEV;
@@ -801,6 +960,35 @@ void TetherController::addStats(TetherStatsList& statsList, const TetherStats& s
     statsList.push_back(stats);
 }
 
+/* static */
+void TetherController::addCountingRuleStats(TetherStatsList& statsList, TetherStats& stats,
+                                            const std::string& iface0, const std::string& iface1,
+                                            int64_t packets, int64_t bytes) {
+    /*
+     * The following assumes that the 1st rule has in:extIface out:intIface,
+     * which is what TetherController sets up.
+     * The 1st matches rx, and sets up the pair for the tx side.
+     */
+    if (stats.intIface.empty()) {
+        ALOGV("0Filter RX iface_in=%s iface_out=%s rx_bytes=%" PRId64 " rx_packets=%" PRId64
+              " ", iface0.c_str(), iface1.c_str(), bytes, packets);
+        stats.intIface = iface0;
+        stats.extIface = iface1;
+        stats.txPackets = packets;
+        stats.txBytes = bytes;
+    } else if (stats.intIface == iface1 && stats.extIface == iface0) {
+        ALOGV("0Filter TX iface_in=%s iface_out=%s rx_bytes=%" PRId64 " rx_packets=%" PRId64
+              " ", iface0.c_str(), iface1.c_str(), bytes, packets);
+        stats.rxPackets = packets;
+        stats.rxBytes = bytes;
+    }
+    if (stats.rxBytes != -1 && stats.txBytes != -1) {
+        ALOGV("rx_bytes=%" PRId64" tx_bytes=%" PRId64, stats.rxBytes, stats.txBytes);
+        addStats(statsList, stats);
+        stats = TetherStats();
+    }
+}
+
 /*
  * Parse the ptks and bytes out of:
  *   Chain tetherctrl_counters (4 references)
@@ -829,7 +1017,6 @@ int TetherController::addForwardChainStats(TetherStatsList& statsList,
         DESTINATION
     };
     TetherStats stats;
-    const TetherStats empty;
 
     static const std::string NUM = "(\\d+)";
     static const std::string IFACE = "([^\\s]+)";
@@ -860,8 +1047,8 @@ int TetherController::addForwardChainStats(TetherStatsList& statsList,
         //		 26 	2373 RETURN     all  --  wlan0	rmnet0	0.0.0.0/0			 0.0.0.0/0
         //		 26 	2373 RETURN     all  --  wlan0	rmnet0	::/0				 ::/0
         // TODO: Replace strtoXX() calls with ParseUint() /ParseInt()
-        int64_t packets = strtoul(matches[PACKET_COUNTS].str().c_str(), nullptr, 10);
-        int64_t bytes = strtoul(matches[BYTE_COUNTS].str().c_str(), nullptr, 10);
+        int64_t packets = strtoull(matches[PACKET_COUNTS].str().c_str(), nullptr, 10);
+        int64_t bytes = strtoull(matches[BYTE_COUNTS].str().c_str(), nullptr, 10);
         std::string iface0 = matches[IFACE0_NAME].str();
         std::string iface1 = matches[IFACE1_NAME].str();
         std::string rest = matches[SOURCE].str();
@@ -869,30 +1056,83 @@ int TetherController::addForwardChainStats(TetherStatsList& statsList,
         ALOGV("parse iface0=<%s> iface1=<%s> pkts=%" PRId64 " bytes=%" PRId64
               " rest=<%s> orig line=<%s>",
               iface0.c_str(), iface1.c_str(), packets, bytes, rest.c_str(), line.c_str());
-        /*
-         * The following assumes that the 1st rule has in:extIface out:intIface,
-         * which is what TetherController sets up.
-         * The 1st matches rx, and sets up the pair for the tx side.
-         */
-        if (stats.intIface.empty()) {
-            ALOGV("0Filter RX iface_in=%s iface_out=%s rx_bytes=%" PRId64 " rx_packets=%" PRId64
-                  " ", iface0.c_str(), iface1.c_str(), bytes, packets);
-            stats.intIface = iface0;
-            stats.extIface = iface1;
-            stats.txPackets = packets;
-            stats.txBytes = bytes;
-        } else if (stats.intIface == iface1 && stats.extIface == iface0) {
-            ALOGV("0Filter TX iface_in=%s iface_out=%s rx_bytes=%" PRId64 " rx_packets=%" PRId64
-                  " ", iface0.c_str(), iface1.c_str(), bytes, packets);
-            stats.rxPackets = packets;
-            stats.rxBytes = bytes;
+        addCountingRuleStats(statsList, stats, iface0, iface1, packets, bytes);
+    }
+
+    /* It is always an error to find only one side of the stats. */
+    if (((stats.rxBytes == -1) != (stats.txBytes == -1))) {
+        return -EREMOTEIO;
+    }
+    return 0;
+}
+
+namespace {
+
+const ipt_ip& entryIpFields(const ipt_entry& entry) {
+    return entry.ip;
+}
+
+const ip6t_ip6& entryIpFields(const ip6t_entry& entry) {
+    return entry.ipv6;
+}
+
+std::string ifaceName(const char (&iface)[IFNAMSIZ]) {
+    return std::string(iface, strnlen(iface, IFNAMSIZ));
+}
+
+// Calls |fn| with the interfaces and counters of every rule in |chain|, in order. |table| is the
+// entrytable returned by IPT_SO_GET_ENTRIES or IP6T_SO_GET_ENTRIES. Returns 0 on success, -ENOENT
+// if there is no such chain or -EBADMSG if the table is malformed.
+template <typename Entry, typename Fn>
+int forEachChainRule(const uint8_t* table, size_t size, const char* chain, Fn fn) {
+    bool inChain = false;
+    size_t offset = 0;
+    while (offset < size) {
+        if (size - offset < sizeof(Entry)) return -EBADMSG;
+        const Entry& entry = *reinterpret_cast<const Entry*>(table + offset);
+        if (entry.target_offset < sizeof(Entry) || entry.next_offset > size - offset ||
+            entry.target_offset + sizeof(xt_entry_target) > entry.next_offset) {
+            return -EBADMSG;
         }
-        if (stats.rxBytes != -1 && stats.txBytes != -1) {
-            ALOGV("rx_bytes=%" PRId64" tx_bytes=%" PRId64, stats.rxBytes, stats.txBytes);
-            addStats(statsList, stats);
-            stats = empty;
+        const auto& target = *reinterpret_cast<const xt_entry_target*>(table + offset +
+                                                                       entry.target_offset);
+
+        // User-defined chains start with an ERROR target whose data is the name of the chain.
+        // The end of the table is marked by another ERROR target.
+        if (!strncmp(target.u.user.name, XT_ERROR_TARGET, sizeof(target.u.user.name))) {
+            if (inChain) return 0;
+            if (entry.target_offset + sizeof(xt_error_target) > entry.next_offset) return -EBADMSG;
+            const auto& error = reinterpret_cast<const xt_error_target&>(target);
+            inChain = !strncmp(error.errorname, chain, sizeof(error.errorname));
+        } else if (inChain) {
+            const auto& ip = entryIpFields(entry);
+            // Skip the RETURN that ends the chain, which matches any interface.
+            if (ip.iniface[0] && ip.outiface[0]) {
+                fn(ifaceName(ip.iniface), ifaceName(ip.outiface), entry.counters);
+            }
         }
+        offset += entry.next_offset;
     }
+    return inChain ? -EBADMSG : -ENOENT;
+}
+
+}  // namespace
+
+/* static */
+int TetherController::addKernelForwardChainStats(TetherStatsList& statsList, IptablesTarget target,
+                                                 const void* entries, size_t size) {
+    TetherStats stats;
+    const auto addRule = [&](const std::string& iface0, const std::string& iface1,
+                             const xt_counters& counters) {
+        addCountingRuleStats(statsList, stats, iface0, iface1, counters.pcnt, counters.bcnt);
+    };
+    const uint8_t* table = static_cast<const uint8_t*>(entries);
+    int ret = (target == V6)
+                      ? forEachChainRule<ip6t_entry>(table, size, LOCAL_TETHER_COUNTERS_CHAIN,
+                                                     addRule)
+                      : forEachChainRule<ipt_entry>(table, size, LOCAL_TETHER_COUNTERS_CHAIN,
+                                                    addRule);
+    if (ret) return ret;
 
     /* It is always an error to find only one side of the stats. */
     if (((stats.rxBytes == -1) != (stats.txBytes == -1))) {
@@ -901,10 +1141,60 @@ int TetherController::addForwardChainStats(TetherStatsList& statsList,
     return 0;
 }
 
+/* static */
+int TetherController::readKernelForwardChainStats(IptablesTarget target,
+                                                  TetherStatsList& statsList) {
+    // The IPv6 structures have the same layout as the IPv4 ones up to the entry table.
+    static_assert(sizeof(ipt_getinfo) == sizeof(ip6t_getinfo));
+    static_assert(offsetof(ipt_get_entries, entrytable) ==
+                  offsetof(ip6t_get_entries, entrytable));
+
+    const bool v6 = (target == V6);
+    unique_fd s(socket(v6 ? AF_INET6 : AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW));
+    if (s == -1) return -errno;
+    const int level = v6 ? IPPROTO_IPV6 : IPPROTO_IP;
+
+    // If the table changes between the two calls, IPT_SO_GET_ENTRIES fails with EAGAIN.
+    for (int attempt = 0; attempt < 3; attempt++) {
+        ipt_getinfo info = {};
+        strlcpy(info.name, "filter", sizeof(info.name));
+        socklen_t len = sizeof(info);
+        if (getsockopt(s, level, v6 ? IP6T_SO_GET_INFO : IPT_SO_GET_INFO, &info, &len)) {
+            return -errno;
+        }
+
+        std::vector<uint8_t> buf(offsetof(ipt_get_entries, entrytable) + info.size);
+        auto* entries = reinterpret_cast<ipt_get_entries*>(buf.data());
+        strlcpy(entries->name, "filter", sizeof(entries->name));
+        entries->size = info.size;
+        len = buf.size();
+        if (getsockopt(s, level, v6 ? IP6T_SO_GET_ENTRIES : IPT_SO_GET_ENTRIES, entries, &len)) {
+            if (errno == EAGAIN) continue;
+            return -errno;
+        }
+        return addKernelForwardChainStats(statsList, target, entries->entrytable, entries->size);
+    }
+    return -EAGAIN;
+}
+
 StatusOr<TetherController::TetherStatsList> TetherController::getTetherStats() {
     TetherStatsList statsList;
     std::string parsedIptablesOutput;
 
+    // Reading the counters from the kernel's binary tables is much cheaper than having iptables
+    // list them as text and parsing that, but it needs the legacy xtables socket options.
+    if (mKernelCountersAvailable) {
+        int ret = readForwardChainStatsFunction(V4, statsList);
+        if (!ret) ret = readForwardChainStatsFunction(V6, statsList);
+        if (!ret) return statsList;
+        if (ret != -ENOENT && ret != -EREMOTEIO && ret != -EAGAIN) {
+            ALOGW("Cannot read tether counters from the kernel, using iptables: %s",
+                  strerror(-ret));
+            mKernelCountersAvailable = false;
+        }
+        statsList.clear();
+    }
+
     for (const IptablesTarget target : {V4, V6}) {
         std::string statsString;
         if (int ret = iptablesRestoreFunction(target, GET_TETHER_STATS_COMMAND, &statsString)) {
@@ -922,6 +1212,37 @@ StatusOr<TetherController::TetherStatsList> TetherController::getTetherStats() {
     return statsList;
 }
 
+StatusOr<TetherController::TetherStatsList> TetherController::getTetherStatsDelta() {
+    StatusOr<TetherStatsList> totals = getTetherStats();
+    if (!isOk(totals)) {
+        return totals.status();
+    }
+
+    TetherStatsList deltas;
+    std::map<std::pair<std::string, std::string>, TetherStats> lastStats;
+    for (const TetherStats& stats : totals.value()) {
+        const auto key = std::make_pair(stats.intIface, stats.extIface);
+        TetherStats delta = stats;
+        const auto it = mLastStats.find(key);
+        // The counters only go down if the counting rules were recreated, in which case
+        // everything they counted is new.
+        if (it != mLastStats.end() && stats.rxBytes >= it->second.rxBytes &&
+            stats.rxPackets >= it->second.rxPackets && stats.txBytes >= it->second.txBytes &&
+            stats.txPackets >= it->second.txPackets) {
+            delta.rxBytes -= it->second.rxBytes;
+            delta.rxPackets -= it->second.rxPackets;
+            delta.txBytes -= it->second.txBytes;
+            delta.txPackets -= it->second.txPackets;
+        }
+        if (delta.rxBytes || delta.rxPackets || delta.txBytes || delta.txPackets) {
+            deltas.push_back(delta);
+        }
+        lastStats[key] = stats;
+    }
+    mLastStats = std::move(lastStats);
+    return deltas;
+}
+
 void TetherController::dumpIfaces(DumpWriter& dw) {
     dw.println("Interface pairs:");
 
@@ -947,6 +1268,7 @@ void TetherController::dump(DumpWriter& dw) {
     if (mDaemonPid != 0) {
         dw.println("dnsmasq PID: %d", mDaemonPid);
     }
+    mDnsmasqChannel.dump(dw);
 
     dumpIfaces(dw);
 }
@@ -18,13 +18,17 @@
 #define _TETHER_CONTROLLER_H
 
 #include <list>
+#include <map>
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <netdutils/DumpWriter.h>
 #include <netdutils/StatusOr.h>
 #include <sysutils/SocketClient.h>
 
+#include "DnsmasqChannel.h"
 #include "NetdConstants.h"
 #include "android-base/result.h"
 
@@ -55,12 +59,9 @@ class TetherController {
     unsigned               mDnsNetId = 0;
     std::list<std::string> mDnsForwarders;
     pid_t                  mDaemonPid = 0;
-    int                    mDaemonFd = -1;
     std::set<std::string>  mForwardingRequests;
 
     struct DnsmasqState {
-        static int sendCmd(int daemonFd, const std::string& cmd);
-
         // List of downstream interfaces on which to serve. The format used is:
         //     update_ifaces|<ifname1>|<ifname2>|...
         std::string update_ifaces_cmd;
@@ -69,9 +70,11 @@ class TetherController {
         std::string update_dns_cmd;
 
         void clear();
-        int sendAllState(int daemonFd) const;
     } mDnsmasqState{};
 
+    // Sends the commands in mDnsmasqState to dnsmasq while it is running.
+    DnsmasqChannel mDnsmasqChannel;
+
   public:
     TetherController();
     ~TetherController() = default;
@@ -98,6 +101,15 @@ class TetherController {
 
     int enableNat(const char* intIface, const char* extIface);
     int disableNat(const char* intIface, const char* extIface);
+
+    // An (intIface, extIface) pair to forward and NAT between.
+    typedef std::pair<std::string, std::string> ForwardingPair;
+    // Makes |pairs| the complete set of enabled forwarding pairs, as if by calling enableNat() for
+    // each new pair and disableNat() for each pair that is no longer present. Only the rules that
+    // differ from the installed ones are touched, and they are changed with one IPv4 and one IPv6
+    // iptables-restore transaction. If any pair is invalid, nothing is changed.
+    int setForwardingPairs(const std::vector<ForwardingPair>& pairs);
+
     int setupIptablesHooks();
 
     class TetherStats {
@@ -132,6 +144,10 @@ class TetherController {
 
     netdutils::StatusOr<TetherStatsList> getTetherStats();
 
+    // Returns the number of bytes and packets forwarded since the previous call, only for the
+    // interface pairs that forwarded any. The first call returns the totals.
+    netdutils::StatusOr<TetherStatsList> getTetherStatsDelta();
+
     /*
      * extraProcessingInfo: contains raw parsed data, and error info.
      * This strongly requires that setup of the rules is in a specific order:
@@ -142,6 +158,14 @@ class TetherController {
     static int addForwardChainStats(TetherStatsList& statsList, const std::string& iptOutput,
                                     std::string &extraProcessingInfo);
 
+    /*
+     * Same as addForwardChainStats, but reads the rules of LOCAL_TETHER_COUNTERS_CHAIN from the
+     * binary filter table returned by IPT_SO_GET_ENTRIES (or IP6T_SO_GET_ENTRIES if |target| is
+     * V6), i.e., the entrytable of an ipt_get_entries of |size| bytes.
+     */
+    static int addKernelForwardChainStats(TetherStatsList& statsList, IptablesTarget target,
+                                          const void* entries, size_t size);
+
     static constexpr const char* LOCAL_FORWARD               = "tetherctrl_FORWARD";
     static constexpr const char* LOCAL_MANGLE_FORWARD        = "tetherctrl_mangle_FORWARD";
     static constexpr const char* LOCAL_NAT_POSTROUTING       = "tetherctrl_nat_POSTROUTING";
@@ -158,6 +182,10 @@ class TetherController {
     std::vector<char*> toCstrVec(const std::vector<std::string>& addrs);
     int setupIPv6CountersChain();
     static std::string makeTetherCountingRule(const char *if1, const char *if2);
+    static std::string makeRpfilterRule(const char* op, const char* intIface);
+    static std::vector<std::string> makeHelperRules(const char* op, const char* intIface);
+    static std::vector<std::string> makeForwardRules(const char* op, const char* intIface,
+                                                     const char* extIface);
     ForwardingDownstream* findForwardingDownstream(const std::string& intIface,
         const std::string& extIface);
     void addForwardingPair(const std::string& intIface, const std::string& extIface);
@@ -171,13 +199,27 @@ class TetherController {
     int setDefaults();
     int setTetherGlobalAlertRule();
     int setForwardRules(bool set, const char *intIface, const char *extIface);
+    void getForwardingPairsDelta(const std::set<ForwardingPair>& from,
+                                 const std::set<ForwardingPair>& to, std::string* v4Cmds,
+                                 std::string* v6Cmds);
     int setTetherCountingRules(bool add, const char *intIface, const char *extIface);
 
     static void addStats(TetherStatsList& statsList, const TetherStats& stats);
+    static void addCountingRuleStats(TetherStatsList& statsList, TetherStats& stats,
+                                     const std::string& iface0, const std::string& iface1,
+                                     int64_t packets, int64_t bytes);
+    static int readKernelForwardChainStats(IptablesTarget target, TetherStatsList& statsList);
+
+    // Whether the counters can be read with IPT_SO_GET_ENTRIES instead of iptables. Cleared the
+    // first time the kernel doesn't support it.
+    bool mKernelCountersAvailable = true;
+    // The totals seen by the last call to getTetherStatsDelta(), by (intIface, extIface).
+    std::map<std::pair<std::string, std::string>, TetherStats> mLastStats;
 
     // For testing.
     friend class TetherControllerTest;
     static int (*iptablesRestoreFunction)(IptablesTarget, const std::string&, std::string *);
+    static int (*readForwardChainStatsFunction)(IptablesTarget, TetherStatsList&);
 };
 
 }  // namespace net
@@ -16,11 +16,16 @@
  * TetherControllerTest.cpp - unit tests for TetherController.cpp
  */
 
+#include <iostream>
 #include <string>
 #include <vector>
 
 #include <fcntl.h>
 #include <inttypes.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter_ipv6/ip6_tables.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -31,6 +36,7 @@
 #include <android-base/strings.h>
 #include <gmock/gmock.h>
 #include <netdutils/StatusOr.h>
+#include <netdutils/Stopwatch.h>
 
 #include "IptablesBaseTest.h"
 #include "TcUtils.h"
@@ -39,6 +45,7 @@
 using android::base::Join;
 using android::base::StringPrintf;
 using android::netdutils::StatusOr;
+using android::netdutils::Stopwatch;
 using TetherStats = android::net::TetherController::TetherStats;
 using TetherStatsList = android::net::TetherController::TetherStatsList;
 
@@ -49,6 +56,12 @@ class TetherControllerTest : public IptablesBaseTest {
 public:
     TetherControllerTest() {
         TetherController::iptablesRestoreFunction = fakeExecIptablesRestoreWithOutput;
+        TetherController::readForwardChainStatsFunction = fakeReadForwardChainStats;
+    }
+
+    // Pretend that the kernel doesn't support reading the counters, so they come from iptables.
+    static int fakeReadForwardChainStats(IptablesTarget, TetherStatsList&) {
+        return -ENOPROTOOPT;
     }
 
 protected:
@@ -328,6 +341,226 @@ TEST_F(TetherControllerTest, TestMultipleUpstreams) {
     expectIptablesRestoreCommands(stopFirstNat);
 }
 
+TEST_F(TetherControllerTest, TestSetForwardingPairs) {
+    // Invalid pairs are rejected before anything is changed.
+    EXPECT_EQ(-EINVAL, mTetherCtrl.setForwardingPairs({{"wlan0", "rmnet0"}, {"usb0", "usb0"}}));
+    EXPECT_EQ(-ENODEV, mTetherCtrl.setForwardingPairs({{"wlan0", "rmnet0"}, {"usb0", ""}}));
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+
+    // Two downstreams on the same upstream. Everything is added with one transaction per family.
+    EXPECT_EQ(0, mTetherCtrl.setForwardingPairs({{"wlan0", "rmnet0"}, {"usb0", "rmnet0"}}));
+    expectIptablesRestoreCommands({
+            {V4,
+             "*raw\n"
+             "-A tetherctrl_raw_PREROUTING -p tcp --dport 21 -i usb0 -j CT --helper ftp\n"
+             "-A tetherctrl_raw_PREROUTING -p tcp --dport 1723 -i usb0 -j CT --helper pptp\n"
+             "-A tetherctrl_raw_PREROUTING -p tcp --dport 21 -i wlan0 -j CT --helper ftp\n"
+             "-A tetherctrl_raw_PREROUTING -p tcp --dport 1723 -i wlan0 -j CT --helper pptp\n"
+             "COMMIT\n"
+             "*filter\n"
+             "-I tetherctrl_FORWARD -j bw_global_alert\n"
+             "-A tetherctrl_FORWARD -i rmnet0 -o usb0 -m state --state ESTABLISHED,RELATED "
+             "-g tetherctrl_counters\n"
+             "-A tetherctrl_FORWARD -i usb0 -o rmnet0 -m state --state INVALID -j DROP\n"
+             "-A tetherctrl_FORWARD -i usb0 -o rmnet0 -g tetherctrl_counters\n"
+             "-A tetherctrl_counters -i usb0 -o rmnet0 -j RETURN\n"
+             "-A tetherctrl_counters -i rmnet0 -o usb0 -j RETURN\n"
+             "-A tetherctrl_FORWARD -i rmnet0 -o wlan0 -m state --state ESTABLISHED,RELATED "
+             "-g tetherctrl_counters\n"
+             "-A tetherctrl_FORWARD -i wlan0 -o rmnet0 -m state --state INVALID -j DROP\n"
+             "-A tetherctrl_FORWARD -i wlan0 -o rmnet0 -g tetherctrl_counters\n"
+             "-A tetherctrl_counters -i wlan0 -o rmnet0 -j RETURN\n"
+             "-A tetherctrl_counters -i rmnet0 -o wlan0 -j RETURN\n"
+             "-D tetherctrl_FORWARD -j DROP\n"
+             "-A tetherctrl_FORWARD -j DROP\n"
+             "COMMIT\n"
+             "*nat\n"
+             "-A tetherctrl_nat_POSTROUTING -o rmnet0 -j MASQUERADE\n"
+             "COMMIT\n"},
+            {V6,
+             "*raw\n"
+             "-A tetherctrl_raw_PREROUTING -i usb0 -m rpfilter --invert ! -s fe80::/64 -j DROP\n"
+             "-A tetherctrl_raw_PREROUTING -i wlan0 -m rpfilter --invert ! -s fe80::/64 -j DROP\n"
+             "COMMIT\n"
+             "*filter\n"
+             "-A tetherctrl_FORWARD -g tetherctrl_counters\n"
+             "-I tetherctrl_FORWARD -j bw_global_alert\n"
+             "-A tetherctrl_counters -i usb0 -o rmnet0 -j RETURN\n"
+             "-A tetherctrl_counters -i rmnet0 -o usb0 -j RETURN\n"
+             "-A tetherctrl_counters -i wlan0 -o rmnet0 -j RETURN\n"
+             "-A tetherctrl_counters -i rmnet0 -o wlan0 -j RETURN\n"
+             "COMMIT\n"},
+    });
+
+    // Setting the same pairs again does nothing.
+    EXPECT_EQ(0, mTetherCtrl.setForwardingPairs({{"usb0", "rmnet0"}, {"wlan0", "rmnet0"}}));
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+
+    // Switch both downstreams to a new upstream. Only the forwarding and NAT rules change.
+    EXPECT_EQ(0, mTetherCtrl.setForwardingPairs({{"wlan0", "rmnet1"}, {"usb0", "rmnet1"}}));
+    expectIptablesRestoreCommands({
+            {V4,
+             "*filter\n"
+             "-D tetherctrl_FORWARD -i rmnet0 -o usb0 -m state --state ESTABLISHED,RELATED "
+             "-g tetherctrl_counters\n"
+             "-D tetherctrl_FORWARD -i usb0 -o rmnet0 -m state --state INVALID -j DROP\n"
+             "-D tetherctrl_FORWARD -i usb0 -o rmnet0 -g tetherctrl_counters\n"
+             "-D tetherctrl_FORWARD -i rmnet0 -o wlan0 -m state --state ESTABLISHED,RELATED "
+             "-g tetherctrl_counters\n"
+             "-D tetherctrl_FORWARD -i wlan0 -o rmnet0 -m state --state INVALID -j DROP\n"
+             "-D tetherctrl_FORWARD -i wlan0 -o rmnet0 -g tetherctrl_counters\n"
+             "-A tetherctrl_FORWARD -i rmnet1 -o usb0 -m state --state ESTABLISHED,RELATED "
+             "-g tetherctrl_counters\n"
+             "-A tetherctrl_FORWARD -i usb0 -o rmnet1 -m state --state INVALID -j DROP\n"
+             "-A tetherctrl_FORWARD -i usb0 -o rmnet1 -g tetherctrl_counters\n"
+             "-A tetherctrl_counters -i usb0 -o rmnet1 -j RETURN\n"
+             "-A tetherctrl_counters -i rmnet1 -o usb0 -j RETURN\n"
+             "-A tetherctrl_FORWARD -i rmnet1 -o wlan0 -m state --state ESTABLISHED,RELATED "
+             "-g tetherctrl_counters\n"
+             "-A tetherctrl_FORWARD -i wlan0 -o rmnet1 -m state --state INVALID -j DROP\n"
+             "-A tetherctrl_FORWARD -i wlan0 -o rmnet1 -g tetherctrl_counters\n"
+             "-A tetherctrl_counters -i wlan0 -o rmnet1 -j RETURN\n"
+             "-A tetherctrl_counters -i rmnet1 -o wlan0 -j RETURN\n"
+             "-D tetherctrl_FORWARD -j DROP\n"
+             "-A tetherctrl_FORWARD -j DROP\n"
+             "COMMIT\n"
+             "*nat\n"
+             "-D tetherctrl_nat_POSTROUTING -o rmnet0 -j MASQUERADE\n"
+             "-A tetherctrl_nat_POSTROUTING -o rmnet1 -j MASQUERADE\n"
+             "COMMIT\n"},
+            {V6,
+             "*filter\n"
+             "-A tetherctrl_counters -i usb0 -o rmnet1 -j RETURN\n"
+             "-A tetherctrl_counters -i rmnet1 -o usb0 -j RETURN\n"
+             "-A tetherctrl_counters -i wlan0 -o rmnet1 -j RETURN\n"
+             "-A tetherctrl_counters -i rmnet1 -o wlan0 -j RETURN\n"
+             "COMMIT\n"},
+    });
+
+    // Switching back doesn't add the counting rules again, and disableNat() sees the new state.
+    EXPECT_EQ(0, mTetherCtrl.setForwardingPairs({{"wlan0", "rmnet0"}}));
+    expectIptablesRestoreCommands({
+            {V4,
+             "*raw\n"
+             "-D tetherctrl_raw_PREROUTING -p tcp --dport 21 -i usb0 -j CT --helper ftp\n"
+             "-D tetherctrl_raw_PREROUTING -p tcp --dport 1723 -i usb0 -j CT --helper pptp\n"
+             "COMMIT\n"
+             "*filter\n"
+             "-D tetherctrl_FORWARD -i rmnet1 -o usb0 -m state --state ESTABLISHED,RELATED "
+             "-g tetherctrl_counters\n"
+             "-D tetherctrl_FORWARD -i usb0 -o rmnet1 -m state --state INVALID -j DROP\n"
+             "-D tetherctrl_FORWARD -i usb0 -o rmnet1 -g tetherctrl_counters\n"
+             "-D tetherctrl_FORWARD -i rmnet1 -o wlan0 -m state --state ESTABLISHED,RELATED "
+             "-g tetherctrl_counters\n"
+             "-D tetherctrl_FORWARD -i wlan0 -o rmnet1 -m state --state INVALID -j DROP\n"
+             "-D tetherctrl_FORWARD -i wlan0 -o rmnet1 -g tetherctrl_counters\n"
+             "-A tetherctrl_FORWARD -i rmnet0 -o wlan0 -m state --state ESTABLISHED,RELATED "
+             "-g tetherctrl_counters\n"
+             "-A tetherctrl_FORWARD -i wlan0 -o rmnet0 -m state --state INVALID -j DROP\n"
+             "-A tetherctrl_FORWARD -i wlan0 -o rmnet0 -g tetherctrl_counters\n"
+             "-D tetherctrl_FORWARD -j DROP\n"
+             "-A tetherctrl_FORWARD -j DROP\n"
+             "COMMIT\n"
+             "*nat\n"
+             "-D tetherctrl_nat_POSTROUTING -o rmnet1 -j MASQUERADE\n"
+             "-A tetherctrl_nat_POSTROUTING -o rmnet0 -j MASQUERADE\n"
+             "COMMIT\n"},
+            {V6,
+             "*raw\n"
+             "-D tetherctrl_raw_PREROUTING -i usb0 -m rpfilter --invert ! -s fe80::/64 -j DROP\n"
+             "COMMIT\n"},
+    });
+
+    ExpectedIptablesCommands stopLastNat = stopNatCommands("wlan0", "rmnet0");
+    appendAll(stopLastNat, FLUSH_COMMANDS);
+    mTetherCtrl.disableNat("wlan0", "rmnet0");
+    expectIptablesRestoreCommands(stopLastNat);
+
+    // Removing every pair flushes the chains, except for the IPv4 helper rules.
+    EXPECT_EQ(0, mTetherCtrl.enableNat("wlan0", "rmnet0"));
+    expectIptablesRestoreCommands(
+            allNewNatCommands("wlan0", "rmnet0", NO_COUNTERS, WITH_IPV6, true));
+    EXPECT_EQ(0, mTetherCtrl.setForwardingPairs({}));
+    expectIptablesRestoreCommands({
+            {V4,
+             "*raw\n"
+             "-D tetherctrl_raw_PREROUTING -p tcp --dport 21 -i wlan0 -j CT --helper ftp\n"
+             "-D tetherctrl_raw_PREROUTING -p tcp --dport 1723 -i wlan0 -j CT --helper pptp\n"
+             "COMMIT\n" + FLUSH_COMMANDS[0].second},
+            FLUSH_COMMANDS[1],
+    });
+}
+
+TEST_F(TetherControllerTest, TestUpstreamSwitchBenchmark) {
+    // Moves kNumDownstreams downstreams from one upstream to another, as happens when the default
+    // network changes, with enableNat()/disableNat() and with setForwardingPairs(). The iptables
+    // calls are faked, so the time taken is mostly building the commands. On a device every
+    // iptables-restore transaction is a round trip to the iptables-restore process, so the number
+    // of transactions is what matters.
+    constexpr int kNumDownstreams = 8;
+    constexpr int kNumSwitches = 100;
+
+    std::vector<std::string> downstreams;
+    for (int i = 0; i < kNumDownstreams; i++) {
+        downstreams.push_back(StringPrintf("rndis%d", i));
+    }
+    auto pairsOn = [&downstreams](const std::string& upstream) {
+        std::vector<TetherController::ForwardingPair> pairs;
+        for (const auto& downstream : downstreams) pairs.push_back({downstream, upstream});
+        return pairs;
+    };
+    auto countRules = [] {
+        size_t rules = 0;
+        for (const auto& [target, cmds] : sRestoreCmds) {
+            for (const auto& line : android::base::Split(cmds, "\n")) {
+                if (android::base::StartsWith(line, "-")) rules++;
+            }
+        }
+        return rules;
+    };
+
+    std::string upstream = "rmnet0";
+    for (const auto& downstream : downstreams) {
+        EXPECT_EQ(0, mTetherCtrl.enableNat(downstream.c_str(), upstream.c_str()));
+    }
+    sRestoreCmds.clear();
+
+    Stopwatch s;
+    for (int i = 0; i < kNumSwitches; i++) {
+        const std::string next = (upstream == "rmnet0") ? "rmnet1" : "rmnet0";
+        for (const auto& downstream : downstreams) {
+            EXPECT_EQ(0, mTetherCtrl.disableNat(downstream.c_str(), upstream.c_str()));
+            EXPECT_EQ(0, mTetherCtrl.enableNat(downstream.c_str(), next.c_str()));
+        }
+        upstream = next;
+    }
+    int64_t timeTaken = s.getTimeAndResetUs();
+    const size_t perPairTransactions = sRestoreCmds.size() / kNumSwitches;
+    std::cerr << "    Switch upstream of " << kNumDownstreams << " downstreams one pair at a time: "
+              << perPairTransactions << " transactions, " << countRules() / kNumSwitches
+              << " rules, " << timeTaken / kNumSwitches << "us per switch" << std::endl;
+    sRestoreCmds.clear();
+
+    s.getTimeAndResetUs();
+    for (int i = 0; i < kNumSwitches; i++) {
+        upstream = (upstream == "rmnet0") ? "rmnet1" : "rmnet0";
+        EXPECT_EQ(0, mTetherCtrl.setForwardingPairs(pairsOn(upstream)));
+    }
+    timeTaken = s.getTimeAndResetUs();
+    const size_t diffedTransactions = sRestoreCmds.size() / kNumSwitches;
+    std::cerr << "    Switch upstream of " << kNumDownstreams << " downstreams with one diff: "
+              << diffedTransactions << " transactions, " << countRules() / kNumSwitches
+              << " rules, " << timeTaken / kNumSwitches << "us per switch" << std::endl;
+    sRestoreCmds.clear();
+
+    // At most one IPv4 and one IPv6 transaction per switch. After the first switch there is
+    // nothing to change for IPv6, because the counting rules are never removed.
+    EXPECT_LE(diffedTransactions, 2U);
+    EXPECT_LT(diffedTransactions, perPairTransactions);
+
+    EXPECT_EQ(0, mTetherCtrl.setForwardingPairs({}));
+}
+
 std::string kTetherCounterHeaders = Join(std::vector<std::string> {
     "Chain tetherctrl_counters (4 references)",
     "    pkts      bytes target     prot opt in     out     source               destination",
@@ -438,5 +671,164 @@ TEST_F(TetherControllerTest, TestGetTetherStats) {
     EXPECT_TRUE(std::equal(expectedError.rbegin(), expectedError.rend(), err.rbegin()));
 }
 
+TEST_F(TetherControllerTest, TestGetTetherStatsDelta) {
+    // The first call returns the totals.
+    addIptablesRestoreOutput(kIPv4TetherCounters, kIPv6TetherCounters);
+    StatusOr<TetherStatsList> result = mTetherCtrl.getTetherStatsDelta();
+    ASSERT_TRUE(isOk(result));
+    ASSERT_EQ(2U, result.value().size());
+    expectTetherStatsEqual(TetherStats("wlan0", "rmnet0", 20002002, 20027, 10002373, 10026),
+                           result.value()[0]);
+    expectTetherStatsEqual(TetherStats("bt-pan", "rmnet0", 1708806, 1450, 107471, 1040),
+                           result.value()[1]);
+
+    // Nothing was forwarded.
+    addIptablesRestoreOutput(kIPv4TetherCounters, kIPv6TetherCounters);
+    result = mTetherCtrl.getTetherStatsDelta();
+    ASSERT_TRUE(isOk(result));
+    EXPECT_EQ(0U, result.value().size());
+
+    // Only bt-pan forwarded anything.
+    std::string ipv4Counters = Join(std::vector<std::string> {
+        "Chain tetherctrl_counters (4 references)",
+        "    pkts      bytes target     prot opt in     out     source               destination",
+        "      26     2373 RETURN     all  --  wlan0  rmnet0  0.0.0.0/0            0.0.0.0/0",
+        "      27     2002 RETURN     all  --  rmnet0 wlan0   0.0.0.0/0            0.0.0.0/0",
+        "    1050   108471 RETURN     all  --  bt-pan rmnet0  0.0.0.0/0            0.0.0.0/0",
+        "    1470  1728806 RETURN     all  --  rmnet0 bt-pan  0.0.0.0/0            0.0.0.0/0",
+    }, '\n');
+    addIptablesRestoreOutput(ipv4Counters, kIPv6TetherCounters);
+    result = mTetherCtrl.getTetherStatsDelta();
+    ASSERT_TRUE(isOk(result));
+    ASSERT_EQ(1U, result.value().size());
+    expectTetherStatsEqual(TetherStats("bt-pan", "rmnet0", 20000, 20, 1000, 10),
+                           result.value()[0]);
+
+    // The counters went down, e.g., because the rules were recreated.
+    addIptablesRestoreOutput(kIPv4TetherCounters, kTetherCounterHeaders);
+    result = mTetherCtrl.getTetherStatsDelta();
+    ASSERT_TRUE(isOk(result));
+    ASSERT_EQ(2U, result.value().size());
+    expectTetherStatsEqual(TetherStats("wlan0", "rmnet0", 2002, 27, 2373, 26), result.value()[0]);
+    expectTetherStatsEqual(TetherStats("bt-pan", "rmnet0", 1708806, 1450, 107471, 1040),
+                           result.value()[1]);
+
+    // Errors are passed on.
+    clearIptablesRestoreOutput();
+    EXPECT_FALSE(isOk(mTetherCtrl.getTetherStatsDelta()));
+}
+
+ipt_ip& entryIpFields(ipt_entry& entry) {
+    return entry.ip;
+}
+
+ip6t_ip6& entryIpFields(ip6t_entry& entry) {
+    return entry.ipv6;
+}
+
+// Builds a filter table in the format returned by IPT_SO_GET_ENTRIES or IP6T_SO_GET_ENTRIES.
+template <typename Entry>
+class FakeFilterTable {
+  public:
+    void addChain(const char* name) {
+        xt_error_target target = {};
+        strlcpy(target.target.u.user.name, XT_ERROR_TARGET, sizeof(target.target.u.user.name));
+        strlcpy(target.errorname, name, sizeof(target.errorname));
+        addEntry(Entry{}, &target, sizeof(target));
+    }
+
+    void addReturnRule(const char* in, const char* out, uint64_t packets, uint64_t bytes) {
+        Entry entry = {};
+        auto& ip = entryIpFields(entry);
+        strlcpy(ip.iniface, in, sizeof(ip.iniface));
+        strlcpy(ip.outiface, out, sizeof(ip.outiface));
+        entry.counters.pcnt = packets;
+        entry.counters.bcnt = bytes;
+        xt_standard_target target = {};
+        target.verdict = XT_RETURN;
+        addEntry(entry, &target, sizeof(target));
+    }
+
+    const uint8_t* data() const { return mTable.data(); }
+    size_t size() const { return mTable.size(); }
+
+  private:
+    void addEntry(Entry entry, const void* target, size_t targetSize) {
+        entry.target_offset = sizeof(Entry);
+        entry.next_offset = sizeof(Entry) + XT_ALIGN(targetSize);
+        const size_t offset = mTable.size();
+        mTable.resize(offset + entry.next_offset);
+        memcpy(&mTable[offset], &entry, sizeof(entry));
+        memcpy(&mTable[offset + sizeof(entry)], target, targetSize);
+        reinterpret_cast<xt_entry_target*>(&mTable[offset + sizeof(entry)])->u.target_size =
+                XT_ALIGN(targetSize);
+    }
+
+    std::vector<uint8_t> mTable;
+};
+
+TEST_F(TetherControllerTest, TestAddKernelForwardChainStats) {
+    FakeFilterTable<ipt_entry> ipv4;
+    // Rules in other chains are ignored.
+    ipv4.addReturnRule("wlan0", "rmnet0", 1, 100);
+    ipv4.addChain("tetherctrl_FORWARD");
+    ipv4.addReturnRule("wlan0", "rmnet0", 2, 200);
+    ipv4.addChain("tetherctrl_counters");
+    ipv4.addReturnRule("wlan0", "rmnet0", 26, 2373);
+    ipv4.addReturnRule("rmnet0", "wlan0", 27, 2002);
+    ipv4.addReturnRule("bt-pan", "rmnet0", 1040, 107471);
+    ipv4.addReturnRule("rmnet0", "bt-pan", 1450, 1708806);
+    // The RETURN at the end of the chain.
+    ipv4.addReturnRule("", "", 3, 300);
+    ipv4.addChain("tetherctrl_mangle_FORWARD");
+    ipv4.addReturnRule("rmnet0", "wlan0", 4, 400);
+    ipv4.addChain(XT_ERROR_TARGET);
+
+    // Counters don't wrap at 32 bits.
+    FakeFilterTable<ip6t_entry> ipv6;
+    ipv6.addChain("tetherctrl_counters");
+    ipv6.addReturnRule("wlan0", "rmnet0", 10000, 10000000000);
+    ipv6.addReturnRule("rmnet0", "wlan0", 20000, 20000000000);
+    ipv6.addReturnRule("", "", 0, 0);
+    ipv6.addChain(XT_ERROR_TARGET);
+
+    TetherStatsList statsList;
+    EXPECT_EQ(0, TetherController::addKernelForwardChainStats(statsList, V4, ipv4.data(),
+                                                              ipv4.size()));
+    EXPECT_EQ(0, TetherController::addKernelForwardChainStats(statsList, V6, ipv6.data(),
+                                                              ipv6.size()));
+    ASSERT_EQ(2U, statsList.size());
+    expectTetherStatsEqual(TetherStats("wlan0", "rmnet0", 20000002002, 20027, 10000002373, 10026),
+                           statsList[0]);
+    expectTetherStatsEqual(TetherStats("bt-pan", "rmnet0", 1708806, 1450, 107471, 1040),
+                           statsList[1]);
+
+    // A table without the chain is an error.
+    FakeFilterTable<ipt_entry> noChain;
+    noChain.addChain("tetherctrl_FORWARD");
+    noChain.addChain(XT_ERROR_TARGET);
+    statsList.clear();
+    EXPECT_EQ(-ENOENT, TetherController::addKernelForwardChainStats(statsList, V4, noChain.data(),
+                                                                    noChain.size()));
+
+    // As is finding only one side of a pair.
+    FakeFilterTable<ipt_entry> unpaired;
+    unpaired.addChain("tetherctrl_counters");
+    unpaired.addReturnRule("wlan0", "rmnet0", 26, 2373);
+    unpaired.addChain(XT_ERROR_TARGET);
+    EXPECT_EQ(-EREMOTEIO, TetherController::addKernelForwardChainStats(
+                                  statsList, V4, unpaired.data(), unpaired.size()));
+
+    // And a table that ends in the middle of the chain.
+    FakeFilterTable<ipt_entry> truncated;
+    truncated.addChain("tetherctrl_counters");
+    truncated.addReturnRule("wlan0", "rmnet0", 26, 2373);
+    truncated.addReturnRule("rmnet0", "wlan0", 27, 2002);
+    EXPECT_EQ(-EBADMSG, TetherController::addKernelForwardChainStats(
+                                statsList, V4, truncated.data(), truncated.size() - 1));
+    EXPECT_EQ(-EBADMSG, TetherController::addKernelForwardChainStats(
+                                statsList, V4, truncated.data(), truncated.size()));
+}
+
 }  // namespace net
 }  // namespace android
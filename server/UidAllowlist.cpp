@@ -0,0 +1,124 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "UidAllowlist"
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <thread>
+
+#include <log/log.h>
+
+#include "UidAllowlist.h"
+
+using android::netdutils::DumpWriter;
+
+namespace android {
+namespace net {
+
+void UidAllowlist::Table::addNetwork(unsigned netId, const std::optional<UidRanges>& allowedUids) {
+    if (!mNetworks.empty() && mNetworks.back().netId >= netId) {
+        ALOGE("Networks added out of order: %u after %u", netId, mNetworks.back().netId);
+        return;
+    }
+
+    const uint32_t begin = mRanges.size();
+    if (allowedUids) {
+        std::vector<std::pair<uid_t, uid_t>> ranges;
+        for (const auto& range : allowedUids->getRanges()) {
+            if (range.start < 0 || range.stop < range.start) continue;
+            ranges.emplace_back(range.start, range.stop);
+        }
+        std::sort(ranges.begin(), ranges.end());
+        for (const auto& [first, last] : ranges) {
+            // Ranges may overlap or be adjacent, but lookups need disjoint ranges.
+            if (mRanges.size() > begin && first <= mRanges.back().second + 1) {
+                mRanges.back().second = std::max(mRanges.back().second, last);
+            } else {
+                mRanges.emplace_back(first, last);
+            }
+        }
+    }
+    mNetworks.push_back({
+            .netId = netId,
+            .restricted = allowedUids.has_value(),
+            .begin = begin,
+            .end = static_cast<uint32_t>(mRanges.size()),
+    });
+}
+
+bool UidAllowlist::Table::isAllowed(unsigned netId, uid_t uid) const {
+    // Exempt when no netId is specified and there is no default network, so that apps or tests can
+    // do DNS lookups for hostnames in etc/hosts.
+    if (netId == NETID_UNSET && mDefaultNetId == NETID_UNSET) {
+        return true;
+    }
+
+    const auto network = std::lower_bound(
+            mNetworks.begin(), mNetworks.end(), netId,
+            [](const Network& network, unsigned netId) { return network.netId < netId; });
+    if (network == mNetworks.end() || network->netId != netId) return false;
+    if (!network->restricted) return true;
+
+    // The first range that ends at or after |uid|.
+    const auto begin = mRanges.begin() + network->begin;
+    const auto end = mRanges.begin() + network->end;
+    const auto range = std::lower_bound(
+            begin, end, uid,
+            [](const std::pair<uid_t, uid_t>& range, uid_t uid) { return range.second < uid; });
+    return range != end && range->first <= uid;
+}
+
+void UidAllowlist::publish(Table table) {
+    const uint64_t generation = mGeneration.load();
+    Slot& slot = mSlots[(generation + 1) % 2];
+
+    // Readers that entered this slot before the last publish() may still be reading it. Readers
+    // that enter it from now on see that the generation has changed since they picked it, and
+    // leave without reading.
+    while (slot.readers.load() != 0) {
+        std::this_thread::yield();
+    }
+    slot.table = std::move(table);
+    mGeneration.store(generation + 1);
+}
+
+bool UidAllowlist::isAllowed(unsigned netId, uid_t uid) const {
+    while (true) {
+        const uint64_t generation = mGeneration.load();
+        const Slot& slot = mSlots[generation % 2];
+        slot.readers.fetch_add(1);
+        // Both sides use sequentially consistent operations, so either publish() sees this reader,
+        // or this reader sees the new generation.
+        if (mGeneration.load() == generation) {
+            const bool allowed = slot.table.isAllowed(netId, uid);
+            slot.readers.fetch_sub(1);
+            return allowed;
+        }
+        slot.readers.fetch_sub(1);
+    }
+}
+
+void UidAllowlist::dump(DumpWriter& dw) const {
+    const uint64_t generation = mGeneration.load();
+    const Table& table = mSlots[generation % 2].table;
+    dw.println("UID allowlist: generation %" PRIu64 ", %zu networks, %zu allowed ranges",
+               generation, table.networks(), table.ranges());
+}
+
+}  // namespace net
+}  // namespace android
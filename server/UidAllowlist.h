@@ -0,0 +1,102 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "UidRanges.h"
+#include "netdutils/DumpWriter.h"
+#include "netid_client.h"  // NETID_UNSET
+
+namespace android {
+namespace net {
+
+// The networks that each UID may use, as set by NetworkController::setNetworkAllowlist(), in a form
+// that the resolver can check on every DNS query without taking NetworkController's lock.
+//
+// NetworkController builds a Table from its state under its write lock and publish()es it. Two
+// tables are kept, and the generation number selects the one that readers use. publish() fills the
+// other table once no reader is left in it, and then increments the generation. A reader announces
+// itself in the table that it is about to read, and only reads it if the generation has not changed
+// meanwhile, so isAllowed() never blocks and never waits for a writer.
+class UidAllowlist {
+  public:
+    class Table {
+      public:
+        // Adds a network. Networks must be added in increasing netId order. If |allowedUids| is
+        // not set, every UID may use the network.
+        void addNetwork(unsigned netId, const std::optional<UidRanges>& allowedUids);
+        void setDefaultNetwork(unsigned netId) { mDefaultNetId = netId; }
+
+        // Same as NetworkController::isUidAllowed().
+        bool isAllowed(unsigned netId, uid_t uid) const;
+
+        size_t networks() const { return mNetworks.size(); }
+        size_t ranges() const { return mRanges.size(); }
+
+      private:
+        struct Network {
+            unsigned netId;
+            bool restricted;
+            // The allowed UIDs are mRanges[begin, end).
+            uint32_t begin;
+            uint32_t end;
+        };
+
+        std::vector<Network> mNetworks;
+        // The allowed UID ranges of every network, sorted and merged within each network.
+        std::vector<std::pair<uid_t, uid_t>> mRanges;
+        unsigned mDefaultNetId = NETID_UNSET;
+    };
+
+    UidAllowlist() = default;
+    UidAllowlist(const UidAllowlist&) = delete;
+    UidAllowlist& operator=(const UidAllowlist&) = delete;
+
+    // Replaces the table that isAllowed() uses. Calls must be serialized by the caller. Yields
+    // until every reader has left the table that is replaced, which readers leave after a single
+    // lookup.
+    void publish(Table table);
+
+    // Returns whether |uid| may use |netId| according to the last published table. Lock-free, and
+    // safe to call concurrently with publish().
+    bool isAllowed(unsigned netId, uid_t uid) const;
+
+    uint64_t generation() const { return mGeneration.load(); }
+
+    // Must not be called concurrently with publish().
+    void dump(netdutils::DumpWriter& dw) const;
+
+  private:
+    struct Slot {
+        Table table;
+        mutable std::atomic<uint32_t> readers = 0;
+    };
+
+    // mSlots[mGeneration % 2] is the table that readers use.
+    Slot mSlots[2];
+    std::atomic<uint64_t> mGeneration = 0;
+};
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * UidAllowlistTest.cpp - unit tests for UidAllowlist.cpp
+ */
+
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <netdutils/NetNativeTestBase.h>
+
+#include "UidAllowlist.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+constexpr unsigned kNetId = 100;
+constexpr unsigned kOtherNetId = 101;
+
+UidRanges makeRanges(const std::vector<std::pair<int32_t, int32_t>>& ranges) {
+    std::vector<UidRangeParcel> parcels;
+    for (const auto& [start, stop] : ranges) {
+        UidRangeParcel& parcel = parcels.emplace_back();
+        parcel.start = start;
+        parcel.stop = stop;
+    }
+    return UidRanges(parcels);
+}
+
+}  // namespace
+
+class UidAllowlistTest : public NetNativeTestBase {};
+
+TEST_F(UidAllowlistTest, EmptyTable) {
+    UidAllowlist allowlist;
+    EXPECT_EQ(0U, allowlist.generation());
+    // Lookups without a network are allowed while there is no default network.
+    EXPECT_TRUE(allowlist.isAllowed(NETID_UNSET, 10000));
+    EXPECT_FALSE(allowlist.isAllowed(kNetId, 10000));
+}
+
+TEST_F(UidAllowlistTest, Networks) {
+    UidAllowlist::Table table;
+    table.addNetwork(kNetId, std::nullopt);
+    table.addNetwork(kOtherNetId, makeRanges({{10000, 10099}}));
+    table.setDefaultNetwork(kNetId);
+
+    UidAllowlist allowlist;
+    allowlist.publish(std::move(table));
+    EXPECT_EQ(1U, allowlist.generation());
+
+    // A network without an allowlist allows every UID.
+    EXPECT_TRUE(allowlist.isAllowed(kNetId, 0));
+    EXPECT_TRUE(allowlist.isAllowed(kNetId, 20000));
+    EXPECT_TRUE(allowlist.isAllowed(kOtherNetId, 10000));
+    EXPECT_TRUE(allowlist.isAllowed(kOtherNetId, 10099));
+    EXPECT_FALSE(allowlist.isAllowed(kOtherNetId, 9999));
+    EXPECT_FALSE(allowlist.isAllowed(kOtherNetId, 10100));
+    // Unknown networks allow nothing, and neither does NETID_UNSET once there is a default network.
+    EXPECT_FALSE(allowlist.isAllowed(kOtherNetId + 1, 10000));
+    EXPECT_FALSE(allowlist.isAllowed(NETID_UNSET, 10000));
+
+    // An empty allowlist allows nothing.
+    table = UidAllowlist::Table();
+    table.addNetwork(kNetId, UidRanges());
+    allowlist.publish(std::move(table));
+    EXPECT_EQ(2U, allowlist.generation());
+    EXPECT_FALSE(allowlist.isAllowed(kNetId, 10000));
+    EXPECT_TRUE(allowlist.isAllowed(NETID_UNSET, 10000));
+}
+
+TEST_F(UidAllowlistTest, OverlappingRanges) {
+    UidAllowlist::Table table;
+    // Unsorted, overlapping and adjacent ranges.
+    table.addNetwork(kNetId, makeRanges({{10050, 10060}, {10000, 10099}, {10100, 10199},
+                                         {0, 0}, {20000, 20000}, {19000, 19500}}));
+    UidAllowlist allowlist;
+    allowlist.publish(std::move(table));
+
+    for (uid_t uid : {0U, 10000U, 10055U, 10099U, 10100U, 10199U, 19000U, 19500U, 20000U}) {
+        EXPECT_TRUE(allowlist.isAllowed(kNetId, uid)) << uid;
+    }
+    for (uid_t uid :
+         {1U, 9999U, 10200U, 18999U, 19501U, 19999U, 20001U, 0x80000000U, 0xffffffffU}) {
+        EXPECT_FALSE(allowlist.isAllowed(kNetId, uid)) << uid;
+    }
+}
+
+TEST_F(UidAllowlistTest, PublishWhileReading) {
+    // Every table allows the same UIDs on kNetId, but has a different number of other networks,
+    // so a reader that reads a table that is being replaced would see the wrong answer or crash.
+    auto makeTable = [](int otherNetworks) {
+        UidAllowlist::Table table;
+        table.addNetwork(kNetId, makeRanges({{10000, 10999}}));
+        for (int i = 1; i <= otherNetworks; i++) {
+            table.addNetwork(kNetId + i, std::nullopt);
+        }
+        return table;
+    };
+
+    UidAllowlist allowlist;
+    allowlist.publish(makeTable(0));
+    std::atomic<bool> stop = false;
+    std::atomic<int> wrong = 0;
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&allowlist, &stop, &wrong] {
+            for (uid_t uid = 0; !stop; uid = (uid + 7) % 12000) {
+                if (allowlist.isAllowed(kNetId, uid) != (10000 <= uid && uid <= 10999)) wrong++;
+            }
+        });
+    }
+    for (int i = 1; i <= 1000; i++) {
+        allowlist.publish(makeTable(i % 100));
+    }
+    stop = true;
+    for (auto& reader : readers) reader.join();
+
+    EXPECT_EQ(1001U, allowlist.generation());
+    EXPECT_EQ(0, wrong);
+}
+
+}  // namespace net
+}  // namespace android
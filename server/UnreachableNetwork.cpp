@@ -26,7 +26,7 @@ namespace net {
 // The unreachable network is used to reject traffic. It is used for system purposes only.
 UnreachableNetwork::UnreachableNetwork(unsigned netId) : Network(netId) {}
 
-int UnreachableNetwork::addUsers(const UidRanges& uidRanges, int32_t subPriority) {
+int UnreachableNetwork::applyAddUsers(const UidRanges& uidRanges, int32_t subPriority) const {
     if (!isValidSubPriority(subPriority) || !canAddUidRanges(uidRanges)) {
         return -EINVAL;
     }
@@ -36,11 +36,11 @@ int UnreachableNetwork::addUsers(const UidRanges& uidRanges, int32_t subPriority
         ALOGE("failed to add users to unreachable network");
         return ret;
     }
-    addToUidRangeMap(uidRanges, subPriority);
     return 0;
 }
 
-int UnreachableNetwork::removeUsers(const UidRanges& uidRanges, int32_t subPriority) {
+int UnreachableNetwork::applyRemoveUsers(const UidRanges& uidRanges,
+                                         int32_t subPriority) const {
     if (!isValidSubPriority(subPriority)) return -EINVAL;
 
     int ret =
@@ -49,11 +49,10 @@ int UnreachableNetwork::removeUsers(const UidRanges& uidRanges, int32_t subPrior
         ALOGE("failed to remove users from unreachable network");
         return ret;
     }
-    removeFromUidRangeMap(uidRanges, subPriority);
     return 0;
 }
 
-bool UnreachableNetwork::isValidSubPriority(int32_t priority) {
+bool UnreachableNetwork::isValidSubPriority(int32_t priority) const {
     return priority >= UidRanges::SUB_PRIORITY_HIGHEST &&
            priority <= UidRanges::SUB_PRIORITY_LOWEST;
 }
@@ -24,14 +24,15 @@ class UnreachableNetwork : public Network {
   public:
     explicit UnreachableNetwork(unsigned netId);
     Permission getPermission() const { return PERMISSION_SYSTEM; };
-    [[nodiscard]] int addUsers(const UidRanges& uidRanges, int32_t subPriority) override;
-    [[nodiscard]] int removeUsers(const UidRanges& uidRanges, int32_t subPriority) override;
+    [[nodiscard]] int applyAddUsers(const UidRanges& uidRanges, int32_t subPriority) const override;
+    [[nodiscard]] int applyRemoveUsers(const UidRanges& uidRanges,
+                                       int32_t subPriority) const override;
     bool isUnreachable() override { return true; }
     bool canAddUsers() override { return true; }
 
   private:
     std::string getTypeString() const override { return "UNREACHABLE"; };
-    bool isValidSubPriority(int32_t priority) override;
+    bool isValidSubPriority(int32_t priority) const override;
 };
 
 }  // namespace android::net
\ No newline at end of file
@@ -32,7 +32,7 @@ VirtualNetwork::VirtualNetwork(unsigned netId, bool secure, bool excludeLocalRou
 
 VirtualNetwork::~VirtualNetwork() {}
 
-int VirtualNetwork::addUsers(const UidRanges& uidRanges, int32_t subPriority) {
+int VirtualNetwork::applyAddUsers(const UidRanges& uidRanges, int32_t subPriority) const {
     if (!isValidSubPriority(subPriority) || !canAddUidRanges(uidRanges)) {
         return -EINVAL;
     }
@@ -46,11 +46,10 @@ int VirtualNetwork::addUsers(const UidRanges& uidRanges, int32_t subPriority) {
             return ret;
         }
     }
-    addToUidRangeMap(uidRanges, subPriority);
     return 0;
 }
 
-int VirtualNetwork::removeUsers(const UidRanges& uidRanges, int32_t subPriority) {
+int VirtualNetwork::applyRemoveUsers(const UidRanges& uidRanges, int32_t subPriority) const {
     if (!isValidSubPriority(subPriority)) return -EINVAL;
 
     for (const std::string& interface : mInterfaces) {
@@ -62,11 +61,10 @@ int VirtualNetwork::removeUsers(const UidRanges& uidRanges, int32_t subPriority)
             return ret;
         }
     }
-    removeFromUidRangeMap(uidRanges, subPriority);
     return 0;
 }
 
-int VirtualNetwork::addInterface(const std::string& interface) {
+int VirtualNetwork::applyAddInterface(const std::string& interface) const {
     if (hasInterface(interface)) {
         return 0;
     }
@@ -75,11 +73,10 @@ int VirtualNetwork::addInterface(const std::string& interface) {
         ALOGE("failed to add interface %s to VPN netId %u", interface.c_str(), mNetId);
         return ret;
     }
-    mInterfaces.insert(interface);
     return 0;
 }
 
-int VirtualNetwork::removeInterface(const std::string& interface) {
+int VirtualNetwork::applyRemoveInterface(const std::string& interface) const {
     if (!hasInterface(interface)) {
         return 0;
     }
@@ -88,11 +85,10 @@ int VirtualNetwork::removeInterface(const std::string& interface) {
         ALOGE("failed to remove interface %s from VPN netId %u", interface.c_str(), mNetId);
         return ret;
     }
-    mInterfaces.erase(interface);
     return 0;
 }
 
-bool VirtualNetwork::isValidSubPriority(int32_t priority) {
+bool VirtualNetwork::isValidSubPriority(int32_t priority) const {
     // Only supports default subsidiary permissions.
     return priority == UidRanges::SUB_PRIORITY_HIGHEST;
 }
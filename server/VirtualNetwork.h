@@ -36,18 +36,20 @@ public:
   explicit VirtualNetwork(unsigned netId, bool secure, bool excludeLocalRoutes = false);
   virtual ~VirtualNetwork();
   Permission getPermission() const { return PERMISSION_SYSTEM; };
-  [[nodiscard]] int addUsers(const UidRanges& uidRanges, int32_t subPriority) override;
-  [[nodiscard]] int removeUsers(const UidRanges& uidRanges, int32_t subPriority) override;
+  [[nodiscard]] int applyAddUsers(const UidRanges& uidRanges, int32_t subPriority) const override;
+  [[nodiscard]] int applyRemoveUsers(const UidRanges& uidRanges,
+                                     int32_t subPriority) const override;
   bool isVirtual() override { return true; }
   bool canAddUsers() override { return true; }
+  bool getExcludeLocalRoutes() const { return mExcludeLocalRoutes; }
 
 private:
   std::string getTypeString() const override { return "VIRTUAL"; };
-  [[nodiscard]] int addInterface(const std::string& interface) override;
-  [[nodiscard]] int removeInterface(const std::string& interface) override;
-  bool isValidSubPriority(int32_t priority) override;
+  [[nodiscard]] int applyAddInterface(const std::string& interface) const override;
+  [[nodiscard]] int applyRemoveInterface(const std::string& interface) const override;
+  bool isValidSubPriority(int32_t priority) const override;
   // Whether the local traffic will be excluded from the VPN network.
-  [[maybe_unused]] const bool mExcludeLocalRoutes;
+  const bool mExcludeLocalRoutes;
 };
 
 }  // namespace android::net
@@ -14,20 +14,25 @@
  * limitations under the License.
  */
 
+#include <linux/if_ether.h>
 #include <linux/netfilter/nfnetlink_log.h>
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/tcp.h>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <netdutils/Netlink.h>
 
 #include "NetlinkManager.h"
 #include "WakeupController.h"
+#include "nflog_corpus.h"
 
+using ::testing::Mock;
 using ::testing::StrictMock;
 using ::testing::Test;
 using ::testing::DoAll;
@@ -281,6 +286,41 @@ TEST_F(WakeupControllerTest, unterminatedString) {
     mMessageHandler(msg.nlmsg, msg.nfmsg, payload);
 }
 
+TEST_F(WakeupControllerTest, corpus) {
+    constexpr int kNFLogPacketMsgType = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET;
+
+    for (const NFLogPacket& packet : makeNFLogPackets()) {
+        SCOPED_TRACE(testing::Message() << packet.srcIp << " proto " << int(packet.protocol)
+                                        << " copy " << packet.copyRange << " payload "
+                                        << (packet.payloadFirst ? "first" : "last"));
+        const size_t ipHeaderLength = (packet.family == AF_INET) ? sizeof(iphdr) : sizeof(ip6_hdr);
+        const bool hasIpHeader = packet.copyRange >= ipHeaderLength;
+        const bool hasPorts = packet.copyRange >= packet.headerLength();
+        const int ethertype = (packet.family == AF_INET) ? ETH_P_IP : ETH_P_IPV6;
+        // The timestamp is not checked: WakeupController does not parse the 64-bit seconds and
+        // microseconds that the kernel sends correctly.
+        EXPECT_CALL(mEventListener,
+                    onWakeupEvent(packet.prefix, packet.uid, ethertype,
+                                  hasIpHeader ? packet.protocol : -1, packet.hwAddr,
+                                  hasIpHeader ? packet.srcIp : "", hasIpHeader ? packet.dstIp : "",
+                                  hasPorts ? packet.srcPort : -1, hasPorts ? packet.dstPort : -1,
+                                  _));
+
+        std::vector<uint8_t> batch;
+        appendNFLogPacket(NetlinkManager::NFLOG_WAKEUP_GROUP, packet, &batch);
+        appendNFLogDone(&batch);
+        netdutils::forEachNetlinkMessage(
+                netdutils::Slice(batch.data(), batch.size()),
+                [this](const nlmsghdr& nlmsg, const netdutils::Slice msg) {
+                    if (nlmsg.nlmsg_type != kNFLogPacketMsgType) return;
+                    nfgenmsg nfmsg = {};
+                    extract(msg, nfmsg);
+                    mMessageHandler(nlmsg, nfmsg, drop(msg, sizeof(nfmsg)));
+                });
+        Mock::VerifyAndClearExpectations(&mEventListener);
+    }
+}
+
 TEST_F(WakeupControllerTest, addInterface) {
     const char kPrefix[] = "test:prefix";
     const char kIfName[] = "wlan8";
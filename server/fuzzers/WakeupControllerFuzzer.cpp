@@ -0,0 +1,93 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Feeds NFLOG batches through NFLogListener to WakeupController.
+//
+// Half of the inputs are built from the packets in nflog_corpus.h, also used by
+// netd_wakeup_benchmark, with a fuzzed copy range, attribute order and number of packets per
+// batch, and then a few corrupted bytes. The other half are delivered as they are, which covers
+// malformed netlink message and attribute lengths.
+
+#include <fuzzer/FuzzedDataProvider.h>
+
+#include <memory>
+#include <vector>
+
+#include <netdutils/Slice.h>
+
+#include "NFLogListener.h"
+#include "NetlinkManager.h"
+#include "WakeupController.h"
+#include "nflog_corpus.h"
+
+using android::net::appendNFLogDone;
+using android::net::appendNFLogPacket;
+using android::net::makeNFLogPackets;
+using android::net::NetlinkManager;
+using android::net::NFLogListener;
+using android::net::NFLogPacket;
+using android::net::ReplayNetlinkListener;
+using android::net::WakeupController;
+using android::netdutils::Slice;
+
+namespace {
+
+constexpr size_t kMaxPacketsPerBatch = 32;
+constexpr size_t kMaxCorruptedBytes = 8;
+
+// Longer than any packet in the corpus.
+constexpr uint32_t kMaxCopyRange = 2048;
+
+std::vector<uint8_t> makeBatch(FuzzedDataProvider& provider) {
+    static const std::vector<NFLogPacket> kPackets = makeNFLogPackets();
+
+    std::vector<uint8_t> batch;
+    const size_t numPackets = provider.ConsumeIntegralInRange<size_t>(1, kMaxPacketsPerBatch);
+    for (size_t i = 0; i < numPackets && provider.remaining_bytes() > 0; i++) {
+        NFLogPacket packet =
+                kPackets[provider.ConsumeIntegralInRange<size_t>(0, kPackets.size() - 1)];
+        if (provider.ConsumeBool()) {
+            packet.copyRange = provider.ConsumeIntegralInRange<uint32_t>(0, kMaxCopyRange);
+            packet.payloadFirst = provider.ConsumeBool();
+        }
+        appendNFLogPacket(NetlinkManager::NFLOG_WAKEUP_GROUP, packet, &batch);
+    }
+    appendNFLogDone(&batch);
+
+    const size_t numCorrupted = provider.ConsumeIntegralInRange<size_t>(0, kMaxCorruptedBytes);
+    for (size_t i = 0; i < numCorrupted; i++) {
+        const size_t offset = provider.ConsumeIntegralInRange<size_t>(0, batch.size() - 1);
+        batch[offset] = provider.ConsumeIntegral<uint8_t>();
+    }
+    batch.resize(provider.ConsumeIntegralInRange<size_t>(0, batch.size()));
+    return batch;
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    FuzzedDataProvider provider(data, size);
+    std::vector<uint8_t> batch = provider.ConsumeBool() ? makeBatch(provider)
+                                                        : provider.ConsumeRemainingBytes<uint8_t>();
+
+    const auto netlinkListener = std::make_shared<ReplayNetlinkListener>();
+    NFLogListener nfLogListener(netlinkListener);
+    WakeupController controller([](const WakeupController::ReportArgs&) {}, nullptr);
+    if (!isOk(controller.init(&nfLogListener))) return 0;
+
+    netlinkListener->replay(Slice(batch.data(), batch.size()));
+    return 0;
+}
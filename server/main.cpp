@@ -191,8 +191,8 @@ int main() {
     }
 
     FwmarkServer fwmarkServer(&gCtls->netCtrl, &gCtls->eventReporter);
-    if (fwmarkServer.startListener()) {
-        ALOGE("Unable to start FwmarkServer (%s)", strerror(errno));
+    if (int ret = fwmarkServer.start()) {
+        ALOGE("Unable to start FwmarkServer (%s)", strerror(-ret));
         exit(1);
     }
 
@@ -14,8 +14,10 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "NdcDispatcher.h"
 
@@ -23,9 +25,42 @@ namespace {
 
 void usage(char* progname) {
     fprintf(stderr, "Usage: %s (<cmd> [arg ...])\n", progname);
+    fprintf(stderr, "       %s batch [-0] [<file>|-]\n", progname);
     exit(1);
 }
 
+// ndc batch [-0] [<file>|-]
+//
+// Runs the commands in <file>, or on stdin, with one connection to netd. See
+// NdcDispatcher::dispatchBatch() for the format. Exits with 1 if any command failed.
+int runBatch(char* progname, int argc, char** argv) {
+    bool nulSeparated = false;
+    if (argc > 0 && !strcmp(argv[0], "-0")) {
+        nulSeparated = true;
+        argc--;
+        argv++;
+    }
+    if (argc > 1) {
+        usage(progname);
+    }
+
+    FILE* script = stdin;
+    if (argc == 1 && strcmp(argv[0], "-") != 0) {
+        script = fopen(argv[0], "re");
+        if (script == nullptr) {
+            fprintf(stderr, "Cannot open %s: %s\n", argv[0], strerror(errno));
+            return 1;
+        }
+    }
+
+    android::net::NdcDispatcher nd;
+    const int failed = nd.dispatchBatch(script, nulSeparated);
+    if (script != stdin) {
+        fclose(script);
+    }
+    return failed == 0 ? 0 : 1;
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -33,6 +68,10 @@ int main(int argc, char** argv) {
         usage(argv[0]);
     }
 
+    if (!strcmp(argv[1], "batch")) {
+        exit(runBatch(argv[0], argc - 2, argv + 2));
+    }
+
     android::net::NdcDispatcher nd;
     exit(nd.dispatchCommand(argc - 1, argv + 1));
 }
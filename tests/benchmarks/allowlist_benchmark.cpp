@@ -0,0 +1,142 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput of the network allowlist check that the resolver makes through the
+ * evaluate_domain_name callback on every DNS query, i.e., NetworkController::isUidAllowed(), which
+ * looks up the UidAllowlist published by NetworkController.
+ *
+ * Each benchmark reports:
+ *
+ *   lookups  Allowlist lookups per second, across all threads.
+ *
+ * allowlistLookup/N/R looks up random UIDs on N restricted networks that each allow R disjoint UID
+ * ranges, from 1 to 8 threads. allowlistLookupWhilePublishing does the same while another thread
+ * publishes a new table as fast as it can, which is far more often than setNetworkAllowlist() is
+ * ever called, and also reports:
+ *
+ *   publishes  Tables published per second.
+ */
+
+#include <stdint.h>
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "UidAllowlist.h"
+
+namespace android {
+namespace net {
+namespace {
+
+constexpr unsigned kFirstNetId = 100;
+constexpr uid_t kFirstUid = 10000;
+constexpr uid_t kUidsPerRange = 100;
+
+UidAllowlist::Table makeTable(int networks, int ranges) {
+    UidAllowlist::Table table;
+    table.setDefaultNetwork(kFirstNetId);
+    for (int i = 0; i < networks; i++) {
+        std::vector<UidRangeParcel> parcels;
+        // Every other block of kUidsPerRange UIDs is allowed.
+        for (int j = 0; j < ranges; j++) {
+            UidRangeParcel& parcel = parcels.emplace_back();
+            parcel.start = kFirstUid + 2 * j * kUidsPerRange;
+            parcel.stop = parcel.start + kUidsPerRange - 1;
+        }
+        table.addNetwork(kFirstNetId + i, UidRanges(parcels));
+    }
+    return table;
+}
+
+void lookup(benchmark::State& state, const UidAllowlist& allowlist) {
+    const int networks = state.range(0);
+    const int ranges = state.range(1);
+    std::mt19937 random(state.thread_index());
+    std::uniform_int_distribution<unsigned> netIds(kFirstNetId, kFirstNetId + networks - 1);
+    std::uniform_int_distribution<uid_t> uids(kFirstUid, kFirstUid + 2 * ranges * kUidsPerRange);
+
+    // Generate the queries up front, so that the random number generator is not measured.
+    std::vector<std::pair<unsigned, uid_t>> queries(1024);
+    for (auto& [netId, uid] : queries) {
+        netId = netIds(random);
+        uid = uids(random);
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+        const auto& [netId, uid] = queries[i++ % queries.size()];
+        benchmark::DoNotOptimize(allowlist.isAllowed(netId, uid));
+    }
+    state.counters["lookups"] =
+            benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+
+UidAllowlist sAllowlist;
+
+void allowlistLookup(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        sAllowlist.publish(makeTable(state.range(0), state.range(1)));
+    }
+    lookup(state, sAllowlist);
+}
+BENCHMARK(allowlistLookup)
+        ->ArgsProduct({{1, 8, 64}, {1, 16, 256}})
+        ->ThreadRange(1, 8)
+        ->UseRealTime();
+
+void allowlistLookupWhilePublishing(benchmark::State& state) {
+    static std::atomic<bool> sStop;
+    static std::thread sPublisher;
+    static std::atomic<uint64_t> sPublishes;
+
+    const int networks = state.range(0);
+    const int ranges = state.range(1);
+    if (state.thread_index() == 0) {
+        sAllowlist.publish(makeTable(networks, ranges));
+        sStop = false;
+        sPublishes = 0;
+        sPublisher = std::thread([networks, ranges] {
+            const UidAllowlist::Table table = makeTable(networks, ranges);
+            while (!sStop) {
+                sAllowlist.publish(table);
+                sPublishes++;
+            }
+        });
+    }
+
+    lookup(state, sAllowlist);
+
+    if (state.thread_index() == 0) {
+        sStop = true;
+        sPublisher.join();
+        state.counters["publishes"] =
+                benchmark::Counter(sPublishes.load(), benchmark::Counter::kIsRate);
+    }
+}
+BENCHMARK(allowlistLookupWhilePublishing)
+        ->Args({8, 16})
+        ->ThreadRange(1, 8)
+        ->UseRealTime();
+
+}  // namespace
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,288 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "benchmark_compare.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <utility>
+
+#include <json/json.h>
+
+namespace android {
+namespace net {
+
+namespace {
+
+// MAD of a normal distribution times this is its standard deviation.
+constexpr double kMadToStddev = 1.4826;
+
+std::optional<double> unitToNs(const std::string& unit) {
+    if (unit.empty() || unit == "ns") return 1;
+    if (unit == "us") return 1e3;
+    if (unit == "ms") return 1e6;
+    if (unit == "s") return 1e9;
+    return std::nullopt;
+}
+
+std::string runName(const Json::Value& run) {
+    const Json::Value& runName = run["run_name"];
+    return runName.isString() ? runName.asString() : run["name"].asString();
+}
+
+}  // namespace
+
+bool parseBenchmarkReport(const std::string& json, const std::string& metric,
+                          BenchmarkReport* report, std::string* error) {
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    Json::Value root;
+    std::string parseErrors;
+    if (!reader->parse(json.data(), json.data() + json.size(), &root, &parseErrors)) {
+        *error = parseErrors;
+        return false;
+    }
+    if (!root.isObject() || !root["benchmarks"].isArray()) {
+        *error = "no \"benchmarks\" array";
+        return false;
+    }
+
+    // Medians of benchmarks that only appear as aggregates, e.g., because the report was filtered
+    // with --benchmark_report_aggregates_only.
+    BenchmarkReport medians;
+    for (const Json::Value& run : root["benchmarks"]) {
+        if (!run.isObject()) {
+            *error = "benchmark is not an object";
+            return false;
+        }
+        const std::string name = runName(run);
+        const std::string runType = run.get("run_type", "iteration").asString();
+        const bool isMedian =
+                runType == "aggregate" && run["aggregate_name"].asString() == "median";
+        if (runType != "iteration" && !isMedian) continue;
+
+        BenchmarkSamples& samples = isMedian ? medians[name] : (*report)[name];
+        if (run["error_occurred"].asBool()) {
+            samples.error = run.get("error_message", "error").asString();
+            continue;
+        }
+        const std::optional<double> scale = unitToNs(run["time_unit"].asString());
+        if (!scale) {
+            *error = name + ": unknown time unit " + run["time_unit"].asString();
+            return false;
+        }
+        if (!run[metric].isNumeric()) {
+            *error = name + ": no " + metric;
+            return false;
+        }
+        samples.ns.push_back(run[metric].asDouble() * *scale);
+    }
+    for (auto& [name, samples] : medians) {
+        report->try_emplace(name, std::move(samples));
+    }
+    return true;
+}
+
+double median(std::vector<double> values) {
+    if (values.empty()) return 0;
+    const size_t middle = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    if (values.size() % 2) return values[middle];
+    const double upper = values[middle];
+    const double lower = *std::max_element(values.begin(), values.begin() + middle);
+    return (lower + upper) / 2;
+}
+
+double medianAbsoluteDeviation(const std::vector<double>& values) {
+    const double center = median(values);
+    std::vector<double> deviations;
+    deviations.reserve(values.size());
+    for (double value : values) {
+        deviations.push_back(std::abs(value - center));
+    }
+    return kMadToStddev * median(std::move(deviations));
+}
+
+double mannWhitneyPValue(const std::vector<double>& a, const std::vector<double>& b) {
+    const double n1 = a.size();
+    const double n2 = b.size();
+    const double n = n1 + n2;
+    if (a.empty() || b.empty()) return 1;
+
+    // Rank both samples together. Tied values all get the average of their ranks.
+    std::vector<std::pair<double, bool>> all;
+    all.reserve(a.size() + b.size());
+    for (double value : a) all.emplace_back(value, true);
+    for (double value : b) all.emplace_back(value, false);
+    std::sort(all.begin(), all.end());
+
+    double rankSumA = 0;
+    double tieCorrection = 0;
+    for (size_t i = 0; i < all.size();) {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first) j++;
+        const double ties = j - i;
+        const double rank = (i + 1 + j) / 2.0;
+        for (size_t k = i; k < j; k++) {
+            if (all[k].second) rankSumA += rank;
+        }
+        tieCorrection += ties * ties * ties - ties;
+        i = j;
+    }
+
+    const double u = rankSumA - n1 * (n1 + 1) / 2;
+    const double mean = n1 * n2 / 2;
+    const double variance = n1 * n2 / 12 * ((n + 1) - tieCorrection / (n * (n - 1)));
+    if (variance <= 0) return 1;
+    const double z = std::max(0.0, std::abs(u - mean) - 0.5) / std::sqrt(variance);
+    return std::min(1.0, std::erfc(z / std::sqrt(2.0)));
+}
+
+const char* verdictName(Comparison::Verdict verdict) {
+    switch (verdict) {
+        case Comparison::SAME:
+            return "SAME";
+        case Comparison::FASTER:
+            return "FASTER";
+        case Comparison::SLOWER:
+            return "SLOWER";
+        case Comparison::REGRESSION:
+            return "REGRESSION";
+        case Comparison::OVER_BUDGET:
+            return "OVER_BUDGET";
+        case Comparison::FAILED:
+            return "FAILED";
+        case Comparison::ADDED:
+            return "ADDED";
+        case Comparison::REMOVED:
+            return "REMOVED";
+    }
+    return "?";
+}
+
+namespace {
+
+Comparison compare(const std::string& name, const BenchmarkSamples* oldSamples,
+                   const BenchmarkSamples* newSamples, const CompareOptions& options) {
+    Comparison result = {.name = name, .verdict = Comparison::SAME};
+    if (oldSamples) {
+        result.oldSamples = oldSamples->ns.size();
+        result.oldMedian = median(oldSamples->ns);
+        result.oldMad = medianAbsoluteDeviation(oldSamples->ns);
+    }
+    if (newSamples) {
+        result.newSamples = newSamples->ns.size();
+        result.newMedian = median(newSamples->ns);
+        result.newMad = medianAbsoluteDeviation(newSamples->ns);
+    }
+
+    if (!newSamples) {
+        result.verdict = Comparison::REMOVED;
+        return result;
+    }
+    if (!newSamples->error.empty() || newSamples->ns.empty()) {
+        result.verdict = Comparison::FAILED;
+        result.error = newSamples->error;
+        return result;
+    }
+
+    std::optional<double> maxIncrease;
+    std::optional<double> budgetNs;
+    for (const CompareOptions::Rule& rule : options.rules) {
+        if (!std::regex_search(name, rule.pattern)) continue;
+        if (!maxIncrease) maxIncrease = rule.maxIncrease;
+        if (!budgetNs) budgetNs = rule.budgetNs;
+    }
+
+    // A budget applies even if there is nothing to compare against.
+    if (budgetNs && result.newMedian > *budgetNs) {
+        result.verdict = Comparison::OVER_BUDGET;
+        return result;
+    }
+    if (!oldSamples || !oldSamples->error.empty() || oldSamples->ns.empty()) {
+        result.verdict = Comparison::ADDED;
+        return result;
+    }
+
+    const double delta = result.newMedian - result.oldMedian;
+    if (result.oldMedian > 0) {
+        result.change = delta / result.oldMedian;
+    } else if (delta > 0) {
+        result.change = std::numeric_limits<double>::infinity();
+    }
+
+    bool significant;
+    if (result.oldSamples >= kMinUTestSamples && result.newSamples >= kMinUTestSamples) {
+        result.pValue = mannWhitneyPValue(oldSamples->ns, newSamples->ns);
+        significant = *result.pValue < options.alpha;
+    } else {
+        // With a single run on each side there is no estimate of the noise at all, and every
+        // change counts. The threshold still has to be exceeded for a regression.
+        const double noise = std::max(result.oldMad, result.newMad);
+        significant = std::abs(delta) > kMinMadsForSignificance * noise;
+    }
+
+    if (!significant || delta == 0) {
+        result.verdict = Comparison::SAME;
+    } else if (delta < 0) {
+        result.verdict = Comparison::FASTER;
+    } else if (result.change > maxIncrease.value_or(options.maxIncrease)) {
+        result.verdict = Comparison::REGRESSION;
+    } else {
+        result.verdict = Comparison::SLOWER;
+    }
+    return result;
+}
+
+}  // namespace
+
+std::vector<Comparison> compareReports(const BenchmarkReport& oldReport,
+                                       const BenchmarkReport& newReport,
+                                       const CompareOptions& options) {
+    std::vector<Comparison> results;
+    auto oldIt = oldReport.begin();
+    auto newIt = newReport.begin();
+    while (oldIt != oldReport.end() || newIt != newReport.end()) {
+        if (newIt == newReport.end() || (oldIt != oldReport.end() && oldIt->first < newIt->first)) {
+            results.push_back(compare(oldIt->first, &oldIt->second, nullptr, options));
+            ++oldIt;
+        } else if (oldIt == oldReport.end() || newIt->first < oldIt->first) {
+            results.push_back(compare(newIt->first, nullptr, &newIt->second, options));
+            ++newIt;
+        } else {
+            results.push_back(compare(oldIt->first, &oldIt->second, &newIt->second, options));
+            ++oldIt;
+            ++newIt;
+        }
+    }
+    return results;
+}
+
+std::optional<double> parseDurationNs(const std::string& text) {
+    const char* start = text.c_str();
+    char* end = nullptr;
+    const double value = strtod(start, &end);
+    if (end == start || !std::isfinite(value) || value < 0) return std::nullopt;
+    const std::optional<double> scale = unitToNs(end);
+    if (!scale) return std::nullopt;
+    return value * *scale;
+}
+
+}  // namespace net
+}  // namespace android
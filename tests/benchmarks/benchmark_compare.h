@@ -0,0 +1,120 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <map>
+#include <optional>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace net {
+
+// The repetitions of one benchmark in a google-benchmark JSON report, in nanoseconds, or the
+// error message if the benchmark failed.
+struct BenchmarkSamples {
+    std::vector<double> ns;
+    std::string error;
+};
+
+// Benchmarks keyed by run name, e.g., "RouteController/addRemoveUsers/8/real_time".
+using BenchmarkReport = std::map<std::string, BenchmarkSamples>;
+
+// Parses the output of --benchmark_format=json or --benchmark_out. |metric| is "real_time" or
+// "cpu_time". Each repetition of a benchmark, as run with --benchmark_repetitions, is one sample.
+// If the report only has aggregates, the median is used as the only sample. Returns false and
+// sets |error| if the report cannot be parsed.
+bool parseBenchmarkReport(const std::string& json, const std::string& metric,
+                          BenchmarkReport* report, std::string* error);
+
+double median(std::vector<double> values);
+// Median absolute deviation from the median. Unlike the standard deviation, it is not inflated by
+// the occasional outlier caused by preemption or frequency scaling.
+double medianAbsoluteDeviation(const std::vector<double>& values);
+// Two-sided p-value of the Mann-Whitney U test that |a| and |b| come from the same distribution,
+// using the normal approximation with tie and continuity corrections.
+double mannWhitneyPValue(const std::vector<double>& a, const std::vector<double>& b);
+
+struct CompareOptions {
+    // Benchmarks whose median increases by more than this fraction regress.
+    double maxIncrease = 0.05;
+    // Changes are significant if the U test p-value is below this.
+    double alpha = 0.05;
+
+    // Overrides for benchmarks whose names match |pattern|. The first matching rule that sets a
+    // threshold, and the first one that sets a budget, apply.
+    struct Rule {
+        std::regex pattern;
+        // If set, replaces maxIncrease.
+        std::optional<double> maxIncrease;
+        // If set, benchmarks regress if their new median is above this many nanoseconds.
+        std::optional<double> budgetNs;
+    };
+    std::vector<Rule> rules;
+};
+
+// Below this many samples in either report, the U test cannot reach the usual significance levels
+// and changes are compared against the noise measured by the MAD instead.
+constexpr size_t kMinUTestSamples = 4;
+// With too few samples for the U test, changes larger than this many MADs are significant.
+constexpr double kMinMadsForSignificance = 3;
+
+struct Comparison {
+    enum Verdict {
+        SAME,        // No significant change.
+        FASTER,      // Significantly faster.
+        SLOWER,      // Significantly slower, but within the threshold.
+        REGRESSION,  // Significantly slower, by more than the threshold.
+        OVER_BUDGET, // The new median is above the budget.
+        FAILED,      // The benchmark reported an error in the new report.
+        ADDED,       // Only in the new report, or failed in the old one.
+        REMOVED,     // Only in the old report.
+    };
+
+    std::string name;
+    Verdict verdict;
+    double oldMedian = 0;
+    double newMedian = 0;
+    double oldMad = 0;
+    double newMad = 0;
+    // Relative change of the median.
+    double change = 0;
+    // Unset if there were too few samples for the U test.
+    std::optional<double> pValue;
+    size_t oldSamples = 0;
+    size_t newSamples = 0;
+    std::string error;
+
+    bool failed() const {
+        return verdict == REGRESSION || verdict == OVER_BUDGET || verdict == FAILED;
+    }
+};
+
+const char* verdictName(Comparison::Verdict verdict);
+
+// Compares every benchmark in either report, in name order.
+std::vector<Comparison> compareReports(const BenchmarkReport& oldReport,
+                                       const BenchmarkReport& newReport,
+                                       const CompareOptions& options);
+
+// Parses a duration such as "250us" or "1.5ms" into nanoseconds. A number without a unit is in
+// nanoseconds.
+std::optional<double> parseDurationNs(const std::string& text);
+
+}  // namespace net
+}  // namespace android
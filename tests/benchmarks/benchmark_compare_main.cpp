@@ -0,0 +1,183 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares two google-benchmark JSON reports and fails if any benchmark regressed.
+//
+//   netd_benchmark_compare [options] OLD.json NEW.json
+//
+// Exits with 0 if there are no regressions, 1 if there are, and 2 if the arguments or the reports
+// are invalid. See README.md for the options.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cmath>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/parsedouble.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#include "benchmark_compare.h"
+
+using android::base::ParseDouble;
+using android::base::ReadFileToString;
+using android::base::StartsWith;
+using android::base::StringPrintf;
+using android::net::BenchmarkReport;
+using android::net::CompareOptions;
+using android::net::Comparison;
+using android::net::compareReports;
+using android::net::parseBenchmarkReport;
+using android::net::parseDurationNs;
+using android::net::verdictName;
+
+namespace {
+
+constexpr int kExitRegression = 1;
+constexpr int kExitUsage = 2;
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] OLD.json NEW.json\n"
+            "  --metric=real_time|cpu_time  Time to compare. Default: real_time.\n"
+            "  --threshold=PCT              Maximum increase of the median. Default: 5.\n"
+            "  --threshold=REGEX:PCT        Maximum increase for matching benchmarks.\n"
+            "  --budget=REGEX:TIME          Maximum median for matching benchmarks, e.g., 50us.\n"
+            "  --alpha=P                    Significance level. Default: 0.05.\n",
+            argv0);
+}
+
+// Splits "REGEX:VALUE" at the last colon, since the regex may contain colons itself.
+bool splitRule(const std::string& arg, std::string* pattern, std::string* value) {
+    const size_t colon = arg.rfind(':');
+    if (colon == std::string::npos || colon == 0) return false;
+    *pattern = arg.substr(0, colon);
+    *value = arg.substr(colon + 1);
+    return true;
+}
+
+bool addRule(CompareOptions* options, const std::string& pattern, std::optional<double> maxIncrease,
+             std::optional<double> budgetNs) {
+    try {
+        options->rules.push_back({
+                .pattern = std::regex(pattern),
+                .maxIncrease = maxIncrease,
+                .budgetNs = budgetNs,
+        });
+    } catch (const std::regex_error& e) {
+        fprintf(stderr, "Invalid regex %s: %s\n", pattern.c_str(), e.what());
+        return false;
+    }
+    return true;
+}
+
+bool parseOption(const std::string& arg, CompareOptions* options, std::string* metric) {
+    std::string pattern;
+    std::string value;
+    double number;
+    if (StartsWith(arg, "--metric=")) {
+        *metric = arg.substr(strlen("--metric="));
+        return *metric == "real_time" || *metric == "cpu_time";
+    }
+    if (StartsWith(arg, "--alpha=")) {
+        return ParseDouble(arg.substr(strlen("--alpha=")), &options->alpha, 0.0, 1.0);
+    }
+    if (StartsWith(arg, "--threshold=")) {
+        const std::string rule = arg.substr(strlen("--threshold="));
+        if (ParseDouble(rule, &number, 0.0)) {
+            options->maxIncrease = number / 100;
+            return true;
+        }
+        return splitRule(rule, &pattern, &value) && ParseDouble(value, &number, 0.0) &&
+               addRule(options, pattern, number / 100, std::nullopt);
+    }
+    if (StartsWith(arg, "--budget=")) {
+        if (!splitRule(arg.substr(strlen("--budget=")), &pattern, &value)) return false;
+        const std::optional<double> budgetNs = parseDurationNs(value);
+        return budgetNs && addRule(options, pattern, std::nullopt, budgetNs);
+    }
+    return false;
+}
+
+bool readReport(const char* path, const std::string& metric, BenchmarkReport* report) {
+    std::string json;
+    if (!ReadFileToString(path, &json)) {
+        fprintf(stderr, "Cannot read %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    std::string error;
+    if (!parseBenchmarkReport(json, metric, report, &error)) {
+        fprintf(stderr, "Cannot parse %s: %s\n", path, error.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string formatNs(double ns) {
+    if (ns >= 1e9) return StringPrintf("%.3fs", ns / 1e9);
+    if (ns >= 1e6) return StringPrintf("%.3fms", ns / 1e6);
+    if (ns >= 1e3) return StringPrintf("%.3fus", ns / 1e3);
+    return StringPrintf("%.1fns", ns);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    CompareOptions options;
+    std::string metric = "real_time";
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        if (!StartsWith(argv[i], "--")) {
+            paths.push_back(argv[i]);
+        } else if (!parseOption(argv[i], &options, &metric)) {
+            fprintf(stderr, "Invalid option %s\n", argv[i]);
+            usage(argv[0]);
+            return kExitUsage;
+        }
+    }
+    if (paths.size() != 2) {
+        usage(argv[0]);
+        return kExitUsage;
+    }
+
+    BenchmarkReport oldReport;
+    BenchmarkReport newReport;
+    if (!readReport(paths[0], metric, &oldReport) || !readReport(paths[1], metric, &newReport)) {
+        return kExitUsage;
+    }
+
+    int exitCode = 0;
+    printf("%-60s %12s %12s %9s %8s %9s  %s\n", "Benchmark", "Old", "New", "Change", "p",
+           "Noise", "Verdict");
+    for (const Comparison& c : compareReports(oldReport, newReport, options)) {
+        const std::string p = c.pValue ? StringPrintf("%.3f", *c.pValue) : "-";
+        const double noise = c.newMedian > 0 ? c.newMad / c.newMedian : 0;
+        printf("%-60s %12s %12s %+8.1f%% %8s %8.1f%%  %s", c.name.c_str(),
+               c.oldSamples ? formatNs(c.oldMedian).c_str() : "-",
+               c.newSamples ? formatNs(c.newMedian).c_str() : "-",
+               std::isfinite(c.change) ? c.change * 100 : 0.0, p.c_str(), noise * 100,
+               verdictName(c.verdict));
+        if (!c.error.empty()) printf(" (%s)", c.error.c_str());
+        printf("\n");
+        if (c.failed()) exitCode = kExitRegression;
+    }
+    return exitCode;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "benchmark_compare.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+// Abridged output of --benchmark_format=json --benchmark_repetitions=3.
+constexpr char kReport[] = R"({
+  "context": {"library_build_type": "release"},
+  "benchmarks": [
+    {"name": "BM_a/real_time", "run_name": "BM_a/real_time", "run_type": "iteration",
+     "repetitions": 3, "repetition_index": 0, "iterations": 10,
+     "real_time": 1.5, "cpu_time": 1.0, "time_unit": "us"},
+    {"name": "BM_a/real_time", "run_name": "BM_a/real_time", "run_type": "iteration",
+     "repetitions": 3, "repetition_index": 1, "iterations": 10,
+     "real_time": 1.2, "cpu_time": 1.0, "time_unit": "us"},
+    {"name": "BM_a/real_time", "run_name": "BM_a/real_time", "run_type": "iteration",
+     "repetitions": 3, "repetition_index": 2, "iterations": 10,
+     "real_time": 1.3, "cpu_time": 1.0, "time_unit": "us"},
+    {"name": "BM_a/real_time_median", "run_name": "BM_a/real_time", "run_type": "aggregate",
+     "aggregate_name": "median", "iterations": 3,
+     "real_time": 1.3, "cpu_time": 1.0, "time_unit": "us"},
+    {"name": "BM_b", "run_name": "BM_b", "run_type": "iteration", "iterations": 0,
+     "real_time": 0, "cpu_time": 0, "time_unit": "ns",
+     "error_occurred": true, "error_message": "socket failed"},
+    {"name": "BM_c_median", "run_name": "BM_c", "run_type": "aggregate",
+     "aggregate_name": "median", "real_time": 7, "cpu_time": 6, "time_unit": "ms"},
+    {"name": "BM_c_mean", "run_name": "BM_c", "run_type": "aggregate",
+     "aggregate_name": "mean", "real_time": 9, "cpu_time": 8, "time_unit": "ms"}
+  ]
+})";
+
+BenchmarkReport makeReport(const std::string& name, const std::vector<double>& ns) {
+    BenchmarkReport report;
+    report[name].ns = ns;
+    return report;
+}
+
+Comparison compareOne(const std::vector<double>& oldNs, const std::vector<double>& newNs,
+                      const CompareOptions& options = {}) {
+    std::vector<Comparison> results =
+            compareReports(makeReport("BM", oldNs), makeReport("BM", newNs), options);
+    EXPECT_EQ(1U, results.size());
+    return results[0];
+}
+
+}  // namespace
+
+TEST(BenchmarkCompareTest, ParseReport) {
+    BenchmarkReport report;
+    std::string error;
+    ASSERT_TRUE(parseBenchmarkReport(kReport, "real_time", &report, &error)) << error;
+    ASSERT_EQ(3U, report.size());
+    EXPECT_EQ((std::vector<double>{1500, 1200, 1300}), report["BM_a/real_time"].ns);
+    EXPECT_TRUE(report["BM_a/real_time"].error.empty());
+    EXPECT_EQ("socket failed", report["BM_b"].error);
+    // Only aggregates: the median is the only sample.
+    EXPECT_EQ((std::vector<double>{7e6}), report["BM_c"].ns);
+
+    report.clear();
+    ASSERT_TRUE(parseBenchmarkReport(kReport, "cpu_time", &report, &error)) << error;
+    EXPECT_EQ((std::vector<double>{1000, 1000, 1000}), report["BM_a/real_time"].ns);
+}
+
+TEST(BenchmarkCompareTest, ParseInvalidReport) {
+    BenchmarkReport report;
+    std::string error;
+    EXPECT_FALSE(parseBenchmarkReport("{", "real_time", &report, &error));
+    EXPECT_FALSE(parseBenchmarkReport(R"({"context": {}})", "real_time", &report, &error));
+    EXPECT_FALSE(parseBenchmarkReport(
+            R"({"benchmarks": [{"name": "BM", "real_time": 1, "time_unit": "fortnights"}]})",
+            "real_time", &report, &error));
+    EXPECT_FALSE(parseBenchmarkReport(R"({"benchmarks": [{"name": "BM", "time_unit": "ns"}]})",
+                                      "real_time", &report, &error));
+}
+
+TEST(BenchmarkCompareTest, Statistics) {
+    EXPECT_EQ(3, median({5, 1, 3}));
+    EXPECT_EQ(2.5, median({4, 1, 3, 2}));
+    EXPECT_EQ(0, median({}));
+    // Deviations from 3 are {2, 2, 0, 1, 97}.
+    EXPECT_DOUBLE_EQ(2 * 1.4826, medianAbsoluteDeviation({1, 5, 3, 2, 100}));
+    EXPECT_EQ(0, medianAbsoluteDeviation({7, 7, 7}));
+}
+
+TEST(BenchmarkCompareTest, MannWhitney) {
+    // Completely separated samples of 5: U = 0, z = (12.5 - 0.5) / sqrt(22.9166...).
+    EXPECT_NEAR(0.01219, mannWhitneyPValue({1, 2, 3, 4, 5}, {6, 7, 8, 9, 10}), 1e-4);
+    EXPECT_NEAR(0.01219, mannWhitneyPValue({6, 7, 8, 9, 10}, {1, 2, 3, 4, 5}), 1e-4);
+    // Interleaved samples are indistinguishable.
+    EXPECT_GT(mannWhitneyPValue({1, 3, 5, 7, 9}, {2, 4, 6, 8, 10}), 0.5);
+    // All ties.
+    EXPECT_EQ(1, mannWhitneyPValue({4, 4, 4, 4}, {4, 4, 4, 4}));
+    EXPECT_EQ(1, mannWhitneyPValue({}, {1}));
+}
+
+TEST(BenchmarkCompareTest, Verdicts) {
+    const std::vector<double> base = {100, 101, 99, 100, 102, 98};
+
+    EXPECT_EQ(Comparison::SAME, compareOne(base, {101, 99, 100, 100, 98, 102}).verdict);
+
+    Comparison c = compareOne(base, {120, 121, 119, 120, 122, 118});
+    EXPECT_EQ(Comparison::REGRESSION, c.verdict);
+    EXPECT_NEAR(0.2, c.change, 1e-9);
+    ASSERT_TRUE(c.pValue.has_value());
+    EXPECT_LT(*c.pValue, 0.05);
+    EXPECT_TRUE(c.failed());
+
+    c = compareOne(base, {103, 104, 102, 103, 105, 101});
+    EXPECT_EQ(Comparison::SLOWER, c.verdict);
+    EXPECT_FALSE(c.failed());
+
+    EXPECT_EQ(Comparison::FASTER, compareOne(base, {80, 81, 79, 80, 82, 78}).verdict);
+
+    // A large change in the median that is not significant because the samples are so noisy.
+    EXPECT_EQ(Comparison::SAME,
+              compareOne({100, 300, 100, 300, 200}, {100, 400, 150, 320, 250}).verdict);
+}
+
+TEST(BenchmarkCompareTest, FewSamples) {
+    // With a single run each, there is no noise estimate; only the threshold applies.
+    Comparison c = compareOne({100}, {110});
+    EXPECT_EQ(Comparison::REGRESSION, c.verdict);
+    EXPECT_FALSE(c.pValue.has_value());
+    EXPECT_EQ(Comparison::SLOWER, compareOne({100}, {104}).verdict);
+
+    // Three runs each: changes must exceed three MADs.
+    EXPECT_EQ(Comparison::SAME, compareOne({100, 90, 110}, {110, 100, 120}).verdict);
+    EXPECT_EQ(Comparison::REGRESSION, compareOne({100, 99, 101}, {110, 109, 111}).verdict);
+}
+
+TEST(BenchmarkCompareTest, Rules) {
+    CompareOptions options;
+    options.rules.push_back({.pattern = std::regex("^BM$"), .maxIncrease = 0.25});
+    options.rules.push_back({.pattern = std::regex("B"), .maxIncrease = 0.01});
+    options.rules.push_back({.pattern = std::regex("B"), .budgetNs = 115});
+
+    // The first threshold applies, not the second.
+    EXPECT_EQ(Comparison::SLOWER, compareOne({100}, {110}, options).verdict);
+    // The budget applies regardless of the change.
+    EXPECT_EQ(Comparison::OVER_BUDGET, compareOne({120}, {116}, options).verdict);
+    EXPECT_TRUE(compareOne({120}, {116}, options).failed());
+
+    CompareOptions loose;
+    loose.maxIncrease = 0.5;
+    EXPECT_EQ(Comparison::SLOWER, compareOne({100}, {140}, loose).verdict);
+}
+
+TEST(BenchmarkCompareTest, AddedRemovedFailed) {
+    BenchmarkReport oldReport = makeReport("removed", {1});
+    oldReport["failedBefore"] = {.error = "oops"};
+    oldReport["failedNow"].ns = {1};
+    BenchmarkReport newReport = makeReport("added", {1});
+    newReport["failedBefore"].ns = {1};
+    newReport["failedNow"] = {.error = "oops"};
+
+    CompareOptions options;
+    options.rules.push_back({.pattern = std::regex("added"), .budgetNs = 0.5});
+    const std::vector<Comparison> results = compareReports(oldReport, newReport, options);
+    ASSERT_EQ(4U, results.size());
+    EXPECT_EQ("added", results[0].name);
+    EXPECT_EQ(Comparison::OVER_BUDGET, results[0].verdict);
+    EXPECT_EQ("failedBefore", results[1].name);
+    EXPECT_EQ(Comparison::ADDED, results[1].verdict);
+    EXPECT_EQ("failedNow", results[2].name);
+    EXPECT_EQ(Comparison::FAILED, results[2].verdict);
+    EXPECT_EQ("oops", results[2].error);
+    EXPECT_TRUE(results[2].failed());
+    EXPECT_EQ("removed", results[3].name);
+    EXPECT_EQ(Comparison::REMOVED, results[3].verdict);
+    EXPECT_FALSE(results[3].failed());
+}
+
+TEST(BenchmarkCompareTest, ParseDuration) {
+    EXPECT_EQ(250, parseDurationNs("250"));
+    EXPECT_EQ(250, parseDurationNs("250ns"));
+    EXPECT_EQ(1500, parseDurationNs("1.5us"));
+    EXPECT_EQ(2e6, parseDurationNs("2ms"));
+    EXPECT_EQ(1e9, parseDurationNs("1s"));
+    EXPECT_FALSE(parseDurationNs("").has_value());
+    EXPECT_FALSE(parseDurationNs("ms").has_value());
+    EXPECT_FALSE(parseDurationNs("5 min").has_value());
+    EXPECT_FALSE(parseDurationNs("-1us").has_value());
+}
+
+}  // namespace net
+}  // namespace android
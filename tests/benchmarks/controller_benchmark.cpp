@@ -0,0 +1,740 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "controller_benchmark"
+
+/*
+ * See README.md for general notes.
+ *
+ * These benchmarks measure the cost of netd's own code in the controllers that program the kernel,
+ * without measuring the kernel. They run in-process against fakes instead of a live netd:
+ *
+ *   - rtnetlink and sock_diag requests are served by FakeNetlinkKernel, which ACKs every request
+ *     and answers SOCK_DIAG_BY_FAMILY dumps with a configurable number of TCP sockets.
+ *   - iptables-restore and ip6tables-restore are this binary, which echoes the comment lines that
+ *     IptablesRestoreController uses as PINGs and ignores everything else.
+ *   - The netdutils Syscalls that write quotas to /proc/net/xt_quota write to /dev/null instead.
+ *
+ * NetworkController runs on top of these fakes, with a VPN that getNetworkContextDuringVpnBringUp
+ * brings up and down.
+ *
+ * Unless another --benchmark_format is given, results are written as JSON so that runs on
+ * different changes can be compared by tools.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <gmock/gmock.h>
+#include <log/log.h>
+#include <netd_resolv/resolv.h>
+#include <netdutils/MockSyscalls.h>
+
+#include "BandwidthController.h"
+#include "Fwmark.h"
+#include "IptablesRestoreController.h"
+#include "NetlinkCommands.h"
+#include "NetworkController.h"
+#include "RouteController.h"
+#include "SockDiag.h"
+#include "TcpSocketMonitor.h"
+
+using android::base::StartsWith;
+using android::base::StringAppendF;
+using android::base::unique_fd;
+using android::netdutils::ScopedMockSyscalls;
+using android::netdutils::Status;
+using android::netdutils::statusFromErrno;
+using android::netdutils::StatusOr;
+using android::netdutils::UniqueFile;
+using testing::_;
+using testing::Invoke;
+using testing::NiceMock;
+
+namespace android {
+namespace net {
+
+namespace {
+
+constexpr unsigned kNetId = 100;
+constexpr char kInterface[] = "bench0";
+constexpr uint32_t kIfIndex = 1000;
+constexpr int64_t kQuotaBytes = 1000000000;
+constexpr unsigned kVpnNetId = 101;
+constexpr char kVpnInterface[] = "benchtun0";
+
+// The UIDs that the sockets in sock_diag dumps belong to.
+constexpr uid_t kFirstUid = 10000;
+constexpr uid_t kNumUids = 1000;
+
+// Serves the netlink sockets that netd opens, from a single thread.
+//
+// Each socket is one end of an AF_UNIX SOCK_SEQPACKET socket pair, which keeps datagram boundaries
+// like netlink does. Every request that asks for an ACK gets a successful one, dumps other than
+// SOCK_DIAG_BY_FAMILY are empty, and everything else is accepted without a reply. Replies that do
+// not fit in the socket buffer are queued until netd reads, so that a dump that netd reads while
+// sending SOCK_DESTROY requests on another socket does not block the other socket.
+class FakeNetlinkKernel {
+  public:
+    FakeNetlinkKernel() : mEpoll(epoll_create1(EPOLL_CLOEXEC)), mStop(eventfd(0, EFD_CLOEXEC)) {
+        epoll_event event = {.events = EPOLLIN, .data = {.u64 = kStopKey}};
+        if (epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, mStop.get(), &event) == -1) {
+            ALOGE("Cannot add stop event to epoll: %s", strerror(errno));
+            return;
+        }
+        mThread = std::thread([this] { serve(); });
+    }
+
+    ~FakeNetlinkKernel() {
+        if (!mThread.joinable()) return;
+        eventfd_write(mStop.get(), 1);
+        mThread.join();
+        for (const auto& [fd, socket] : mSockets) close(fd);
+    }
+
+    // Returns netd's end of a new socket of |protocol|, or negative errno.
+    int open(int protocol) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) {
+            return -errno;
+        }
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        epoll_event event = {.events = EPOLLIN, .data = {.u64 = key(fds[1], protocol)}};
+        if (epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, fds[1], &event) == -1) {
+            const int ret = -errno;
+            close(fds[0]);
+            close(fds[1]);
+            return ret;
+        }
+        return fds[0];
+    }
+
+    // Sets the number of sockets that SOCK_DIAG_BY_FAMILY dumps return, over both families.
+    void setNumSockets(uint32_t numSockets) { mNumSockets = numSockets; }
+
+    // Number of netlink messages received so far.
+    uint64_t requests() const { return mRequests; }
+
+  private:
+    static constexpr uint64_t kStopKey = UINT64_MAX;
+    // Like the kernel, fill dump datagrams up to 32 KiB.
+    static constexpr size_t kMaxDumpDatagram = 32768;
+
+    struct Socket {
+        int protocol = 0;
+        // Replies that did not fit in the socket buffer yet.
+        std::deque<std::vector<uint8_t>> replies;
+        bool waitingForOutput = false;
+    };
+
+    static uint64_t key(int fd, int protocol) {
+        return (static_cast<uint64_t>(protocol) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    void serve() {
+        epoll_event events[16];
+        while (true) {
+            const int count = epoll_wait(mEpoll.get(), events, std::size(events), -1);
+            if (count == -1) {
+                if (errno == EINTR) continue;
+                ALOGE("epoll_wait failed: %s", strerror(errno));
+                return;
+            }
+            for (int i = 0; i < count; i++) {
+                if (events[i].data.u64 == kStopKey) return;
+                const int fd = static_cast<int>(events[i].data.u64 & UINT32_MAX);
+                const auto [it, inserted] = mSockets.try_emplace(fd);
+                if (inserted) it->second.protocol = static_cast<int>(events[i].data.u64 >> 32);
+                bool open = !(events[i].events & (EPOLLHUP | EPOLLERR));
+                if (events[i].events & EPOLLIN) {
+                    open = receive(fd, &it->second);
+                }
+                if (open) {
+                    open = sendReplies(fd, &it->second);
+                }
+                if (!open) {
+                    close(fd);
+                    mSockets.erase(it);
+                }
+            }
+        }
+    }
+
+    // Handles all requests queued on |fd|. Returns false if netd closed its end.
+    bool receive(int fd, Socket* socket) {
+        while (true) {
+            const ssize_t len = recv(fd, mBuffer, sizeof(mBuffer), 0);
+            if (len == 0) return false;
+            if (len == -1) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN;
+            }
+            uint32_t remaining = len;
+            for (const nlmsghdr* nlh = reinterpret_cast<const nlmsghdr*>(mBuffer);
+                 NLMSG_OK(nlh, remaining); nlh = NLMSG_NEXT(nlh, remaining)) {
+                mRequests++;
+                if (nlh->nlmsg_flags & NLM_F_DUMP) {
+                    if (socket->protocol == NETLINK_SOCK_DIAG &&
+                        nlh->nlmsg_type == SOCK_DIAG_BY_FAMILY) {
+                        addSocketDump(*nlh, socket);
+                    } else {
+                        socket->replies.emplace_back();
+                        addDone(*nlh, &socket->replies.back());
+                    }
+                } else if (nlh->nlmsg_flags & NLM_F_ACK) {
+                    addAck(*nlh, socket);
+                }
+            }
+        }
+    }
+
+    // Sends as many queued replies as fit in the socket buffer, and waits until the rest fit.
+    // Returns false if netd closed its end.
+    bool sendReplies(int fd, Socket* socket) {
+        while (!socket->replies.empty()) {
+            const std::vector<uint8_t>& reply = socket->replies.front();
+            if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL) == -1) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN) break;
+                return false;
+            }
+            socket->replies.pop_front();
+        }
+
+        const bool waitForOutput = !socket->replies.empty();
+        if (waitForOutput != socket->waitingForOutput) {
+            epoll_event event = {
+                    .events = EPOLLIN | (waitForOutput ? EPOLLOUT : 0u),
+                    .data = {.u64 = key(fd, socket->protocol)},
+            };
+            epoll_ctl(mEpoll.get(), EPOLL_CTL_MOD, fd, &event);
+            socket->waitingForOutput = waitForOutput;
+        }
+        return true;
+    }
+
+    static void addAck(const nlmsghdr& request, Socket* socket) {
+        struct {
+            nlmsghdr hdr;
+            nlmsgerr err;
+        } ack = {
+                .hdr = {.nlmsg_len = sizeof(ack),
+                        .nlmsg_type = NLMSG_ERROR,
+                        .nlmsg_seq = request.nlmsg_seq},
+                .err = {.error = 0, .msg = request},
+        };
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(&ack);
+        socket->replies.emplace_back(data, data + sizeof(ack));
+    }
+
+    static void addDone(const nlmsghdr& request, std::vector<uint8_t>* datagram) {
+        struct {
+            nlmsghdr hdr;
+            int32_t error;
+        } done = {
+                .hdr = {.nlmsg_len = sizeof(done),
+                        .nlmsg_type = NLMSG_DONE,
+                        .nlmsg_flags = NLM_F_MULTI,
+                        .nlmsg_seq = request.nlmsg_seq},
+                .error = 0,
+        };
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(&done);
+        datagram->insert(datagram->end(), data, data + sizeof(done));
+    }
+
+    static void addAttribute(uint16_t type, const void* data, size_t len,
+                             std::vector<uint8_t>* message) {
+        const rtattr attr = {.rta_len = static_cast<uint16_t>(RTA_LENGTH(len)), .rta_type = type};
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&attr);
+        message->insert(message->end(), p, p + sizeof(attr));
+        p = static_cast<const uint8_t*>(data);
+        message->insert(message->end(), p, p + len);
+        message->resize(message->size() + RTA_ALIGN(len) - len);
+    }
+
+    // Queues a dump of established TCP sockets, whose contents change on every dump so that
+    // TcpSocketMonitor never considers them idle.
+    void addSocketDump(const nlmsghdr& request, Socket* socket) {
+        const auto* req = reinterpret_cast<const inet_diag_req_v2*>(NLMSG_DATA(&request));
+        const bool ipv4 = (req->sdiag_family == AF_INET);
+        const uint32_t numSockets = mNumSockets;
+        const uint32_t first = ipv4 ? 0 : numSockets / 2;
+        const uint32_t end = ipv4 ? numSockets / 2 : numSockets;
+        const uint32_t generation = ++mDumps;
+
+        std::vector<uint8_t> datagram;
+        std::vector<uint8_t> message;
+        for (uint32_t i = first; i < end; i++) {
+            inet_diag_msg msg = {};
+            msg.idiag_family = req->sdiag_family;
+            msg.idiag_state = TCP_ESTABLISHED;
+            msg.idiag_uid = kFirstUid + i % kNumUids;
+            msg.idiag_inode = i + 1;
+            msg.id.idiag_sport = htons(32768 + i % 32768);
+            msg.id.idiag_dport = htons(443);
+            msg.id.idiag_cookie[1] = i + 1;
+            if (ipv4) {
+                msg.id.idiag_src[0] = htonl(0xc0000200 | (i & 0xff));  // 192.0.2.x
+                msg.id.idiag_dst[0] = htonl(0xc6336401);               // 198.51.100.1
+            } else {
+                msg.id.idiag_src[0] = htonl(0x20010db8);  // 2001:db8::x
+                msg.id.idiag_src[3] = htonl(i + 1);
+                msg.id.idiag_dst[0] = htonl(0x20010db8);  // 2001:db8:1::1
+                msg.id.idiag_dst[1] = htonl(0x00010000);
+                msg.id.idiag_dst[3] = htonl(1);
+            }
+
+            Fwmark mark;
+            mark.netId = kNetId + i % 4;
+            mark.permission = PERMISSION_NONE;
+
+            const nlmsghdr hdr = {
+                    .nlmsg_type = SOCK_DIAG_BY_FAMILY,
+                    .nlmsg_flags = NLM_F_MULTI,
+                    .nlmsg_seq = request.nlmsg_seq,
+            };
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(&hdr);
+            message.assign(p, p + NLMSG_HDRLEN);
+            p = reinterpret_cast<const uint8_t*>(&msg);
+            message.insert(message.end(), p, p + sizeof(msg));
+            message.resize(NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(msg)));
+            addAttribute(INET_DIAG_MARK, &mark.intValue, sizeof(mark.intValue), &message);
+            if (req->idiag_ext & (1 << (INET_DIAG_INFO - 1))) {
+                tcp_info info = {};
+                info.tcpi_state = TCP_ESTABLISHED;
+                info.tcpi_rtt = 20000 + i % 1000;
+                info.tcpi_segs_out = generation * 10 + i;
+                info.tcpi_last_data_sent = 100;
+                info.tcpi_last_ack_recv = 120;
+                addAttribute(INET_DIAG_INFO, &info, sizeof(info), &message);
+            }
+            reinterpret_cast<nlmsghdr*>(message.data())->nlmsg_len = message.size();
+
+            if (datagram.size() + message.size() > kMaxDumpDatagram) {
+                socket->replies.push_back(std::move(datagram));
+                datagram.clear();
+            }
+            datagram.insert(datagram.end(), message.begin(), message.end());
+        }
+        addDone(request, &datagram);
+        socket->replies.push_back(std::move(datagram));
+    }
+
+    const unique_fd mEpoll;
+    const unique_fd mStop;
+    std::atomic<uint32_t> mNumSockets = 0;
+    std::atomic<uint64_t> mRequests = 0;
+    // Only used by the serving thread.
+    std::map<int, Socket> mSockets;
+    uint32_t mDumps = 0;
+    uint8_t mBuffer[65536];
+    std::thread mThread;
+};
+
+// Stands in for iptables-restore and ip6tables-restore, which IptablesRestoreController starts with
+// "--noflush -w -v". In verbose mode iptables-restore echoes comment lines, which is what the PINGs
+// that IptablesRestoreController sends after each command rely on.
+int runIptablesRestoreStub() {
+    char* line = nullptr;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, stdin)) != -1) {
+        if (line[0] == '#') {
+            fwrite(line, 1, len, stdout);
+            fflush(stdout);
+        }
+    }
+    free(line);
+    return 0;
+}
+
+UidRanges makeUidRanges(int numRanges) {
+    std::vector<UidRangeParcel> ranges;
+    for (int i = 0; i < numRanges; i++) {
+        UidRangeParcel range;
+        range.start = kFirstUid + 2 * i;
+        range.stop = range.start;
+        ranges.push_back(range);
+    }
+    return UidRanges(ranges);
+}
+
+}  // namespace
+
+// Installs the fakes and runs the benchmarks. Only one instance exists at a time.
+class ControllerBenchmark {
+  public:
+    ControllerBenchmark() {
+        sInstance = this;
+
+        ON_CALL(mSyscalls, fork()).WillByDefault(Invoke([]() -> StatusOr<pid_t> {
+            const pid_t pid = ::fork();
+            if (pid == -1) return statusFromErrno(errno, "fork() failed");
+            return pid;
+        }));
+        ON_CALL(mSyscalls, fopen(_, _))
+                .WillByDefault(Invoke([](const std::string&,
+                                         const std::string& mode) -> StatusOr<UniqueFile> {
+                    return UniqueFile(::fopen("/dev/null", mode.c_str()));
+                }));
+        ON_CALL(mSyscalls, vfprintf(_, _, _))
+                .WillByDefault(Invoke([](FILE* file, const std::string& format,
+                                         va_list ap) -> StatusOr<int> {
+                    return ::vfprintf(file, format.c_str(), ap);
+                }));
+        ON_CALL(mSyscalls, fclose(_)).WillByDefault(Invoke([](FILE* file) -> Status {
+            if (::fclose(file) != 0) return statusFromErrno(errno, "fclose() failed");
+            return netdutils::status::ok;
+        }));
+
+        openNetlinkSocketFunction = [](int protocol) { return sInstance->mKernel.open(protocol); };
+        RouteController::ifNameToIndexFunction = [](const char*) { return kIfIndex; };
+
+        // Run this binary as iptables-restore. See main().
+        IptablesRestoreController::IPTABLES_RESTORE_PATH = "/proc/self/exe";
+        IptablesRestoreController::IP6TABLES_RESTORE_PATH = "/proc/self/exe";
+        mIptablesRestoreCtrl = std::make_unique<IptablesRestoreController>();
+        BandwidthController::iptablesRestoreFunction = [](IptablesTarget target,
+                                                          const std::string& commands,
+                                                          std::string* output) {
+            return sInstance->mIptablesRestoreCtrl->execute(target, commands, output);
+        };
+
+        mNetCtrl = std::make_unique<NetworkController>();
+        if (int ret = mNetCtrl->createVirtualNetwork(kVpnNetId, true /* secure */,
+                                                     NativeVpnType::SERVICE,
+                                                     false /* excludeLocalRoutes */)) {
+            ALOGE("Cannot create VPN: %s", strerror(-ret));
+        }
+    }
+
+    ~ControllerBenchmark() { sInstance = nullptr; }
+
+    ControllerBenchmark(const ControllerBenchmark&) = delete;
+    ControllerBenchmark& operator=(const ControllerBenchmark&) = delete;
+
+    // Adds and removes the UID rules of a physical network for state.range(0) UID ranges, each in
+    // its own netlink round trip, or with a single NetlinkBatch if |batched| is true.
+    static void addRemoveUsers(benchmark::State& state, bool batched) {
+        const UidRangeMap uidRangeMap = {
+                {UidRanges::SUB_PRIORITY_HIGHEST, makeUidRanges(state.range(0))}};
+        const auto modifyUsers = [&uidRangeMap, batched](bool add) {
+            std::unique_ptr<NetlinkBatch> batch;
+            if (batched) batch = std::make_unique<NetlinkBatch>();
+            int ret = add ? RouteController::addUsersToPhysicalNetwork(kNetId, kInterface,
+                                                                       uidRangeMap, false)
+                          : RouteController::removeUsersFromPhysicalNetwork(kNetId, kInterface,
+                                                                            uidRangeMap, false);
+            if (batch != nullptr && ret == 0) ret = batch->flush();
+            return ret;
+        };
+
+        const uint64_t requests = sInstance->mKernel.requests();
+        for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+            if (int ret = modifyUsers(true)) {
+                state.SkipWithError(("add users: " + std::string(strerror(-ret))).c_str());
+                break;
+            }
+            if (int ret = modifyUsers(false)) {
+                state.SkipWithError(("remove users: " + std::string(strerror(-ret))).c_str());
+                break;
+            }
+        }
+        state.counters["netlink_requests"] = benchmark::Counter(
+                sInstance->mKernel.requests() - requests, benchmark::Counter::kAvgIterations);
+    }
+
+    // Dumps the tcp_info of state.range(0) sockets.
+    static void getLiveTcpInfos(benchmark::State& state) {
+        sInstance->mKernel.setNumSockets(state.range(0));
+        for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+            SockDiag sd;
+            int64_t sockets = 0;
+            const auto countSockets = [&sockets](Fwmark, const inet_diag_msg*, const tcp_info*,
+                                                 uint32_t) { sockets++; };
+            if (!sd.open() || sd.getLiveTcpInfos(countSockets) != 0 || sockets != state.range(0)) {
+                state.SkipWithError("sock_diag dump failed");
+                break;
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+
+    // Destroys state.range(0) sockets by UID.
+    static void destroySockets(benchmark::State& state) {
+        sInstance->mKernel.setNumSockets(state.range(0));
+        const UidRanges uidRanges({[] {
+            UidRangeParcel range;
+            range.start = kFirstUid;
+            range.stop = kFirstUid + kNumUids - 1;
+            return range;
+        }()});
+        for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+            SockDiag sd;
+            if (!sd.open() || sd.destroySockets(uidRanges, {}, false /* excludeLoopback */) != 0) {
+                state.SkipWithError("destroying sockets failed");
+                break;
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+
+    // Samples the stats of state.range(0) sockets, as every TcpSocketMonitor poll does.
+    static void sampleSockets(benchmark::State& state) {
+        sInstance->mKernel.setNumSockets(state.range(0));
+        TcpSocketMonitor monitor;
+        for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+            std::lock_guard guard(monitor.mLock);
+            if (!monitor.sampleSockets(std::chrono::steady_clock::now())) {
+                state.SkipWithError("sampling sockets failed");
+                break;
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+
+    // Changes the quota of an interface that already has one.
+    static void updateQuota(benchmark::State& state) {
+        BandwidthController bw;
+        if (bw.setInterfaceQuota(kInterface, kQuotaBytes)) {
+            state.SkipWithError("setting quota failed");
+            return;
+        }
+        int64_t bytes = kQuotaBytes;
+        for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+            if (bw.setInterfaceQuota(kInterface, ++bytes)) {
+                state.SkipWithError("updating quota failed");
+                break;
+            }
+        }
+        bw.removeInterfaceQuota(kInterface);
+    }
+
+    // Adds and removes the quota of an interface, which takes two iptables-restore commands for
+    // each of IPv4 and IPv6.
+    static void setRemoveQuota(benchmark::State& state) {
+        BandwidthController bw;
+        for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+            if (bw.setInterfaceQuota(kInterface, kQuotaBytes) ||
+                bw.removeInterfaceQuota(kInterface)) {
+                state.SkipWithError("setting or removing quota failed");
+                break;
+            }
+        }
+    }
+
+    // Sends a command of state.range(0) lines to iptables-restore and ip6tables-restore.
+    static void iptablesRestore(benchmark::State& state) {
+        std::string commands = "*filter\n";
+        for (int i = 0; i < state.range(0); i++) {
+            StringAppendF(&commands, "-A bw_costly_%s -m quota2 ! --quota %d --name %s -j REJECT\n",
+                          kInterface, i + 1, kInterface);
+        }
+        commands += "COMMIT\n";
+        for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+            if (sInstance->mIptablesRestoreCtrl->execute(V4V6, commands, nullptr)) {
+                state.SkipWithError("iptables-restore failed");
+                break;
+            }
+        }
+    }
+
+    // Measures the latency of the getNetworkContext() call that the resolver makes for every DNS
+    // query, while another thread brings a VPN with state.range(0) UID ranges up and down as fast
+    // as it can. With 0 UID ranges, the VPN is left alone. The UIDs looked up are not in the VPN,
+    // so that the lookups only measure waiting for NetworkController's lock.
+    static void getNetworkContextDuringVpnBringUp(benchmark::State& state) {
+        static std::atomic<bool> sStop;
+        static std::atomic<int> sError;
+        static std::atomic<uint64_t> sBringUps;
+        static std::thread sWriter;
+
+        // Only the last kMaxSamples latencies of each thread are kept.
+        static constexpr size_t kMaxSamples = 1 << 16;
+
+        NetworkController& netCtrl = *sInstance->mNetCtrl;
+        const int numRanges = state.range(0);
+        if (state.thread_index() == 0 && numRanges > 0) {
+            sStop = false;
+            sError = 0;
+            sBringUps = 0;
+            sWriter = std::thread([&netCtrl, numRanges] {
+                const UidRanges uidRanges = makeUidRanges(numRanges);
+                const int32_t subPriority = UidRanges::SUB_PRIORITY_HIGHEST;
+                while (!sStop) {
+                    int ret = netCtrl.addInterfaceToNetwork(kVpnNetId, kVpnInterface);
+                    if (!ret) ret = netCtrl.addUsersToNetwork(kVpnNetId, uidRanges, subPriority);
+                    if (!ret) {
+                        ret = netCtrl.removeUsersFromNetwork(kVpnNetId, uidRanges, subPriority);
+                    }
+                    if (!ret) ret = netCtrl.removeInterfaceFromNetwork(kVpnNetId, kVpnInterface);
+                    if (ret) {
+                        sError = ret;
+                        return;
+                    }
+                    sBringUps++;
+                }
+            });
+        }
+
+        std::vector<uint32_t> latencies(kMaxSamples);
+        uint64_t samples = 0;
+        // Odd UIDs, which makeUidRanges() never puts in the VPN.
+        uid_t uid = kFirstUid + 1;
+        android_net_context context;
+        for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+            const auto start = std::chrono::steady_clock::now();
+            netCtrl.getNetworkContext(NETID_UNSET, uid, &context);
+            const auto latency = std::chrono::steady_clock::now() - start;
+            latencies[samples++ % kMaxSamples] =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+            benchmark::DoNotOptimize(context);
+            uid = (uid + 2 < kFirstUid + 2 * kNumUids) ? uid + 2 : kFirstUid + 1;
+        }
+
+        latencies.resize(std::min<uint64_t>(samples, kMaxSamples));
+        if (!latencies.empty()) {
+            std::sort(latencies.begin(), latencies.end());
+            const auto percentile = [&latencies](size_t p) {
+                return latencies[(latencies.size() - 1) * p / 100];
+            };
+            state.counters["p50_ns"] = benchmark::Counter(percentile(50),
+                                                          benchmark::Counter::kAvgThreads);
+            state.counters["p99_ns"] = benchmark::Counter(percentile(99),
+                                                          benchmark::Counter::kAvgThreads);
+            state.counters["max_ns"] = benchmark::Counter(latencies.back(),
+                                                          benchmark::Counter::kAvgThreads);
+        }
+
+        if (state.thread_index() == 0 && numRanges > 0) {
+            sStop = true;
+            sWriter.join();
+            if (sError) {
+                state.SkipWithError(("VPN bring-up: " + std::string(strerror(-sError))).c_str());
+            }
+            state.counters["bringups"] =
+                    benchmark::Counter(sBringUps.load(), benchmark::Counter::kIsRate);
+        }
+    }
+
+  private:
+    static ControllerBenchmark* sInstance;
+
+    NiceMock<ScopedMockSyscalls> mSyscalls;
+    FakeNetlinkKernel mKernel;
+    std::unique_ptr<IptablesRestoreController> mIptablesRestoreCtrl;
+    std::unique_ptr<NetworkController> mNetCtrl;
+};
+
+ControllerBenchmark* ControllerBenchmark::sInstance = nullptr;
+
+}  // namespace net
+}  // namespace android
+
+int main(int argc, char** argv) {
+    using android::net::ControllerBenchmark;
+
+    if (argc > 1 && !strcmp(argv[1], "--noflush")) {
+        return android::net::runIptablesRestoreStub();
+    }
+
+    std::vector<char*> args(argv, argv + argc);
+    char jsonFormat[] = "--benchmark_format=json";
+    if (std::none_of(args.begin(), args.end(),
+                     [](const char* arg) { return StartsWith(arg, "--benchmark_format="); })) {
+        args.insert(args.begin() + 1, jsonFormat);
+    }
+    int numArgs = args.size();
+    benchmark::Initialize(&numArgs, args.data());
+    if (benchmark::ReportUnrecognizedArguments(numArgs, args.data())) return 1;
+
+    ControllerBenchmark controllerBenchmark;
+    benchmark::RegisterBenchmark("RouteController/addRemoveUsers",
+                                 [](benchmark::State& state) {
+                                     ControllerBenchmark::addRemoveUsers(state, false);
+                                 })
+            ->RangeMultiplier(8)
+            ->Range(1, 512)
+            ->UseRealTime();
+    benchmark::RegisterBenchmark("RouteController/addRemoveUsersBatched",
+                                 [](benchmark::State& state) {
+                                     ControllerBenchmark::addRemoveUsers(state, true);
+                                 })
+            ->RangeMultiplier(8)
+            ->Range(1, 512)
+            ->UseRealTime();
+    benchmark::RegisterBenchmark("SockDiag/getLiveTcpInfos", ControllerBenchmark::getLiveTcpInfos)
+            ->RangeMultiplier(8)
+            ->Range(8, 4096)
+            ->UseRealTime();
+    benchmark::RegisterBenchmark("SockDiag/destroySockets", ControllerBenchmark::destroySockets)
+            ->RangeMultiplier(8)
+            ->Range(8, 4096)
+            ->UseRealTime();
+    benchmark::RegisterBenchmark("TcpSocketMonitor/sampleSockets",
+                                 ControllerBenchmark::sampleSockets)
+            ->RangeMultiplier(8)
+            ->Range(8, 4096)
+            ->UseRealTime();
+    benchmark::RegisterBenchmark("BandwidthController/updateQuota",
+                                 ControllerBenchmark::updateQuota)
+            ->UseRealTime();
+    benchmark::RegisterBenchmark("BandwidthController/setRemoveQuota",
+                                 ControllerBenchmark::setRemoveQuota)
+            ->UseRealTime();
+    benchmark::RegisterBenchmark("NetworkController/getNetworkContextDuringVpnBringUp",
+                                 ControllerBenchmark::getNetworkContextDuringVpnBringUp)
+            ->Arg(0)
+            ->Arg(1)
+            ->Arg(64)
+            ->Arg(512)
+            ->ThreadRange(1, 4)
+            ->UseRealTime();
+    benchmark::RegisterBenchmark("IptablesRestoreController/execute",
+                                 ControllerBenchmark::iptablesRestore)
+            ->RangeMultiplier(16)
+            ->Range(1, 256)
+            ->UseRealTime();
+
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
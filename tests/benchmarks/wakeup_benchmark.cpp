@@ -0,0 +1,151 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cost of delivering wakeup packets, from the NFLOG messages that the kernel sends for them to the
+ * WakeupController::ReportFn that notifies the event listeners.
+ *
+ * Batches of synthetic NFLOG messages from nflog_corpus.h are replayed through a fake
+ * NetlinkListenerInterface, so the benchmark needs neither root nor a running netd. What is
+ * measured is NFLogListener's dispatch by NFLOG group and WakeupController's parsing of the
+ * attributes and of the packet headers in NFULA_PAYLOAD. Reporting to the event listeners over
+ * binder is not included.
+ *
+ * Each benchmark reports:
+ *
+ *   packets            Wakeup packets reported per second.
+ *   allocs_per_packet  Calls to operator new per packet.
+ *
+ * wakeupPacket/N replays batches of one kind of packet, described in the label: IPv4 or IPv6, TCP
+ * or UDP, the copy range, and whether NFULA_PAYLOAD comes before NFULA_PACKET_HDR, which makes
+ * WakeupController parse the message twice. wakeupCorpus replays all of them.
+ */
+
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <netdutils/Slice.h>
+
+#include "NFLogListener.h"
+#include "NetlinkManager.h"
+#include "WakeupController.h"
+#include "nflog_corpus.h"
+
+namespace {
+
+std::atomic<uint64_t> sAllocations;
+
+}  // namespace
+
+// Counts allocations. The array variants call these by default.
+void* operator new(size_t size) {
+    sAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) abort();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace android {
+namespace net {
+namespace {
+
+using android::base::StringPrintf;
+using netdutils::Slice;
+
+// NFLOG messages per batch, as configured by WakeupController with --nflog-threshold.
+constexpr size_t kBatchSize = 8;
+
+class WakeupPipeline {
+  public:
+    WakeupPipeline() { expectOk(mController.init(&mNFLogListener)); }
+
+    void replay(std::vector<uint8_t>& batch) {
+        mNetlinkListener->replay(Slice(batch.data(), batch.size()));
+    }
+
+    uint64_t reported() const { return mReported; }
+
+  private:
+    void report(const WakeupController::ReportArgs& args) {
+        benchmark::DoNotOptimize(args.dstPort);
+        mReported++;
+    }
+
+    const std::shared_ptr<ReplayNetlinkListener> mNetlinkListener =
+            std::make_shared<ReplayNetlinkListener>();
+    NFLogListener mNFLogListener{mNetlinkListener};
+    WakeupController mController{[this](const auto& args) { report(args); }, nullptr};
+    uint64_t mReported = 0;
+};
+
+std::string describe(const NFLogPacket& packet) {
+    return StringPrintf("%s/%s/copy:%u/%s", packet.family == AF_INET ? "ipv4" : "ipv6",
+                        packet.protocol == IPPROTO_TCP ? "tcp" : "udp", packet.copyRange,
+                        packet.payloadFirst ? "payload_first" : "payload_last");
+}
+
+void replayBatches(benchmark::State& state, std::vector<std::vector<uint8_t>> batches) {
+    WakeupPipeline pipeline;
+    const uint64_t allocationsBefore = sAllocations.load();
+    for (auto _ : state) {  // NOLINT(clang-analyzer-deadcode.DeadStores)
+        for (auto& batch : batches) {
+            pipeline.replay(batch);
+        }
+    }
+    const double allocations = sAllocations.load() - allocationsBefore;
+    const double packets = pipeline.reported();
+    if (packets == 0) {
+        state.SkipWithError("No wakeup packets reported");
+        return;
+    }
+    state.counters["packets"] = benchmark::Counter(packets, benchmark::Counter::kIsRate);
+    state.counters["allocs_per_packet"] = allocations / packets;
+}
+
+void wakeupPacket(benchmark::State& state) {
+    const NFLogPacket packet = makeNFLogPackets()[state.range(0)];
+    state.SetLabel(describe(packet));
+    replayBatches(state, makeNFLogBatches(NetlinkManager::NFLOG_WAKEUP_GROUP,
+                                          std::vector<NFLogPacket>(kBatchSize, packet),
+                                          kBatchSize));
+}
+BENCHMARK(wakeupPacket)->DenseRange(0, makeNFLogPackets().size() - 1);
+
+void wakeupCorpus(benchmark::State& state) {
+    replayBatches(state, makeNFLogBatches(NetlinkManager::NFLOG_WAKEUP_GROUP, makeNFLogPackets(),
+                                          kBatchSize));
+}
+BENCHMARK(wakeupCorpus);
+
+}  // namespace
+}  // namespace net
+}  // namespace android
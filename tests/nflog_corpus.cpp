@@ -0,0 +1,262 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * nflog_corpus.cpp - synthetic NFLOG packet messages, as the kernel sends them for wakeup packets
+ */
+
+#include "nflog_corpus.h"
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <linux/if_ether.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_log.h>
+#include <linux/netlink.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <android-base/stringprintf.h>
+#include <netdutils/Netlink.h>
+
+namespace android {
+namespace net {
+
+using android::base::StringPrintf;
+using netdutils::Slice;
+using netdutils::Status;
+using netdutils::status::ok;
+
+namespace {
+
+constexpr uint16_t kNFLogPacketMsgType = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET;
+constexpr uint32_t kMark = 0x100064;
+constexpr uint32_t kIfIndex = 42;
+constexpr uint64_t kTimestampSec = 1700000000;
+constexpr uint64_t kTimestampUsec = 250000;
+
+template <typename T>
+void append(std::vector<uint8_t>* buf, const T& value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    buf->insert(buf->end(), bytes, bytes + sizeof(value));
+}
+
+void appendAttr(std::vector<uint8_t>* buf, uint16_t type, const void* data, size_t len) {
+    const nlattr attr = {
+            .nla_len = static_cast<uint16_t>(NLA_HDRLEN + len),
+            .nla_type = type,
+    };
+    append(buf, attr);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    buf->insert(buf->end(), bytes, bytes + len);
+    buf->resize(buf->size() + NLA_ALIGN(len) - len);
+}
+
+template <typename T>
+void appendAttr(std::vector<uint8_t>* buf, uint16_t type, const T& value) {
+    appendAttr(buf, type, &value, sizeof(value));
+}
+
+std::vector<uint8_t> makeIpPacket(const NFLogPacket& packet) {
+    std::vector<uint8_t> bytes;
+    const size_t transportLength = (packet.protocol == IPPROTO_TCP) ? sizeof(tcphdr)
+                                                                    : sizeof(udphdr);
+    const size_t length = packet.headerLength() + kNFLogPacketDataLength;
+
+    if (packet.family == AF_INET) {
+        iphdr ip = {};
+        ip.version = 4;
+        ip.ihl = sizeof(ip) / 4;
+        ip.tot_len = htons(length);
+        ip.ttl = 64;
+        ip.protocol = packet.protocol;
+        inet_pton(AF_INET, packet.srcIp.c_str(), &ip.saddr);
+        inet_pton(AF_INET, packet.dstIp.c_str(), &ip.daddr);
+        append(&bytes, ip);
+    } else {
+        ip6_hdr ip6 = {};
+        ip6.ip6_vfc = 6 << 4;
+        ip6.ip6_plen = htons(transportLength + kNFLogPacketDataLength);
+        ip6.ip6_nxt = packet.protocol;
+        ip6.ip6_hlim = 64;
+        inet_pton(AF_INET6, packet.srcIp.c_str(), &ip6.ip6_src);
+        inet_pton(AF_INET6, packet.dstIp.c_str(), &ip6.ip6_dst);
+        append(&bytes, ip6);
+    }
+
+    if (packet.protocol == IPPROTO_TCP) {
+        tcphdr tcp = {};
+        tcp.th_sport = htons(packet.srcPort);
+        tcp.th_dport = htons(packet.dstPort);
+        tcp.th_off = sizeof(tcp) / 4;
+        tcp.th_flags = TH_ACK | TH_PUSH;
+        append(&bytes, tcp);
+    } else {
+        udphdr udp = {};
+        udp.uh_sport = htons(packet.srcPort);
+        udp.uh_dport = htons(packet.dstPort);
+        udp.uh_ulen = htons(sizeof(udp) + kNFLogPacketDataLength);
+        append(&bytes, udp);
+    }
+
+    bytes.resize(length, 0xa5);
+    return bytes;
+}
+
+}  // namespace
+
+size_t NFLogPacket::headerLength() const {
+    return ((family == AF_INET) ? sizeof(iphdr) : sizeof(ip6_hdr)) +
+           ((protocol == IPPROTO_TCP) ? sizeof(tcphdr) : sizeof(udphdr));
+}
+
+std::vector<NFLogPacket> makeNFLogPackets() {
+    // 0 is NFULNL_COPY_NONE. The others end inside the IPv4 header, after the UDP header of an
+    // IPv4 packet, after the UDP header of an IPv6 packet, at the default copy range of
+    // WakeupController, which covers TCP over IPv6, and after the whole packet.
+    constexpr uint32_t kCopyRanges[] = {0, 16, 28, 48, 60, 1280};
+
+    std::vector<NFLogPacket> packets;
+    for (int family : {AF_INET, AF_INET6}) {
+        for (uint8_t protocol : {IPPROTO_TCP, IPPROTO_UDP}) {
+            for (uint32_t copyRange : kCopyRanges) {
+                for (bool payloadFirst : {false, true}) {
+                    const unsigned i = packets.size();
+                    NFLogPacket packet = {
+                            .family = family,
+                            .protocol = protocol,
+                            .copyRange = copyRange,
+                            .payloadFirst = payloadFirst,
+                            .prefix = StringPrintf("%u:wlan0", 100 + i % 4),
+                            .uid = 10000 + i,
+                            .gid = 10000 + i,
+                            .hwAddr = {0x02, 0x00, 0x00, 0x00, 0x00, static_cast<uint8_t>(i)},
+                            .srcPort = static_cast<uint16_t>(protocol == IPPROTO_TCP ? 443 : 53),
+                            .dstPort = static_cast<uint16_t>(32768 + i),
+                    };
+                    if (family == AF_INET) {
+                        packet.srcIp = StringPrintf("198.51.100.%u", 1 + i);
+                        packet.dstIp = "192.0.2.10";
+                    } else {
+                        packet.srcIp = StringPrintf("2001:db8:1::%x", 1 + i);
+                        packet.dstIp = "2001:db8:2::10";
+                    }
+                    packets.push_back(packet);
+                }
+            }
+        }
+    }
+    return packets;
+}
+
+// Attributes are in the order that the kernel's __build_packet_message() emits them.
+void appendNFLogPacket(uint16_t nfLogGroup, const NFLogPacket& packet,
+                       std::vector<uint8_t>* batch) {
+    const size_t start = batch->size();
+    append(batch, nlmsghdr{.nlmsg_type = kNFLogPacketMsgType, .nlmsg_flags = NLM_F_MULTI});
+    append(batch, nfgenmsg{
+                          .nfgen_family = static_cast<uint8_t>(packet.family),
+                          .version = NFNETLINK_V0,
+                          .res_id = htons(nfLogGroup),
+                  });
+
+    const std::vector<uint8_t> ipPacket = makeIpPacket(packet);
+    const size_t payloadLength = std::min<size_t>(packet.copyRange, ipPacket.size());
+    const auto appendPayload = [&]() {
+        if (payloadLength > 0) appendAttr(batch, NFULA_PAYLOAD, ipPacket.data(), payloadLength);
+    };
+
+    if (packet.payloadFirst) appendPayload();
+
+    const nfulnl_msg_packet_hdr packetHdr = {
+            .hw_protocol = htons(packet.family == AF_INET ? ETH_P_IP : ETH_P_IPV6),
+            .hook = NF_INET_LOCAL_IN,
+    };
+    appendAttr(batch, NFULA_PACKET_HDR, packetHdr);
+    appendAttr(batch, NFULA_PREFIX, packet.prefix.c_str(), packet.prefix.size() + 1);
+    appendAttr(batch, NFULA_IFINDEX_INDEV, htonl(kIfIndex));
+    appendAttr(batch, NFULA_MARK, htonl(kMark));
+
+    nfulnl_msg_packet_hw hw = {.hw_addrlen = htons(packet.hwAddr.size())};
+    memcpy(hw.hw_addr, packet.hwAddr.data(), std::min(packet.hwAddr.size(), sizeof(hw.hw_addr)));
+    appendAttr(batch, NFULA_HWADDR, hw);
+
+    const nfulnl_msg_packet_timestamp timestamp = {
+            .sec = htobe64(kTimestampSec),
+            .usec = htobe64(kTimestampUsec),
+    };
+    appendAttr(batch, NFULA_TIMESTAMP, timestamp);
+    appendAttr(batch, NFULA_UID, htonl(packet.uid));
+    appendAttr(batch, NFULA_GID, htonl(packet.gid));
+
+    if (!packet.payloadFirst) appendPayload();
+
+    reinterpret_cast<nlmsghdr*>(batch->data() + start)->nlmsg_len = batch->size() - start;
+}
+
+void appendNFLogDone(std::vector<uint8_t>* batch) {
+    // The kernel reserves room for an nfgenmsg, but leaves it uninitialized.
+    append(batch, nlmsghdr{
+                          .nlmsg_len = NLMSG_LENGTH(sizeof(nfgenmsg)),
+                          .nlmsg_type = NLMSG_DONE,
+                          .nlmsg_flags = NLM_F_MULTI,
+                  });
+    append(batch, nfgenmsg{});
+}
+
+std::vector<std::vector<uint8_t>> makeNFLogBatches(uint16_t nfLogGroup,
+                                                   const std::vector<NFLogPacket>& packets,
+                                                   size_t batchSize) {
+    std::vector<std::vector<uint8_t>> batches;
+    for (size_t i = 0; i < packets.size(); i += batchSize) {
+        std::vector<uint8_t>& batch = batches.emplace_back();
+        for (size_t j = i; j < std::min(i + batchSize, packets.size()); j++) {
+            appendNFLogPacket(nfLogGroup, packets[j], &batch);
+        }
+        appendNFLogDone(&batch);
+    }
+    return batches;
+}
+
+Status ReplayNetlinkListener::send(const Slice) {
+    return ok;
+}
+
+Status ReplayNetlinkListener::subscribe(uint16_t type, const DispatchFn& fn) {
+    mDispatchMap[type] = fn;
+    return ok;
+}
+
+Status ReplayNetlinkListener::unsubscribe(uint16_t type) {
+    mDispatchMap.erase(type);
+    return ok;
+}
+
+void ReplayNetlinkListener::replay(const Slice batch) {
+    const auto rxHandler = [this](const nlmsghdr& nlmsg, const Slice msg) {
+        const auto it = mDispatchMap.find(nlmsg.nlmsg_type);
+        if (it != mDispatchMap.end()) it->second(nlmsg, msg);
+    };
+    netdutils::forEachNetlinkMessage(batch, rxHandler);
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * nflog_corpus.h - synthetic NFLOG packet messages, as the kernel sends them for wakeup packets
+ */
+
+#ifndef _SYSTEM_NETD_TESTS_NFLOG_CORPUS_H
+#define _SYSTEM_NETD_TESTS_NFLOG_CORPUS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <netdutils/NetlinkListener.h>
+
+namespace android {
+namespace net {
+
+// One packet logged by an NFLOG rule.
+struct NFLogPacket {
+    int family;         // AF_INET or AF_INET6.
+    uint8_t protocol;   // IPPROTO_TCP or IPPROTO_UDP.
+    uint32_t copyRange; // Bytes of the packet that are copied into NFULA_PAYLOAD. 0 for none.
+    // If true, NFULA_PAYLOAD comes before NFULA_PACKET_HDR instead of last.
+    bool payloadFirst;
+
+    std::string prefix;
+    uid_t uid;
+    gid_t gid;
+    std::vector<uint8_t> hwAddr;
+    std::string srcIp;
+    std::string dstIp;
+    uint16_t srcPort;
+    uint16_t dstPort;
+
+    // Length of the IP and transport headers, which are followed by some data.
+    size_t headerLength() const;
+};
+
+// Bytes of data after the transport header of every packet.
+constexpr size_t kNFLogPacketDataLength = 64;
+
+// Every combination of IPv4 and IPv6, TCP and UDP, NFULA_PAYLOAD first or last, and copy ranges
+// that cover none, part or all of the IP and transport headers.
+std::vector<NFLogPacket> makeNFLogPackets();
+
+// Appends one NFULNL_MSG_PACKET message for |packet| to |batch|.
+void appendNFLogPacket(uint16_t nfLogGroup, const NFLogPacket& packet,
+                       std::vector<uint8_t>* batch);
+// Appends the NLMSG_DONE message that ends every batch of NFLOG messages.
+void appendNFLogDone(std::vector<uint8_t>* batch);
+
+// Splits |packets| into batches of up to |batchSize| messages, as the kernel delivers them with
+// --nflog-threshold.
+std::vector<std::vector<uint8_t>> makeNFLogBatches(uint16_t nfLogGroup,
+                                                   const std::vector<NFLogPacket>& packets,
+                                                   size_t batchSize);
+
+// Delivers netlink messages to subscribers like NetlinkListener does, but from buffers passed to
+// replay() instead of from a socket. Messages sent to the kernel are discarded.
+class ReplayNetlinkListener : public netdutils::NetlinkListenerInterface {
+  public:
+    ~ReplayNetlinkListener() override = default;
+
+    netdutils::Status send(const netdutils::Slice msg) override;
+    netdutils::Status subscribe(uint16_t type, const DispatchFn& fn) override;
+    netdutils::Status unsubscribe(uint16_t type) override;
+    void join() override {}
+    void registerSkErrorHandler(const SkErrorHandler&) override {}
+
+    // Dispatches every message in |batch| on the calling thread.
+    void replay(const netdutils::Slice batch);
+
+  private:
+    std::map<uint16_t, DispatchFn> mDispatchMap;
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif